@@ -13,27 +13,21 @@
 
 #include <geekos/ktypes.h>
 
+/*
+ * A bit set is an opaque object; bits are numbered from 0.
+ * Bits which are set are considered in use.
+ */
+struct Bit_Set;
+
 void* Create_Bit_Set(uint_t totalBits);
 void Set_Bit(void *bitSet, uint_t bitPos);
 void Clear_Bit(void *bitSet, uint_t bitPos);
+void Set_Bits(void *bitSet, uint_t first, uint_t count);
+void Clear_Bits(void *bitSet, uint_t first, uint_t count);
 bool Is_Bit_Set(void *bitSet, uint_t bitPos);
 int Find_First_Free_Bit(void *bitSet, ulong_t totalBits);
+int Find_Next_Free_Bit(void *bitSet, ulong_t totalBits);
 int Find_First_N_Free(void *bitSet, uint_t runLength, ulong_t totalBits);
 void Destroy_Bit_Set(void *bitSet);
 
-#if 0
-struct Bit_Set {
-    int size;
-    uchar_t bits[0];  /* Note: unwarranted chumminess with compiler */
-};
-
-struct Bit_Set *Create_Bit_Set(uchar_t *bits, int totalBits);
-int Set_Bit(struct Bit_Set *set, int bitPos);
-int Clear_Bit(struct Bit_Set *set, int bitPos);
-int Is_Bit_Set(struct Bit_Set *set, int bitPos);
-int Find_First_Free_Bit(struct Bit_Set *set);
-int Find_First_N_Free(struct Bit_Set *set, int runLength);
-uchar_t *Get_Bits(struct Bit_Set *set);
-#endif
-
 #endif
@@ -15,6 +15,7 @@
 #include <geekos/kthread.h>
 #include <geekos/list.h>
 #include <geekos/fileio.h>
+#include <geekos/iosched.h>
 
 #ifdef GEEKOS
 
@@ -40,16 +41,44 @@ struct Block_Request;
 DEFINE_LIST(Block_Request_List, Block_Request);
 
 /*
- * An I/O request for a block device.
+ * Function called when an asynchronous request completes.
+ * It runs with interrupts disabled, in the thread completing the
+ * request (usually the driver's), so it must not block.
+ */
+typedef void (*Block_Request_Callback)(struct Block_Request *request);
+
+/*
+ * Requests naming a completion queue are added to it when they
+ * complete, so a thread can wait for whichever of several requests
+ * finishes first.
+ */
+struct Block_Completion_Queue {
+    struct Block_Request_List doneList;
+    struct Thread_Queue waitQueue;
+};
+
+/*
+ * An I/O request for a block device, transferring
+ * numBlocks consecutive blocks starting at blockNum.
+ * The scheduler may merge requests for the blocks following it
+ * into the same transfer; they are chained through nextMerged.
+ * Asynchronous requests may set a callback, or a completion queue
+ * (not both), before they are submitted.
  */
 struct Block_Request {
     struct Block_Device *dev;
     enum Request_Type type;
     int blockNum;
+    int numBlocks;
     void *buf;
     volatile enum Request_State state;
     volatile int errorCode;
     struct Thread_Queue waitQueue;
+    ulong_t postTime;
+    struct Block_Request *nextMerged;
+    Block_Request_Callback callback;
+    void *callbackData;
+    struct Block_Completion_Queue *completionQueue;
 
     DEFINE_LINK(Block_Request_List, Block_Request);
 };
@@ -59,6 +88,16 @@ IMPLEMENT_LIST(Block_Request_List, Block_Request);
 struct Block_Device;
 struct Block_Device_Ops;
 
+/*
+ * An I/O scheduler chooses which pending request of a device
+ * is transferred next.  Select removes the request from the queue,
+ * which may also hold requests for other devices of the driver.
+ */
+struct Block_Scheduler {
+    const char *name;
+    struct Block_Request *(*Select)(struct Block_Device *dev, struct Block_Request_List *queue);
+};
+
 /*
  * A block device.
  */
@@ -70,6 +109,9 @@ struct Block_Device {
     void *driverData;
     struct Thread_Queue *waitQueue;
     struct Block_Request_List *requestQueue;
+    int scheduler;			/* one of IO_SCHED_* */
+    int headBlock;			/* block following the last transfer */
+    ulong_t stats[BLOCKDEV_NUM_STATS];
 
     DEFINE_LINK(Block_Device_List, Block_Device);
 };
@@ -93,11 +135,27 @@ int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
 int Open_Block_Device(const char *name, struct Block_Device **pDev);
 int Close_Block_Device(struct Block_Device *dev);
 struct Block_Request *Create_Request(struct Block_Device *dev, enum Request_Type type,
-    int blockNum, void *buf);
+    int blockNum, int numBlocks, void *buf);
 void Post_Request_And_Wait(struct Block_Request *request);
+void Submit_Request(struct Block_Request *request);
+void Submit_Requests(struct Block_Request **requests, int count);
+bool Is_Request_Done(struct Block_Request *request);
+int Wait_For_Request(struct Block_Request *request);
+int Wait_For_Requests(struct Block_Request **requests, int count);
+int Cancel_Request(struct Block_Request *request);
+void Init_Completion_Queue(struct Block_Completion_Queue *queue);
+struct Block_Request *Get_Completed_Request(struct Block_Completion_Queue *queue, bool wait);
 struct Block_Request *Dequeue_Request(struct Block_Request_List *requestQueue,
     struct Thread_Queue *waitQueue);
 void Notify_Request_Completion(struct Block_Request *request, enum Request_State state, int errorCode);
+int Get_Request_Num_Blocks(struct Block_Request *request);
+void *Get_Request_Block_Buffer(struct Block_Request *request, int block);
+
+/*
+ * Scheduling of requests.
+ */
+int Set_IO_Scheduler(const char *name, int scheduler);
+int Block_Device_Stat(const char *name, int which);
 
 /*
  * High level block device API.
@@ -105,6 +163,8 @@ void Notify_Request_Completion(struct Block_Request *request, enum Request_State
  */
 int Block_Read(struct Block_Device *dev, int blockNum, void *buf);
 int Block_Write(struct Block_Device *dev, int blockNum, void *buf);
+int Block_Read_Range(struct Block_Device *dev, int blockNum, int numBlocks, void *buf);
+int Block_Write_Range(struct Block_Device *dev, int blockNum, int numBlocks, void *buf);
 int Get_Num_Blocks(struct Block_Device *dev);
 
 /*
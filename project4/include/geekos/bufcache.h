@@ -0,0 +1,22 @@
+/*
+ * Block buffer cache
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_BUFCACHE_H
+#define GEEKOS_BUFCACHE_H
+
+#include <geekos/ktypes.h>
+
+struct Block_Device;
+
+void Init_Buffer_Cache(void);
+int Buffer_Read(struct Block_Device *dev, int blockNum, ulong_t offset, ulong_t numBytes, void *buf);
+int Buffer_Write(struct Block_Device *dev, int blockNum, ulong_t offset, ulong_t numBytes, const void *buf);
+void Buffer_Prefetch(struct Block_Device *dev, int blockNum, int numBlocks);
+int Flush_Buffers(struct Block_Device *dev);
+bool Shrink_Buffer_Cache(void);
+
+#endif /* GEEKOS_BUFCACHE_H */
@@ -17,6 +17,14 @@
 #define KERNEL_CS  (1<<3)
 #define KERNEL_DS  (2<<3)
 
+/*
+ * User code and data segment selectors, shared by all processes
+ * of the paging kernel (the segmentation kernel gives each process
+ * its own LDT instead).
+ */
+#define USER_CS  ((3<<3)|3)
+#define USER_DS  ((4<<3)|3)
+
 /*
  * Pages for initial kernel thread context object and stack.
  * Keep these up to date with defs.asm.
@@ -50,6 +50,8 @@ typedef struct {
  * Bits in flags field of programHeader.
  * These describe memory permissions required by the segment.
  */
+#define PT_LOAD	1	 /* Program header describes a segment to be loaded. */
+
 #define PF_R	0x4	 /* Pages of segment are readable. */
 #define PF_W	0x2	 /* Pages of segment are writable. */
 #define PF_X	0x1	 /* Pages of segment are executable. */
@@ -33,5 +33,6 @@
 #define ENOSPACE		-16	 /* Out of space on device */
 #define EPIPE			-17	 /* Pipe has no reader */
 #define ENOEXEC			-18	 /* Invalid executable format */
+#define ECANCELED		-19	 /* Operation canceled */
 
 #endif  /* GEEKOS_ERRNO_H */
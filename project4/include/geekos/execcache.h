@@ -0,0 +1,47 @@
+/*
+ * Cache of loaded executable images
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_EXECCACHE_H
+#define GEEKOS_EXECCACHE_H
+
+#include <geekos/ktypes.h>
+#include <geekos/list.h>
+#include <geekos/elf.h>
+
+/* Most images, and most pages of images, kept in the cache. */
+#define EXEC_CACHE_MAX_IMAGES 16
+#define EXEC_CACHE_MAX_PAGES  512
+
+struct Exec_Image;
+DEFINE_LIST(Exec_Image_List, Exec_Image);
+
+/*
+ * An executable file, parsed and with the file data of its segments
+ * laid out in page frames, ready to be mapped into a new process.
+ * The frames are merged frames (see <geekos/ksm.h>): processes map
+ * them read-only, and get their own copy of a page when they write
+ * to it.
+ */
+struct Exec_Image {
+    char *path;
+    int fileSize;			 /* Identity of the file the image was read from */
+    int fileId;
+    int modTime;
+    struct Exe_Format exeFormat;
+    ulong_t startAddress;		 /* User address of the first page */
+    ulong_t numPages;
+    void **frames;			 /* Frame for each page, null if it holds no file data */
+    int refCount;			 /* One for the cache, one for each user */
+    ulong_t lastUsed;
+    DEFINE_LINK(Exec_Image_List, Exec_Image);
+};
+
+int Get_Exec_Image(const char *path, struct Exec_Image **pImage);
+void Put_Exec_Image(struct Exec_Image *image);
+bool Shrink_Exec_Cache(void);
+
+#endif /* GEEKOS_EXECCACHE_H */
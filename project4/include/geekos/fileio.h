@@ -39,6 +39,7 @@
 #define O_READ          0x2	/* Open file for reading. */
 #define O_WRITE         0x4	/* Open file for writing. */
 #define O_EXCL          0x8	/* Don't create file if it already exists. */
+#define O_TRUNC         0x10	/* Truncate the file to nothing. */
 
 /*
  * An entry in an Access Control List (ACL).
@@ -57,6 +58,8 @@ struct VFS_File_Stat {
     int size;
     int isDirectory:1;
     int isSetuid:1;
+    int fileId;			/* Identifies the file's data within its filesystem */
+    int modTime;		/* When the file was last modified */
     struct VFS_ACL_Entry acls[VFS_MAX_ACL_ENTRIES];
 };
 
@@ -80,4 +83,17 @@ struct VFS_Mount_Request {
     char fstype[VFS_MAX_FS_NAME_LEN+1];	/* Filesystem type: e.g., "gosfs". */
 };
 
+/*
+ * Statistics of each mounted filesystem which can be queried
+ * from user mode, counting reads of files and the readahead
+ * of those which are read sequentially.
+ */
+#define MOUNT_STAT_READS        0  /* reads of files */
+#define MOUNT_STAT_SEQ_READS    1  /* reads continuing the previous read of the file */
+#define MOUNT_STAT_RA_HITS      2  /* reads of data which had been read ahead */
+#define MOUNT_STAT_RA_BLOCKS    3  /* blocks requested by readahead */
+#define MOUNT_STAT_RA_STOPPED   4  /* times readahead stopped at a random read */
+
+#define MOUNT_NUM_STATS         5
+
 #endif
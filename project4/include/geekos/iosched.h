@@ -0,0 +1,34 @@
+/*
+ * Block I/O schedulers and their statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_IOSCHED_H
+#define GEEKOS_IOSCHED_H
+
+/*
+ * Schedulers which can be selected for each block device.
+ */
+#define IO_SCHED_FIFO         0  /* serve requests in the order they were posted */
+#define IO_SCHED_ELEVATOR     1  /* C-SCAN with merging and deadlines */
+
+#define IO_NUM_SCHEDULERS     2
+
+/*
+ * Statistics of each block device which can be queried from user mode.
+ */
+#define BLOCKDEV_STAT_SCHEDULER  0  /* scheduler in use */
+#define BLOCKDEV_STAT_REQUESTS   1  /* requests completed */
+#define BLOCKDEV_STAT_TRANSFERS  2  /* transfers handed to the driver */
+#define BLOCKDEV_STAT_MERGED     3  /* requests merged into another's transfer */
+#define BLOCKDEV_STAT_BLOCKS     4  /* blocks transferred */
+#define BLOCKDEV_STAT_SEEK       5  /* blocks the head moved between transfers */
+#define BLOCKDEV_STAT_WAIT       6  /* ticks from posting to completion, summed */
+#define BLOCKDEV_STAT_MAX_WAIT   7  /* longest ticks from posting to completion */
+#define BLOCKDEV_STAT_EXPIRED    8  /* requests served early because of their deadline */
+
+#define BLOCKDEV_NUM_STATS       9
+
+#endif /* GEEKOS_IOSCHED_H */
@@ -0,0 +1,24 @@
+/*
+ * Merging of identical user pages
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_KSM_H
+#define GEEKOS_KSM_H
+
+#include <geekos/ktypes.h>
+#include <geekos/paging.h>
+
+struct Page;
+struct User_Context;
+
+void Init_Ksm(void);
+int Ksm_Unshare_Page(struct User_Context *userContext, pte_t *entry, ulong_t vaddr);
+void Ksm_Release_Page(struct Page *page);
+void Ksm_Add_Frame(void *paddr);
+void Ksm_Map_Frame(pte_t *entry, void *paddr);
+void Ksm_Put_Frame(void *paddr);
+
+#endif /* GEEKOS_KSM_H */
@@ -0,0 +1,16 @@
+/*
+ * Fast LZ77 compression
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_LZ_H
+#define GEEKOS_LZ_H
+
+#include <geekos/ktypes.h>
+
+int LZ_Compress(const void *src, ulong_t srcLen, void *dst, ulong_t dstLen);
+int LZ_Decompress(const void *src, ulong_t srcLen, void *dst, ulong_t dstLen);
+
+#endif /* GEEKOS_LZ_H */
@@ -17,6 +17,7 @@
 #include <geekos/paging.h>
 
 struct Boot_Info;
+struct User_Context;
 
 /*
  * Page flags
@@ -29,6 +30,9 @@ struct Boot_Info;
 #define PAGE_HEAP      0x0010	 /* page is in kernel heap */
 #define PAGE_PAGEABLE  0x0020	 /* page can be paged out */
 #define PAGE_LOCKED    0x0040    /* page is taken should not be freed */
+#define PAGE_SHARED    0x0080    /* page belongs to a shared memory segment */
+#define PAGE_FILE      0x0100    /* page holds clean data of a mapped file */
+#define PAGE_MERGED    0x0200    /* page is a read-only copy shared by identical pages */
 
 /*
  * PC memory map
@@ -64,6 +68,9 @@ struct Page {
     int clock;
     ulong_t vaddr;			 /* User virtual address where page is mapped */
     pte_t *entry;			 /* Page table entry referring to the page */
+    int refCount;			 /* Number of user mappings of a shared page */
+    struct User_Context *owner;		 /* Process charged for the page, or null */
+    ulong_t checksum;			 /* Contents when last scanned for merging */
 };
 
 IMPLEMENT_LIST(Page_List, Page);
@@ -71,8 +78,13 @@ IMPLEMENT_LIST(Page_List, Page);
 void Init_Mem(struct Boot_Info* bootInfo);
 void Init_BSS(void);
 void* Alloc_Page(void);
-void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr);
+void* Alloc_Zeroed_Page(void);
+void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr, struct User_Context *owner);
+void* Alloc_Zeroed_Pageable_Page(pte_t *entry, ulong_t vaddr, struct User_Context *owner);
+void* Alloc_Zeroed_Page_Evicting(void);
 void Free_Page(void* pageAddr);
+bool Zero_Free_Page(void);
+void Update_Mem_Stats(void);
 
 /*
  * Determine if given address is a multiple of the page size.
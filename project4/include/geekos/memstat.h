@@ -0,0 +1,56 @@
+/*
+ * Physical memory statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_MEMSTAT_H
+#define GEEKOS_MEMSTAT_H
+
+/*
+ * Statistics which can be queried from user mode.
+ */
+#define MEM_STAT_FREE_PAGES   0  /* pages on the free lists, zeroed or not */
+#define MEM_STAT_ZERO_PAGES   1  /* pre-zeroed pages waiting in the pool */
+#define MEM_STAT_ZERO_HITS    2  /* zeroed pages handed out from the pool */
+#define MEM_STAT_ZERO_MISSES  3  /* zeroed pages which had to be cleared on demand */
+#define MEM_STAT_IDLE_ZEROED  4  /* pages cleared by the idle thread */
+#define MEM_STAT_ZERO_CYCLES  5  /* average cycles to clear one page */
+#define MEM_STAT_KSM_SHARED   6  /* merged frames, each standing in for identical pages */
+#define MEM_STAT_KSM_SHARING  7  /* user pages mapped to a merged frame */
+#define MEM_STAT_KSM_SCANS    8  /* passes of the merge scanner over all of memory */
+#define MEM_STAT_KSM_COW      9  /* merged pages copied again because they were written */
+#define MEM_STAT_EXEC_HITS    10 /* programs started from the executable cache */
+#define MEM_STAT_EXEC_MISSES  11 /* programs which had to be read and parsed */
+#define MEM_STAT_EXEC_PAGES   12 /* pages held by the executable cache */
+#define MEM_STAT_BUF_HITS     13 /* block buffer cache lookups finding the data */
+#define MEM_STAT_BUF_MISSES   14 /* block buffer cache lookups waiting for a read */
+#define MEM_STAT_BUF_PAGES    15 /* pages held by the block buffer cache */
+#define MEM_STAT_BUF_DIRTY    16 /* buffers waiting to be written back */
+#define MEM_STAT_BUF_WRITES   17 /* buffers written back */
+
+#define MEM_NUM_STATS         18
+
+/*
+ * Memory usage of a process, in pages.
+ */
+#define MEM_USAGE_RSS         0  /* resident pages */
+#define MEM_USAGE_RSS_PEAK    1  /* most resident pages at any time */
+#define MEM_USAGE_SWAP        2  /* pages in the compressed pool or paging file */
+#define MEM_USAGE_RSS_LIMIT   3  /* resident limit, 0 if none */
+
+/*
+ * Largest buffer the copy test system call accepts.
+ */
+#define USER_COPY_TEST_MAX    (64 * 1024)
+
+#ifdef GEEKOS
+
+#include <geekos/ktypes.h>
+
+extern ulong_t g_memStats[MEM_NUM_STATS];
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_MEMSTAT_H */
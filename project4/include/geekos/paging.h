@@ -90,6 +90,9 @@ typedef struct
  * Bits used in the kernelInfo field of the PTE's:
  */
 #define KINFO_PAGE_ON_DISK 0x4 /* Page not present; contents in paging file */
+#define KINFO_PAGE_SHARED 0x2  /* Page not present; ask its shared memory segment */
+#define KINFO_PAGE_BUSY 0x1    /* Page is being brought in by another process */
+#define KINFO_PAGE_COMPRESSED 0x3 /* Page not present; contents in compressed pool */
 
 void Init_VM(struct Boot_Info *bootInfo);
 void Init_Paging(void);
@@ -99,7 +102,23 @@ extern void Set_PDBR(pde_t *pageDir);
 extern pde_t *Get_PDBR(void);
 extern void Enable_Paging(pde_t *pageDir);
 
-int Alloc_User_Page(pde_t *pageDir, uint_t startAddress, uint_t sizeInMemory);
+/*
+ * A kernel instruction which may fault on a user address, and
+ * the code to continue at if the fault cannot be handled.
+ * The table of these is in lowlevel.asm.
+ */
+struct Exception_Table_Entry
+{
+    ulong_t faultAddr;
+    ulong_t fixupAddr;
+};
+extern struct Exception_Table_Entry g_exceptionTableStart[];
+extern struct Exception_Table_Entry g_exceptionTableEnd[];
+extern ulong_t Copy_User_Bytes(void *dest, const void *src, ulong_t numBytes);
+
+pte_t *Get_User_Page_Entry(pde_t *pageDir, ulong_t address, bool create);
+int Alloc_User_Page(struct User_Context *userContext, uint_t startAddress,
+                    uint_t sizeInMemory);
 
 /*
  * Return the address that caused a page fault.
@@ -0,0 +1,56 @@
+/*
+ * PCI configuration space access
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_PCI_H
+#define GEEKOS_PCI_H
+
+#include <geekos/ktypes.h>
+
+/* Offsets of registers in the configuration header of a function */
+#define PCI_VENDOR_ID		0x00
+#define PCI_DEVICE_ID		0x02
+#define PCI_COMMAND		0x04
+#define PCI_PROG_IF		0x09
+#define PCI_SUBCLASS		0x0A
+#define PCI_CLASS		0x0B
+#define PCI_HEADER_TYPE		0x0E
+#define PCI_BAR0		0x10
+#define PCI_BAR4		0x20
+
+/* Bits of the command register */
+#define PCI_COMMAND_IO		0x0001
+#define PCI_COMMAND_MEMORY	0x0002
+#define PCI_COMMAND_MASTER	0x0004
+
+/* A base address register with this bit set maps I/O ports */
+#define PCI_BAR_IO		0x0001
+#define PCI_BAR_IO_MASK		0xFFFFFFFC
+
+/* Classes of devices */
+#define PCI_CLASS_STORAGE	0x01
+#define PCI_SUBCLASS_IDE	0x01
+
+/*
+ * A function of a device on a PCI bus.
+ */
+struct PCI_Device {
+    int bus, slot, func;
+    ushort_t vendor, device;
+};
+
+#ifdef GEEKOS
+
+ulong_t PCI_Read_Config(struct PCI_Device *dev, int reg);
+ushort_t PCI_Read_Config_Word(struct PCI_Device *dev, int reg);
+uchar_t PCI_Read_Config_Byte(struct PCI_Device *dev, int reg);
+void PCI_Write_Config_Word(struct PCI_Device *dev, int reg, ushort_t value);
+
+bool PCI_Find_Class(int class, int subclass, struct PCI_Device *dev);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_PCI_H */
@@ -0,0 +1,45 @@
+/*
+ * Shared memory segments and mapped files
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SHM_H
+#define GEEKOS_SHM_H
+
+#include <geekos/ktypes.h>
+#include <geekos/paging.h>
+
+/* Maximum length of the name of a shared memory segment. */
+#define SHM_MAX_NAME_LEN 25
+
+/* Largest shared memory segment that may be created. */
+#define SHM_MAX_SIZE (16 * 1024 * 1024)
+
+/* Number of times a single segment may be attached at once. */
+#define SHM_MAX_ATTACH 16
+
+/*
+ * Shared memory segments are attached in a fixed area of the user
+ * address space, just below the stack guard page.
+ */
+#define USER_SHM_AREA_SIZE (64 * 1024 * 1024)
+
+#ifdef GEEKOS
+
+struct Page;
+struct User_Context;
+struct VMA;
+
+int Shm_Create(const char *name, ulong_t size);
+int Shm_Attach(struct User_Context *userContext, int id, ulong_t *pUserAddr);
+int Shm_Map_File(struct User_Context *userContext, const char *path, ulong_t *pUserAddr);
+int Shm_Detach(struct User_Context *userContext, ulong_t userAddr);
+void Shm_Detach_All(struct User_Context *userContext);
+int Shm_Fault(struct VMA *vma, pte_t *entry, ulong_t address);
+void Shm_Unmap_Page(struct Page *page);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_SHM_H */
@@ -0,0 +1,46 @@
+/*
+ * Swap devices
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SWAPDEV_H
+#define GEEKOS_SWAPDEV_H
+
+/*
+ * A whole block device can be used for swapping if its first
+ * sector starts with this header (see src/tools/mkswap.c).
+ * Swapped pages are stored from the second page of the device on.
+ */
+#define SWAP_MAGIC "GEEKSWAP"
+#define SWAP_MAGIC_LEN 8
+
+struct Swap_Header {
+    char magic[SWAP_MAGIC_LEN];
+    int priority;		 /* Devices with higher priority are used first */
+};
+
+/*
+ * Priority of paging files found on PFAT filesystems.
+ */
+#define PAGEFILE_PRIORITY 0
+
+/*
+ * Statistics of each swap device which can be queried from user mode.
+ */
+#define SWAP_DEV_PRIORITY     0  /* priority of the device */
+#define SWAP_DEV_SLOTS        1  /* pages the device can hold */
+#define SWAP_DEV_USED         2  /* pages currently stored on the device */
+#define SWAP_DEV_WRITES       3  /* pages written to the device */
+#define SWAP_DEV_READS        4  /* pages read back from the device */
+#define SWAP_DEV_NUM_STATS    5
+
+#ifdef GEEKOS
+
+int Add_Swap_Device(const char *devName);
+int Swap_Device_Stat(int device, int which);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_SWAPDEV_H */
@@ -53,6 +53,27 @@ enum {
     SYS_P,		 /* P (acquire semaphore) system call  */
     SYS_V,		 /* V (release semaphore) system call  */
     SYS_DESTROYSEMAPHORE,  /* Destroy semaphore system call  */
+    SYS_SHMCREATE,	 /* Create shared memory segment system call */
+    SYS_SHMATTACH,	 /* Attach shared memory segment system call */
+    SYS_SHMDETACH,	 /* Detach shared memory segment system call */
+    SYS_MMAP,		 /* Map file into memory system call */
+    SYS_SBRK,		 /* Grow or shrink the heap system call */
+    SYS_SWAPSTAT,	 /* Get compressed swap statistics system call */
+    SYS_MEMSTAT,	 /* Get physical memory statistics system call */
+    SYS_MEMUSAGE,	 /* Get memory usage of a process system call */
+    SYS_COPYTEST,	 /* Copy a buffer into the kernel and back system call */
+    SYS_SWAPDEVSTAT,	 /* Get statistics of a swap device system call */
+    SYS_SETIOSCHED,	 /* Choose the I/O scheduler of a block device system call */
+    SYS_BLOCKDEVSTAT,	 /* Get statistics of a block device system call */
+    SYS_MOUNTSTAT,	 /* Get statistics of a mounted filesystem system call */
+    SYS_OPEN,		 /* Open file system call */
+    SYS_CLOSE,		 /* Close file system call */
+    SYS_READ,		 /* Read from file system call */
+    SYS_WRITE,		 /* Write to file system call */
+    SYS_SEEK,		 /* Set position in file system call */
+    SYS_DELETE,		 /* Delete file system call */
+    SYS_SYNC,		 /* Write back all filesystems system call */
+    SYS_CREATEDIR,	 /* Create directory system call */
 };
 
 /*
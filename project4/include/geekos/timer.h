@@ -33,4 +33,14 @@ int Cancel_Timer(int id);
 
 void Micro_Delay(int us);
 
+/*
+ * Read the processor's cycle counter.
+ */
+static __inline__ unsigned long long Read_TSC(void)
+{
+    unsigned long long tsc;
+    __asm__ __volatile__ ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
 #endif  /* GEEKOS_TIMER_H */
@@ -19,9 +19,12 @@
 
 #define USER_VM_START 0x80000000
 #define USER_VM_LEN 0x70000 * PAGE_SIZE // user_vm_start
-#define DEFAULT_STACK_SIZE 2 * PAGE_SIZE
+#define MAX_STACK_SIZE (1024 * PAGE_SIZE)
+#define USER_GUARD_SIZE PAGE_SIZE
 
 struct File;
+struct VMA;
+struct Exec_Image;
 
 /* Number of files user process can have open. */
 #define USER_MAX_FILES 10
@@ -41,7 +44,9 @@ struct User_Context
     /*
      * Each user context contains a local descriptor table with
      * just enough room for one code and one data segment
-     * describing the process's memory.
+     * describing the process's memory.  Only the segmentation
+     * kernel (userseg.c) uses it: with paging, all processes
+     * share the user segments in the GDT.
      */
     struct Segment_Descriptor ldt[NUM_USER_LDT_ENTRIES];
     struct Segment_Descriptor *ldtDescriptor;
@@ -55,7 +60,7 @@ struct User_Context
 
     /*
      * Selectors for the user context's code and data segments
-     * (which reside in its LDT)
+     * (which reside in its LDT, or with paging in the GDT)
      */
     ushort_t csSelector;
     ushort_t dsSelector;
@@ -72,6 +77,35 @@ struct User_Context
     /* Initial stack pointer */
     ulong_t stackPointerAddr;
 
+    /*
+     * Virtual memory areas of the address space, as an AVL tree
+     * ordered by address (see vma.h).  The heap grows up towards
+     * its limit, the stack (which holds the argument block) grows
+     * down towards its limit.  One unmapped guard page sits below
+     * the stack limit.
+     */
+    struct VMA *vmaRoot;
+    struct VMA *heap;
+    struct VMA *stack;
+
+    /*
+     * Pages charged to the process: resident frames (and the most
+     * there have been at once), and pages evicted to the compressed
+     * pool or the paging file.  Pages of shared segments are not
+     * charged to anyone.  Once rssPages reaches rssLimit (if not 0),
+     * the process has to evict one of its own pages for each new one.
+     */
+    ulong_t rssPages;
+    ulong_t rssPeak;
+    ulong_t swapPages;
+    ulong_t rssLimit;
+
+    /*
+     * Files the process has open, indexed by file descriptor;
+     * unused descriptors are null.
+     */
+    struct File *files[USER_MAX_FILES];
+
     /*
      * May use this in future to allow multiple threads
      * in the same user context
@@ -92,7 +126,8 @@ struct Interrupt_State;
 
 void Attach_User_Context(struct Kernel_Thread *kthread, struct User_Context *context);
 void Detach_User_Context(struct Kernel_Thread *kthread);
-int Spawn(const char *program, const char *command, struct Kernel_Thread **pThread);
+int Spawn(const char *program, const char *command, ulong_t rssLimit,
+          struct Kernel_Thread **pThread);
 void Switch_To_User_Context(struct Kernel_Thread *kthread, struct Interrupt_State *state);
 
 /*
@@ -100,12 +135,13 @@ void Switch_To_User_Context(struct Kernel_Thread *kthread, struct Interrupt_Stat
  */
 
 void Destroy_User_Context(struct User_Context *context);
-int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
-                      struct Exe_Format *exeFormat, const char *command,
+int Load_User_Program(struct Exec_Image *image, const char *command,
                       struct User_Context **pUserContext);
 bool Copy_From_User(void *destInKernel, ulong_t srcInUser, ulong_t bufSize);
 bool Copy_To_User(ulong_t destInUser, void *srcInKernel, ulong_t bufSize);
 void Switch_To_Address_Space(struct User_Context *userContext);
+int Resize_User_Heap(struct User_Context *userContext, int increment,
+                     ulong_t *pOldBreak);
 
 #endif /* GEEKOS_USER_H */
 
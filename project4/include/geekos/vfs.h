@@ -44,6 +44,7 @@ struct Mount_Point {
     char *pathPrefix;		 /* Path prefix where fs is mounted. */
     struct Block_Device *dev;	 /* Block device filesystem is mounted on. */
     void *fsData;		 /* For use by the filesystem implementation. */
+    int stats[MOUNT_NUM_STATS];	 /* MOUNT_STAT_xxx statistics. */
     DEFINE_LINK(Mount_Point_List, Mount_Point);
 };
 
@@ -75,6 +76,14 @@ struct File {
      */
     int mode;			 /* Mode (read vs. write). */
     struct Mount_Point *mountPoint; /* Mounted filesystem file is part of. */
+
+    /*
+     * VFS Read() keeps the following fields, to read ahead
+     * of a file which is read sequentially:
+     */
+    ulong_t raNextPos;		 /* Where a sequential read would start. */
+    ulong_t raEnd;		 /* End of the data read ahead so far. */
+    ulong_t raWindow;		 /* How far to read ahead, 0 if not sequential. */
 };
 
 /* Operations that can be performed on a File. */
@@ -85,6 +94,7 @@ struct File_Ops {
     int (*Seek)(struct File *file, ulong_t pos);
     int (*Close)(struct File *file);
     int (*Read_Entry)(struct File *dir, struct VFS_Dir_Entry *entry);  /* Read next directory entry. */
+    int (*Readahead)(struct File *file, ulong_t pos, ulong_t numBytes);  /* Start reading data without waiting. */
 };
 
 /*
@@ -94,10 +104,12 @@ struct File_Ops {
  * due to a memory shortage.
  */
 struct Paging_Device {
-    char *fileName;		 /* Name of paging file. */
+    char *fileName;		 /* Name of paging file (or of the raw device). */
     struct Block_Device *dev;	 /* Block device for paging file. */
     ulong_t startSector;	 /* Start sector of paging file. */
     ulong_t numSectors;		 /* Number of sectors in paging file. */
+    int priority;		 /* Devices with higher priority are used first. */
+    struct Paging_Device *next;	 /* Next device, in order of decreasing priority. */
 };
 
 /*
@@ -113,7 +125,9 @@ int Mount(const char *devname, const char *pathPrefix, const char *fstype);
 int Open(const char *path, int mode, struct File **pFile);
 int Close(struct File *file);
 int Stat(const char *path, struct VFS_File_Stat *stat);
+int Delete(const char *path);
 int Sync(void);
+int Mount_Point_Stat(const char *prefix, int which);
 
 /* File operations. */
 struct File *Allocate_File(struct File_Ops *ops, int filePos, int endPos, void *fsData,
@@ -121,6 +135,7 @@ struct File *Allocate_File(struct File_Ops *ops, int filePos, int endPos, void *
 int FStat(struct File *file, struct VFS_File_Stat *stat);
 int Read(struct File *file, void *buf, ulong_t len);
 int Write(struct File *file, void *buf, ulong_t len);
+int Seek(struct File *file, ulong_t len);
 int Read_Fully(const char *path, void **pBuffer, ulong_t *pLen);
 
 /* Directory operations. */
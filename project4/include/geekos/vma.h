@@ -0,0 +1,51 @@
+/*
+ * Virtual memory areas
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_VMA_H
+#define GEEKOS_VMA_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * What backs the pages of a virtual memory area.
+ */
+enum {
+    VMA_ANON,		 /* Zero-filled or loaded from the executable */
+    VMA_STACK,		 /* Anonymous, grows down towards its limit */
+    VMA_SHARED,		 /* Shared memory segment */
+    VMA_FILE		 /* Mapped file */
+};
+
+/*
+ * A range of user (segment-relative) addresses with uniform
+ * permissions and backing.  The areas of a user context are
+ * kept in an AVL tree ordered by start address.
+ *
+ * An area may grow: the stack down to its limit, and an anonymous
+ * area with limit > end (the heap) up to its limit.  The range an
+ * area may grow into is reserved, so no other area can overlap it.
+ */
+struct VMA {
+    ulong_t start;		 /* First address in the area */
+    ulong_t end;		 /* One past the last address in the area */
+    ulong_t limit;		 /* Furthest address the area may grow to */
+    int prot;			 /* VM_READ, VM_WRITE flags */
+    int kind;			 /* VMA_xxx */
+    void *object;		 /* Segment for VMA_SHARED and VMA_FILE */
+    struct VMA *left, *right;
+    int height;
+};
+
+struct VMA *Create_VMA(ulong_t start, ulong_t end, ulong_t limit, int prot, int kind);
+int Insert_VMA(struct VMA **root, struct VMA *vma);
+void Remove_VMA(struct VMA **root, struct VMA *vma);
+struct VMA *Find_VMA(struct VMA *root, ulong_t addr);
+struct VMA *Next_VMA(struct VMA *root, ulong_t addr);
+ulong_t Find_VMA_Gap(struct VMA *root, ulong_t low, ulong_t high, ulong_t size);
+void Destroy_VMA_Tree(struct VMA **root);
+
+#endif /* GEEKOS_VMA_H */
@@ -0,0 +1,40 @@
+/*
+ * Compressed swap pool
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_ZSWAP_H
+#define GEEKOS_ZSWAP_H
+
+/*
+ * Statistics which can be queried from user mode.
+ */
+#define ZSWAP_STAT_STORES       0  /* pages compressed into the pool */
+#define ZSWAP_STAT_REJECTS      1  /* pages which did not compress well enough */
+#define ZSWAP_STAT_POOL_FULL    2  /* pages sent to the paging file, pool full */
+#define ZSWAP_STAT_HITS         3  /* faults served from the pool */
+#define ZSWAP_STAT_MISSES       4  /* faults served from the paging file */
+#define ZSWAP_STAT_STORED_PAGES 5  /* pages currently held in the pool */
+#define ZSWAP_STAT_STORED_BYTES 6  /* compressed bytes currently in the pool */
+#define ZSWAP_STAT_POOL_BYTES   7  /* size of the pool */
+#define ZSWAP_NUM_STATS         8
+
+#ifdef GEEKOS
+
+#include <geekos/ktypes.h>
+
+/* Fraction of free memory set aside for the pool at boot. */
+#define ZSWAP_POOL_FRACTION 8
+
+extern ulong_t g_zswapStats[ZSWAP_NUM_STATS];
+
+void Init_Zswap(void);
+int Zswap_Store(void *paddr);
+void Zswap_Load(int index, void *paddr);
+void Zswap_Free(int index);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_ZSWAP_H */
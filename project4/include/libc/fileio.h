@@ -0,0 +1,22 @@
+/*
+ * File I/O
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <geekos/fileio.h>
+
+int Open(const char *path, int mode);
+int Close(int fd);
+int Read(int fd, void *buf, unsigned long len);
+int Write(int fd, const void *buf, unsigned long len);
+int Seek(int fd, unsigned long pos);
+int Delete(const char *path);
+int Sync(void);
+int Create_Directory(const char *path);
+
+#endif  /* FILEIO_H */
@@ -0,0 +1,18 @@
+/*
+ * Block I/O schedulers and I/O statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef IOSCHED_H
+#define IOSCHED_H
+
+#include <geekos/iosched.h>
+#include <geekos/fileio.h>
+
+int Set_IO_Scheduler(const char *device, int scheduler);
+int Get_Block_Device_Stat(const char *device, int which);
+int Get_Mount_Stat(const char *prefix, int which);
+
+#endif  /* IOSCHED_H */
@@ -5,4 +5,7 @@
 #include <conio.h>
 #include <sema.h>
 #include <sched.h>
+#include <shm.h>
+#include <malloc.h>
+#include <swap.h>
 
@@ -0,0 +1,17 @@
+/*
+ * User heap allocator
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef MALLOC_H
+#define MALLOC_H
+
+#include <stddef.h>
+
+void *Sbrk(int increment);
+void *Malloc(size_t size);
+void Free(void *ptr);
+
+#endif  /* MALLOC_H */
@@ -14,6 +14,7 @@
 int Null(void);
 int Exit(int exitCode);
 int Spawn_Program(const char* program, const char* command);
+int Spawn_Limited(const char* program, const char* command, int maxResidentPages);
 int Spawn_With_Path(const char *program, const char *command, const char *path);
 int Wait(int pid);
 int Get_PID(void);
@@ -0,0 +1,19 @@
+/*
+ * Shared memory segments and mapped files
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+
+int Create_Shared_Memory(const char *name, size_t size);
+void *Attach_Shared_Memory(int shmId);
+int Detach_Shared_Memory(void *addr);
+void *Map_File(const char *path);
+int Unmap_File(void *addr);
+
+#endif  /* SHM_H */
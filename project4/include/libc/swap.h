@@ -0,0 +1,21 @@
+/*
+ * Compressed swap and memory statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <geekos/zswap.h>
+#include <geekos/memstat.h>
+#include <geekos/swapdev.h>
+
+int Get_Swap_Stat(int which);
+int Get_Mem_Stat(int which);
+int Get_Mem_Usage(int pid, int which);
+int Get_Swap_Device_Stat(int device, int which);
+int Copy_Test(void *buf, int len);
+
+#endif  /* SWAP_H */
@@ -14,93 +14,337 @@
 #include <geekos/string.h>
 #include <geekos/screen.h>
 
-#define FIND_OFFSET_AND_BIT(bitPos,offset,bit)	\
-do {						\
-    offset = bitPos / 8;			\
-    bit = bitPos % 8;				\
-} while (0)
+/*
+ * Bits are stored 32 to a word.  Above the bits are two summary
+ * levels: bit i of level k+1 is set when word i of level k is full.
+ * Searching for a clear bit therefore looks at one word per level,
+ * and skips 32K full bits with a single compare at the top level.
+ * Bits past the end of each level are kept set, so they are never
+ * found free.
+ */
+#define BITS_PER_WORD 32
+#define NUM_LEVELS 3
+#define ALL_ONES 0xffffffffU
+
+struct Bit_Set {
+    uint_t totalBits;
+    uint_t cursor;			 /* Where Find_Next_Free_Bit() starts */
+    uint_t numWords[NUM_LEVELS];
+    uint_t *level[NUM_LEVELS];		 /* level[0] holds the bits themselves */
+};
+
+#define FIND_NUM_WORDS(totalBits) \
+    (((totalBits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
 
-#define FIND_NUM_BYTES(totalBits) \
-    ((totalBits / 8) + ((totalBits % 8 != 0) ? 1 : 0))
+/* Find the lowest set bit in a nonzero word. */
+static __inline__ int Find_Low_Bit(uint_t word)
+{
+    int bit;
+
+    __asm__ ("bsfl %1, %0" : "=r" (bit) : "r" (word));
+    return bit;
+}
+
+/* Mask of bits from first to last (inclusive) within one word. */
+static __inline__ uint_t Bit_Mask(uint_t first, uint_t last)
+{
+    uint_t high = (last == BITS_PER_WORD - 1) ? ALL_ONES : (1U << (last + 1)) - 1;
+    return high & ~((1U << first) - 1);
+}
+
+/*
+ * Propagate the set bits of given word of a level to the summaries.
+ */
+static void Word_Filled(struct Bit_Set *set, int level, uint_t index)
+{
+    while (level + 1 < NUM_LEVELS && set->level[level][index] == ALL_ONES) {
+	uint_t *summary = &set->level[level + 1][index / BITS_PER_WORD];
+
+	*summary |= 1U << (index % BITS_PER_WORD);
+	++level;
+	index /= BITS_PER_WORD;
+	if (*summary != ALL_ONES)
+	    break;
+    }
+}
+
+/*
+ * Clear the summary bits above a word which is no longer full.
+ */
+static void Word_Emptied(struct Bit_Set *set, uint_t index)
+{
+    int level;
+
+    for (level = 1; level < NUM_LEVELS; ++level) {
+	uint_t *summary = &set->level[level][index / BITS_PER_WORD];
+	bool wasFull = (*summary == ALL_ONES);
+
+	*summary &= ~(1U << (index % BITS_PER_WORD));
+	if (!wasFull)
+	    break;
+	index /= BITS_PER_WORD;
+    }
+}
+
+/*
+ * Find the first clear bit at or after given position in a level.
+ * Returns -1 if there is none.
+ */
+static int Find_Clear_In_Level(struct Bit_Set *set, int level, uint_t from)
+{
+    uint_t *bits = set->level[level];
+    uint_t numWords = set->numWords[level];
+    uint_t index = from / BITS_PER_WORD;
+    uint_t word;
+
+    if (index >= numWords)
+	return -1;
+    word = ~bits[index] & ~((1U << (from % BITS_PER_WORD)) - 1);
+    while (word == 0) {
+	if (++index >= numWords)
+	    return -1;
+	if (level + 1 < NUM_LEVELS) {
+	    /* Skip every full word at once */
+	    int next = Find_Clear_In_Level(set, level + 1, index);
+	    if (next < 0)
+		return -1;
+	    index = next;
+	}
+	word = ~bits[index];
+    }
+    return index * BITS_PER_WORD + Find_Low_Bit(word);
+}
+
+/*
+ * Find the first set bit at or after given position, looking no
+ * further than limit.  Returns limit if there is none before it.
+ */
+static uint_t Find_Set_Before(struct Bit_Set *set, uint_t from, uint_t limit)
+{
+    uint_t *bits = set->level[0];
+    uint_t index = from / BITS_PER_WORD;
+    uint_t word = bits[index] & ~((1U << (from % BITS_PER_WORD)) - 1);
+
+    while (word == 0) {
+	if ((++index) * BITS_PER_WORD >= limit)
+	    return limit;
+	word = bits[index];
+    }
+    from = index * BITS_PER_WORD + Find_Low_Bit(word);
+    return from < limit ? from : limit;
+}
+
+/*
+ * Find a run of at most one word of clear bits, testing all 32
+ * possible starting points of a word at once: shifting the clear
+ * bits of the word (and the next) against themselves leaves a bit
+ * set wherever a long enough run begins.
+ */
+static int Find_Short_Run(struct Bit_Set *set, uint_t from, uint_t runLength)
+{
+    uint_t *bits = set->level[0];
+    int pos = Find_Clear_In_Level(set, 0, from);
+
+    while (pos >= 0) {
+	uint_t index = pos / BITS_PER_WORD;
+	unsigned long long clear, starts;
+	uint_t len = 1;
+
+	clear = ~bits[index] & ~((1U << (pos % BITS_PER_WORD)) - 1);
+	if (index + 1 < set->numWords[0])
+	    clear |= (unsigned long long) ~bits[index + 1] << BITS_PER_WORD;
+
+	starts = clear;
+	while (len * 2 <= runLength) {
+	    starts &= starts >> len;
+	    len *= 2;
+	}
+	starts &= starts >> (runLength - len);
+
+	if ((uint_t) starts != 0)
+	    return index * BITS_PER_WORD + Find_Low_Bit((uint_t) starts);
+	pos = Find_Clear_In_Level(set, 0, (index + 1) * BITS_PER_WORD);
+    }
+    return -1;
+}
+
+/*
+ * Find a run of runLength clear bits starting at or after from.
+ * Returns -1 if there is none.
+ */
+static int Find_Run_From(struct Bit_Set *set, uint_t from, uint_t runLength)
+{
+    int start;
+
+    if (runLength <= 1)
+	return Find_Clear_In_Level(set, 0, from);
+    if (runLength <= BITS_PER_WORD)
+	return Find_Short_Run(set, from, runLength);
+    while ((start = Find_Clear_In_Level(set, 0, from)) >= 0) {
+	uint_t end;
+
+	if (start + runLength > set->totalBits)
+	    return -1;
+	end = Find_Set_Before(set, start, start + runLength);
+	if (end == start + runLength)
+	    return start;
+	from = end;
+    }
+    return -1;
+}
+
+static void Change_Bits(struct Bit_Set *set, uint_t first, uint_t count, bool value)
+{
+    uint_t last = first + count - 1;
+    uint_t index;
+
+    if (count == 0)
+	return;
+    KASSERT(last < set->totalBits);
+
+    for (index = first / BITS_PER_WORD; index <= last / BITS_PER_WORD; ++index) {
+	uint_t lo = (index == first / BITS_PER_WORD) ? first % BITS_PER_WORD : 0;
+	uint_t hi = (index == last / BITS_PER_WORD) ? last % BITS_PER_WORD : BITS_PER_WORD - 1;
+	uint_t mask = Bit_Mask(lo, hi);
+	uint_t *word = &set->level[0][index];
+
+	if (value) {
+	    *word |= mask;
+	    Word_Filled(set, 0, index);
+	} else {
+	    bool wasFull = (*word == ALL_ONES);
+	    *word &= ~mask;
+	    if (wasFull)
+		Word_Emptied(set, index);
+	}
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
 
 void* Create_Bit_Set(uint_t totalBits)
 {
-    ulong_t numBytes;
-    void *bitSet;
+    struct Bit_Set *set;
+    uint_t numWords[NUM_LEVELS], total = 0, bits = totalBits;
+    uint_t *words;
+    int level;
+
+    for (level = 0; level < NUM_LEVELS; ++level) {
+	numWords[level] = FIND_NUM_WORDS(bits);
+	if (numWords[level] == 0)
+	    numWords[level] = 1;
+	total += numWords[level];
+	bits = numWords[level];
+    }
+
+    set = (struct Bit_Set*) Malloc(sizeof(*set) + total * sizeof(uint_t));
+    if (set == 0)
+	return 0;
 
-    numBytes = FIND_NUM_BYTES(totalBits);
+    set->totalBits = totalBits;
+    set->cursor = 0;
+    words = (uint_t*) (set + 1);
+    memset(words, '\0', total * sizeof(uint_t));
 
-    bitSet = Malloc(numBytes);
-    if (bitSet != 0)
-	memset(bitSet, '\0', numBytes);
+    bits = totalBits;
+    for (level = 0; level < NUM_LEVELS; ++level) {
+	set->numWords[level] = numWords[level];
+	set->level[level] = words;
+	words += numWords[level];
+    }
+
+    /* Mark the padding after the last bit of each level as in use */
+    for (level = 0; level < NUM_LEVELS; ++level) {
+	uint_t index = bits / BITS_PER_WORD;
+
+	if (index < numWords[level]) {
+	    set->level[level][index] |= ~((1U << (bits % BITS_PER_WORD)) - 1);
+	    Word_Filled(set, level, index);
+	}
+	bits = numWords[level];
+    }
 
-    return bitSet;
+    return set;
 }
 
 void Set_Bit(void *bitSet, uint_t bitPos)
 {
-    ulong_t offset, bit;
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
+    uint_t index = bitPos / BITS_PER_WORD;
 
-    FIND_OFFSET_AND_BIT(bitPos, offset, bit);
-    ((uchar_t*)bitSet)[offset] |= (1 << bit);
+    KASSERT(bitPos < set->totalBits);
+    set->level[0][index] |= 1U << (bitPos % BITS_PER_WORD);
+    Word_Filled(set, 0, index);
 }
 
 void Clear_Bit(void *bitSet, uint_t bitPos)
 {
-    ulong_t offset, bit;
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
+    uint_t index = bitPos / BITS_PER_WORD;
+    bool wasFull = (set->level[0][index] == ALL_ONES);
+
+    KASSERT(bitPos < set->totalBits);
+    set->level[0][index] &= ~(1U << (bitPos % BITS_PER_WORD));
+    if (wasFull)
+	Word_Emptied(set, index);
+}
+
+/*
+ * Set or clear count consecutive bits starting at first.
+ */
+void Set_Bits(void *bitSet, uint_t first, uint_t count)
+{
+    Change_Bits((struct Bit_Set*) bitSet, first, count, true);
+}
 
-    FIND_OFFSET_AND_BIT(bitPos, offset, bit);
-    ((uchar_t*)bitSet)[offset] &= ~(1 << bit);
+void Clear_Bits(void *bitSet, uint_t first, uint_t count)
+{
+    Change_Bits((struct Bit_Set*) bitSet, first, count, false);
 }
 
 bool Is_Bit_Set(void *bitSet, uint_t bitPos)
 {
-    ulong_t offset, bit;
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
 
-    FIND_OFFSET_AND_BIT(bitPos, offset, bit);
-    return (((uchar_t*)bitSet)[offset] & (1 << bit)) != 0;
+    return (set->level[0][bitPos / BITS_PER_WORD] & (1U << (bitPos % BITS_PER_WORD))) != 0;
 }
 
 int Find_First_Free_Bit(void *bitSet, ulong_t totalBits)
 {
-    uint_t numBytes = FIND_NUM_BYTES(totalBits);
-    ulong_t offset;
-    uchar_t *bits = (uchar_t*) bitSet;
-
-    for (offset = 0; offset < numBytes; ++offset) {
-	if (bits[offset] != 0xff) {
-	    uint_t bit;
-	    for (bit = 0; bit < 8; ++bit) {
-		if ((bits[offset] & (1 << bit)) == 0)
-		    return (offset * 8) + bit;
-	    }
-	    KASSERT(false);
-	}
-    }
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
 
-    return -1;
+    KASSERT(totalBits <= set->totalBits);
+    return Find_Run_From(set, 0, 1);
 }
 
 /*
- * This is slow!!
+ * Find a free bit at or after the one following the bit last
+ * returned (next fit), wrapping around to the start of the set.
+ * Consecutive allocations thus tend to be adjacent, even once
+ * bits have been freed behind the cursor.
  */
+int Find_Next_Free_Bit(void *bitSet, ulong_t totalBits)
+{
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
+    int bitPos;
+
+    KASSERT(totalBits <= set->totalBits);
+    bitPos = Find_Run_From(set, set->cursor, 1);
+    if (bitPos < 0 && set->cursor != 0)
+	bitPos = Find_Run_From(set, 0, 1);
+    if (bitPos >= 0)
+	set->cursor = (bitPos + 1 < (int) set->totalBits) ? bitPos + 1 : 0;
+    return bitPos;
+}
+
 int Find_First_N_Free(void *bitSet, uint_t runLength, ulong_t totalBits)
 {
-    uint_t i,j;
-
-    for (i=0; i < totalBits - runLength; i++) {
-        if (!Is_Bit_Set(bitSet, i)) {
-	    for (j=1; j < runLength; j++) {
-	        if (Is_Bit_Set(bitSet, i+j)) {
-		    break;
-		}
-	    }
-	    if (j == runLength) {
-	        return i;
-	    }
-	}
-    }
-    return -1;
+    struct Bit_Set *set = (struct Bit_Set*) bitSet;
+
+    KASSERT(totalBits <= set->totalBits);
+    return Find_Run_From(set, 0, runLength);
 }
 
 void Destroy_Bit_Set(void *bitSet)
@@ -14,6 +14,7 @@
 #include <geekos/int.h>
 #include <geekos/kthread.h>
 #include <geekos/synch.h>
+#include <geekos/timer.h>
 #include <geekos/blockdev.h>
 
 /*#define BLOCKDEV_DEBUG */
@@ -44,16 +45,161 @@ IMPLEMENT_LIST(Block_Device_List, Block_Device);
  */
 static struct Block_Device_List s_deviceList;
 
+/*
+ * Most requests, and most blocks, the elevator puts in one transfer.
+ * One IDE command moves at most 256 blocks.
+ */
+#define MAX_MERGE_REQUESTS	8
+#define MAX_MERGE_BLOCKS	256
+
+/*
+ * Ticks a request may wait before the elevator serves it out of
+ * sweep order (the timer runs at about 18Hz).  Reads get the
+ * shorter deadline, since the thread needs their data to go on.
+ */
+#define READ_DEADLINE		9
+#define WRITE_DEADLINE		90
+
+/*
+ * Find a registered block device by name.
+ * Must be called with s_blockdevLock held.
+ */
+static struct Block_Device *Find_Block_Device(const char *name)
+{
+    struct Block_Device *dev = Get_Front_Of_Block_Device_List(&s_deviceList);
+
+    while (dev != 0) {
+	if (strcmp(dev->name, name) == 0)
+	    break;
+	dev = Get_Next_In_Block_Device_List(dev);
+    }
+    return dev;
+}
+
+/*
+ * Serve requests in the order they were posted.
+ */
+static struct Block_Request *FIFO_Select(struct Block_Device *dev, struct Block_Request_List *queue)
+{
+    struct Block_Request *request = Get_Front_Of_Block_Request_List(queue);
+
+    while (request->dev != dev)
+	request = Get_Next_In_Block_Request_List(request);
+    Remove_From_Block_Request_List(queue, request);
+    return request;
+}
+
+static bool Deadline_Expired(struct Block_Request *request)
+{
+    ulong_t deadline = request->type == BLOCK_READ ? READ_DEADLINE : WRITE_DEADLINE;
+    return g_numTicks - request->postTime > deadline;
+}
+
+/*
+ * Chain the requests of the same device and type which continue
+ * a transfer (or which it continues) behind it, so the driver moves
+ * them all at once.  Returns the request now starting the transfer.
+ */
+static struct Block_Request *Merge_Requests(struct Block_Request_List *queue, struct Block_Request *first)
+{
+    struct Block_Device *dev = first->dev;
+    struct Block_Request *last = first, *request;
+    int numRequests = 1, numBlocks = first->numBlocks;
+    bool merged;
+
+    do {
+	merged = false;
+	for (request = Get_Front_Of_Block_Request_List(queue);
+	     request != 0 && numRequests < MAX_MERGE_REQUESTS;
+	     request = Get_Next_In_Block_Request_List(request)) {
+	    if (request->dev != dev || request->type != first->type ||
+		numBlocks + request->numBlocks > MAX_MERGE_BLOCKS)
+		continue;
+
+	    if (request->blockNum == last->blockNum + last->numBlocks) {
+		Remove_From_Block_Request_List(queue, request);
+		last->nextMerged = request;
+		last = request;
+	    } else if (request->blockNum + request->numBlocks == first->blockNum) {
+		Remove_From_Block_Request_List(queue, request);
+		request->nextMerged = first;
+		first = request;
+	    } else
+		continue;
+
+	    ++numRequests;
+	    numBlocks += request->numBlocks;
+	    ++dev->stats[BLOCKDEV_STAT_MERGED];
+	    merged = true;
+	    break;
+	}
+    } while (merged);
+
+    return first;
+}
+
+/*
+ * C-SCAN elevator with deadlines: serve the request with the lowest
+ * block at or after the end of the last transfer, going back to the
+ * lowest block when no request is left above it, unless the oldest
+ * read or write has waited past its deadline.
+ */
+static struct Block_Request *Elevator_Select(struct Block_Device *dev, struct Block_Request_List *queue)
+{
+    struct Block_Request *request, *next = 0, *lowest = 0, *scan;
+    struct Block_Request *oldestRead = 0, *oldestWrite = 0;
+
+    /* The queue is in posting order, so the first of each type is the oldest */
+    for (request = Get_Front_Of_Block_Request_List(queue); request != 0;
+	 request = Get_Next_In_Block_Request_List(request)) {
+	if (request->dev != dev)
+	    continue;
+	if (request->type == BLOCK_READ && oldestRead == 0)
+	    oldestRead = request;
+	if (request->type == BLOCK_WRITE && oldestWrite == 0)
+	    oldestWrite = request;
+	if (request->blockNum >= dev->headBlock && (next == 0 || request->blockNum < next->blockNum))
+	    next = request;
+	if (lowest == 0 || request->blockNum < lowest->blockNum)
+	    lowest = request;
+    }
+    KASSERT(lowest != 0);
+
+    scan = next != 0 ? next : lowest;
+    if (oldestRead != 0 && Deadline_Expired(oldestRead))
+	request = oldestRead;
+    else if (oldestWrite != 0 && Deadline_Expired(oldestWrite))
+	request = oldestWrite;
+    else
+	request = scan;
+    if (request != scan)
+	++dev->stats[BLOCKDEV_STAT_EXPIRED];
+
+    Remove_From_Block_Request_List(queue, request);
+    return Merge_Requests(queue, request);
+}
+
+/*
+ * The schedulers, indexed by IO_SCHED_* number.
+ */
+static struct Block_Scheduler s_schedulers[IO_NUM_SCHEDULERS] = {
+    { "fifo", FIFO_Select },
+    { "elevator", Elevator_Select },
+};
+
 /*
  * Perform a block IO request.
  * Returns 0 if successful, error code on failure.
  */
-static int Do_Request(struct Block_Device *dev, enum Request_Type type, int blockNum, void *buf)
+static int Do_Request(struct Block_Device *dev, enum Request_Type type,
+    int blockNum, int numBlocks, void *buf)
 {
     struct Block_Request *request;
     int rc;
 
-    request = Create_Request(dev, type, blockNum, buf);
+    if (numBlocks <= 0)
+	return EINVALID;
+    request = Create_Request(dev, type, blockNum, numBlocks, buf);
     if (request == 0)
 	return ENOMEM;
     Post_Request_And_Wait(request);
@@ -62,6 +208,46 @@ static int Do_Request(struct Block_Device *dev, enum Request_Type type, int bloc
     return rc;
 }
 
+/*
+ * Add a request to the queue of its device.
+ * Must be called with interrupts disabled.
+ */
+static void Enqueue_Request(struct Block_Request *request)
+{
+    struct Block_Device *dev = request->dev;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(dev != 0);
+
+    Debug("Posting block device request [@%x]...\n", request);
+    request->postTime = g_numTicks;
+    Add_To_Back_Of_Block_Request_List(dev->requestQueue, request);
+    Wake_Up(dev->waitQueue);
+}
+
+/*
+ * Mark a request as finished, and tell whoever is waiting for it.
+ * Must be called with interrupts disabled.
+ */
+static void Complete_Request(struct Block_Request *request, enum Request_State state, int errorCode)
+{
+    struct Block_Completion_Queue *queue = request->completionQueue;
+
+    KASSERT(!Interrupts_Enabled());
+
+    request->state = state;
+    request->errorCode = errorCode;
+    Wake_Up(&request->waitQueue);
+    if (queue != 0) {
+	Add_To_Back_Of_Block_Request_List(&queue->doneList, request);
+	Wake_Up(&queue->waitQueue);
+    }
+
+    /* The callback may free the request, so it comes last */
+    if (request->callback != 0)
+	request->callback(request);
+}
+
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
@@ -93,6 +279,9 @@ int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
     dev->driverData = driverData;
     dev->waitQueue = waitQueue;
     dev->requestQueue = requestQueue;
+    dev->scheduler = IO_SCHED_ELEVATOR;
+    dev->headBlock = 0;
+    memset(dev->stats, '\0', sizeof(dev->stats));
 
     Mutex_Lock(&s_blockdevLock);
     /* FIXME: handle name conflict with existing device */
@@ -114,13 +303,7 @@ int Open_Block_Device(const char *name, struct Block_Device **pDev)
 
     Mutex_Lock(&s_blockdevLock);
 
-    dev = Get_Front_Of_Block_Device_List(&s_deviceList);
-    while (dev != 0) {
-	if (strcmp(dev->name, name) == 0)
-	    break;
-	dev = Get_Next_In_Block_Device_List(dev);
-    }
-
+    dev = Find_Block_Device(name);
     if (dev == 0)
 	rc = ENODEV;
     else if (dev->inUse)
@@ -159,19 +342,24 @@ int Close_Block_Device(struct Block_Device *dev)
 }
 
 /*
- * Create a block device request to transfer a single block.
+ * Create a block device request to transfer a range of blocks.
  */
 struct Block_Request *Create_Request(struct Block_Device *dev, enum Request_Type type,
-    int blockNum, void *buf)
+    int blockNum, int numBlocks, void *buf)
 {
     struct Block_Request *request = Malloc(sizeof(*request));
     if (request != 0) {
 	request->dev = dev;
 	request->type = type;
 	request->blockNum = blockNum;
+	request->numBlocks = numBlocks;
 	request->buf = buf;
 	request->state = PENDING;
 	Clear_Thread_Queue(&request->waitQueue);
+	request->nextMerged = 0;
+	request->callback = 0;
+	request->callbackData = 0;
+	request->completionQueue = 0;
     }
     return request;
 }
@@ -183,21 +371,56 @@ struct Block_Request *Create_Request(struct Block_Device *dev, enum Request_Type
  */
 void Post_Request_And_Wait(struct Block_Request *request)
 {
-    struct Block_Device *dev;
+    KASSERT(request != 0);
 
+    Submit_Request(request);
+    Wait_For_Request(request);
+}
+
+/*
+ * Send a block IO request to a device without waiting for it.
+ * Its completion can be noticed by polling with Is_Request_Done(),
+ * by waiting with Wait_For_Request(), or through the callback or
+ * completion queue set in the request.
+ */
+void Submit_Request(struct Block_Request *request)
+{
     KASSERT(request != 0);
 
-    dev = request->dev;
-    KASSERT(dev != 0);
+    Disable_Interrupts();
+    Enqueue_Request(request);
+    Enable_Interrupts();
+}
+
+/*
+ * Send several block IO requests without waiting for them.
+ * They are queued together, so the scheduler sees all of them
+ * before the driver takes the next one.
+ */
+void Submit_Requests(struct Block_Request **requests, int count)
+{
+    int i;
 
-    /* Send request to the driver */
-    Debug("Posting block device request [@%x]...\n", request);
     Disable_Interrupts();
-    Add_To_Back_Of_Block_Request_List(dev->requestQueue, request);
-    Wake_Up(dev->waitQueue);
+    for (i = 0; i < count; ++i)
+	Enqueue_Request(requests[i]);
     Enable_Interrupts();
+}
+
+/*
+ * Check whether a submitted request has completed.
+ */
+bool Is_Request_Done(struct Block_Request *request)
+{
+    return request->state != PENDING;
+}
 
-    /* Wait for request to be processed */
+/*
+ * Wait for a submitted request to complete.
+ * Returns 0 if it was successful, error code otherwise.
+ */
+int Wait_For_Request(struct Block_Request *request)
+{
     Disable_Interrupts();
     while (request->state == PENDING) {
 	Debug("Waiting, state=%d\n", request->state);
@@ -205,45 +428,217 @@ void Post_Request_And_Wait(struct Block_Request *request)
     }
     Debug("Wait completed!\n");
     Enable_Interrupts();
+
+    return request->errorCode;
+}
+
+/*
+ * Wait for all of several submitted requests to complete.
+ * Returns 0 if they were all successful, otherwise the
+ * error code of the first one which failed.
+ */
+int Wait_For_Requests(struct Block_Request **requests, int count)
+{
+    int i, rc, result = 0;
+
+    for (i = 0; i < count; ++i) {
+	rc = Wait_For_Request(requests[i]);
+	if (rc != 0 && result == 0)
+	    result = rc;
+    }
+    return result;
+}
+
+/*
+ * Cancel a submitted request which the driver has not started.
+ * It completes with the error ECANCELED.
+ * Returns 0 if the request was canceled, or EBUSY if it is
+ * already being transferred or has completed.
+ */
+int Cancel_Request(struct Block_Request *request)
+{
+    struct Block_Device *dev = request->dev;
+    int rc = EBUSY;
+
+    Disable_Interrupts();
+    if (request->state == PENDING && Is_Member_Of_Block_Request_List(dev->requestQueue, request)) {
+	Remove_From_Block_Request_List(dev->requestQueue, request);
+	Complete_Request(request, ERROR, ECANCELED);
+	rc = 0;
+    }
+    Enable_Interrupts();
+
+    return rc;
+}
+
+/*
+ * Initialize a completion queue.
+ */
+void Init_Completion_Queue(struct Block_Completion_Queue *queue)
+{
+    Clear_Block_Request_List(&queue->doneList);
+    Clear_Thread_Queue(&queue->waitQueue);
+}
+
+/*
+ * Take a completed request from a completion queue.
+ * If none has completed yet, wait for one if wait is true,
+ * otherwise return null.
+ */
+struct Block_Request *Get_Completed_Request(struct Block_Completion_Queue *queue, bool wait)
+{
+    struct Block_Request *request = 0;
+
+    Disable_Interrupts();
+    while (wait && Is_Block_Request_List_Empty(&queue->doneList))
+	Wait(&queue->waitQueue);
+    if (!Is_Block_Request_List_Empty(&queue->doneList))
+	request = Remove_From_Front_Of_Block_Request_List(&queue->doneList);
+    Enable_Interrupts();
+
+    return request;
 }
 
 /*
  * Wait for a block request to arrive.
+ * The device whose request was posted first is served next, and
+ * its scheduler chooses which of its requests to transfer.  The
+ * returned request may have others merged behind it; the driver
+ * transfers all of them (see Get_Request_Block_Buffer()).
  */
 struct Block_Request *Dequeue_Request(struct Block_Request_List *requestQueue,
     struct Thread_Queue *waitQueue)
 {
     struct Block_Request *request;
+    struct Block_Device *dev;
+    int distance;
 
     Disable_Interrupts();
     while (Is_Block_Request_List_Empty(requestQueue))
 	Wait(waitQueue);
-    request = Get_Front_Of_Block_Request_List(requestQueue);
-    Remove_From_Front_Of_Block_Request_List(requestQueue);
+    dev = Get_Front_Of_Block_Request_List(requestQueue)->dev;
+    request = s_schedulers[dev->scheduler].Select(dev, requestQueue);
+
+    distance = request->blockNum - dev->headBlock;
+    dev->stats[BLOCKDEV_STAT_SEEK] += distance < 0 ? -distance : distance;
+    dev->headBlock = request->blockNum + Get_Request_Num_Blocks(request);
+    ++dev->stats[BLOCKDEV_STAT_TRANSFERS];
     Enable_Interrupts();
 
     return request;
 }
 
 /*
- * Signal the completion of a block request.
+ * Signal the completion of a block request,
+ * and of the requests merged behind it.
  */
 void Notify_Request_Completion(struct Block_Request *request, enum Request_State state, int errorCode)
 {
     Disable_Interrupts();
-    request->state = state;
-    request->errorCode = errorCode;
-    Wake_Up(&request->waitQueue);
+    while (request != 0) {
+	struct Block_Request *next = request->nextMerged;
+	struct Block_Device *dev = request->dev;
+	ulong_t wait = g_numTicks - request->postTime;
+
+	++dev->stats[BLOCKDEV_STAT_REQUESTS];
+	dev->stats[BLOCKDEV_STAT_BLOCKS] += request->numBlocks;
+	dev->stats[BLOCKDEV_STAT_WAIT] += wait;
+	if (wait > dev->stats[BLOCKDEV_STAT_MAX_WAIT])
+	    dev->stats[BLOCKDEV_STAT_MAX_WAIT] = wait;
+
+	Complete_Request(request, state, errorCode);
+	request = next;
+    }
     Enable_Interrupts();
 }
 
+/*
+ * Get the number of blocks transferred by a request
+ * and those merged behind it.
+ */
+int Get_Request_Num_Blocks(struct Block_Request *request)
+{
+    int numBlocks = 0;
+
+    for (; request != 0; request = request->nextMerged)
+	numBlocks += request->numBlocks;
+    return numBlocks;
+}
+
+/*
+ * Get the buffer for the given block of a transfer, counting
+ * from the first block of the request and going on into the
+ * requests merged behind it.
+ */
+void *Get_Request_Block_Buffer(struct Block_Request *request, int block)
+{
+    while (block >= request->numBlocks) {
+	block -= request->numBlocks;
+	request = request->nextMerged;
+	KASSERT(request != 0);
+    }
+    return (char *) request->buf + block * SECTOR_SIZE;
+}
+
+/*
+ * Choose the I/O scheduler of the named device.
+ * Return 0 if successful, error code on error.
+ */
+int Set_IO_Scheduler(const char *name, int scheduler)
+{
+    struct Block_Device *dev;
+    int rc = 0;
+
+    if (scheduler < 0 || scheduler >= IO_NUM_SCHEDULERS)
+	return EINVALID;
+
+    Mutex_Lock(&s_blockdevLock);
+    dev = Find_Block_Device(name);
+    if (dev == 0)
+	rc = ENODEV;
+    else {
+	Disable_Interrupts();
+	dev->scheduler = scheduler;
+	Enable_Interrupts();
+	Debug("Block device %s uses the %s scheduler\n", name, s_schedulers[scheduler].name);
+    }
+    Mutex_Unlock(&s_blockdevLock);
+
+    return rc;
+}
+
+/*
+ * Get one of the BLOCKDEV_STAT_* statistics of the named device.
+ * Returns the (non-negative) value, or an error code.
+ */
+int Block_Device_Stat(const char *name, int which)
+{
+    struct Block_Device *dev;
+    int rc;
+
+    if (which < 0 || which >= BLOCKDEV_NUM_STATS)
+	return EINVALID;
+
+    Mutex_Lock(&s_blockdevLock);
+    dev = Find_Block_Device(name);
+    if (dev == 0)
+	rc = ENODEV;
+    else if (which == BLOCKDEV_STAT_SCHEDULER)
+	rc = dev->scheduler;
+    else
+	rc = (int) dev->stats[which];
+    Mutex_Unlock(&s_blockdevLock);
+
+    return rc;
+}
+
 /*
  * Read a block from given device.
  * Return 0 if successful, error code on error.
  */
 int Block_Read(struct Block_Device *dev, int blockNum, void *buf)
 {
-    return Do_Request(dev, BLOCK_READ, blockNum, buf);
+    return Do_Request(dev, BLOCK_READ, blockNum, 1, buf);
 }
 
 /*
@@ -252,7 +647,27 @@ int Block_Read(struct Block_Device *dev, int blockNum, void *buf)
  */
 int Block_Write(struct Block_Device *dev, int blockNum, void *buf)
 {
-    return Do_Request(dev, BLOCK_WRITE, blockNum, buf);
+    return Do_Request(dev, BLOCK_WRITE, blockNum, 1, buf);
+}
+
+/*
+ * Read consecutive blocks from given device into a buffer,
+ * as a single request.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Read_Range(struct Block_Device *dev, int blockNum, int numBlocks, void *buf)
+{
+    return Do_Request(dev, BLOCK_READ, blockNum, numBlocks, buf);
+}
+
+/*
+ * Write consecutive blocks from a buffer to given device,
+ * as a single request.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Write_Range(struct Block_Device *dev, int blockNum, int numBlocks, void *buf)
+{
+    return Do_Request(dev, BLOCK_WRITE, blockNum, numBlocks, buf);
 }
 
 /*
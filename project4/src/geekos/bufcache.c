@@ -0,0 +1,596 @@
+/*
+ * Block buffer cache
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/screen.h>
+#include <geekos/malloc.h>
+#include <geekos/kthread.h>
+#include <geekos/timer.h>
+#include <geekos/mem.h>
+#include <geekos/blockdev.h>
+#include <geekos/memstat.h>
+#include <geekos/bufcache.h>
+
+/*
+ * Filesystems read and write blocks through this cache instead of
+ * going to the device each time.  A buffer holds the BUFFER_BLOCKS
+ * blocks of a device which share a page-sized, page-aligned range,
+ * so reading one block brings in its neighbours as well.  Buffers
+ * are found through a hash table on (device, first block).
+ *
+ * Writes only change the buffer and mark the blocks dirty.  A kernel
+ * thread writes back blocks which have been dirty for a while, or all
+ * of them when too many are dirty or memory is short; Sync() writes
+ * back everything.
+ *
+ * The cache keeps at most about an eighth of memory.  Beyond that,
+ * and whenever the page allocator runs out of memory, the least
+ * recently used buffer which is clean and not in use is dropped.
+ *
+ * Buffers are protected by disabling interrupts.  A buffer whose
+ * data is being read or written is busy; threads wanting it wait
+ * until it is not.  Holding a reference keeps a buffer in the cache.
+ */
+
+#define BUFFER_BLOCKS		(PAGE_SIZE / SECTOR_SIZE)
+#define BUFFER_HASH_BUCKETS	256
+#define MAX_PREFETCH_REQUESTS	16
+
+/* Flags of a buffer */
+#define BUFFER_VALID		0x01	/* data has been read */
+#define BUFFER_BUSY		0x02	/* data is being read or written */
+
+/*
+ * The flusher thread wakes up every FLUSH_INTERVAL ticks and writes
+ * back blocks which have been dirty for DIRTY_EXPIRE ticks or more
+ * (the timer runs at about 18Hz).
+ */
+#define FLUSH_INTERVAL		18
+#define DIRTY_EXPIRE		90
+
+struct Buffer;
+DEFINE_LIST(Buffer_List, Buffer);
+
+struct Buffer {
+    struct Block_Device *dev;
+    int firstBlock;			/* a multiple of BUFFER_BLOCKS */
+    int numBlocks;			/* fewer than BUFFER_BLOCKS at the end of the device */
+    char *data;				/* a page */
+    int flags;
+    int refCount;
+    uchar_t dirtyMask;			/* one bit for each dirty block */
+    ulong_t dirtyTime;			/* when the first block became dirty */
+    struct Buffer *hashNext;
+    DEFINE_LINK(Buffer_List, Buffer);	/* least recently used first */
+};
+
+IMPLEMENT_LIST(Buffer_List, Buffer);
+
+extern uint_t s_numPages;
+
+static struct Buffer *s_bufferHash[BUFFER_HASH_BUCKETS];
+static struct Buffer_List s_lruList;
+static int s_numBuffers, s_maxBuffers;
+static int s_numDirty;
+static struct Thread_Queue s_bufferWaitQueue;
+
+static struct Thread_Queue s_flushWaitQueue;
+static int s_flushTimer = -1;
+static bool s_flushAll;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct Buffer **Hash_Bucket(struct Block_Device *dev, int firstBlock)
+{
+    ulong_t key = (ulong_t) dev / sizeof(ulong_t) + firstBlock / BUFFER_BLOCKS;
+    return &s_bufferHash[key % BUFFER_HASH_BUCKETS];
+}
+
+static struct Buffer *Lookup_Buffer(struct Block_Device *dev, int firstBlock)
+{
+    struct Buffer *buffer = *Hash_Bucket(dev, firstBlock);
+
+    while (buffer != 0 && (buffer->dev != dev || buffer->firstBlock != firstBlock))
+	buffer = buffer->hashNext;
+    return buffer;
+}
+
+/*
+ * Take a buffer out of the hash table and the LRU list.
+ */
+static void Remove_Buffer(struct Buffer *buffer)
+{
+    struct Buffer **pp = Hash_Bucket(buffer->dev, buffer->firstBlock);
+
+    KASSERT(buffer->refCount == 0 && buffer->dirtyMask == 0);
+    while (*pp != buffer)
+	pp = &(*pp)->hashNext;
+    *pp = buffer->hashNext;
+    Remove_From_Buffer_List(&s_lruList, buffer);
+    --s_numBuffers;
+    g_memStats[MEM_STAT_BUF_PAGES] = s_numBuffers;
+}
+
+/*
+ * Find the least recently used buffer which could be dropped.
+ */
+static struct Buffer *Find_Clean_Buffer(void)
+{
+    struct Buffer *buffer = Get_Front_Of_Buffer_List(&s_lruList);
+
+    while (buffer != 0 &&
+	   (buffer->refCount != 0 || buffer->dirtyMask != 0 || (buffer->flags & BUFFER_BUSY)))
+	buffer = Get_Next_In_Buffer_List(buffer);
+    return buffer;
+}
+
+/*
+ * Ask the flusher thread to write back every dirty buffer now.
+ */
+static void Wake_Flusher(void)
+{
+    s_flushAll = true;
+    Wake_Up(&s_flushWaitQueue);
+}
+
+/*
+ * Create a buffer for the blocks starting at firstBlock, and add it
+ * to the cache, neither valid nor busy.  Once the cache is full, or
+ * if memory runs out, the least recently used clean buffer is reused.
+ * Returns null if there is no memory and no buffer to reuse.
+ */
+static struct Buffer *Create_Buffer(struct Block_Device *dev, int firstBlock, int numBlocks)
+{
+    struct Buffer *buffer = 0, **bucket;
+
+    if (s_numBuffers >= s_maxBuffers)
+	buffer = Find_Clean_Buffer();
+    if (buffer == 0) {
+	buffer = (struct Buffer *) Malloc(sizeof(*buffer));
+	if (buffer != 0 && (buffer->data = Alloc_Page()) == 0) {
+	    Free(buffer);
+	    buffer = 0;
+	}
+	if (buffer == 0) {
+	    buffer = Find_Clean_Buffer();
+	    if (buffer == 0) {
+		Wake_Flusher();
+		return 0;
+	    }
+	}
+    }
+    if (Is_Member_Of_Buffer_List(&s_lruList, buffer))
+	Remove_Buffer(buffer);
+
+    buffer->dev = dev;
+    buffer->firstBlock = firstBlock;
+    buffer->numBlocks = numBlocks;
+    buffer->flags = 0;
+    buffer->refCount = 0;
+    buffer->dirtyMask = 0;
+    bucket = Hash_Bucket(dev, firstBlock);
+    buffer->hashNext = *bucket;
+    *bucket = buffer;
+    Add_To_Back_Of_Buffer_List(&s_lruList, buffer);
+    ++s_numBuffers;
+    g_memStats[MEM_STAT_BUF_PAGES] = s_numBuffers;
+
+    return buffer;
+}
+
+/*
+ * Find or create the buffer holding the given block, and take a
+ * reference to it.  Interrupts must be disabled.
+ * Returns null if the block is past the end of the device,
+ * or if there is no memory for the buffer.
+ */
+static struct Buffer *Find_Buffer(struct Block_Device *dev, int blockNum)
+{
+    int firstBlock = blockNum - blockNum % BUFFER_BLOCKS;
+    int numBlocks = Get_Num_Blocks(dev) - firstBlock;
+    struct Buffer *buffer;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (blockNum < 0 || blockNum >= Get_Num_Blocks(dev))
+	return 0;
+    if (numBlocks > BUFFER_BLOCKS)
+	numBlocks = BUFFER_BLOCKS;
+
+    buffer = Lookup_Buffer(dev, firstBlock);
+    if (buffer == 0)
+	buffer = Create_Buffer(dev, firstBlock, numBlocks);
+    if (buffer == 0)
+	return 0;
+
+    ++buffer->refCount;
+
+    /* Now the most recently used */
+    Remove_From_Buffer_List(&s_lruList, buffer);
+    Add_To_Back_Of_Buffer_List(&s_lruList, buffer);
+
+    return buffer;
+}
+
+/*
+ * Make sure the data of a referenced buffer has been read.
+ * Interrupts must be disabled; they are enabled while reading.
+ */
+static int Fill_Buffer(struct Buffer *buffer)
+{
+    int rc = 0;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(buffer->refCount > 0);
+
+    if (buffer->flags & BUFFER_VALID)
+	++g_memStats[MEM_STAT_BUF_HITS];
+    else
+	++g_memStats[MEM_STAT_BUF_MISSES];
+
+    while (buffer->flags & BUFFER_BUSY)
+	Wait(&s_bufferWaitQueue);
+
+    if (!(buffer->flags & BUFFER_VALID)) {
+	buffer->flags |= BUFFER_BUSY;
+	Enable_Interrupts();
+	rc = Block_Read_Range(buffer->dev, buffer->firstBlock, buffer->numBlocks, buffer->data);
+	Disable_Interrupts();
+	buffer->flags &= ~BUFFER_BUSY;
+	if (rc == 0)
+	    buffer->flags |= BUFFER_VALID;
+	Wake_Up(&s_bufferWaitQueue);
+    }
+
+    return rc;
+}
+
+/*
+ * Write the dirty blocks of a referenced buffer to the device,
+ * one request for each run of them.  Interrupts must be disabled;
+ * they are enabled while writing.
+ */
+static int Write_Back_Buffer(struct Buffer *buffer)
+{
+    uchar_t mask;
+    int i, start, rc = 0;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(buffer->refCount > 0);
+
+    while (buffer->flags & BUFFER_BUSY)
+	Wait(&s_bufferWaitQueue);
+    if (buffer->dirtyMask == 0)
+	return 0;
+
+    /* Blocks dirtied again while we write will be written next time */
+    mask = buffer->dirtyMask;
+    buffer->dirtyMask = 0;
+    buffer->flags |= BUFFER_BUSY;
+    --s_numDirty;
+    g_memStats[MEM_STAT_BUF_DIRTY] = s_numDirty;
+    Enable_Interrupts();
+
+    for (i = 0; i < buffer->numBlocks && rc == 0; ) {
+	if (!(mask & (1 << i))) {
+	    ++i;
+	    continue;
+	}
+	start = i;
+	while (i < buffer->numBlocks && (mask & (1 << i)))
+	    ++i;
+	rc = Block_Write_Range(buffer->dev, buffer->firstBlock + start, i - start,
+	    buffer->data + start * SECTOR_SIZE);
+    }
+
+    Disable_Interrupts();
+    buffer->flags &= ~BUFFER_BUSY;
+    ++g_memStats[MEM_STAT_BUF_WRITES];
+    if (rc != 0) {
+	/* Keep the data, and try again later */
+	Print("Error %d writing back blocks of %s at %d\n", rc, buffer->dev->name, buffer->firstBlock);
+	if (buffer->dirtyMask == 0) {
+	    buffer->dirtyTime = g_numTicks;
+	    ++s_numDirty;
+	    g_memStats[MEM_STAT_BUF_DIRTY] = s_numDirty;
+	}
+	buffer->dirtyMask |= mask;
+    }
+    Wake_Up(&s_bufferWaitQueue);
+
+    return rc;
+}
+
+/*
+ * Write back the dirty buffers of a device (or of all devices if
+ * dev is null) which became dirty at least minAge ticks ago.
+ * Returns 0 if successful, otherwise the first error.
+ */
+static int Write_Back_Buffers(struct Block_Device *dev, ulong_t minAge)
+{
+    struct Buffer *buffer, *next;
+    int i, err, rc = 0;
+
+    Disable_Interrupts();
+
+    /*
+     * Walk the hash chains, which only change at their heads or where
+     * an unreferenced buffer is removed; the reference held on the
+     * current buffer keeps the walk on its chain while writing.
+     */
+    for (i = 0; i < BUFFER_HASH_BUCKETS; ++i) {
+	buffer = s_bufferHash[i];
+	if (buffer != 0)
+	    ++buffer->refCount;
+	while (buffer != 0) {
+	    if ((dev == 0 || buffer->dev == dev) && buffer->dirtyMask != 0 &&
+		g_numTicks - buffer->dirtyTime >= minAge) {
+		err = Write_Back_Buffer(buffer);
+		if (err != 0 && rc == 0)
+		    rc = err;
+	    }
+	    next = buffer->hashNext;
+	    if (next != 0)
+		++next->refCount;
+	    --buffer->refCount;
+	    buffer = next;
+	}
+    }
+
+    Enable_Interrupts();
+
+    return rc;
+}
+
+static void Flush_Timer_Expired(int id)
+{
+    Cancel_Timer(id);
+    s_flushTimer = -1;
+    Wake_Up(&s_flushWaitQueue);
+}
+
+/*
+ * Body of the flusher thread.
+ */
+static void Flush_Thread(ulong_t arg)
+{
+    bool all;
+
+    while (true) {
+	Disable_Interrupts();
+	if (s_flushTimer < 0)
+	    s_flushTimer = Start_Timer(FLUSH_INTERVAL, Flush_Timer_Expired);
+	if (!s_flushAll)
+	    Wait(&s_flushWaitQueue);
+	all = s_flushAll || s_numDirty > s_maxBuffers / 2;
+	s_flushAll = false;
+	Enable_Interrupts();
+
+	Write_Back_Buffers(0, all ? 0 : DIRTY_EXPIRE);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Size the cache, and start the flusher thread.
+ */
+void Init_Buffer_Cache(void)
+{
+    s_maxBuffers = s_numPages / 8;
+    Start_Kernel_Thread(Flush_Thread, 0, PRIORITY_NORMAL, true);
+}
+
+/*
+ * Read numBytes bytes, starting offset bytes into block blockNum
+ * of a device, through the cache.
+ * Returns 0 if successful, error code otherwise.
+ */
+int Buffer_Read(struct Block_Device *dev, int blockNum, ulong_t offset, ulong_t numBytes, void *buf)
+{
+    struct Buffer *buffer;
+    char *dest = (char *) buf;
+    ulong_t pos, len;
+    int rc = 0;
+
+    blockNum += offset / SECTOR_SIZE;
+    offset %= SECTOR_SIZE;
+
+    Disable_Interrupts();
+    while (numBytes > 0 && rc == 0) {
+	buffer = Find_Buffer(dev, blockNum);
+	if (buffer == 0) {
+	    rc = blockNum >= Get_Num_Blocks(dev) ? EINVALID : ENOMEM;
+	    break;
+	}
+
+	pos = (blockNum - buffer->firstBlock) * SECTOR_SIZE + offset;
+	len = buffer->numBlocks * SECTOR_SIZE - pos;
+	if (len > numBytes)
+	    len = numBytes;
+
+	rc = Fill_Buffer(buffer);
+	if (rc == 0) {
+	    memcpy(dest, buffer->data + pos, len);
+	    dest += len;
+	    numBytes -= len;
+	    blockNum = buffer->firstBlock + buffer->numBlocks;
+	    offset = 0;
+	}
+	--buffer->refCount;
+    }
+    Enable_Interrupts();
+
+    return rc;
+}
+
+/*
+ * Write numBytes bytes, starting offset bytes into block blockNum
+ * of a device, into the cache.  The blocks are written to the device
+ * later by the flusher thread, or by Flush_Buffers().
+ * Returns 0 if successful, error code otherwise.
+ */
+int Buffer_Write(struct Block_Device *dev, int blockNum, ulong_t offset, ulong_t numBytes, const void *buf)
+{
+    struct Buffer *buffer;
+    const char *src = (const char *) buf;
+    ulong_t pos, len;
+    int rc = 0, i;
+
+    blockNum += offset / SECTOR_SIZE;
+    offset %= SECTOR_SIZE;
+
+    Disable_Interrupts();
+    while (numBytes > 0 && rc == 0) {
+	buffer = Find_Buffer(dev, blockNum);
+	if (buffer == 0) {
+	    rc = blockNum >= Get_Num_Blocks(dev) ? EINVALID : ENOMEM;
+	    break;
+	}
+
+	pos = (blockNum - buffer->firstBlock) * SECTOR_SIZE + offset;
+	len = buffer->numBlocks * SECTOR_SIZE - pos;
+	if (len > numBytes)
+	    len = numBytes;
+
+	/*
+	 * Unless all of it is overwritten, the rest of the buffer
+	 * must be read first.  Either way it must not be in flight.
+	 */
+	if (pos == 0 && len == buffer->numBlocks * SECTOR_SIZE)
+	    buffer->flags |= BUFFER_VALID;
+	else
+	    rc = Fill_Buffer(buffer);
+	while (rc == 0 && (buffer->flags & BUFFER_BUSY))
+	    Wait(&s_bufferWaitQueue);
+	if (rc == 0) {
+	    memcpy(buffer->data + pos, src, len);
+	    if (buffer->dirtyMask == 0) {
+		buffer->dirtyTime = g_numTicks;
+		++s_numDirty;
+		g_memStats[MEM_STAT_BUF_DIRTY] = s_numDirty;
+	    }
+	    for (i = pos / SECTOR_SIZE; i * SECTOR_SIZE < pos + len; ++i)
+		buffer->dirtyMask |= 1 << i;
+
+	    src += len;
+	    numBytes -= len;
+	    blockNum = buffer->firstBlock + buffer->numBlocks;
+	    offset = 0;
+	}
+	--buffer->refCount;
+    }
+
+    if (s_numDirty > s_maxBuffers / 2)
+	Wake_Flusher();
+    Enable_Interrupts();
+
+    return rc;
+}
+
+/*
+ * Called by the driver when a prefetch read completes.
+ */
+static void Prefetch_Done(struct Block_Request *request)
+{
+    struct Buffer *buffer = (struct Buffer *) request->callbackData;
+
+    buffer->flags &= ~BUFFER_BUSY;
+    if (request->state == COMPLETED)
+	buffer->flags |= BUFFER_VALID;
+    --buffer->refCount;
+    Wake_Up(&s_bufferWaitQueue);
+    Free(request);
+}
+
+/*
+ * Start reading blocks of a device into the cache, without waiting
+ * for them.  Blocks already cached or being read are skipped; if
+ * memory runs short, the rest are not read.  The reads of up to
+ * MAX_PREFETCH_REQUESTS buffers are queued together, so that the
+ * scheduler can merge a run of them into one transfer.
+ */
+void Buffer_Prefetch(struct Block_Device *dev, int blockNum, int numBlocks)
+{
+    struct Buffer *buffer;
+    struct Block_Request *request, *requests[MAX_PREFETCH_REQUESTS];
+    int end = blockNum + numBlocks, count = 0;
+
+    Disable_Interrupts();
+    while (blockNum < end) {
+	buffer = Find_Buffer(dev, blockNum);
+	if (buffer == 0)
+	    break;
+	blockNum = buffer->firstBlock + buffer->numBlocks;
+	if (buffer->flags & (BUFFER_VALID | BUFFER_BUSY)) {
+	    --buffer->refCount;
+	    continue;
+	}
+
+	/* The reference is dropped when the read completes */
+	request = Create_Request(dev, BLOCK_READ, buffer->firstBlock, buffer->numBlocks, buffer->data);
+	if (request == 0) {
+	    --buffer->refCount;
+	    break;
+	}
+	request->callback = Prefetch_Done;
+	request->callbackData = buffer;
+	buffer->flags |= BUFFER_BUSY;
+	requests[count++] = request;
+	if (count == MAX_PREFETCH_REQUESTS) {
+	    Enable_Interrupts();
+	    Submit_Requests(requests, count);
+	    Disable_Interrupts();
+	    count = 0;
+	}
+    }
+    Enable_Interrupts();
+
+    Submit_Requests(requests, count);
+}
+
+/*
+ * Write back all dirty blocks of a device, or of all devices
+ * if dev is null.
+ * Returns 0 if successful, otherwise the first error.
+ */
+int Flush_Buffers(struct Block_Device *dev)
+{
+    return Write_Back_Buffers(dev, 0);
+}
+
+/*
+ * Drop the least recently used clean buffer which is not in use,
+ * to free memory.  Interrupts must be disabled.
+ * Returns true if a buffer was dropped.
+ */
+bool Shrink_Buffer_Cache(void)
+{
+    struct Buffer *buffer;
+
+    KASSERT(!Interrupts_Enabled());
+
+    buffer = Find_Clean_Buffer();
+    if (buffer == 0) {
+	/* Dirty buffers can be dropped once they have been written */
+	if (s_numDirty > 0)
+	    Wake_Flusher();
+	return false;
+    }
+
+    Remove_Buffer(buffer);
+    Free_Page(buffer->data);
+    Free(buffer);
+    return true;
+}
@@ -34,7 +34,8 @@ int Parse_ELF_Executable(char *exeFileData, ulong_t exeFileLength,
     elfHeader *elfHead = (elfHeader *)exeFileData;
     int i;
 
-    if (elfHead->ident[0] != 0x7F || elfHead->ident[1] != 'E' ||
+    if (exeFileLength < sizeof(elfHeader) ||
+        elfHead->ident[0] != 0x7F || elfHead->ident[1] != 'E' ||
         elfHead->ident[2] != 'L' || elfHead->ident[3] != 'F')
     {
         return -1;
@@ -43,16 +44,36 @@ int Parse_ELF_Executable(char *exeFileData, ulong_t exeFileLength,
     exeFormat->numSegments = 0;
     exeFormat->entryAddr = elfHead->entry;
 
+    if (elfHead->phoff + elfHead->phnum * sizeof(programHeader) > exeFileLength)
+    {
+        return ENOEXEC;
+    }
+
     programHeader *phHead = (programHeader *)(exeFileData + elfHead->phoff);
     for (i = 0; i < elfHead->phnum; i++)
     {
         programHeader *ph = &phHead[i];
 
+        /* Other headers (such as GNU_STACK) describe nothing to load */
+        if (ph->type != PT_LOAD)
+            continue;
+        if (exeFormat->numSegments == EXE_MAX_SEGMENTS ||
+            ph->offset + ph->fileSize > exeFileLength ||
+            ph->offset + ph->fileSize < ph->offset)
+        {
+            return ENOEXEC;
+        }
+
         struct Exe_Segment *seg = &exeFormat->segmentList[exeFormat->numSegments];
         seg->offsetInFile = ph->offset;
         seg->lengthInFile = ph->fileSize;
         seg->startAddress = ph->vaddr;
         seg->sizeInMemory = ph->memSize;
+        seg->protFlags = VM_READ;
+        if (ph->flags & PF_W)
+            seg->protFlags |= VM_WRITE;
+        if (ph->flags & PF_X)
+            seg->protFlags |= VM_EXEC;
 
         exeFormat->numSegments++;
     }
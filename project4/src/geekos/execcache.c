@@ -0,0 +1,349 @@
+/*
+ * Cache of loaded executable images
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/malloc.h>
+#include <geekos/range.h>
+#include <geekos/mem.h>
+#include <geekos/vfs.h>
+#include <geekos/user.h>
+#include <geekos/ksm.h>
+#include <geekos/memstat.h>
+#include <geekos/execcache.h>
+
+/*
+ * Starting a program used to mean reading the whole executable,
+ * parsing it, and copying its segments into fresh pages of the new
+ * process.  Instead, each executable is read once into an image:
+ * the file data of its segments is laid out page by page in frames
+ * which every process running the program maps read-only.  Pages of
+ * writable segments are copied when a process first writes to them.
+ *
+ * Images are looked up by path, and only used if the file still has
+ * the same size, location and modification time.  The cache holds at
+ * most EXEC_CACHE_MAX_IMAGES images and EXEC_CACHE_MAX_PAGES pages;
+ * beyond that, and whenever memory runs out, the least recently used
+ * image which nobody is loading from is dropped.  Frames of a dropped
+ * image which are still mapped stay until their last user exits.
+ *
+ * The list of cached images is protected by disabling interrupts.
+ */
+
+IMPLEMENT_LIST(Exec_Image_List, Exec_Image);
+
+static struct Exec_Image_List s_imageList;
+static int s_numImages;
+static ulong_t s_numCachedPages;
+static ulong_t s_useClock;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct Exec_Image *Lookup_Image(const char *path)
+{
+    struct Exec_Image *image = Get_Front_Of_Exec_Image_List(&s_imageList);
+
+    while (image != 0 && strcmp(image->path, path) != 0)
+	image = Get_Next_In_Exec_Image_List(image);
+    return image;
+}
+
+static bool Same_File(struct Exec_Image *image, struct VFS_File_Stat *stat)
+{
+    return image->fileSize == stat->size && image->fileId == stat->fileId &&
+	image->modTime == stat->modTime;
+}
+
+static void Destroy_Image(struct Exec_Image *image)
+{
+    ulong_t i;
+
+    for (i = 0; i < image->numPages; ++i) {
+	if (image->frames[i] != 0)
+	    Ksm_Put_Frame(image->frames[i]);
+    }
+    if (image->frames != 0)
+	Free(image->frames);
+    Free(image->path);
+    Free(image);
+}
+
+/*
+ * Remove an image from the cache.  It is destroyed once
+ * the last process loading from it is done.
+ * Interrupts must be disabled.
+ */
+static void Drop_Image(struct Exec_Image *image)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    Remove_From_Exec_Image_List(&s_imageList, image);
+    --s_numImages;
+    s_numCachedPages -= image->numPages;
+    g_memStats[MEM_STAT_EXEC_PAGES] = s_numCachedPages;
+    Put_Exec_Image(image);
+}
+
+/*
+ * Find the least recently used image which is not in use.
+ * Returns null if every cached image is in use.
+ */
+static struct Exec_Image *Find_Unused_Image(void)
+{
+    struct Exec_Image *image, *best = 0;
+
+    for (image = Get_Front_Of_Exec_Image_List(&s_imageList); image != 0;
+	 image = Get_Next_In_Exec_Image_List(image)) {
+	if (image->refCount == 1 && (best == 0 || image->lastUsed < best->lastUsed))
+	    best = image;
+    }
+    return best;
+}
+
+/*
+ * Add a newly built image to the cache, making room for it.
+ * Interrupts must be disabled.
+ */
+static void Cache_Image(struct Exec_Image *image)
+{
+    struct Exec_Image *victim;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (image->numPages > EXEC_CACHE_MAX_PAGES)
+	return;
+
+    ++image->refCount;
+    Add_To_Front_Of_Exec_Image_List(&s_imageList, image);
+    ++s_numImages;
+    s_numCachedPages += image->numPages;
+
+    while ((s_numImages > EXEC_CACHE_MAX_IMAGES ||
+	    s_numCachedPages > EXEC_CACHE_MAX_PAGES) &&
+	   (victim = Find_Unused_Image()) != 0)
+	Drop_Image(victim);
+    g_memStats[MEM_STAT_EXEC_PAGES] = s_numCachedPages;
+}
+
+/*
+ * Copy the file data of one segment into the frames of an image,
+ * allocating frames for pages which do not have one yet.
+ * Returns 0 if successful, or an error code.
+ */
+static int Fill_Segment_Pages(struct Exec_Image *image, struct Exe_Segment *segment,
+    char *exeFileData)
+{
+    ulong_t fileEnd = segment->startAddress + segment->lengthInFile;
+    ulong_t vaddr;
+
+    if (segment->lengthInFile == 0)
+	return 0;
+    for (vaddr = Round_Down_To_Page(segment->startAddress); vaddr < fileEnd;
+	 vaddr += PAGE_SIZE) {
+	ulong_t index = (vaddr - image->startAddress) / PAGE_SIZE;
+	ulong_t copyStart = vaddr < segment->startAddress ? segment->startAddress : vaddr;
+	ulong_t copyEnd = vaddr + PAGE_SIZE < fileEnd ? vaddr + PAGE_SIZE : fileEnd;
+
+	if (image->frames[index] == 0) {
+	    image->frames[index] = Alloc_Zeroed_Page_Evicting();
+	    if (image->frames[index] == 0)
+		return ENOMEM;
+	}
+	memcpy((char *) image->frames[index] + (copyStart - vaddr),
+	    exeFileData + segment->offsetInFile + (copyStart - segment->startAddress),
+	    copyEnd - copyStart);
+    }
+    return 0;
+}
+
+/*
+ * Read and parse an executable, and lay out its file data in frames.
+ * Returns 0 and stores the image, with one reference for the caller,
+ * if successful, or an error code.
+ */
+static int Build_Image(const char *path, struct VFS_File_Stat *stat,
+    struct Exec_Image **pImage)
+{
+    char *exeFileData = 0;
+    ulong_t exeFileLength;
+    struct Exec_Image *image;
+    ulong_t start = USER_VM_LEN, end = 0, i;
+    int rc;
+
+    image = (struct Exec_Image *) Malloc(sizeof(*image));
+    if (image == 0)
+	return ENOMEM;
+    memset(image, '\0', sizeof(*image));
+
+    if ((rc = Read_Fully(path, (void **) &exeFileData, &exeFileLength)) != 0 ||
+	(rc = Parse_ELF_Executable(exeFileData, exeFileLength, &image->exeFormat)) != 0)
+	goto fail;
+
+    /* Find the pages which hold file data of some segment */
+    rc = ENOEXEC;
+    for (i = 0; i < image->exeFormat.numSegments; ++i) {
+	struct Exe_Segment *segment = &image->exeFormat.segmentList[i];
+
+	if (segment->lengthInFile > segment->sizeInMemory ||
+	    !Check_Range_Under(segment->startAddress, segment->sizeInMemory, USER_VM_LEN))
+	    goto fail;
+	if (segment->lengthInFile == 0)
+	    continue;
+	if (Round_Down_To_Page(segment->startAddress) < start)
+	    start = Round_Down_To_Page(segment->startAddress);
+	if (Round_Up_To_Page(segment->startAddress + segment->lengthInFile) > end)
+	    end = Round_Up_To_Page(segment->startAddress + segment->lengthInFile);
+    }
+    if (end == 0)
+	goto fail;
+
+    rc = ENOMEM;
+    image->startAddress = start;
+    image->numPages = (end - start) / PAGE_SIZE;
+    image->frames = (void **) Malloc(image->numPages * sizeof(void *));
+    image->path = strdup(path);
+    if (image->frames == 0 || image->path == 0)
+	goto fail;
+    memset(image->frames, '\0', image->numPages * sizeof(void *));
+
+    for (i = 0; i < image->exeFormat.numSegments; ++i) {
+	rc = Fill_Segment_Pages(image, &image->exeFormat.segmentList[i], exeFileData);
+	if (rc != 0)
+	    goto fail;
+    }
+    Free(exeFileData);
+
+    /* From now on the frames are shared, and must not be written */
+    for (i = 0; i < image->numPages; ++i) {
+	if (image->frames[i] != 0)
+	    Ksm_Add_Frame(image->frames[i]);
+    }
+
+    image->fileSize = stat->size;
+    image->fileId = stat->fileId;
+    image->modTime = stat->modTime;
+    image->refCount = 1;
+    *pImage = image;
+    return 0;
+
+fail:
+    if (exeFileData != 0)
+	Free(exeFileData);
+    for (i = 0; image->frames != 0 && i < image->numPages; ++i) {
+	if (image->frames[i] != 0)
+	    Free_Page(image->frames[i]);
+    }
+    if (image->frames != 0)
+	Free(image->frames);
+    if (image->path != 0)
+	Free(image->path);
+    Free(image);
+    return rc;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Get the image of the executable with given path, from the cache
+ * if the file has not changed since it was cached, and otherwise by
+ * reading the file.  Interrupts must be enabled.
+ * Returns 0 and stores the image if successful, or an error code.
+ * The image must be released with Put_Exec_Image().
+ */
+int Get_Exec_Image(const char *path, struct Exec_Image **pImage)
+{
+    struct VFS_File_Stat stat;
+    struct Exec_Image *image, *built = 0;
+    int rc;
+
+    KASSERT(Interrupts_Enabled());
+
+    rc = Stat(path, &stat);
+    if (rc != 0)
+	return rc;
+
+    Disable_Interrupts();
+    image = Lookup_Image(path);
+    if (image != 0 && !Same_File(image, &stat)) {
+	Drop_Image(image);
+	image = 0;
+    }
+    if (image != 0) {
+	++image->refCount;
+	image->lastUsed = ++s_useClock;
+	++g_memStats[MEM_STAT_EXEC_HITS];
+	Enable_Interrupts();
+	*pImage = image;
+	return 0;
+    }
+    Enable_Interrupts();
+
+    rc = Build_Image(path, &stat, &built);
+    if (rc != 0)
+	return rc;
+
+    /* Someone else may have cached the file while it was being read */
+    Disable_Interrupts();
+    ++g_memStats[MEM_STAT_EXEC_MISSES];
+    image = Lookup_Image(path);
+    if (image != 0 && !Same_File(image, &stat)) {
+	Drop_Image(image);
+	image = 0;
+    }
+    if (image != 0) {
+	++image->refCount;
+    } else {
+	image = built;
+	built = 0;
+	Cache_Image(image);
+    }
+    image->lastUsed = ++s_useClock;
+    Enable_Interrupts();
+
+    if (built != 0)
+	Put_Exec_Image(built);
+    *pImage = image;
+    return 0;
+}
+
+/*
+ * Release an image obtained from Get_Exec_Image().
+ */
+void Put_Exec_Image(struct Exec_Image *image)
+{
+    bool iflag = Begin_Int_Atomic();
+
+    KASSERT(image->refCount > 0);
+    if (--image->refCount == 0)
+	Destroy_Image(image);
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Drop the least recently used image which nobody is loading
+ * from, to free memory.  Interrupts must be disabled.
+ * Returns true if an image was dropped.
+ */
+bool Shrink_Exec_Cache(void)
+{
+    struct Exec_Image *victim;
+
+    KASSERT(!Interrupts_Enabled());
+
+    victim = Find_Unused_Image();
+    if (victim == 0)
+	return false;
+    Drop_Image(victim);
+    return true;
+}
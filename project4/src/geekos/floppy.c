@@ -570,7 +570,7 @@ static int Floppy_Write(int driveNum, int blockNum, char *buffer)
  */
 static void Floppy_Request_Thread(ulong_t arg)
 {
-    int rc;
+    int rc, i, numBlocks;
 
     Debug("FRQ: Floppy request thread starting...\n");
 
@@ -583,11 +583,15 @@ static void Floppy_Request_Thread(ulong_t arg)
 	Debug("FRQ: Got a floppy request [@%x]\n", request);
 	KASSERT(request->type == BLOCK_READ || request->type == BLOCK_WRITE);
 
-	/* Perform the I/O. */
-	if (request->type == BLOCK_READ)
-	    rc = Floppy_Read(request->dev->unit, request->blockNum, request->buf);
-	else
-	    rc = Floppy_Write(request->dev->unit, request->blockNum, request->buf);
+	/* Perform the I/O, one block at a time, including merged requests. */
+	numBlocks = Get_Request_Num_Blocks(request);
+	for (i = 0, rc = 0; i < numBlocks && rc == 0; ++i) {
+	    char *buf = Get_Request_Block_Buffer(request, i);
+	    if (request->type == BLOCK_READ)
+		rc = Floppy_Read(request->dev->unit, request->blockNum + i, buf);
+	    else
+		rc = Floppy_Write(request->dev->unit, request->blockNum + i, buf);
+	}
 
 	/* Notify the requesting thread of the outcome of the I/O. */
 	Debug("FRQ: Notifying requesting thread...\n");
@@ -12,6 +12,7 @@
 #include <geekos/int.h>
 #include <geekos/tss.h>
 #include <geekos/gdt.h>
+#include <geekos/user.h>
 
 /*
  * This is defined in lowlevel.asm.
@@ -132,6 +133,29 @@ void Init_GDT(void)
     );
     KASSERT(Get_Descriptor_Index(desc) == (KERNEL_DS >> 3));
 
+    /*
+     * User code and data segments.  With paging, every process
+     * has its own page directory but the same segments, so they
+     * all share these instead of needing descriptors of their own.
+     */
+    desc = Allocate_Segment_Descriptor();
+    Init_Code_Segment_Descriptor(
+	desc,
+	USER_VM_START,		 /* base address */
+	USER_VM_LEN / PAGE_SIZE, /* num pages */
+	USER_PRIVILEGE		 /* privilege level */
+    );
+    KASSERT(Get_Descriptor_Index(desc) == (USER_CS >> 3));
+
+    desc = Allocate_Segment_Descriptor();
+    Init_Data_Segment_Descriptor(
+	desc,
+	USER_VM_START,		 /* base address */
+	USER_VM_LEN / PAGE_SIZE, /* num pages */
+	USER_PRIVILEGE		 /* privilege level */
+    );
+    KASSERT(Get_Descriptor_Index(desc) == (USER_DS >> 3));
+
     /* Activate the kernel GDT. */
     limitAndBase[0] = sizeof(struct Segment_Descriptor) * NUM_GDT_ENTRIES;
     limitAndBase[1] = gdtBaseAddr & 0xffff;
@@ -21,10 +21,12 @@
 #include <geekos/string.h>
 #include <geekos/io.h>
 #include <geekos/int.h>
+#include <geekos/irq.h>
 #include <geekos/screen.h>
 #include <geekos/timer.h>
 #include <geekos/kthread.h>
 #include <geekos/blockdev.h>
+#include <geekos/pci.h>
 #include <geekos/ide.h>
 
 /* Registers */
@@ -53,6 +55,11 @@
 #define IDE_COMMAND_WRITE_BUFFER	0xE8
 #define IDE_COMMAND_DIAGNOSTIC		0x90
 #define IDE_COMMAND_ATAPI_IDENT_DRIVE	0xA1
+#define IDE_COMMAND_READ_MULTIPLE	0xC4
+#define IDE_COMMAND_WRITE_MULTIPLE	0xC5
+#define IDE_COMMAND_SET_MULTIPLE	0xC6
+#define IDE_COMMAND_READ_DMA		0xC8
+#define IDE_COMMAND_WRITE_DMA		0xCA
 
 /* Results words from Identify Drive Request */
 #define	IDE_INDENTIFY_NUM_CYLINDERS	0x01
@@ -60,6 +67,11 @@
 #define	IDE_INDENTIFY_NUM_BYTES_TRACK	0x04
 #define	IDE_INDENTIFY_NUM_BYTES_SECTOR	0x05
 #define	IDE_INDENTIFY_NUM_SECTORS_TRACK	0x06
+#define	IDE_INDENTIFY_MAX_MULTIPLE	0x2F
+#define	IDE_INDENTIFY_CAPABILITIES	0x31
+
+/* Bits of the capabilities word */
+#define IDE_CAPABILITY_DMA		0x0100
 
 /* bits of Status Register */
 #define IDE_STATUS_DRIVE_BUSY		0x80
@@ -91,11 +103,57 @@
 
 #define IDE_MAX_DRIVES			2
 
+/* Both drives are on the primary channel, which interrupts on IRQ 14 */
+#define IDE_IRQ				14
+
+/* Most sectors one command can transfer (a sector count of 0 means 256) */
+#define IDE_MAX_SECTORS_PER_COMMAND	256
+
+/*
+ * Bus master DMA registers of the primary channel, relative to the
+ * I/O base in BAR 4 of the controller's PCI function.
+ */
+#define IDE_BM_COMMAND			0
+#define IDE_BM_STATUS			2
+#define IDE_BM_PRD_TABLE		4
+
+/* Bits of the bus master command register */
+#define IDE_BM_COMMAND_START		0x01
+#define IDE_BM_COMMAND_TO_MEMORY	0x08
+
+/* Bits of the bus master status register */
+#define IDE_BM_STATUS_ACTIVE		0x01
+#define IDE_BM_STATUS_ERROR		0x02
+#define IDE_BM_STATUS_INTERRUPT		0x04
+
+/* The controller can be a bus master if this bit of its prog-if is set */
+#define IDE_PROG_IF_BUS_MASTER		0x80
+
+/*
+ * A physical region descriptor: one piece of the buffer of a DMA
+ * transfer.  A piece may not cross a 64K boundary, and a byte count
+ * of 0 means 64K.  The table may not cross a 64K boundary either.
+ */
+struct IDE_PRD {
+    ulong_t addr;
+    ushort_t count;
+    ushort_t flags;
+};
+#define IDE_PRD_END			0x8000
+
+/*
+ * A command moves at most 128K, which may touch three 64K regions,
+ * and each request merged into it may add two more pieces.
+ */
+#define IDE_PRD_ENTRIES			32
+
 typedef struct {
     short num_Cylinders;
     short num_Heads;
     short num_SectorsPerTrack;
     short num_BytesPerSector;
+    short num_SectorsPerBlock;	/* sectors per data request in multiple mode, 0 if not used */
+    bool useDMA;		/* transfer with bus master DMA */
 } ideDisk;
 
 int ideDebug = 0;
@@ -105,13 +163,30 @@ static ideDisk drives[IDE_MAX_DRIVES];
 struct Thread_Queue s_ideWaitQueue;
 struct Block_Request_List s_ideRequestQueue;
 
+/*
+ * The request thread sleeps here until the drive interrupts.
+ * The handler records the status the drive had at the interrupt.
+ */
+static struct Thread_Queue s_ideInterruptWaitQueue;
+static volatile bool s_ideInterruptPending;
+static volatile int s_ideInterruptStatus;
+
+/*
+ * I/O base of the bus master registers, 0 if there is no
+ * bus master controller; and the table describing the buffer of
+ * the current transfer.  Kernel memory is identity mapped,
+ * so buffer addresses are physical addresses.
+ */
+static ushort_t s_ideBusMasterBase;
+static struct IDE_PRD s_idePrdTable[IDE_PRD_ENTRIES] __attribute__ ((aligned (256)));
+
 /*
  * return the number of logical blocks for a particular drive.
  *
  */
 static int IDE_getNumBlocks(int driveNum)
 {
-    if (driveNum < 0 || driveNum > IDE_MAX_DRIVES) {
+    if (driveNum < 0 || driveNum >= IDE_MAX_DRIVES) {
         return IDE_ERROR_BAD_DRIVE;
     }
 
@@ -121,31 +196,58 @@ static int IDE_getNumBlocks(int driveNum)
 }
 
 /*
- * Read a block at the logical block number indicated.
+ * Wait until the drive is no longer busy.
+ * Returns the drive status.
  */
-static int IDE_Read(int driveNum, int blockNum, char *buffer)
+static int IDE_Wait_Not_Busy(void)
 {
-    int i;
-    int head;
-    int sector;
-    int cylinder;
-    short *bufferW;
-    int reEnable = 0;
+    int status;
 
-    if (driveNum < 0 || driveNum > (numDrives-1)) {
-	if (ideDebug) Print("ide: invalid drive %d\n", driveNum);
-        return IDE_ERROR_BAD_DRIVE;
-    }
+    while ((status = In_Byte(IDE_STATUS_REGISTER)) & IDE_STATUS_DRIVE_BUSY)
+	;
+    return status;
+}
 
-    if (blockNum < 0 || blockNum >= IDE_getNumBlocks(driveNum)) {
-	if (ideDebug) Print("ide: invalid block %d\n", blockNum);
-        return IDE_ERROR_INVALID_BLOCK;
-    }
+/*
+ * Interrupt handler for the IDE controller.
+ * Reading the status register acknowledges the interrupt.
+ */
+static void IDE_Interrupt_Handler(struct Interrupt_State* state)
+{
+    Begin_IRQ(state);
+    s_ideInterruptStatus = In_Byte(IDE_STATUS_REGISTER);
+    s_ideInterruptPending = true;
+    Wake_Up(&s_ideInterruptWaitQueue);
+    End_IRQ(state);
+}
 
-    if (Interrupts_Enabled()) {
-	Disable_Interrupts();
-	reEnable = 1;
-    }
+/*
+ * Wait for the drive to interrupt, and return its status at the time.
+ * Other threads run while the drive seeks and transfers.
+ */
+static int IDE_Wait_Interrupt(void)
+{
+    int status;
+
+    Disable_Interrupts();
+    while (!s_ideInterruptPending)
+	Wait(&s_ideInterruptWaitQueue);
+    s_ideInterruptPending = false;
+    status = s_ideInterruptStatus;
+    Enable_Interrupts();
+
+    return status;
+}
+
+/*
+ * Issue a command transferring numSectors sectors (at most 256)
+ * starting at the logical block number indicated.
+ */
+static void IDE_Issue_Command(int driveNum, int blockNum, int numSectors, int command)
+{
+    int head;
+    int sector;
+    int cylinder;
 
     /* now compute the head, cylinder, and sector */
     sector = blockNum % drives[driveNum].num_SectorsPerTrack + 1;
@@ -155,13 +257,16 @@ static int IDE_Read(int driveNum, int blockNum, char *buffer)
         drives[driveNum].num_Heads;
 
     if (ideDebug >= 2) {
-	Print ("request to read block %d\n", blockNum);
+	Print ("request to %s %d blocks at %d\n",
+	    command == IDE_COMMAND_READ_SECTORS || command == IDE_COMMAND_READ_MULTIPLE
+		? "read" : "write", numSectors, blockNum);
 	Print ("    head %d\n", head);
 	Print ("    cylinder %d\n", cylinder);
 	Print ("    sector %d\n", sector);
     }
 
-    Out_Byte(IDE_SECTOR_COUNT_REGISTER, 1);
+    /* The drive moves on to the following tracks and cylinders by itself */
+    Out_Byte(IDE_SECTOR_COUNT_REGISTER, LOW_BYTE(numSectors));
     Out_Byte(IDE_SECTOR_NUMBER_REGISTER, sector);
     Out_Byte(IDE_CYLINDER_LOW_REGISTER, LOW_BYTE(cylinder));
     Out_Byte(IDE_CYLINDER_HIGH_REGISTER, HIGH_BYTE(cylinder));
@@ -171,103 +276,198 @@ static int IDE_Read(int driveNum, int blockNum, char *buffer)
 	Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE_1 | head);
     }
 
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_READ_SECTORS);
-
-    if (ideDebug > 2) Print("About to wait for Read \n");
+    s_ideInterruptPending = false;
+    Out_Byte(IDE_COMMAND_REGISTER, command);
+}
 
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY);
+/*
+ * Read or write count sectors (at most 256) at the logical block number
+ * indicated with programmed I/O, moving the data of the blocks of the
+ * request starting at block first.
+ * Drives in multiple mode ask for the data of several sectors at a time.
+ *
+ * The drive interrupts when the data of a read is ready, and when
+ * it has written each block of a write, so the calling thread sleeps
+ * through seeks with interrupts enabled.  Only the first block of a
+ * write is asked for without an interrupt.
+ */
+static int IDE_PIO_Command(int driveNum, int blockNum, struct Block_Request *request,
+    int first, int count, bool write)
+{
+    int i, j;
+    int status;
+    short *bufferW;
+    int perRequest = drives[driveNum].num_SectorsPerBlock;
+    int done, command;
 
-    if (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_ERROR) {
-	Print("ERROR: Got Read %d\n", In_Byte(IDE_STATUS_REGISTER));
-	return IDE_ERROR_DRIVE_ERROR;
+    if (perRequest > 1) {
+	command = write ? IDE_COMMAND_WRITE_MULTIPLE : IDE_COMMAND_READ_MULTIPLE;
+    } else {
+	perRequest = 1;
+	command = write ? IDE_COMMAND_WRITE_SECTORS : IDE_COMMAND_READ_SECTORS;
     }
+    IDE_Issue_Command(driveNum, blockNum, count, command);
+
+    for (done = 0; done < count; done += perRequest) {
+	int sectors = count - done < perRequest ? count - done : perRequest;
 
-    if (ideDebug > 2) Print("got buffer \n");
+	/* wait for the drive to ask for (or offer) the data */
+	status = (write && done == 0) ? IDE_Wait_Not_Busy() : IDE_Wait_Interrupt();
+	if ((status & IDE_STATUS_DRIVE_ERROR) || !(status & IDE_STATUS_DRIVE_DATA_REQUEST)) {
+	    Print("ERROR: Got %s %d\n", write ? "Write" : "Read", status);
+	    return IDE_ERROR_DRIVE_ERROR;
+	}
 
-    bufferW = (short *) buffer;
-    for (i=0; i < 256; i++) {
-        bufferW[i] = In_Word(IDE_DATA_REGISTER);
+	for (j = 0; j < sectors; j++) {
+	    bufferW = Get_Request_Block_Buffer(request, first + done + j);
+	    if (write) {
+		for (i=0; i < 256; i++)
+		    Out_Word(IDE_DATA_REGISTER, bufferW[i]);
+	    } else {
+		for (i=0; i < 256; i++)
+		    bufferW[i] = In_Word(IDE_DATA_REGISTER);
+	    }
+	}
     }
 
-    if (reEnable) Enable_Interrupts();
+    /* wait for the last sectors to be written */
+    if (write) {
+	status = IDE_Wait_Interrupt();
+	if (status & (IDE_STATUS_DRIVE_ERROR | IDE_STATUS_DRIVE_WRITE_FAULT)) {
+	    Print("ERROR: Got Write %d\n", status);
+	    return IDE_ERROR_DRIVE_ERROR;
+	}
+    }
 
     return IDE_ERROR_NO_ERROR;
 }
 
 /*
- * Write a block at the logical block number indicated.
+ * Describe count blocks of a request, starting at block first, in the
+ * physical region descriptor table.  Blocks whose buffers follow each
+ * other in memory share a piece, up to the next 64K boundary.
  */
-static int IDE_Write(int driveNum, int blockNum, char *buffer)
+static void IDE_Build_PRD_Table(struct Block_Request *request, int first, int count)
 {
-    int i;
-    int head;
-    int sector;
-    int cylinder;
-    short *bufferW;
-    int reEnable = 0;
-
-    if (driveNum < 0 || driveNum > (numDrives-1)) {
-        return IDE_ERROR_BAD_DRIVE;
+    ulong_t end = 0;
+    int i = 0, block;
+
+    for (block = first; block < first + count; ++block) {
+	ulong_t addr = (ulong_t) Get_Request_Block_Buffer(request, block);
+	ulong_t size = SECTOR_SIZE;
+
+	while (size > 0) {
+	    ulong_t len = 0x10000 - (addr & 0xFFFF);
+	    if (len > size)
+		len = size;
+
+	    if (i > 0 && addr == end && (addr & 0xFFFF) != 0) {
+		s_idePrdTable[i - 1].count += len;
+	    } else {
+		KASSERT(i < IDE_PRD_ENTRIES);
+		s_idePrdTable[i].addr = addr;
+		s_idePrdTable[i].count = len & 0xFFFF;
+		s_idePrdTable[i].flags = 0;
+		++i;
+	    }
+	    addr += len;
+	    end = addr;
+	    size -= len;
+	}
     }
+    s_idePrdTable[i - 1].flags = IDE_PRD_END;
+}
 
-    if (blockNum < 0 || blockNum >= IDE_getNumBlocks(driveNum)) {
-        return IDE_ERROR_INVALID_BLOCK;
-    }
+/*
+ * Read or write count sectors (at most 256) with bus master DMA,
+ * like IDE_PIO_Command().  The controller moves the data by itself,
+ * and the drive interrupts once when the whole command is done.
+ */
+static int IDE_DMA_Command(int driveNum, int blockNum, struct Block_Request *request,
+    int first, int count, bool write)
+{
+    uchar_t direction = write ? 0 : IDE_BM_COMMAND_TO_MEMORY;
+    int status, bmStatus;
 
-    if (Interrupts_Enabled()) {
-	Disable_Interrupts();
-	reEnable = 1;
-    }
+    IDE_Build_PRD_Table(request, first, count);
 
-    /* now compute the head, cylinder, and sector */
-    sector = blockNum % drives[driveNum].num_SectorsPerTrack + 1;
-    cylinder = blockNum / (drives[driveNum].num_Heads * 
-     	drives[driveNum].num_SectorsPerTrack);
-    head = (blockNum / drives[driveNum].num_SectorsPerTrack) % 
-        drives[driveNum].num_Heads;
+    /* Point the controller at the table, and clear its old status */
+    Out_DWord(s_ideBusMasterBase + IDE_BM_PRD_TABLE, (ulong_t) s_idePrdTable);
+    Out_Byte(s_ideBusMasterBase + IDE_BM_COMMAND, direction);
+    Out_Byte(s_ideBusMasterBase + IDE_BM_STATUS,
+	In_Byte(s_ideBusMasterBase + IDE_BM_STATUS) | IDE_BM_STATUS_ERROR | IDE_BM_STATUS_INTERRUPT);
 
-    if (ideDebug) {
-	Print ("request to write block %d\n", blockNum);
-	Print ("    head %d\n", head);
-	Print ("    cylinder %d\n", cylinder);
-	Print ("    sector %d\n", sector);
-    }
+    IDE_Issue_Command(driveNum, blockNum, count,
+	write ? IDE_COMMAND_WRITE_DMA : IDE_COMMAND_READ_DMA);
+    Out_Byte(s_ideBusMasterBase + IDE_BM_COMMAND, direction | IDE_BM_COMMAND_START);
 
-    Out_Byte(IDE_SECTOR_COUNT_REGISTER, 1);
-    Out_Byte(IDE_SECTOR_NUMBER_REGISTER, sector);
-    Out_Byte(IDE_CYLINDER_LOW_REGISTER, LOW_BYTE(cylinder));
-    Out_Byte(IDE_CYLINDER_HIGH_REGISTER, HIGH_BYTE(cylinder));
-    if (driveNum == 0) {
-	Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE_0 | head);
-    } else if (driveNum == 1) {
-	Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE_1 | head);
+    status = IDE_Wait_Interrupt();
+
+    /* Stop the controller, and acknowledge its interrupt */
+    bmStatus = In_Byte(s_ideBusMasterBase + IDE_BM_STATUS);
+    Out_Byte(s_ideBusMasterBase + IDE_BM_COMMAND, direction);
+    Out_Byte(s_ideBusMasterBase + IDE_BM_STATUS, bmStatus | IDE_BM_STATUS_ERROR | IDE_BM_STATUS_INTERRUPT);
+
+    if ((status & (IDE_STATUS_DRIVE_ERROR | IDE_STATUS_DRIVE_WRITE_FAULT)) ||
+	(bmStatus & IDE_BM_STATUS_ERROR)) {
+	Print("ERROR: Got DMA %s %d, bus master %d\n", write ? "Write" : "Read", status, bmStatus);
+	return IDE_ERROR_DRIVE_ERROR;
     }
 
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_WRITE_SECTORS);
+    return IDE_ERROR_NO_ERROR;
+}
 
+/*
+ * Transfer the blocks of a request, and of the requests merged behind it.
+ * Each command moves up to 256 sectors, by DMA if the drive and the
+ * controller can do it and otherwise by programmed I/O.
+ * Must be called by the request thread, with interrupts enabled.
+ */
+static int IDE_Transfer(struct Block_Request *request)
+{
+    int driveNum = request->dev->unit;
+    int blockNum = request->blockNum;
+    int numBlocks = Get_Request_Num_Blocks(request);
+    bool write = request->type == BLOCK_WRITE;
+    bool aligned = true;
+    struct Block_Request *merged;
+    int done, rc = IDE_ERROR_NO_ERROR;
 
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY);
+    KASSERT(Interrupts_Enabled());
 
-    bufferW = (short *) buffer;
-    for (i=0; i < 256; i++) {
-        Out_Word(IDE_DATA_REGISTER, bufferW[i]);
+    if (driveNum < 0 || driveNum > (numDrives-1)) {
+	if (ideDebug) Print("ide: invalid drive %d\n", driveNum);
+        return IDE_ERROR_BAD_DRIVE;
     }
 
-    if (ideDebug) Print("About to wait for Write \n");
-
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY);
+    if (blockNum < 0 || numBlocks <= 0 ||
+	blockNum + numBlocks > IDE_getNumBlocks(driveNum)) {
+	if (ideDebug) Print("ide: invalid blocks %d-%d\n", blockNum, blockNum + numBlocks - 1);
+        return IDE_ERROR_INVALID_BLOCK;
+    }
 
-    if (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_ERROR) {
-	Print("ERROR: Got Read %d\n", In_Byte(IDE_STATUS_REGISTER));
-	return IDE_ERROR_DRIVE_ERROR;
+    /* The controller needs word aligned buffers */
+    for (merged = request; merged != 0; merged = merged->nextMerged) {
+	if ((ulong_t) merged->buf & 1)
+	    aligned = false;
     }
 
-    if (reEnable) Enable_Interrupts();
+    for (done = 0; done < numBlocks && rc == IDE_ERROR_NO_ERROR; done += IDE_MAX_SECTORS_PER_COMMAND) {
+	int count = numBlocks - done < IDE_MAX_SECTORS_PER_COMMAND ? numBlocks - done : IDE_MAX_SECTORS_PER_COMMAND;
+
+	if (drives[driveNum].useDMA && aligned) {
+	    rc = IDE_DMA_Command(driveNum, blockNum + done, request, done, count, write);
+	    if (rc != IDE_ERROR_NO_ERROR) {
+		Print("ide%d: DMA failed, using programmed I/O\n", driveNum);
+		drives[driveNum].useDMA = false;
+		rc = IDE_PIO_Command(driveNum, blockNum + done, request, done, count, write);
+	    }
+	} else {
+	    rc = IDE_PIO_Command(driveNum, blockNum + done, request, done, count, write);
+	}
+    }
 
-    return IDE_ERROR_NO_ERROR;
+    return rc;
 }
 
 static int IDE_Open(struct Block_Device *dev)
@@ -303,10 +503,7 @@ static void IDE_Request_Thread(ulong_t arg)
 	request = Dequeue_Request(&s_ideRequestQueue, &s_ideWaitQueue);
 
 	/* Do the I/O */
-	if (request->type == BLOCK_READ)
-	    rc = IDE_Read(request->dev->unit, request->blockNum, request->buf);
-	else
-	    rc = IDE_Write(request->dev->unit, request->blockNum, request->buf);
+	rc = IDE_Transfer(request);
 
 	/* Notify requesting thread of final status */
 	Notify_Request_Completion(request, rc == 0 ? COMPLETED : ERROR, rc);
@@ -343,6 +540,19 @@ static int readDriveConfig(int drive)
 	drives[drive].num_Heads = info[IDE_INDENTIFY_NUM_HEADS];
 	drives[drive].num_SectorsPerTrack = info[IDE_INDENTIFY_NUM_SECTORS_TRACK];
 	drives[drive].num_BytesPerSector = info[IDE_INDENTIFY_NUM_BYTES_SECTOR];
+
+	/* Transfer several sectors per data request, if the drive can */
+	drives[drive].num_SectorsPerBlock = 0;
+	if (LOW_BYTE(info[IDE_INDENTIFY_MAX_MULTIPLE]) > 1) {
+	    Out_Byte(IDE_SECTOR_COUNT_REGISTER, LOW_BYTE(info[IDE_INDENTIFY_MAX_MULTIPLE]));
+	    Out_Byte(IDE_DRIVE_HEAD_REGISTER, (drive == 0) ? IDE_DRIVE_0 : IDE_DRIVE_1);
+	    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_SET_MULTIPLE);
+	    if (!(IDE_Wait_Not_Busy() & IDE_STATUS_DRIVE_ERROR))
+		drives[drive].num_SectorsPerBlock = LOW_BYTE(info[IDE_INDENTIFY_MAX_MULTIPLE]);
+	}
+
+	drives[drive].useDMA = s_ideBusMasterBase != 0 &&
+	    (info[IDE_INDENTIFY_CAPABILITIES] & IDE_CAPABILITY_DMA);
     } else {
        /* try for ATAPI */
        Out_Byte(IDE_FEATURE_REG, 0);		 /* disable dma & overlap */
@@ -355,8 +565,9 @@ static int readDriveConfig(int drive)
        return -1;
     }
 
-    Print("    ide%d: cyl=%d, heads=%d, sectors=%d\n", drive, drives[drive].num_Cylinders,
-	drives[drive].num_Heads, drives[drive].num_SectorsPerTrack);
+    Print("    ide%d: cyl=%d, heads=%d, sectors=%d, multiple=%d, %s\n", drive, drives[drive].num_Cylinders,
+	drives[drive].num_Heads, drives[drive].num_SectorsPerTrack,
+	drives[drive].num_SectorsPerBlock, drives[drive].useDMA ? "dma" : "pio");
 
     /* Register the drive as a block device */
     snprintf(devname, sizeof(devname), "ide%d", drive);
@@ -367,6 +578,34 @@ static int readDriveConfig(int drive)
     return 0;
 }
 
+/*
+ * Find the IDE controller on the PCI bus, and if it can be a bus
+ * master, let it; the drives will then transfer by DMA.
+ */
+static void Init_Bus_Master(void)
+{
+    struct PCI_Device pci;
+    ulong_t bar;
+
+    if (!PCI_Find_Class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)) {
+	if (ideDebug) Print("ide: no PCI controller, using programmed I/O\n");
+	return;
+    }
+
+    bar = PCI_Read_Config(&pci, PCI_BAR4);
+    if (!(PCI_Read_Config_Byte(&pci, PCI_PROG_IF) & IDE_PROG_IF_BUS_MASTER) ||
+	!(bar & PCI_BAR_IO) || (bar & PCI_BAR_IO_MASK) == 0) {
+	if (ideDebug) Print("ide: controller %x:%x can't do DMA\n", pci.vendor, pci.device);
+	return;
+    }
+
+    PCI_Write_Config_Word(&pci, PCI_COMMAND,
+	PCI_Read_Config_Word(&pci, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    s_ideBusMasterBase = bar & PCI_BAR_IO_MASK;
+
+    Print("    ide: controller %x:%x, bus master registers at %x\n",
+	pci.vendor, pci.device, s_ideBusMasterBase);
+}
 
 void Init_IDE(void)
 {
@@ -396,6 +635,8 @@ void Init_IDE(void)
     errorCode = In_Byte(IDE_ERROR_REGISTER);
     if (ideDebug > 1) Print("ide: ide error register = %x\n", errorCode);
 
+    Init_Bus_Master();
+
     /* Probe and register drives */
     if (readDriveConfig(0) == 0)
 	++numDrives;
@@ -403,6 +644,15 @@ void Init_IDE(void)
 	++numDrives;
     if (ideDebug) Print("Found %d IDE drives\n", numDrives);
 
+    /*
+     * Probing was done by polling; from now on the drives
+     * interrupt when they have data or have finished a command.
+     */
+    Install_IRQ(IDE_IRQ, &IDE_Interrupt_Handler);
+    Enable_IRQ(IDE_IRQ);
+    In_Byte(IDE_STATUS_REGISTER);
+    Out_Byte(IDE_DEVICE_CONTROL_REGISTER, 0);
+
     /* Start request thread */
     if (numDrives > 0)
 	Start_Kernel_Thread(IDE_Request_Thread, 0, PRIORITY_NORMAL, true);
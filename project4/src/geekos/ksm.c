@@ -0,0 +1,394 @@
+/*
+ * Merging of identical user pages
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/screen.h>
+#include <geekos/malloc.h>
+#include <geekos/kthread.h>
+#include <geekos/timer.h>
+#include <geekos/crc32.h>
+#include <geekos/mem.h>
+#include <geekos/user.h>
+#include <geekos/memstat.h>
+#include <geekos/ksm.h>
+
+/*
+ * Processes running the same program end up with many private
+ * pages holding exactly the same bytes.  A kernel thread walks
+ * over all of physical memory a batch of pages at a time, and
+ * replaces each private page whose contents match another one by
+ * a mapping of a single read-only frame.  Writing to such a page
+ * faults, and the writer is given a private copy again.
+ *
+ * The crc32 of a page is used as a hash; pages are only merged
+ * once their bytes are found to be equal.  A page is not considered
+ * until its checksum has stayed the same for a whole pass, so pages
+ * which are being written to are left alone.
+ *
+ * Merged frames are kept in a hash table by checksum, chained
+ * through their Page_List links (which are only used by free pages
+ * otherwise).  Their refCount is the number of user page table
+ * entries mapping them, plus one for an executable image cache
+ * which holds on to them.  Merged frames are not pageable, and are
+ * not charged to any process.
+ *
+ * Candidates seen during the current pass are kept in a second,
+ * open addressed table which is cleared at the start of each pass.
+ * Entries are not removed when a page is freed or changes; they
+ * are checked again before they are used.
+ *
+ * All of this data is protected by disabling interrupts.
+ */
+
+#define KSM_HASH_BUCKETS    256
+
+/* Largest table of candidates for one pass; it is never filled past 3/4. */
+#define KSM_MAX_UNSTABLE    16384
+
+/* Pages examined each time the scanner wakes up, and how often it does. */
+#define KSM_PAGES_PER_BATCH 128
+#define KSM_SLEEP_TICKS     4
+
+extern struct Page *g_pageList;
+extern uint_t s_numPages;
+
+static struct Page_List s_stableTable[KSM_HASH_BUCKETS];
+
+static struct Page **s_unstableTable;
+static ulong_t s_unstableSize;
+static ulong_t s_numUnstable;
+
+/* The scanner thread waits here between batches. */
+static struct Thread_Queue s_ksmWaitQueue;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct Page_List *Stable_Bucket(ulong_t checksum)
+{
+    return &s_stableTable[checksum & (KSM_HASH_BUCKETS - 1)];
+}
+
+static bool Same_Contents(struct Page *a, struct Page *b)
+{
+    return memcmp((void *) Get_Page_Address(a), (void *) Get_Page_Address(b),
+	PAGE_SIZE) == 0;
+}
+
+/*
+ * Determine whether a page is a private, resident user page
+ * which may be merged.
+ */
+static bool Is_Candidate(struct Page *page)
+{
+    return (page->flags & (PAGE_ALLOCATED | PAGE_PAGEABLE)) ==
+	    (PAGE_ALLOCATED | PAGE_PAGEABLE) &&
+	(page->flags & (PAGE_SHARED | PAGE_FILE | PAGE_LOCKED | PAGE_MERGED)) == 0 &&
+	page->owner != 0 && page->entry != 0 && page->entry->present &&
+	page->entry->pageBaseAddr == Get_Page_Address(page) >> 12;
+}
+
+static struct Page *Find_Stable_Page(struct Page *page)
+{
+    struct Page *merged = Get_Front_Of_Page_List(Stable_Bucket(page->checksum));
+
+    while (merged != 0 &&
+	   (merged->checksum != page->checksum || !Same_Contents(merged, page)))
+	merged = Get_Next_In_Page_List(merged);
+    return merged;
+}
+
+static struct Page *Find_Unstable_Page(struct Page *page)
+{
+    ulong_t mask = s_unstableSize - 1;
+    ulong_t i;
+
+    for (i = page->checksum & mask; s_unstableTable[i] != 0; i = (i + 1) & mask) {
+	struct Page *other = s_unstableTable[i];
+	if (other != page && other->checksum == page->checksum &&
+	    Is_Candidate(other) && Same_Contents(other, page))
+	    return other;
+    }
+    return 0;
+}
+
+static void Add_Unstable_Page(struct Page *page)
+{
+    ulong_t mask = s_unstableSize - 1;
+    ulong_t i;
+
+    if (s_numUnstable >= s_unstableSize / 4 * 3)
+	return;
+    for (i = page->checksum & mask; s_unstableTable[i] != 0; i = (i + 1) & mask)
+	;
+    s_unstableTable[i] = page;
+    ++s_numUnstable;
+}
+
+/*
+ * Turn a private page into a merged frame, mapped read-only
+ * by the page table entry which mapped it before.
+ */
+static void Make_Merged_Page(struct Page *page)
+{
+    page->entry->flags &= ~VM_WRITE;
+    page->flags &= ~PAGE_PAGEABLE;
+    page->flags |= PAGE_MERGED;
+    --page->owner->rssPages;
+    page->owner = 0;
+    page->entry = 0;
+    page->vaddr = 0;
+    page->refCount = 1;
+    Add_To_Back_Of_Page_List(Stable_Bucket(page->checksum), page);
+    ++g_memStats[MEM_STAT_KSM_SHARED];
+    ++g_memStats[MEM_STAT_KSM_SHARING];
+}
+
+/*
+ * Point the page table entry of a private page at a merged frame
+ * with the same contents, and free the private page.
+ */
+static void Map_Merged_Page(struct Page *page, struct Page *merged)
+{
+    pte_t *entry = page->entry;
+
+    entry->pageBaseAddr = Get_Page_Address(merged) >> 12;
+    entry->flags &= ~VM_WRITE;
+    ++merged->refCount;
+    ++g_memStats[MEM_STAT_KSM_SHARING];
+    Free_Page((void *) Get_Page_Address(page));
+}
+
+/*
+ * Drop one reference to a merged frame, freeing it with the last.
+ */
+static void Put_Merged_Page(struct Page *merged)
+{
+    KASSERT(merged->refCount > 0);
+    if (--merged->refCount == 0) {
+	Remove_From_Page_List(Stable_Bucket(merged->checksum), merged);
+	--g_memStats[MEM_STAT_KSM_SHARED];
+	Free_Page((void *) Get_Page_Address(merged));
+    }
+}
+
+/*
+ * Look at one page of physical memory, and merge it if
+ * it is a private page with the same contents as another.
+ * Interrupts must be disabled.
+ */
+static void Scan_Page(struct Page *page)
+{
+    struct Page *match;
+    ulong_t checksum;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (!Is_Candidate(page))
+	return;
+
+    checksum = crc32(0, (char *) Get_Page_Address(page), PAGE_SIZE);
+    if (checksum != page->checksum) {
+	/* Changed since the last pass; try again next time */
+	page->checksum = checksum;
+	return;
+    }
+
+    match = Find_Stable_Page(page);
+    if (match == 0) {
+	match = Find_Unstable_Page(page);
+	if (match == 0) {
+	    Add_Unstable_Page(page);
+	    return;
+	}
+	Make_Merged_Page(match);
+    }
+    Map_Merged_Page(page, match);
+
+    /* The scanner may be running in the address space it changed */
+    Flush_TLB();
+}
+
+static void Ksm_Timer_Expired(int id)
+{
+    Cancel_Timer(id);
+    Wake_Up(&s_ksmWaitQueue);
+}
+
+/*
+ * Body of the scanner thread.
+ */
+static void Ksm_Thread(ulong_t arg)
+{
+    ulong_t next = 0;
+    int i;
+
+    while (true) {
+	for (i = 0; i < KSM_PAGES_PER_BATCH; ++i) {
+	    if (next == s_numPages) {
+		next = 0;
+		memset(s_unstableTable, '\0', s_unstableSize * sizeof(struct Page *));
+		s_numUnstable = 0;
+		++g_memStats[MEM_STAT_KSM_SCANS];
+	    }
+	    Disable_Interrupts();
+	    Scan_Page(&g_pageList[next++]);
+	    Enable_Interrupts();
+	}
+
+	Disable_Interrupts();
+	if (Start_Timer(KSM_SLEEP_TICKS, Ksm_Timer_Expired) >= 0)
+	    Wait(&s_ksmWaitQueue);
+	Enable_Interrupts();
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Start the thread which merges identical pages.
+ */
+void Init_Ksm(void)
+{
+    s_unstableSize = 1;
+    while (s_unstableSize < s_numPages && s_unstableSize < KSM_MAX_UNSTABLE)
+	s_unstableSize <<= 1;
+    s_unstableTable = (struct Page **) Malloc(s_unstableSize * sizeof(struct Page *));
+    if (s_unstableTable == 0) {
+	Print("Not enough memory to merge pages\n");
+	return;
+    }
+    memset(s_unstableTable, '\0', s_unstableSize * sizeof(struct Page *));
+
+    Start_Kernel_Thread(Ksm_Thread, 0, PRIORITY_LOW, true);
+}
+
+/*
+ * Handle a write to a user page which is mapped to a merged frame,
+ * given the page table entry and linear address of the page.
+ * The process gets a private copy of the page; the last process
+ * using a merged frame simply takes it over.  Interrupts must be
+ * disabled.  Returns 0 if successful, -1 if out of memory.
+ */
+int Ksm_Unshare_Page(struct User_Context *userContext, pte_t *entry, ulong_t vaddr)
+{
+    struct Page *merged = Get_Page(entry->pageBaseAddr << 12);
+    void *paddr;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(merged->flags & PAGE_MERGED);
+
+    ++g_memStats[MEM_STAT_KSM_COW];
+
+    if (merged->refCount == 1) {
+	Remove_From_Page_List(Stable_Bucket(merged->checksum), merged);
+	--g_memStats[MEM_STAT_KSM_SHARED];
+	--g_memStats[MEM_STAT_KSM_SHARING];
+	merged->flags &= ~PAGE_MERGED;
+	merged->flags |= PAGE_PAGEABLE;
+	merged->refCount = 0;
+	merged->entry = entry;
+	merged->vaddr = vaddr;
+	merged->owner = userContext;
+	merged->checksum = 0;
+	if (++userContext->rssPages > userContext->rssPeak)
+	    userContext->rssPeak = userContext->rssPages;
+	entry->flags |= VM_WRITE;
+	Flush_TLB();
+	return 0;
+    }
+
+    /* Allocating may block; keep the frame until it has been copied */
+    ++merged->refCount;
+    paddr = Alloc_Pageable_Page(entry, vaddr, userContext);
+    if (paddr == 0) {
+	Put_Merged_Page(merged);
+	return -1;
+    }
+    memcpy(paddr, (void *) Get_Page_Address(merged), PAGE_SIZE);
+
+    entry->pageBaseAddr = (ulong_t) paddr >> 12;
+    entry->flags |= VM_WRITE;
+    --g_memStats[MEM_STAT_KSM_SHARING];
+    Put_Merged_Page(merged);
+    Put_Merged_Page(merged);
+    Flush_TLB();
+    return 0;
+}
+
+/*
+ * Called when a user page table entry which maps
+ * a merged frame is cleared.
+ */
+void Ksm_Release_Page(struct Page *page)
+{
+    bool iflag = Begin_Int_Atomic();
+
+    KASSERT(page->flags & PAGE_MERGED);
+    --g_memStats[MEM_STAT_KSM_SHARING];
+    Put_Merged_Page(page);
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Make a frame holding read-only data, such as a page of a cached
+ * executable, a merged frame which user page table entries may map.
+ * The caller holds the only reference, and must not change the
+ * contents of the frame any more.
+ */
+void Ksm_Add_Frame(void *paddr)
+{
+    struct Page *page = Get_Page((ulong_t) paddr);
+    ulong_t checksum = crc32(0, (char *) paddr, PAGE_SIZE);
+    bool iflag = Begin_Int_Atomic();
+
+    KASSERT((page->flags & (PAGE_ALLOCATED | PAGE_PAGEABLE)) == PAGE_ALLOCATED);
+    page->flags |= PAGE_MERGED;
+    page->checksum = checksum;
+    page->refCount = 1;
+    page->owner = 0;
+    page->entry = 0;
+    Add_To_Back_Of_Page_List(Stable_Bucket(checksum), page);
+    ++g_memStats[MEM_STAT_KSM_SHARED];
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Map a merged frame read-only with a user page table entry.
+ */
+void Ksm_Map_Frame(pte_t *entry, void *paddr)
+{
+    struct Page *page = Get_Page((ulong_t) paddr);
+    bool iflag = Begin_Int_Atomic();
+
+    KASSERT(page->flags & PAGE_MERGED);
+    *((uint_t *) entry) = 0;
+    entry->present = 1;
+    entry->flags = VM_READ | VM_USER;
+    entry->pageBaseAddr = (ulong_t) paddr >> 12;
+    ++page->refCount;
+    ++g_memStats[MEM_STAT_KSM_SHARING];
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Drop a reference to a merged frame taken by Ksm_Add_Frame().
+ */
+void Ksm_Put_Frame(void *paddr)
+{
+    bool iflag = Begin_Int_Atomic();
+    Put_Merged_Page(Get_Page((ulong_t) paddr));
+    End_Int_Atomic(iflag);
+}
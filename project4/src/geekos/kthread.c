@@ -166,6 +166,8 @@ static __inline__ void Push(struct Kernel_Thread* kthread, ulong_t value)
  */
 static void Destroy_Thread(struct Kernel_Thread* kthread)
 {
+    /* Release the process's memory, if this was the last thread using it */
+    Detach_User_Context(kthread);
 
     /* Dispose of the thread's memory. */
     Disable_Interrupts();
@@ -348,12 +350,15 @@ void Setup_User_Thread(
 /*
  * This is the body of the idle thread.  Its job is to preserve
  * the invariant that a runnable thread always exists,
- * i.e., the run queue is never empty.
+ * i.e., the run queue is never empty.  While it has nothing
+ * better to do, it clears free pages for later allocations.
  */
 static void Idle(ulong_t arg)
 {
-    while (true)
+    while (true) {
+	Zero_Free_Page();
 	Yield();
+    }
 }
 
 /*
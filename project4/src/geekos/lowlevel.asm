@@ -152,6 +152,12 @@ EXPORT Set_PDBR
 EXPORT Get_PDBR
 EXPORT Flush_TLB
 
+; Copying to and from user memory, and the table of kernel
+; instructions which may fault on a user address.
+EXPORT Copy_User_Bytes
+EXPORT g_exceptionTableStart
+EXPORT g_exceptionTableEnd
+
 
 ; ----------------------------------------------------------------------
 ; Code
@@ -236,6 +242,49 @@ Flush_TLB:
 	mov	cr3, eax
 	ret
 
+;
+; Copy bytes between kernel memory and user memory, through
+; the user's own mapping:
+;	ulong_t Copy_User_Bytes(void *dest, const void *src, ulong_t numBytes)
+; Pages which are not present are brought in by the page fault
+; handler, and the copy resumes.  If an address cannot be mapped,
+; the fault handler continues at the fixup code listed in the
+; exception table instead, and we return the number of bytes
+; which were not copied.  Returns 0 if everything was copied.
+;
+align 8
+Copy_User_Bytes:
+	push	esi
+	push	edi
+	mov	edi, [esp+12]	; dest
+	mov	esi, [esp+16]	; src
+	mov	ecx, [esp+20]	; numBytes
+	mov	edx, ecx
+	shr	ecx, 2		; whole dwords first
+	and	edx, 3		; then the remaining bytes
+	cld
+Copy_User_Dwords:
+	rep movsd
+	mov	ecx, edx
+Copy_User_Tail:
+	rep movsb
+	xor	eax, eax
+	pop	edi
+	pop	esi
+	ret
+
+Copy_User_Dword_Fault:
+	lea	eax, [edx+ecx*4]	; bytes not copied
+	pop	edi
+	pop	esi
+	ret
+
+Copy_User_Byte_Fault:
+	mov	eax, ecx
+	pop	edi
+	pop	esi
+	ret
+
 
 ; Common interrupt handling code.
 ; Save registers, call C handler function,
@@ -431,6 +480,16 @@ g_entryPointTableEnd:
 
 [SECTION .data]
 
+; Exception table: pairs of the address of a kernel instruction
+; which may fault on a user address, and the address to continue at
+; if the page fault handler cannot map the address.
+; Must be kept up to date with struct Exception_Table_Entry in paging.h.
+align 4
+g_exceptionTableStart:
+	dd	Copy_User_Dwords, Copy_User_Dword_Fault
+	dd	Copy_User_Tail, Copy_User_Byte_Fault
+g_exceptionTableEnd:
+
 ; Exported symbols defining the size of handler entry points
 ; (both with and without error codes).
 align 4
@@ -0,0 +1,193 @@
+/*
+ * Fast LZ77 compression
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/string.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+#include <geekos/lz.h>
+
+/*
+ * A byte-oriented LZ77 codec in the style of LZ4, tuned for
+ * compressing single pages: it needs no memory beyond a small
+ * hash table, and decompression is a simple copy loop.
+ *
+ * The compressed data is a series of sequences.  Each sequence is
+ * a token byte, whose high nibble is the number of literal bytes
+ * and low nibble the match length minus MIN_MATCH; the literals;
+ * and a two byte little-endian offset back to the match.  A nibble
+ * of 15 means more length bytes follow, each added to the length,
+ * until one is less than 255.  The last sequence only has literals.
+ */
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5		 /* Input bytes never covered by a match */
+#define MAX_OFFSET    0xffff
+#define HASH_BITS     10
+
+/*
+ * Input positions of recently seen 4-byte sequences.
+ * Only used with interrupts disabled.
+ */
+static ushort_t s_hashTable[1 << HASH_BITS];
+
+#define Read32(p) (*(const uint_t *) (p))
+#define Hash(v)   (((v) * 2654435761U) >> (32 - HASH_BITS))
+
+/*
+ * Emit the extra length bytes for a length nibble of 15.
+ */
+static uchar_t *Put_Length(uchar_t *op, ulong_t len)
+{
+    while (len >= 255) {
+	*op++ = 255;
+	len -= 255;
+    }
+    *op++ = (uchar_t) len;
+    return op;
+}
+
+/*
+ * Emit one sequence.  Returns null if it does not fit in the output.
+ */
+static uchar_t *Put_Sequence(uchar_t *op, uchar_t *opEnd, const uchar_t *literals,
+    ulong_t numLiterals, ulong_t offset, ulong_t matchLen)
+{
+    uchar_t *token = op++;
+
+    /* Worst case size of the sequence */
+    if (op + numLiterals + numLiterals / 255 + 1 + 2 + matchLen / 255 + 1 > opEnd)
+	return 0;
+
+    if (numLiterals >= 15) {
+	*token = 15 << 4;
+	op = Put_Length(op, numLiterals - 15);
+    } else {
+	*token = numLiterals << 4;
+    }
+    memcpy(op, literals, numLiterals);
+    op += numLiterals;
+
+    if (matchLen == 0)
+	return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    matchLen -= MIN_MATCH;
+    if (matchLen >= 15) {
+	*token |= 15;
+	op = Put_Length(op, matchLen - 15);
+    } else {
+	*token |= matchLen;
+    }
+    return op;
+}
+
+/*
+ * Compress srcLen bytes from src into dst.  Interrupts must be
+ * disabled, since the hash table is shared.
+ * Returns the compressed length, or -1 if it would exceed dstLen.
+ */
+int LZ_Compress(const void *src, ulong_t srcLen, void *dst, ulong_t dstLen)
+{
+    const uchar_t *in = (const uchar_t *) src;
+    const uchar_t *ip = in, *anchor = in;
+    const uchar_t *end = in + srcLen;
+    uchar_t *op = (uchar_t *) dst, *opEnd = op + dstLen;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(srcLen <= MAX_OFFSET + 1);
+
+    memset(s_hashTable, '\0', sizeof(s_hashTable));
+
+    while (srcLen >= LAST_LITERALS + MIN_MATCH && ip < end - LAST_LITERALS - MIN_MATCH) {
+	uint_t seq = Read32(ip);
+	uint_t h = Hash(seq);
+	const uchar_t *ref = in + s_hashTable[h];
+	const uchar_t *m, *r;
+
+	s_hashTable[h] = ip - in;
+	if (ref >= ip || Read32(ref) != seq) {
+	    ++ip;
+	    continue;
+	}
+
+	/* Extend the match as far as it goes */
+	for (m = ip + MIN_MATCH, r = ref + MIN_MATCH; m < end - LAST_LITERALS && *m == *r; ++m, ++r)
+	    ;
+
+	op = Put_Sequence(op, opEnd, anchor, ip - anchor, ip - ref, m - ip);
+	if (op == 0)
+	    return -1;
+	ip = anchor = m;
+    }
+
+    op = Put_Sequence(op, opEnd, anchor, end - anchor, 0, 0);
+    if (op == 0)
+	return -1;
+    return op - (uchar_t *) dst;
+}
+
+/*
+ * Decompress srcLen bytes of compressed data from src into dst.
+ * Returns the decompressed length, or -1 if the data is corrupt
+ * or would exceed dstLen.
+ */
+int LZ_Decompress(const void *src, ulong_t srcLen, void *dst, ulong_t dstLen)
+{
+    const uchar_t *ip = (const uchar_t *) src, *ipEnd = ip + srcLen;
+    uchar_t *out = (uchar_t *) dst;
+    uchar_t *op = out, *opEnd = out + dstLen;
+
+    while (ip < ipEnd) {
+	uint_t token = *ip++;
+	ulong_t len = token >> 4;
+	const uchar_t *match;
+	uint_t b;
+
+	if (len == 15) {
+	    do {
+		if (ip >= ipEnd)
+		    return -1;
+		b = *ip++;
+		len += b;
+	    } while (b == 255);
+	}
+	if (len > (ulong_t) (ipEnd - ip) || len > (ulong_t) (opEnd - op))
+	    return -1;
+	memcpy(op, ip, len);
+	ip += len;
+	op += len;
+
+	if (ip == ipEnd)
+	    break;		 /* last sequence has no match */
+	if (ipEnd - ip < 2)
+	    return -1;
+	match = op - (ip[0] | (ip[1] << 8));
+	ip += 2;
+	if (match < out || match == op)
+	    return -1;
+
+	len = token & 15;
+	if (len == 15) {
+	    do {
+		if (ip >= ipEnd)
+		    return -1;
+		b = *ip++;
+		len += b;
+	    } while (b == 255);
+	}
+	len += MIN_MATCH;
+	if (len > (ulong_t) (opEnd - op))
+	    return -1;
+
+	/* Byte by byte, since the match may overlap the output */
+	while (len-- > 0)
+	    *op++ = *match++;
+    }
+
+    return op - out;
+}
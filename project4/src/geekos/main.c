@@ -23,10 +23,14 @@
 #include <geekos/dma.h>
 #include <geekos/ide.h>
 #include <geekos/floppy.h>
+#include <geekos/bufcache.h>
 #include <geekos/pfat.h>
 #include <geekos/vfs.h>
 #include <geekos/user.h>
 #include <geekos/paging.h>
+#include <geekos/zswap.h>
+#include <geekos/ksm.h>
+#include <geekos/swapdev.h>
 
 
 /*
@@ -46,6 +50,13 @@
 
 #define INIT_PROGRAM "/" ROOT_PREFIX "/shell.exe"
 
+/*
+ * Block device which is used for swapping, in addition to the
+ * paging file, if it has a swap header.  (Target "diskd.img" in
+ * the makefile.)
+ */
+#define SWAP_DEVICE "ide1"
+
 
 
 static void Mount_Root_Filesystem(void);
@@ -65,6 +76,7 @@ void Main(struct Boot_Info* bootInfo)
     Init_TSS();
     Init_Interrupts();
     Init_VM(bootInfo);
+    Init_Zswap();
     Init_Scheduler();
     Init_Traps();
     Init_Timer();
@@ -72,7 +84,9 @@ void Main(struct Boot_Info* bootInfo)
     Init_DMA();
     Init_Floppy();
     Init_IDE();
+    Init_Buffer_Cache();
     Init_PFAT();
+    Init_Ksm();
 
     Mount_Root_Filesystem();
 
@@ -96,6 +110,9 @@ static void Mount_Root_Filesystem(void)
     else
 	Print("Mounted /" ROOT_PREFIX " filesystem!\n");
 
+    if (Add_Swap_Device(SWAP_DEVICE) != 0)
+	Print("No swap device on " SWAP_DEVICE "\n");
+
     Init_Paging();
 }
 
@@ -104,7 +121,7 @@ static void Spawn_Init_Process(void)
     int rc;
     struct Kernel_Thread *initProcess;
     Print("Spawning init process (%s)\n", INIT_PROGRAM);
-    rc = Spawn(INIT_PROGRAM, INIT_PROGRAM,
+    rc = Spawn(INIT_PROGRAM, INIT_PROGRAM, 0,
                &initProcess);
     if (rc != 0)
     {
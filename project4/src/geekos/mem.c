@@ -19,6 +19,13 @@
 #include <geekos/string.h>
 #include <geekos/paging.h>
 #include <geekos/mem.h>
+#include <geekos/user.h>
+#include <geekos/shm.h>
+#include <geekos/zswap.h>
+#include <geekos/timer.h>
+#include <geekos/memstat.h>
+#include <geekos/execcache.h>
+#include <geekos/bufcache.h>
 
 /* ----------------------------------------------------------------------
  * Global data
@@ -30,10 +37,15 @@
 struct Page* g_pageList;
 
 /*
- * Number of pages currently available on the freelist.
+ * Number of pages currently available on the freelists.
  */
 uint_t g_freePageCount = 0;
 
+/*
+ * Statistics reported to user mode, see <geekos/memstat.h>.
+ */
+ulong_t g_memStats[MEM_NUM_STATS];
+
 /* ----------------------------------------------------------------------
  * Private data and functions
  * ---------------------------------------------------------------------- */
@@ -49,6 +61,20 @@ extern int debugFaults;
  */
 static struct Page_List s_freeList;
 
+/*
+ * Free pages which have already been filled with zeroes.
+ * The idle thread keeps up to ZERO_POOL_TARGET pages here, so that
+ * page tables and newly touched user pages need not be cleared
+ * while someone waits for them.  Pages on this list are free,
+ * and are counted in g_freePageCount.
+ */
+static struct Page_List s_zeroList;
+static uint_t s_numZeroPages;
+#define ZERO_POOL_TARGET 128
+
+/* Average cycles the idle thread spends clearing a page */
+static ulong_t s_zeroCycles;
+
 /*
  * Total number of physical pages.
  */
@@ -84,6 +110,9 @@ static void Add_Page_Range(ulong_t start, ulong_t end, int flags)
 	page->clock = 0;
 	page->vaddr = 0;
 	page->entry = 0;
+	page->refCount = 0;
+	page->owner = 0;
+	page->checksum = 0;
     }
 }
 
@@ -174,27 +203,62 @@ void Init_BSS(void)
     memset(&BSS_START, '\0', &BSS_END - &BSS_START);
 }
 
+/*
+ * Take a page off a freelist and mark it as allocated.
+ * Interrupts must be disabled.
+ */
+static void *Take_Free_Page(struct Page_List *list)
+{
+    struct Page *page = Get_Front_Of_Page_List(list);
+
+    KASSERT((page->flags & PAGE_ALLOCATED) == 0);
+    Remove_From_Front_Of_Page_List(list);
+    if (list == &s_zeroList)
+	--s_numZeroPages;
+
+    /* Mark page as having been allocated. */
+    page->flags |= PAGE_ALLOCATED;
+    g_freePageCount--;
+    return (void*) Get_Page_Address(page);
+}
+
 /*
  * Allocate a page of physical memory.
  */
 void* Alloc_Page(void)
 {
-    struct Page* page;
     void *result = 0;
 
     bool iflag = Begin_Int_Atomic();
 
-    /* See if we have a free page */
-    if (!Is_Page_List_Empty(&s_freeList)) {
-	/* Remove the first page on the freelist. */
-	page = Get_Front_Of_Page_List(&s_freeList);
-	KASSERT((page->flags & PAGE_ALLOCATED) == 0);
-	Remove_From_Front_Of_Page_List(&s_freeList);
-
-	/* Mark page as having been allocated. */
-	page->flags |= PAGE_ALLOCATED;
-	g_freePageCount--;
-	result = (void*) Get_Page_Address(page);
+    /* Leave the zeroed pages to those who need them, if we can */
+    if (!Is_Page_List_Empty(&s_freeList))
+	result = Take_Free_Page(&s_freeList);
+    else if (!Is_Page_List_Empty(&s_zeroList))
+	result = Take_Free_Page(&s_zeroList);
+
+    End_Int_Atomic(iflag);
+
+    return result;
+}
+
+/*
+ * Allocate a page of physical memory filled with zeroes,
+ * from the pool of pre-zeroed pages if possible.
+ */
+void* Alloc_Zeroed_Page(void)
+{
+    void *result = 0;
+
+    bool iflag = Begin_Int_Atomic();
+
+    if (!Is_Page_List_Empty(&s_zeroList)) {
+	result = Take_Free_Page(&s_zeroList);
+	++g_memStats[MEM_STAT_ZERO_HITS];
+    } else if (!Is_Page_List_Empty(&s_freeList)) {
+	result = Take_Free_Page(&s_freeList);
+	++g_memStats[MEM_STAT_ZERO_MISSES];
+	memset(result, '\0', PAGE_SIZE);
     }
 
     End_Int_Atomic(iflag);
@@ -203,23 +267,99 @@ void* Alloc_Page(void)
 }
 
 /*
- * Choose a page to evict.
+ * Clear one free page and move it to the pool of zeroed pages,
+ * unless the pool is full.  Called by the idle thread; the page
+ * is cleared with interrupts enabled, so this never delays anyone.
+ * Returns true if a page was cleared.
+ */
+bool Zero_Free_Page(void)
+{
+    struct Page *page;
+    void *addr;
+    ulong_t cycles;
+    unsigned long long start;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    if (s_numZeroPages >= ZERO_POOL_TARGET || Is_Page_List_Empty(&s_freeList)) {
+	End_Int_Atomic(iflag);
+	return false;
+    }
+    /* Nobody else can get at the page while it is allocated to us */
+    addr = Take_Free_Page(&s_freeList);
+    End_Int_Atomic(iflag);
+
+    start = Read_TSC();
+    memset(addr, '\0', PAGE_SIZE);
+    cycles = (ulong_t) (Read_TSC() - start);
+
+    iflag = Begin_Int_Atomic();
+    page = Get_Page((ulong_t) addr);
+    page->flags &= ~(PAGE_ALLOCATED);
+    Add_To_Back_Of_Page_List(&s_zeroList, page);
+    ++s_numZeroPages;
+    g_freePageCount++;
+    ++g_memStats[MEM_STAT_IDLE_ZEROED];
+    /*
+     * Keep a running mean in 32 bits; the kernel is not linked with
+     * libgcc, so it cannot divide 64 bit numbers.
+     */
+    s_zeroCycles += ((long) cycles - (long) s_zeroCycles) /
+	(long) g_memStats[MEM_STAT_IDLE_ZEROED];
+    g_memStats[MEM_STAT_ZERO_CYCLES] = s_zeroCycles;
+    End_Int_Atomic(iflag);
+
+    return true;
+}
+
+/*
+ * Fill in the statistics which are not counted as they happen.
+ */
+void Update_Mem_Stats(void)
+{
+    bool iflag = Begin_Int_Atomic();
+    g_memStats[MEM_STAT_FREE_PAGES] = g_freePageCount;
+    g_memStats[MEM_STAT_ZERO_PAGES] = s_numZeroPages;
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Determine whether a process has as many resident pages
+ * as its limit allows.
+ */
+static bool At_RSS_Limit(struct User_Context *userContext)
+{
+    return userContext != 0 && userContext->rssLimit != 0 &&
+	userContext->rssPages >= userContext->rssLimit;
+}
+
+/*
+ * Choose a page to evict: the least recently used page of the given
+ * process, or if owner is null, of any process.  Pages of processes
+ * at their resident limit are taken before anyone else's.
  * Returns null if no pages are available.
  */
-static struct Page *Find_Page_To_Page_Out()
+static struct Page *Find_Page_To_Page_Out(struct User_Context *owner)
 {
     int i;
     struct Page *curr, *best;
+    bool bestOver = false;
 
     best = NULL;
 
     for (i=0; i < s_numPages; i++) {
 	if ((g_pageList[i].flags & PAGE_PAGEABLE) &&
 	    (g_pageList[i].flags & PAGE_ALLOCATED)) {
-	    if (!best) best = &g_pageList[i];
+	    bool over;
+
 	    curr = &g_pageList[i];
-	    if ((curr->clock < best->clock) && (curr->flags & PAGE_PAGEABLE)) {
+	    if (owner != 0 && curr->owner != owner)
+		continue;
+	    over = At_RSS_Limit(curr->owner);
+	    if (!best || (over && !bestOver) ||
+		(over == bestOver && curr->clock < best->clock)) {
 		best = curr;
+		bestOver = over;
 	    }
 	}
     }
@@ -227,45 +367,95 @@ static struct Page *Find_Page_To_Page_Out()
     return best;
 }
 
-/**
- * Allocate a page of pageable physical memory, to be mapped
- * into a user address space.
- *
- * @param entry pointer to user page table entry which will
- *   refer to the allocated page
- * @param vaddr virtual address where page will be mapped
- *   in user address space
+/*
+ * Allocate a pageable page, stealing one from another process
+ * if no page is free.  A process at its resident limit has to
+ * give up one of its own pages instead.  If zero is set, the page
+ * is returned filled with zeroes.  If entry is null, the page is
+ * not mapped by any user page table, and is not pageable.
  */
-void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr)
+static void* Alloc_Pageable(pte_t *entry, ulong_t vaddr,
+    struct User_Context *owner, bool zero)
 {
-    bool iflag;
+    bool iflag, stolen = false;
     void* paddr = 0;
     struct Page* page = 0;
+    struct User_Context *victim;
 
     iflag = Begin_Int_Atomic();
 
     KASSERT(!Interrupts_Enabled());
     KASSERT(Is_Page_Multiple(vaddr));
 
-    paddr = Alloc_Page();
+    if (At_RSS_Limit(owner))
+	page = Find_Page_To_Page_Out(owner);
+    if (page == 0) {
+	paddr = zero ? Alloc_Zeroed_Page() : Alloc_Page();
+
+	/* Cached blocks and executables are given up before anyone's pages */
+	while (paddr == 0 && (Shrink_Buffer_Cache() || Shrink_Exec_Cache()))
+	    paddr = zero ? Alloc_Zeroed_Page() : Alloc_Page();
+    }
     if (paddr != 0) {
 	page = Get_Page((ulong_t) paddr);
 	KASSERT((page->flags & PAGE_PAGEABLE) == 0);
     } else {
-	int pagefileIndex;
+	int pagefileIndex, poolIndex;
 
         /* Select a page to steal from another process */
 	Debug("About to hunt for a page to page out\n");
-	page = Find_Page_To_Page_Out();
+	stolen = true;
+	if (page == 0)
+	    page = Find_Page_To_Page_Out(0);
+	if (page == 0)
+	    goto done;
 	KASSERT(page->flags & PAGE_PAGEABLE);
+
+	/* The page no longer counts as resident for its owner */
+	victim = page->owner;
+	page->owner = 0;
+	if (victim != 0)
+	    --victim->rssPages;
 	paddr = (void*) Get_Page_Address(page);
 	Debug("Selected page at addr %p (age = %d)\n", paddr, page->clock);
 
+	if (page->flags & PAGE_FILE) {
+	    /*
+	     * Pages of mapped files are never modified, so instead of
+	     * writing them out we just drop them; they will be read
+	     * from the file again on the next access.
+	     */
+	    Shm_Unmap_Page(page);
+	    *((uint_t *) page->entry) = 0;
+	    Flush_TLB();
+	    goto account;
+	}
+
+	/* Compressing the page into the pool is much cheaper than disk I/O */
+	poolIndex = Zswap_Store(paddr);
+	if (poolIndex >= 0) {
+	    Debug("Compressed physical frame %p into pool entry %d\n", paddr, poolIndex);
+	    if (page->flags & PAGE_SHARED)
+		Shm_Unmap_Page(page);
+	    page->entry->present = 0;
+	    page->entry->kernelInfo = KINFO_PAGE_COMPRESSED;
+	    page->entry->pageBaseAddr = poolIndex;
+	    if (victim != 0)
+		++victim->swapPages;
+	    Flush_TLB();
+	    goto account;
+	}
+
 	/* Find a place on disk for it */
 	pagefileIndex = Find_Space_On_Paging_File();
-	if (pagefileIndex < 0)
+	if (pagefileIndex < 0) {
 	    /* No space available in paging file. */
+	    page->owner = victim;
+	    if (victim != 0)
+		++victim->rssPages;
+	    paddr = 0;
 	    goto done;
+	}
 	Debug("Free disk page at index %d\n", pagefileIndex);
 
 	/* Make the page temporarily unpageable (can't let another process steal it) */
@@ -284,10 +474,16 @@ void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr)
         if (page->flags & PAGE_ALLOCATED)
         {
            /* The page is still in use update its bookeping info */
+           /* A shared page must first be unmapped from every process */
+           if (page->flags & PAGE_SHARED)
+               Shm_Unmap_Page(page);
+
            /* Update page table to reflect the page being on disk */
            page->entry->present = 0;
            page->entry->kernelInfo = KINFO_PAGE_ON_DISK;
            page->entry->pageBaseAddr = pagefileIndex; /* Remember where it is located! */
+           if (victim != 0)
+               ++victim->swapPages;
         }
         else
         {
@@ -305,11 +501,26 @@ void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr)
 	Flush_TLB();
     }
 
+account:
+    /* A page taken from another process still holds its data */
+    if (zero && stolen) {
+	++g_memStats[MEM_STAT_ZERO_MISSES];
+	memset(paddr, '\0', PAGE_SIZE);
+    }
+
     /* Fill in accounting information for page */
-    page->flags |= PAGE_PAGEABLE;
+    page->flags &= ~(PAGE_SHARED | PAGE_FILE | PAGE_PAGEABLE);
+    if (entry != 0) {
+	page->flags |= PAGE_PAGEABLE;
+	entry->kernelInfo = 0;
+    }
+    page->refCount = 0;
     page->entry = entry;
-    page->entry->kernelInfo = 0;
     page->vaddr = vaddr;
+    page->owner = owner;
+    page->checksum = 0;
+    if (owner != 0 && ++owner->rssPages > owner->rssPeak)
+	owner->rssPeak = owner->rssPages;
     KASSERT(page->flags & PAGE_ALLOCATED);
 
 done:
@@ -317,6 +528,44 @@ done:
     return paddr;
 }
 
+/**
+ * Allocate a page of pageable physical memory, to be mapped
+ * into a user address space.
+ *
+ * @param entry pointer to user page table entry which will
+ *   refer to the allocated page
+ * @param vaddr virtual address where page will be mapped
+ *   in user address space
+ * @param owner process charged for the page, or null
+ *   for pages of shared memory segments
+ */
+void* Alloc_Pageable_Page(pte_t *entry, ulong_t vaddr, struct User_Context *owner)
+{
+    return Alloc_Pageable(entry, vaddr, owner, false);
+}
+
+/**
+ * Allocate a page of pageable physical memory filled with zeroes.
+ * Pre-zeroed pages are used first, so the caller usually does
+ * not have to wait for the page to be cleared.
+ */
+void* Alloc_Zeroed_Pageable_Page(pte_t *entry, ulong_t vaddr, struct User_Context *owner)
+{
+    return Alloc_Pageable(entry, vaddr, owner, true);
+}
+
+/**
+ * Allocate a page of physical memory filled with zeroes, paging
+ * out a user page to make room if no page is free.  The page
+ * itself is not pageable.  Interrupts must be enabled, since
+ * writing out the page may block.
+ */
+void* Alloc_Zeroed_Page_Evicting(void)
+{
+    KASSERT(Interrupts_Enabled());
+    return Alloc_Pageable(0, 0, 0, true);
+}
+
 /*
  * Free a page of physical memory.
  */
@@ -337,12 +586,20 @@ void Free_Page(void* pageAddr)
     /* Clear the allocation bit */
     page->flags &= ~(PAGE_ALLOCATED);
 
+    /* Uncharge the process the page belonged to */
+    if (page->owner != 0) {
+	--page->owner->rssPages;
+	page->owner = 0;
+    }
+
     /* When a page is locked, don't free it just let other thread know its not needed */
-    if (page->flags & PAGE_LOCKED)
+    if (page->flags & PAGE_LOCKED) {
+      End_Int_Atomic(iflag);
       return;
+    }
 
-    /* Clear the pageable bit */
-    page->flags &= ~(PAGE_PAGEABLE);
+    /* Clear the pageable and shared bits */
+    page->flags &= ~(PAGE_PAGEABLE | PAGE_SHARED | PAGE_FILE | PAGE_MERGED);
 
     /* Put the page back on the freelist */
     Add_To_Back_Of_Page_List(&s_freeList, page);
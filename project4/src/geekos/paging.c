@@ -21,17 +21,22 @@
 #include <geekos/user.h>
 #include <geekos/vfs.h>
 #include <geekos/blockdev.h>
+#include <geekos/timer.h>
 #include <geekos/crc32.h>
+#include <geekos/bitset.h>
 #include <geekos/paging.h>
+#include <geekos/shm.h>
+#include <geekos/zswap.h>
+#include <geekos/vma.h>
+#include <geekos/ksm.h>
+#include <geekos/swapdev.h>
+#include <geekos/errno.h>
 
 /* ----------------------------------------------------------------------
  * Public data
  * ---------------------------------------------------------------------- */
 
 pde_t *g_kernel_pde;
-void *BitmapPaging = NULL;
-struct Paging_Device *pagingDevice;
-static int numOfPagingPages;
 
 /* ----------------------------------------------------------------------
  * Private functions/data
@@ -39,6 +44,29 @@ static int numOfPagingPages;
 
 #define SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
 
+/*
+ * Swap areas, one for each paging device, in order of decreasing
+ * priority.  The slots of all areas are numbered consecutively, so
+ * a single index (kept in the page table entry of a swapped page)
+ * names both the area and the slot in it.  Pages go to the areas
+ * of highest priority which have room, taking turns between areas
+ * of equal priority so their disks share the I/O.
+ */
+#define MAX_SWAP_AREAS 8
+struct Swap_Area
+{
+    struct Paging_Device *device;
+    void *bitmap;
+    int firstSlot;  /* index of the area's first slot */
+    int numSlots;
+    int usedSlots;
+    ulong_t writes; /* pages written and read back */
+    ulong_t reads;
+};
+static struct Swap_Area s_swapAreas[MAX_SWAP_AREAS];
+static int s_numSwapAreas;
+static int s_nextArea; /* area to try first in the next round-robin turn */
+
 /*
  * flag to indicate if debugging paging code
  */
@@ -47,6 +75,16 @@ int debugFaults = 0;
     if (debugFaults)   \
     Print(args)
 
+/*
+ * flag to time building the kernel memory map at boot
+ */
+int benchmarkVM = 0;
+
+#define EFLAGS_ID (1 << 21)        /* EFLAGS bit which is writable if CPUID exists */
+#define CPUID_FEATURE_PSE (1 << 3) /* CPUID feature bit: 4MB pages */
+#define CR4_PSE (1 << 4)           /* CR4 bit enabling 4MB pages */
+#define CR0_WP (1 << 16)           /* CR0 bit making read-only pages read-only for the kernel too */
+
 void checkPaging()
 {
     unsigned long reg = 0;
@@ -77,6 +115,112 @@ static void Print_Fault_Info(uint_t address, faultcode_t faultCode)
         Print("in Supervisor Mode\n");
 }
 
+/*
+ * Find the virtual memory area of a user context which covers
+ * the given user address.  A fault between the bottom of the stack
+ * and its growth limit extends the stack down to the faulting page;
+ * the tree stays ordered, since nothing else may live in that range.
+ * Returns null if the address is not in any area.
+ */
+static struct VMA *Find_User_VMA(struct User_Context *userContext,
+                                 ulong_t userAddr)
+{
+    struct VMA *stack = userContext->stack;
+    struct VMA *vma = Find_VMA(userContext->vmaRoot, userAddr);
+    if (vma == NULL && stack != NULL &&
+        userAddr >= stack->limit && userAddr < stack->start)
+    {
+        stack->start = Round_Down_To_Page(userAddr);
+        vma = stack;
+    }
+    return vma;
+}
+
+/*
+ * Give the page containing the given linear address a fresh,
+ * zero-filled frame.  Only pages which are actually touched
+ * get here, so nothing is zeroed ahead of time.
+ * Returns 0 if successful, -1 if out of memory.
+ */
+static int Map_Zero_Fill_Page(struct User_Context *userContext, ulong_t address)
+{
+    ulong_t vaddr = Round_Down_To_Page(address);
+    pte_t *entry;
+    void *paddr;
+    KASSERT(!Interrupts_Enabled());
+    entry = Get_User_Page_Entry(userContext->pageDir, vaddr, true);
+    if (entry == NULL)
+        return -1;
+    // 优先使用空闲时预先清零的页
+    paddr = Alloc_Zeroed_Pageable_Page(entry, vaddr, userContext);
+    if (paddr == NULL)
+        return -1;
+    *((uint_t *)entry) = 0;
+    entry->present = 1;
+    entry->flags = VM_WRITE | VM_READ | VM_USER;
+    entry->pageBaseAddr = (ulong_t)paddr >> 12;
+    return 0;
+}
+
+/*
+ * Bring a page back in from the compressed pool or the paging file.
+ * Returns 0 if successful, -1 if out of memory.
+ */
+static int Page_In(struct User_Context *userContext, pte_t *entry,
+                   ulong_t address)
+{
+    ulong_t vaddr = Round_Down_To_Page(address);
+    bool compressed = (entry->kernelInfo == KINFO_PAGE_COMPRESSED);
+    int pagefileIndex = entry->pageBaseAddr;
+    struct Page *page;
+    void *paddr;
+    paddr = Alloc_Pageable_Page(entry, vaddr, userContext);
+    if (paddr == NULL)
+        return -1;
+    --userContext->swapPages;
+    if (compressed)
+    { // 压缩池中的页不需要磁盘I/O
+        Zswap_Load(pagefileIndex, paddr);
+        Zswap_Free(pagefileIndex);
+    }
+    else
+    {
+        /* Keep the frame from being stolen while it is being filled */
+        page = Get_Page((ulong_t)paddr);
+        page->flags &= ~PAGE_PAGEABLE;
+        ++g_zswapStats[ZSWAP_STAT_MISSES];
+        Enable_Interrupts();
+        Read_From_Paging_File(paddr, vaddr, pagefileIndex);
+        Disable_Interrupts();
+        page->flags |= PAGE_PAGEABLE;
+        Free_Space_On_Paging_File(pagefileIndex);
+    }
+    *((uint_t *)entry) = 0;
+    entry->present = 1;
+    entry->flags = VM_WRITE | VM_READ | VM_USER;
+    entry->pageBaseAddr = (ulong_t)paddr >> 12;
+    return 0;
+}
+
+/*
+ * If a kernel instruction which copies to or from user memory
+ * faulted, make it continue at its fixup code, which makes the
+ * copy fail.  Returns true if the instruction has a fixup.
+ */
+static bool Fixup_Kernel_Fault(struct Interrupt_State *state)
+{
+    struct Exception_Table_Entry *fixup;
+    for (fixup = g_exceptionTableStart; fixup < g_exceptionTableEnd; fixup++)
+    {
+        if (fixup->faultAddr == state->eip)
+        {
+            state->eip = fixup->fixupAddr;
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Handler for page faults.
  * You should call the Install_Interrupt_Handler() function to
@@ -86,130 +230,252 @@ void Page_Fault_Handler(struct Interrupt_State *state)
 {
     ulong_t address;
     faultcode_t faultCode;
-    extern uint_t g_freePageCount;
+    struct User_Context *userContext = g_currentThread->userContext;
+    struct VMA *vma;
+    pte_t *entry;
     KASSERT(!Interrupts_Enabled());
     address = Get_Page_Fault_Address();
     Debug("Page fault @%lx\n", address);
     faultCode = *((faultcode_t *)&(state->errorCode)); /* 错误码 */
-    struct User_Context *userContext = g_currentThread->userContext;
-    if (faultCode.writeFault)
-    { // 写错误，缺页情况为堆栈生长到新页
-        Print_Fault_Info(address, faultCode);
-        int res;
-        res = Alloc_User_Page(userContext->pageDir,
-                              Round_Down_To_Page(address), PAGE_SIZE);
-        if (res == -1)
-            Exit(-1);
+    if (userContext == NULL || address < USER_VM_START)
+        goto bad;
+    vma = Find_User_VMA(userContext, address - USER_VM_START);
+    if (vma == NULL)
+    {
+        if (userContext->stack != NULL &&
+            address - USER_VM_START < userContext->stack->limit &&
+            address - USER_VM_START >=
+                userContext->stack->limit - USER_GUARD_SIZE)
+            Print("Pid %d, stack overflow\n", g_currentThread->pid);
+        goto bad;
+    }
+    if (faultCode.writeFault && !(vma->prot & VM_WRITE))
+        goto bad;
+    if (faultCode.protectionViolation)
+    { // 写被合并的只读页时，给进程一份私有的拷贝
+        entry = Get_User_Page_Entry(userContext->pageDir, address, false);
+        if (!faultCode.writeFault || entry == NULL || !entry->present ||
+            !(Get_Page(entry->pageBaseAddr << 12)->flags & PAGE_MERGED))
+            goto bad;
+        if (Ksm_Unshare_Page(userContext, entry,
+                             Round_Down_To_Page(address)) != 0)
+            goto oom;
         return;
     }
-    else
-    { ////读错误，分两种缺页情况
-        ulong_t page_dir_addr = address >> 22;
-        ulong_t page_addr = (address << 10) >> 22;
-        pde_t *page_dir_entry = (pde_t *)userContext->pageDir +
-                                page_dir_addr;
-        pte_t *page_entry = NULL;
-        if (page_dir_entry->present)
-        { // 页目录项
-            page_entry = (pte_t *)((page_dir_entry->pageTableBaseAddr) << 12);
-            page_entry += page_addr;
-        }
-        else
-        { ////非法地址访问的缺页情况
-            Print_Fault_Info(address, faultCode);
-            Exit(-1);
-        }
-        if (page_entry->kernelInfo != KINFO_PAGE_ON_DISK)
-        { // 页不在磁盘上
-            Print_Fault_Info(address, faultCode);
-            Exit(-1);
-        }
-        // 以下处理因为页保存在磁盘pagefile引起的缺页
-        int pagefile_index = page_entry->pageBaseAddr;
-        void *paddr = Alloc_Pageable_Page(page_entry,
-                                          Round_Down_To_Page(address));
-        if (paddr == NULL)
-            Exit(-1);
-        *((uint_t *)page_entry) = 0;
-        page_entry->present = 1;
-        page_entry->flags = VM_WRITE | VM_READ | VM_USER;
-        page_entry->globalPage = 0;
-        page_entry->pageBaseAddr = (ulong_t)paddr >> 12;
-        Enable_Interrupts();
-        Read_From_Paging_File(paddr, Round_Down_To_Page(address),
-                              pagefile_index);
-        Disable_Interrupts();
-        Free_Space_On_Paging_File(pagefile_index);
+    if (vma->kind == VMA_SHARED || vma->kind == VMA_FILE)
+    { // 共享内存段或映射文件中的页
+        entry = Get_User_Page_Entry(userContext->pageDir, address, true);
+        if (entry == NULL || Shm_Fault(vma, entry, address) != 0)
+            goto oom;
+        return;
+    }
+    entry = Get_User_Page_Entry(userContext->pageDir, address, false);
+    if (entry != NULL && (entry->kernelInfo == KINFO_PAGE_ON_DISK ||
+                          entry->kernelInfo == KINFO_PAGE_COMPRESSED))
+    { // 页保存在压缩池或磁盘pagefile上
+        if (Page_In(userContext, entry, address) != 0)
+            goto oom;
         return;
     }
+    if (entry == NULL || !entry->present)
+    { // 堆栈、堆或BSS中第一次访问的页
+        if (Map_Zero_Fill_Page(userContext, address) != 0)
+            goto oom;
+        return;
+    }
+bad:
+    // 内核拷贝用户内存时遇到非法地址，拷贝失败而不是结束进程
+    if (!Is_User_Interrupt(state) && Fixup_Kernel_Fault(state))
+        return;
+    /* 非法地址访问 */
+    Print_Fault_Info(address, faultCode);
+    if (userContext == NULL)
+    {
+        Dump_Interrupt_State(state);
+        KASSERT(false);
+    }
+    Exit(-1);
+oom:
+    if (!Is_User_Interrupt(state) && Fixup_Kernel_Fault(state))
+        return;
+    Print("Pid %d, out of memory at address %lx\n",
+          g_currentThread->pid, address);
+    Exit(-1);
 }
 
-int Alloc_User_Page(pde_t *pageDir, uint_t startAddress, uint_t sizeInMemory)
+/*
+ * Find the page table entry mapping the given linear address
+ * in a page directory.  If the page table does not exist yet,
+ * it is allocated when create is true.
+ * Returns null if there is no page table (or none could be allocated),
+ * or if the address is mapped by a 4MB page.
+ */
+pte_t *Get_User_Page_Entry(pde_t *pageDir, ulong_t address, bool create)
 {
-    uint_t pagedir_index = startAddress >> 22;
-    uint_t page_index = (startAddress << 10) >> 22;
-    pde_t *pagedir_entry = pageDir + pagedir_index;
-    pte_t *page_entry;
-    // 第一步，建立startAddress对应的页目录表项与页
-    if (pagedir_entry->present)
-    { // startAddress对应的页目录表项已经建立的情况
-        page_entry = (pte_t *)(pagedir_entry->pageTableBaseAddr << 12);
+    pde_t *pagedir_entry = pageDir + PAGE_DIRECTORY_INDEX(address);
+    pte_t *page_table;
+    if (pagedir_entry->present && pagedir_entry->largePages)
+    { // 4MB页没有页表
+        return NULL;
+    }
+    else if (pagedir_entry->present)
+    { // 页表已经建立的情况
+        page_table = (pte_t *)(pagedir_entry->pageTableBaseAddr << 12);
     }
     else
-    { // startAddress对应页目录表项没有建立的情况（对应的页表没有建立）
-        // 分配一个页
-        page_entry = (pte_t *)Alloc_Page();
-        if (page_entry == NULL)
-        {
-            return -1;
-        }
-        memset(page_entry, 0, PAGE_SIZE);
+    { // 页表没有建立的情况，分配一个页
+        if (!create)
+            return NULL;
+        page_table = (pte_t *)Alloc_Zeroed_Page();
+        if (page_table == NULL)
+            return NULL;
         // 设置对应的页目录表项
         *((uint_t *)pagedir_entry) = 0;
         pagedir_entry->present = 1;
         pagedir_entry->flags = VM_WRITE | VM_READ | VM_USER;
-        pagedir_entry->pageTableBaseAddr = (ulong_t)page_entry >> 12;
+        pagedir_entry->pageTableBaseAddr = (ulong_t)page_table >> 12;
     }
-    // 找到页表中对应于startAddress的页表项
-    page_entry += page_index;
-    // 第二步，建立startAddress对应的页表项与页
-    int num_pages;
-    void *page_addr;
+    return page_table + PAGE_TABLE_INDEX(address);
+}
+
+int Alloc_User_Page(struct User_Context *userContext, uint_t startAddress,
+                    uint_t sizeInMemory)
+{
     // 这里算所需页数时，注意要对齐页边界
-    num_pages = Round_Up_To_Page(startAddress -
-                                 Round_Down_To_Page(startAddress) + sizeInMemory) /
-                PAGE_SIZE;
+    int num_pages = Round_Up_To_Page(startAddress -
+                                     Round_Down_To_Page(startAddress) +
+                                     sizeInMemory) /
+                    PAGE_SIZE;
+    ulong_t vaddr = Round_Down_To_Page(startAddress);
     int i;
-    uint_t first_page_addr = 0;
-    for (i = 0; i < num_pages; i++)
+    for (i = 0; i < num_pages; i++, vaddr += PAGE_SIZE)
     {
+        pte_t *page_entry = Get_User_Page_Entry(userContext->pageDir, vaddr,
+                                                true);
+        void *page_addr;
+        if (page_entry == NULL)
+            return -1;
         // 对应的页表项没有建立的情况（此时意味着对应的页没有建立）
-        if (!page_entry->present)
-        {
-            page_addr = Alloc_Pageable_Page(page_entry,
-                                            Round_Down_To_Page(startAddress));
-            if (page_addr == NULL)
-            {
-                return -1;
-            }
-            // 设置页表项
-            *((uint_t *)page_entry) = 0;
-            page_entry->present = 1;
-            page_entry->flags = VM_WRITE | VM_READ | VM_USER;
-            page_entry->globalPage = 0;
-            page_entry->pageBaseAddr = (ulong_t)page_addr >> 12;
-            KASSERT(page_addr != 0);
-            if (i == 0)
-            {
-                first_page_addr = (uint_t)page_addr;
-            }
-        }
-        page_entry++;
-        startAddress += PAGE_SIZE;
+        if (page_entry->present)
+            continue;
+        page_addr = Alloc_Pageable_Page(page_entry, vaddr, userContext);
+        if (page_addr == NULL)
+            return -1;
+        // 设置页表项
+        *((uint_t *)page_entry) = 0;
+        page_entry->present = 1;
+        page_entry->flags = VM_WRITE | VM_READ | VM_USER;
+        page_entry->globalPage = 0;
+        page_entry->pageBaseAddr = (ulong_t)page_addr >> 12;
     }
     return 0;
 }
 
+/*
+ * Determine whether the processor supports 4MB pages (PSE).
+ * Processors which cannot toggle the ID bit of EFLAGS have no CPUID
+ * instruction, and thus no PSE either.
+ */
+static bool Cpu_Has_PSE(void)
+{
+    ulong_t flags, origFlags, eax, ebx, ecx, edx;
+    __asm__ __volatile__(
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl %2, %0\n\t"
+        "pushl %0\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "pushl %1\n\t"
+        "popfl"
+        : "=&r"(flags), "=&r"(origFlags)
+        : "i"(EFLAGS_ID));
+    if (((flags ^ origFlags) & EFLAGS_ID) == 0)
+        return false;
+    __asm__ __volatile__("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(1));
+    return (edx & CPUID_FEATURE_PSE) != 0;
+}
+
+/*
+ * Turn on 4MB page support; must be done before any
+ * page directory entry with largePages set is used.
+ */
+static void Enable_PSE(void)
+{
+    ulong_t cr4;
+    __asm__ __volatile__("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PSE;
+    __asm__ __volatile__("movl %0, %%cr4" : : "r"(cr4));
+}
+
+/*
+ * Make the kernel obey read-only page table entries, so that
+ * writes to user pages from kernel mode fault just like writes
+ * from user mode do.
+ */
+static void Enable_Write_Protect(void)
+{
+    ulong_t cr0;
+    __asm__ __volatile__("movl %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_WP;
+    __asm__ __volatile__("movl %0, %%cr0" : : "r"(cr0));
+}
+
+/*
+ * Identity map the 4MB of memory covered by one kernel page directory
+ * entry: with a single 4MB page if usePSE is set, otherwise with
+ * a page table of 4KB pages.
+ */
+static void Map_Kernel_Range(pde_t *pde, int index, int flags, bool usePSE)
+{
+    ulong_t mem = (ulong_t)index * NUM_PAGE_TABLE_ENTRIES * PAGE_SIZE;
+    pte_t *page_table;
+    int j;
+    *((uint_t *)pde) = 0;
+    pde->present = 1;
+    if (usePSE)
+    {
+        pde->flags = flags;
+        pde->largePages = 1;
+        pde->pageTableBaseAddr = mem >> 12;
+        return;
+    }
+    // 页目录项允许用户访问，实际权限由页表项决定
+    pde->flags = VM_WRITE | VM_USER;
+    page_table = Alloc_Page(); // 为页表分配一页空间
+    if (page_table == NULL)
+        KASSERT(0);
+    memset(page_table, '\0', PAGE_SIZE);
+    pde->pageTableBaseAddr = ((uint_t)page_table) >> 12;
+    for (j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++)
+    {
+        page_table[j].present = 1;
+        page_table[j].flags = flags;
+        page_table[j].pageBaseAddr = mem >> 12;
+        mem += PAGE_SIZE;
+    }
+}
+
+/*
+ * Read one word from each page of physical memory, so that
+ * the cost is dominated by TLB misses.
+ */
+static void Touch_Kernel_Pages(ulong_t numPages)
+{
+    volatile ulong_t *p;
+    ulong_t i, sum = 0;
+    for (i = 1; i < numPages; i++)
+    {
+        p = (volatile ulong_t *)(i * PAGE_SIZE);
+        sum += *p;
+    }
+    Debug("Touched %lu pages (%lx)\n", numPages, sum);
+}
+
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
@@ -222,77 +488,192 @@ void Init_VM(struct Boot_Info *bootInfo)
 {
     // 计算内核页目录中要多少个目录项
     int num_dir_entries = (bootInfo->memSizeKB / 4) / NUM_PAGE_TABLE_ENTRIES + 1;
+    bool usePSE = Cpu_Has_PSE();
+    ulong_t start = 0, mapped;
+    int i;
+    if (benchmarkVM)
+        start = Read_TSC();
     g_kernel_pde = Alloc_Page(); // 为内核页目录分配一页空间
     if (g_kernel_pde == NULL)
         KASSERT(0);
     memset(g_kernel_pde, '\0', PAGE_SIZE);
-    pte_t *first_pte;
-    int i = 0, j;
-    uint_t mem;
+    // 有PSE时每个目录项直接映射4MB，不再需要页表
+    if (usePSE)
+        Enable_PSE();
     for (i = 0; i < num_dir_entries; i++)
+        Map_Kernel_Range(&g_kernel_pde[i], i, VM_WRITE, usePSE);
+    Map_Kernel_Range(&g_kernel_pde[1019], 1019, VM_WRITE, usePSE);
+    Enable_Paging(g_kernel_pde);
+    // 内核写只读的用户页(如合并的页)时也要产生缺页
+    Enable_Write_Protect();
+    Install_Interrupt_Handler(14, Page_Fault_Handler);
+    Install_Interrupt_Handler(46, Page_Fault_Handler);
+    if (usePSE)
+        Print("Kernel memory mapped with 4MB pages\n");
+    if (benchmarkVM)
     {
-        g_kernel_pde[i].flags = VM_WRITE | VM_USER;
-        g_kernel_pde[i].present = 1;
-        first_pte = Alloc_Page(); ////为页表分配一页空间
-        if (first_pte == NULL)
-            KASSERT(0);
-        memset(first_pte, '\0', PAGE_SIZE);
-        g_kernel_pde[i].pageTableBaseAddr = ((uint_t)first_pte) >> 12;
-        int j;
-        mem = i * NUM_PAGE_TABLE_ENTRIES * PAGE_SIZE;
-        for (j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++)
-        {
-            first_pte[j].present = 1;
-            first_pte[j].flags = VM_WRITE;
-            first_pte[j].pageBaseAddr = mem >> 12;
-            mem += PAGE_SIZE;
-        }
+        mapped = Read_TSC() - start;
+        start = Read_TSC();
+        Touch_Kernel_Pages(bootInfo->memSizeKB / 4);
+        Print("Init_VM: %lu cycles to build, %lu cycles to touch every page\n",
+              mapped, (ulong_t)(Read_TSC() - start));
     }
-    i = 1019;
-    g_kernel_pde[i].present = 1;
-    g_kernel_pde[i].flags = VM_WRITE;
-    first_pte = Alloc_Page();
-    if (first_pte == NULL)
-        KASSERT(0);
-    g_kernel_pde[i].pageTableBaseAddr = ((uint_t)first_pte) >> 12;
-    memset(first_pte, '\0', PAGE_SIZE);
-    mem = i * NUM_PAGE_TABLE_ENTRIES * (long long)PAGE_SIZE;
-    for (j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++)
+}
+
+/*
+ * Find the swap area holding the slot with the given index.
+ */
+static struct Swap_Area *Find_Swap_Area(int pagefileIndex)
+{
+    int i;
+    for (i = 0; i < s_numSwapAreas; i++)
     {
-        first_pte[j].present = 1;
-        first_pte[j].flags = VM_WRITE | VM_USER;
-        first_pte[j].pageBaseAddr = mem >> 12;
-        mem += PAGE_SIZE;
+        struct Swap_Area *area = &s_swapAreas[i];
+        if (pagefileIndex >= area->firstSlot &&
+            pagefileIndex < area->firstSlot + area->numSlots)
+            return area;
     }
-    Enable_Paging(g_kernel_pde);
-    Install_Interrupt_Handler(14, Page_Fault_Handler);
-    Install_Interrupt_Handler(46, Page_Fault_Handler);
+    KASSERT(0);
+    return NULL;
+}
+
+/*
+ * Read or write one page in a slot of a swap area,
+ * as a single request for all of its sectors.
+ */
+static void Swap_Area_IO(void *paddr, int pagefileIndex, bool write)
+{
+    struct Swap_Area *area = Find_Swap_Area(pagefileIndex);
+    struct Paging_Device *device = area->device;
+    ulong_t sector = device->startSector +
+                     (pagefileIndex - area->firstSlot) * SECTORS_PER_PAGE;
+    if (write)
+        Block_Write_Range(device->dev, sector, SECTORS_PER_PAGE, paddr);
+    else
+        Block_Read_Range(device->dev, sector, SECTORS_PER_PAGE, paddr);
+    if (write)
+        ++area->writes;
+    else
+        ++area->reads;
+}
+
+/**
+ * Use a whole block device for swapping, if it has a swap header
+ * (see swapdev.h) in its first sector.
+ * @return 0 if the device was registered as a paging device,
+ *   or an error code
+ */
+int Add_Swap_Device(const char *devName)
+{
+    struct Block_Device *dev;
+    struct Paging_Device *pagedev;
+    struct Swap_Header *header;
+    char *sector;
+    int numBlocks, rc;
+    rc = Open_Block_Device(devName, &dev);
+    if (rc != 0)
+        return rc;
+    sector = Malloc(SECTOR_SIZE);
+    pagedev = Malloc(sizeof(*pagedev));
+    if (sector == NULL || pagedev == NULL)
+    {
+        rc = ENOMEM;
+        goto fail;
+    }
+    // 第一个扇区中必须有交换设备的标志，以免覆盖文件系统
+    header = (struct Swap_Header *)sector;
+    numBlocks = Get_Num_Blocks(dev);
+    if ((rc = Block_Read(dev, 0, sector)) != 0)
+        goto fail;
+    if (strncmp(header->magic, SWAP_MAGIC, SWAP_MAGIC_LEN) != 0 ||
+        numBlocks < 2 * SECTORS_PER_PAGE)
+    {
+        rc = EINVALID;
+        goto fail;
+    }
+    pagedev->fileName = dev->name;
+    pagedev->dev = dev;
+    pagedev->startSector = SECTORS_PER_PAGE; // 第一页留给标志
+    pagedev->numSectors = numBlocks - SECTORS_PER_PAGE;
+    pagedev->priority = header->priority;
+    Free(sector);
+    Register_Paging_Device(pagedev);
+    return 0;
+fail:
+    if (sector != NULL)
+        Free(sector);
+    if (pagedev != NULL)
+        Free(pagedev);
+    Close_Block_Device(dev);
+    return rc;
 }
 
 /**
  * Initialize paging file data structures.
- * All filesystems should be mounted before this function
- * is called, to ensure that the paging file is available.
+ * All filesystems should be mounted, and raw swap devices added,
+ * before this function is called, to ensure that all paging
+ * devices are available.
  */
 void Init_Paging(void)
 {
-    pagingDevice = Get_Paging_Device();
-    if (pagingDevice == NULL)
-        KASSERT(0);
-    numOfPagingPages = pagingDevice->numSectors / SECTORS_PER_PAGE;
-    BitmapPaging = Create_Bit_Set(numOfPagingPages);
+    struct Paging_Device *device;
+    int nextSlot = 0;
+    for (device = Get_Paging_Device(); device != NULL; device = device->next)
+    {
+        struct Swap_Area *area = &s_swapAreas[s_numSwapAreas];
+        int numSlots = device->numSectors / SECTORS_PER_PAGE;
+        // 页表项中只有20位保存位置
+        if (s_numSwapAreas == MAX_SWAP_AREAS ||
+            nextSlot + numSlots > (1 << 20) || numSlots == 0)
+        {
+            Print("Not using paging device %s\n", device->fileName);
+            continue;
+        }
+        area->device = device;
+        area->bitmap = Create_Bit_Set(numSlots);
+        area->firstSlot = nextSlot;
+        area->numSlots = numSlots;
+        nextSlot += numSlots;
+        ++s_numSwapAreas;
+    }
+    KASSERT(s_numSwapAreas > 0);
 }
 
 /**
- * Find a free bit of disk on the paging file for this page.
- * Interrupts must be disabled.
+ * Find a free bit of disk on the paging file for this page,
+ * and reserve it.  Interrupts must be disabled.
  * @return index of free page sized chunk of disk space in
  *   the paging file, or -1 if the paging file is full
  */
 int Find_Space_On_Paging_File(void)
 {
+    int group, end, i;
     KASSERT(!Interrupts_Enabled());
-    return Find_First_Free_Bit(BitmapPaging, numOfPagingPages);
+    // 按优先级分组，同优先级的设备轮流使用
+    for (group = 0; group < s_numSwapAreas; group = end)
+    {
+        int priority = s_swapAreas[group].device->priority;
+        for (end = group + 1; end < s_numSwapAreas &&
+                              s_swapAreas[end].device->priority == priority;
+             end++)
+            ;
+        int start = s_nextArea >= group && s_nextArea < end ? s_nextArea : group;
+        for (i = 0; i < end - group; i++)
+        {
+            int n = group + (start - group + i) % (end - group);
+            struct Swap_Area *area = &s_swapAreas[n];
+            // 从上次分配的位置继续查找，连续换出的页在磁盘上相邻
+            int slot = Find_Next_Free_Bit(area->bitmap, area->numSlots);
+            if (slot < 0)
+                continue;
+            // 立即占用，在写盘期间别的进程不会拿到同一个位置
+            Set_Bit(area->bitmap, slot);
+            ++area->usedSlots;
+            s_nextArea = n + 1 < end ? n + 1 : group;
+            return area->firstSlot + slot;
+        }
+    }
+    return -1;
 }
 
 /**
@@ -302,14 +683,18 @@ int Find_Space_On_Paging_File(void)
  */
 void Free_Space_On_Paging_File(int pagefileIndex)
 {
+    struct Swap_Area *area;
     KASSERT(!Interrupts_Enabled());
-    KASSERT(0 <= pagefileIndex && pagefileIndex < numOfPagingPages);
-    Clear_Bit(BitmapPaging, pagefileIndex);
+    area = Find_Swap_Area(pagefileIndex);
+    KASSERT(Is_Bit_Set(area->bitmap, pagefileIndex - area->firstSlot));
+    Clear_Bit(area->bitmap, pagefileIndex - area->firstSlot);
+    --area->usedSlots;
 }
 
 /**
  * Write the contents of given page to the indicated block
- * of space in the paging file.
+ * of space in the paging file.  The space must have been
+ * reserved with Find_Space_On_Paging_File().
  * @param paddr a pointer to the physical memory of the page
  * @param vaddr virtual address where page is mapped in user memory
  * @param pagefileIndex the index of the page sized chunk of space
@@ -320,19 +705,7 @@ void Write_To_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex)
     struct Page *page = Get_Page((ulong_t)paddr);
     KASSERT(!(page->flags & PAGE_PAGEABLE)); // 必须锁定
     KASSERT((page->flags & PAGE_LOCKED));
-    int i;
-    if (0 <= pagefileIndex && pagefileIndex < numOfPagingPages)
-    {
-        for (i = 0; i < SECTORS_PER_PAGE; i++)
-        {
-            Block_Write(pagingDevice->dev,
-                        pagefileIndex * SECTORS_PER_PAGE + i + (pagingDevice->startSector),
-                        paddr + i * SECTOR_SIZE);
-        }
-        Set_Bit(BitmapPaging, pagefileIndex);
-    }
-    else
-        KASSERT(0);
+    Swap_Area_IO(paddr, pagefileIndex, true);
 }
 
 /**
@@ -348,14 +721,34 @@ void Read_From_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex)
 {
     struct Page *page = Get_Page((ulong_t)paddr);
     KASSERT(!(page->flags & PAGE_PAGEABLE)); /* Page must be locked! */
-    int i;
-    if (0 <= pagefileIndex && pagefileIndex < numOfPagingPages)
-        for (i = 0; i < SECTORS_PER_PAGE; i++)
-        {
-            Block_Read(pagingDevice->dev,
-                       pagefileIndex * SECTORS_PER_PAGE + i + (pagingDevice->startSector),
-                       paddr + i * SECTOR_SIZE);
-        }
-    else
-        KASSERT(0);
+    Swap_Area_IO(paddr, pagefileIndex, false);
+}
+
+/**
+ * Get one of the statistics of a swap device.
+ * @param device number of the device, in order of decreasing priority
+ * @param which the statistic (SWAP_DEV_xxx)
+ * @return the value of the statistic, or an error code
+ */
+int Swap_Device_Stat(int device, int which)
+{
+    struct Swap_Area *area;
+    if (device < 0 || device >= s_numSwapAreas)
+        return ENOTFOUND;
+    area = &s_swapAreas[device];
+    switch (which)
+    {
+    case SWAP_DEV_PRIORITY:
+        return area->device->priority;
+    case SWAP_DEV_SLOTS:
+        return area->numSlots;
+    case SWAP_DEV_USED:
+        return area->usedSlots;
+    case SWAP_DEV_WRITES:
+        return (int)area->writes;
+    case SWAP_DEV_READS:
+        return (int)area->reads;
+    default:
+        return EINVALID;
+    }
 }
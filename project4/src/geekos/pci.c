@@ -0,0 +1,119 @@
+/*
+ * PCI configuration space access
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Configuration space is reached through configuration mechanism #1:
+ * the address of a double word is written to CONFIG_ADDRESS, and the
+ * double word is then read or written at CONFIG_DATA.
+ */
+
+#include <geekos/int.h>
+#include <geekos/io.h>
+#include <geekos/pci.h>
+
+#define PCI_CONFIG_ADDRESS	0xCF8
+#define PCI_CONFIG_DATA		0xCFC
+
+#define PCI_MAX_BUSES		256
+#define PCI_MAX_SLOTS		32
+#define PCI_MAX_FUNCS		8
+
+/* Functions other than 0 exist only if this bit of the header type is set */
+#define PCI_HEADER_MULTI_FUNC	0x80
+
+#define PCI_NO_VENDOR		0xFFFF
+
+/*
+ * Select the double word containing the given register.
+ * Must be called with interrupts disabled, so that nothing
+ * else changes CONFIG_ADDRESS before the data is accessed.
+ */
+static void PCI_Select(int bus, int slot, int func, int reg)
+{
+    Out_DWord(PCI_CONFIG_ADDRESS, 0x80000000UL | ((ulong_t) bus << 16) |
+	((ulong_t) slot << 11) | ((ulong_t) func << 8) | (reg & 0xFC));
+}
+
+static ulong_t PCI_Read(int bus, int slot, int func, int reg)
+{
+    bool iflag = Begin_Int_Atomic();
+    ulong_t value;
+
+    PCI_Select(bus, slot, func, reg);
+    value = In_DWord(PCI_CONFIG_DATA);
+
+    End_Int_Atomic(iflag);
+    return value;
+}
+
+/*
+ * Read the double word holding the given register of a function.
+ */
+ulong_t PCI_Read_Config(struct PCI_Device *dev, int reg)
+{
+    return PCI_Read(dev->bus, dev->slot, dev->func, reg);
+}
+
+ushort_t PCI_Read_Config_Word(struct PCI_Device *dev, int reg)
+{
+    return (ushort_t) (PCI_Read_Config(dev, reg) >> ((reg & 2) * 8));
+}
+
+uchar_t PCI_Read_Config_Byte(struct PCI_Device *dev, int reg)
+{
+    return (uchar_t) (PCI_Read_Config(dev, reg) >> ((reg & 3) * 8));
+}
+
+/*
+ * Write a word register of a function.  Only the word itself is
+ * written, since some registers (like the status register next to
+ * the command register) have bits which are cleared by writing 1.
+ */
+void PCI_Write_Config_Word(struct PCI_Device *dev, int reg, ushort_t value)
+{
+    bool iflag = Begin_Int_Atomic();
+
+    PCI_Select(dev->bus, dev->slot, dev->func, reg);
+    Out_Word(PCI_CONFIG_DATA + (reg & 2), value);
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Find the first function with the given class and subclass.
+ * Returns true and fills in dev if one was found.
+ */
+bool PCI_Find_Class(int class, int subclass, struct PCI_Device *dev)
+{
+    int bus, slot, func, numFuncs;
+    ulong_t id, classReg;
+
+    for (bus = 0; bus < PCI_MAX_BUSES; ++bus) {
+	for (slot = 0; slot < PCI_MAX_SLOTS; ++slot) {
+	    numFuncs = 1;
+	    for (func = 0; func < numFuncs; ++func) {
+		id = PCI_Read(bus, slot, func, PCI_VENDOR_ID);
+		if ((id & 0xFFFF) == PCI_NO_VENDOR)
+		    continue;
+		if (func == 0 &&
+		    ((PCI_Read(bus, slot, 0, PCI_HEADER_TYPE) >> 16) & PCI_HEADER_MULTI_FUNC))
+		    numFuncs = PCI_MAX_FUNCS;
+
+		classReg = PCI_Read(bus, slot, func, PCI_CLASS);
+		if (((classReg >> 24) & 0xFF) == class && ((classReg >> 16) & 0xFF) == subclass) {
+		    dev->bus = bus;
+		    dev->slot = slot;
+		    dev->func = func;
+		    dev->vendor = id & 0xFFFF;
+		    dev->device = (id >> 16) & 0xFFFF;
+		    return true;
+		}
+	    }
+	}
+    }
+    return false;
+}
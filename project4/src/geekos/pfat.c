@@ -13,13 +13,16 @@
 #include <geekos/screen.h>
 #include <geekos/string.h>
 #include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/timer.h>
 #include <geekos/ide.h>
 #include <geekos/blockdev.h>
-#include <geekos/bitset.h>
+#include <geekos/bufcache.h>
 #include <geekos/vfs.h>
 #include <geekos/list.h>
 #include <geekos/synch.h>
 #include <geekos/pfat.h>
+#include <geekos/swapdev.h>
 
 /*
  * History:
@@ -27,11 +30,16 @@
  * 17-Dec-2003: Rewrite to conform to new VFS layer
  * 19-Feb-2004: Cache and share PFAT_File objects, instead of
  *   allocating them repeatedly
- */
-
-/*
- * TODO:
- * - Support hierarchical directories
+ *
+ * Files can be created, written, truncated and deleted.  Free
+ * directory entries have an empty name, and free blocks a free FAT
+ * entry; blocks before the end of the root directory are never
+ * allocated.  The FAT and the directories are kept in memory, and
+ * changed entries are written through the buffer cache.
+ *
+ * A subdirectory is a file, marked as a directory in its entry,
+ * holding an array of directory entries.  Unlike the root directory,
+ * it grows when it runs out of free entries.
  */
 
 /* ----------------------------------------------------------------------
@@ -46,6 +54,55 @@ int debugPFAT = 0;
 struct PFAT_File;
 DEFINE_LIST(PFAT_File_List, PFAT_File);
 
+/*
+ * A run of blocks of a file which are also consecutive on the device.
+ */
+struct PFAT_Extent {
+    ulong_t fileBlock;			 /* First block of the run in the file */
+    int devBlock;			 /* Where it is on the device */
+    ulong_t numBlocks;			 /* Number of blocks in the run */
+};
+
+/*
+ * Directories are loaded into memory when first looked into, and
+ * stay there until deleted.  Their entries are kept in chunks of
+ * DIR_CHUNK_ENTRIES, which never move, so pointers to entries stay
+ * valid as a directory grows.  A hash table over the names of the
+ * used entries finds a name in constant time, so looking up a path
+ * takes time proportional to its depth.
+ */
+#define DIR_CHUNK_ENTRIES	64
+
+struct PFAT_Dir_Chunk {
+    directoryEntry entry[DIR_CHUNK_ENTRIES];
+    int hashNext[DIR_CHUNK_ENTRIES];		 /* Next entry in the same bucket, or -1 */
+    struct PFAT_Dir *subdir[DIR_CHUNK_ENTRIES];	 /* Subdirectories loaded so far */
+    struct PFAT_File *file[DIR_CHUNK_ENTRIES];	 /* Files opened so far */
+};
+
+struct PFAT_Dir {
+    directoryEntry *self;		 /* Entry of the directory */
+    struct PFAT_Dir *parent;		 /* Directory holding it, null for the root */
+    int selfIndex;			 /* Index of its entry there */
+    int numEntries;			 /* Entries, used or free */
+    struct PFAT_Dir_Chunk **chunks;	 /* Chunks holding the entries */
+    int numChunks;
+    int *blocks;			 /* Device blocks holding the entries */
+    int numBlocks;
+    int *buckets;			 /* First entry of each hash bucket, or -1 */
+    int numBuckets;			 /* A power of two */
+    int freeHint;			 /* No entry before this one is free */
+    int openCount;			 /* Number of File objects reading it */
+};
+
+#define DIR_ENTRY(dir, i) (&(dir)->chunks[(i) / DIR_CHUNK_ENTRIES]->entry[(i) % DIR_CHUNK_ENTRIES])
+#define DIR_HASH_NEXT(dir, i) ((dir)->chunks[(i) / DIR_CHUNK_ENTRIES]->hashNext[(i) % DIR_CHUNK_ENTRIES])
+#define DIR_SUBDIR(dir, i) ((dir)->chunks[(i) / DIR_CHUNK_ENTRIES]->subdir[(i) % DIR_CHUNK_ENTRIES])
+#define DIR_FILE(dir, i) ((dir)->chunks[(i) / DIR_CHUNK_ENTRIES]->file[(i) % DIR_CHUNK_ENTRIES])
+
+/* Longest name a directory entry can hold */
+#define MAX_NAME_LEN ((int) sizeof(((directoryEntry *) 0)->fileName))
+
 /*
  * In-memory information describing a mounted PFAT filesystem.
  * This is kept in the fsInfo field of the Mount_Point.
@@ -53,23 +110,46 @@ DEFINE_LIST(PFAT_File_List, PFAT_File);
 struct PFAT_Instance {
     bootSector fsinfo;
     int *fat;
-    directoryEntry *rootDir;
+    struct PFAT_Dir *rootDir;
     directoryEntry rootDirEntry;
-    struct Mutex lock;
+    directoryEntry *pagefile;	/* entry of the paging file, if it is in use */
+    int dataStart;		/* first block which can be allocated */
+    int numFatBlocks;		/* blocks described by the FAT */
+    int numFree;		/* free blocks */
+    int nextFree;		/* where to start looking for free blocks */
+    struct Mutex lock;		/* protects all of the above, the directories, and the files' openCount */
     struct PFAT_File_List fileList;
 };
 
+/*
+ * Blocks written past the blocks a file has on the device are not
+ * allocated right away.  Their data is kept in up to MAX_DELAYED_PAGES
+ * pages of the PFAT_File, and blocks are only allocated for it when
+ * the file is closed or synced, or those pages are full.  By then the
+ * file has usually reached its final size, and can be given a single
+ * run of consecutive blocks.
+ */
+#define MAX_DELAYED_PAGES	16
+#define BLOCKS_PER_PAGE		(PAGE_SIZE / SECTOR_SIZE)
+
 /*
  * In-memory information for a particular open file.
- * In particular, this object contains a cache of the contents
- * of the file.
+ * The contents of the file are cached by the buffer cache;
+ * where they are on the device is kept as a list of extents,
+ * built from the FAT on the first read.
  * Kept in fsInfo field of File.
  */
 struct PFAT_File {
     directoryEntry *entry;		 /* Directory entry of the file */
+    struct PFAT_Dir *dir;		 /* Directory holding the entry */
+    int index;				 /* Index of the entry there */
     ulong_t numBlocks;			 /* Number of blocks used by file */
-    char *fileDataCache;		 /* File data cache */
-    struct Bit_Set *validBlockSet;	 /* Which data blocks of cache are valid */
+    ulong_t allocBlocks;		 /* Of those, the ones allocated on the device */
+    struct PFAT_Extent *extents;	 /* Extents in file order, or null */
+    int numExtents;			 /* Number of extents */
+    char *delayed[MAX_DELAYED_PAGES];	 /* Data of the blocks not yet allocated */
+    bool dirty;				 /* Directory entry not yet written */
+    int openCount;			 /* Number of File objects using it */
     struct Mutex lock;			 /* Synchronize concurrent accesses */
     DEFINE_LINK(PFAT_File_List, PFAT_File);
 };
@@ -85,6 +165,8 @@ static void Copy_Stat(struct VFS_File_Stat *stat, directoryEntry *entry)
     stat->isDirectory = entry->directory;
 
     stat->isSetuid = 0;
+    stat->fileId = entry->firstBlock;
+    stat->modTime = ((int) (ushort_t) entry->date << 16) | (ushort_t) entry->time;
     memset(&stat->acls, '\0', sizeof(stat->acls));
     stat->acls[0].uid = 0;
     stat->acls[0].permission = O_READ;
@@ -103,95 +185,592 @@ static int PFAT_FStat(struct File *file, struct VFS_File_Stat *stat)
 }
 
 /*
- * Read function for PFAT files.
+ * Traverse the FAT chain of a file, once to count its runs of
+ * consecutive blocks and once to record them as the extents of
+ * the file.  The caller must hold the lock of the file.
+ * Returns 0 if successful, error code otherwise.
  */
-static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes)
+static int Build_Extents(struct PFAT_Instance *instance, struct PFAT_File *pfatFile)
 {
-    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
-    struct PFAT_Instance *instance = (struct PFAT_Instance*) file->mountPoint->fsData;
-    ulong_t start = file->filePos;
-    ulong_t end = file->filePos + numBytes;
-    ulong_t startBlock, endBlock, curBlock;
+    struct PFAT_Extent *extents = 0;
+    int numExtents = 0, pass, curBlock, prevBlock = 0;
     ulong_t i;
 
-    /* Special case: can't handle reads longer than INT_MAX */
-    if (numBytes > INT_MAX)
-	return EINVALID;
+    for (pass = 0; pass < 2; ++pass) {
+	numExtents = 0;
+	curBlock = pfatFile->entry->firstBlock;
+	for (i = 0; i < pfatFile->allocBlocks; ++i) {
+	    /* Are we at a valid block? */
+	    if (curBlock == FAT_ENTRY_FREE || curBlock == FAT_ENTRY_EOF) {
+		Print("Unexpected end of file in FAT at file block %lu\n", i);
+		if (extents != 0)
+		    Free(extents);
+		return EIO;  /* probable filesystem corruption */
+	    }
 
-    /* Make sure request represents a valid range within the file */
-    if (start >= file->endPos || end > file->endPos || end < start) {
-	Debug("Invalid read position: filePos=%lu, numBytes=%lu, endPos=%lu\n",
-	    file->filePos, numBytes, file->endPos);
-	return EINVALID;
+	    /* Does this block start a new extent? */
+	    if (i == 0 || curBlock != prevBlock + 1) {
+		if (extents != 0) {
+		    extents[numExtents].fileBlock = i;
+		    extents[numExtents].devBlock = curBlock;
+		    extents[numExtents].numBlocks = 0;
+		}
+		++numExtents;
+	    }
+	    if (extents != 0)
+		++extents[numExtents - 1].numBlocks;
+
+	    /* Continue to next block */
+	    prevBlock = curBlock;
+	    curBlock = instance->fat[curBlock];
+	}
+
+	if (pass == 0 && numExtents > 0) {
+	    extents = (struct PFAT_Extent *) Malloc(numExtents * sizeof(*extents));
+	    if (extents == 0)
+		return ENOMEM;
+	}
     }
 
-    /*
-     * Now the complicated part; ensure that all blocks containing the
-     * data we need are in the file data cache.
-     */
-    startBlock = (start % SECTOR_SIZE) / SECTOR_SIZE;
-    endBlock = Round_Up_To_Block(end) / SECTOR_SIZE;
+    Debug("File at block %d has %d extents\n", pfatFile->entry->firstBlock, numExtents);
+    pfatFile->extents = extents;
+    pfatFile->numExtents = numExtents;
+    return 0;
+}
 
-    /*
-     * Traverse the FAT finding the blocks of the file.
-     * As we encounter requested blocks that aren't in the
-     * file data cache, we issue requests to read them.
-     */
-    curBlock = pfatFile->entry->firstBlock;
-    for (i = 0; i < endBlock; ++i) {
-	/* Are we at a valid block? */
-	if (curBlock == FAT_ENTRY_FREE || curBlock == FAT_ENTRY_EOF) {
-	    Print("Unexpected end of file in FAT at file block %lu\n", i);
-	    return EIO;  /* probable filesystem corruption */
+/*
+ * Find the extent holding the given file block.
+ * The file block must be within the file.
+ */
+static struct PFAT_Extent *Find_Extent(struct PFAT_File *pfatFile, ulong_t fileBlock)
+{
+    int low = 0, high = pfatFile->numExtents - 1, mid;
+
+    /* Binary search for the last extent starting at or before the block */
+    while (low < high) {
+	mid = (low + high + 1) / 2;
+	if (pfatFile->extents[mid].fileBlock <= fileBlock)
+	    low = mid;
+	else
+	    high = mid - 1;
+    }
+    return &pfatFile->extents[low];
+}
+
+/*
+ * Write count entries of the in-memory FAT, from the entry of the
+ * given block on, into the buffer cache.
+ */
+static int Write_FAT_Entries(struct Mount_Point *mountPoint, int block, int count)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+
+    return Buffer_Write(mountPoint->dev, instance->fsinfo.fileAllocationOffset,
+	block * sizeof(int), count * sizeof(int), &instance->fat[block]);
+}
+
+/*
+ * Read or write len bytes of the entries of a directory, from the
+ * given byte offset on, through the buffer cache.
+ */
+static int Dir_IO(struct Mount_Point *mountPoint, struct PFAT_Dir *dir,
+    ulong_t offset, ulong_t len, void *buf, bool write)
+{
+    char *p = (char *) buf;
+    ulong_t first, last, count;
+    int rc = 0;
+
+    while (rc == 0 && len > 0) {
+	/* As much as is in consecutive blocks at once */
+	first = last = offset / SECTOR_SIZE;
+	while ((last + 1) * SECTOR_SIZE < offset + len &&
+	       dir->blocks[last + 1] == dir->blocks[last] + 1)
+	    ++last;
+	count = (last + 1) * SECTOR_SIZE - offset;
+	if (count > len)
+	    count = len;
+
+	if (write)
+	    rc = Buffer_Write(mountPoint->dev, dir->blocks[first], offset % SECTOR_SIZE, count, p);
+	else
+	    rc = Buffer_Read(mountPoint->dev, dir->blocks[first], offset % SECTOR_SIZE, count, p);
+
+	p += count;
+	offset += count;
+	len -= count;
+    }
+    return rc;
+}
+
+/*
+ * Write a directory entry into the buffer cache.
+ */
+static int Write_Dir_Entry(struct Mount_Point *mountPoint, struct PFAT_Dir *dir, int index)
+{
+    return Dir_IO(mountPoint, dir, index * sizeof(directoryEntry), sizeof(directoryEntry),
+	DIR_ENTRY(dir, index), true);
+}
+
+/*
+ * Note in a directory entry that its file has changed, so that
+ * anything caching the file (such as the executable cache) can tell.
+ * There is no clock, so the time is in ticks since boot.
+ */
+static void Touch_Entry(directoryEntry *entry)
+{
+    entry->time = (short) g_numTicks;
+    entry->date = (short) (g_numTicks >> 16);
+}
+
+/*
+ * Free the chain of blocks starting at the given block.
+ * The caller must hold the instance lock.
+ */
+static int Free_Chain(struct Mount_Point *mountPoint, int block)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    int next, err, rc = 0;
+
+    while (block >= instance->dataStart && block < instance->numFatBlocks &&
+	   instance->fat[block] != FAT_ENTRY_FREE) {
+	next = instance->fat[block];
+	instance->fat[block] = FAT_ENTRY_FREE;
+	if ((err = Write_FAT_Entries(mountPoint, block, 1)) != 0 && rc == 0)
+	    rc = err;
+	++instance->numFree;
+	if (block < instance->nextFree)
+	    instance->nextFree = block;
+	block = next;
+    }
+    return rc;
+}
+
+/*
+ * Find free blocks for count blocks of a file: the first run of
+ * that many free blocks, or if there is none, the longest run.
+ * The search starts at the hint left by the last allocation.
+ * The caller must hold the instance lock.
+ * Returns the number of blocks found, and stores the first in *pStart.
+ */
+static int Find_Free_Run(struct PFAT_Instance *instance, int count, int *pStart)
+{
+    int block = instance->nextFree, end = instance->numFatBlocks;
+    int start, bestStart = 0, bestLength = 0;
+    bool wrapped = false;
+
+    while (bestLength < count) {
+	if (block >= end) {
+	    /* Then look before the hint */
+	    if (wrapped)
+		break;
+	    wrapped = true;
+	    end = instance->nextFree;
+	    block = instance->dataStart;
+	    continue;
+	}
+	if (instance->fat[block] != FAT_ENTRY_FREE) {
+	    ++block;
+	    continue;
 	}
 
-	/* Do we need to read this block? */
-	if (i >= startBlock) {
-	    int rc = 0;
+	start = block;
+	while (block < end && instance->fat[block] == FAT_ENTRY_FREE && block - start < count)
+	    ++block;
+	if (block - start > bestLength) {
+	    bestStart = start;
+	    bestLength = block - start;
+	}
+    }
 
-	    /* Only allow one thread at a time to read this block. */
-	    Mutex_Lock(&pfatFile->lock);
+    *pStart = bestStart;
+    return bestLength;
+}
 
-	    if (!Is_Bit_Set(pfatFile->validBlockSet, i)) {
-		/* Read block into the file data cache */
-		Debug("Reading file block %lu (device block %lu)\n", i, curBlock);
-		rc = Block_Read(file->mountPoint->dev, curBlock, pfatFile->fileDataCache + i*SECTOR_SIZE);
+/*
+ * Allocate a run of up to count free blocks, the first long enough
+ * if there is one, and link it into a FAT chain after lastBlock (or
+ * start a new chain if lastBlock is 0).  The caller must hold the
+ * instance lock, and have made sure there are free blocks.
+ * Stores the first block of the run in *pStart and its length in *pCount.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Allocate_Run(struct Mount_Point *mountPoint, int lastBlock, int count, int *pStart, int *pCount)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    int start, i, err, rc;
+
+    count = Find_Free_Run(instance, count, &start);
+    KASSERT(count > 0);
+
+    for (i = start; i < start + count - 1; ++i)
+	instance->fat[i] = i + 1;
+    instance->fat[start + count - 1] = FAT_ENTRY_EOF;
+    rc = Write_FAT_Entries(mountPoint, start, count);
+    if (lastBlock != 0) {
+	instance->fat[lastBlock] = start;
+	if ((err = Write_FAT_Entries(mountPoint, lastBlock, 1)) != 0 && rc == 0)
+	    rc = err;
+    }
+    instance->numFree -= count;
+    instance->nextFree = start + count;
 
-		if (rc == 0)
-		    /* Mark as having read this block */
-		    Set_Bit(pfatFile->validBlockSet, i);
-	    }
+    *pStart = start;
+    *pCount = count;
+    return rc;
+}
 
-	    /* Done attempting to fetch the block */
-	    Mutex_Unlock(&pfatFile->lock);
+/*
+ * Free the pages holding the data of the delayed blocks of a file.
+ */
+static void Free_Delayed_Pages(struct PFAT_File *pfatFile)
+{
+    int i;
 
-	    if (rc != 0)
-		return rc;
+    for (i = 0; i < MAX_DELAYED_PAGES; ++i) {
+	if (pfatFile->delayed[i] != 0) {
+	    Free_Page(pfatFile->delayed[i]);
+	    pfatFile->delayed[i] = 0;
+	}
+    }
+}
+
+/*
+ * Forget where the blocks of a file are, after they have changed.
+ */
+static void Drop_Extents(struct PFAT_File *pfatFile)
+{
+    if (pfatFile->extents != 0)
+	Free(pfatFile->extents);
+    pfatFile->extents = 0;
+    pfatFile->numExtents = 0;
+}
+
+/*
+ * Allocate blocks on the device for the delayed blocks of a file,
+ * link them into its FAT chain, and move their data into the buffer
+ * cache, which writes it back later.  Writes the directory entry of
+ * the file too, if it has changed.
+ * The caller must hold the lock of the file.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Allocate_Delayed_Blocks(struct Mount_Point *mountPoint, struct PFAT_File *pfatFile)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    directoryEntry *entry = pfatFile->entry;
+    int numDelayed = pfatFile->numBlocks - pfatFile->allocBlocks;
+    int done = 0, start, count, lastBlock = 0, i, n, err, rc = 0;
+    char *data;
+
+    if (numDelayed == 0 && !pfatFile->dirty)
+	return 0;
+
+    /* Find the last block the file has, to link the new ones to */
+    if (pfatFile->allocBlocks > 0 && pfatFile->extents == 0 &&
+	(rc = Build_Extents(instance, pfatFile)) != 0)
+	return rc;
+    if (pfatFile->numExtents > 0) {
+	struct PFAT_Extent *last = &pfatFile->extents[pfatFile->numExtents - 1];
+	lastBlock = last->devBlock + last->numBlocks - 1;
+    }
+
+    Mutex_Lock(&instance->lock);
+
+    if (numDelayed > instance->numFree) {
+	rc = ENOSPACE;
+	goto done;
+    }
+
+    /* An empty file may still have the block buildFat gave it */
+    if (pfatFile->allocBlocks == 0 && numDelayed > 0) {
+	rc = Free_Chain(mountPoint, entry->firstBlock);
+	entry->firstBlock = 0;
+    }
+
+    while (done < numDelayed && rc == 0) {
+	/* Link a run to the end of the file's chain */
+	rc = Allocate_Run(mountPoint, lastBlock, numDelayed - done, &start, &count);
+	Debug("Allocated %d blocks at %d for file blocks from %lu\n",
+	    count, start, pfatFile->allocBlocks + done);
+	if (lastBlock == 0)
+	    entry->firstBlock = start;
+
+	/* Move the data, as much of a page as is in the run at a time */
+	for (i = 0; i < count && rc == 0; i += n) {
+	    n = BLOCKS_PER_PAGE - (done + i) % BLOCKS_PER_PAGE;
+	    if (n > count - i)
+		n = count - i;
+	    data = pfatFile->delayed[(done + i) / BLOCKS_PER_PAGE] +
+		((done + i) % BLOCKS_PER_PAGE) * SECTOR_SIZE;
+	    rc = Buffer_Write(mountPoint->dev, start + i, 0, n * SECTOR_SIZE, data);
 	}
 
-	/* Continue to next block */
-	ulong_t nextBlock = instance->fat[curBlock];
-	curBlock = nextBlock;
+	lastBlock = start + count - 1;
+	done += count;
+    }
+
+    if (numDelayed > 0) {
+	Free_Delayed_Pages(pfatFile);
+	pfatFile->allocBlocks = pfatFile->numBlocks;
+	Drop_Extents(pfatFile);
+    }
+
+    if ((err = Write_Dir_Entry(mountPoint, pfatFile->dir, pfatFile->index)) != 0 && rc == 0)
+	rc = err;
+    pfatFile->dirty = false;
+
+done:
+    Mutex_Unlock(&instance->lock);
+    return rc;
+}
+
+/*
+ * Truncate a file to nothing, freeing its blocks.
+ * The caller must hold the lock of the file.
+ */
+static int Truncate_File(struct Mount_Point *mountPoint, struct PFAT_File *pfatFile)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    directoryEntry *entry = pfatFile->entry;
+    int rc, err;
+
+    Mutex_Lock(&instance->lock);
+    rc = Free_Chain(mountPoint, entry->firstBlock);
+    entry->firstBlock = 0;
+    entry->fileSize = 0;
+    Touch_Entry(entry);
+    if ((err = Write_Dir_Entry(mountPoint, pfatFile->dir, pfatFile->index)) != 0 && rc == 0)
+	rc = err;
+    Mutex_Unlock(&instance->lock);
+
+    Free_Delayed_Pages(pfatFile);
+    Drop_Extents(pfatFile);
+    pfatFile->numBlocks = 0;
+    pfatFile->allocBlocks = 0;
+    pfatFile->dirty = false;
+
+    return rc;
+}
+
+/*
+ * Go through the blocks holding numBytes bytes of a file from
+ * byte start on, extent by extent, and copy the part of each extent
+ * from the buffer cache into buf.  If buf is null, the extents are
+ * only prefetched into the cache, so that all of them are queued at
+ * the device before any is waited for.  Data of blocks which are not
+ * allocated yet is copied from memory.  Nothing past the end of the
+ * file is read, even if the file was truncated since the caller
+ * looked at its size.
+ * Returns the number of bytes read if successful, error code otherwise.
+ */
+static int Read_File_Blocks(struct File *file, ulong_t start, ulong_t numBytes, char *buf)
+{
+    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) file->mountPoint->fsData;
+    struct Block_Device *dev = file->mountPoint->dev;
+    ulong_t fileSize, curBlock, endBlock, offset, skip, count, len, pos, total;
+    struct PFAT_Extent *extent = 0;
+    int rc = 0;
+
+    Mutex_Lock(&pfatFile->lock);
+
+    /* The size can only change while the lock is held */
+    fileSize = pfatFile->entry->fileSize;
+    if (start >= fileSize)
+	numBytes = 0;
+    else if (numBytes > fileSize - start)
+	numBytes = fileSize - start;
+    total = numBytes;
+
+    curBlock = start / SECTOR_SIZE;
+    endBlock = Round_Up_To_Block(start + numBytes) / SECTOR_SIZE;
+    offset = start % SECTOR_SIZE;
+
+    /* Map the file the first time it is read */
+    if (pfatFile->extents == 0 && pfatFile->allocBlocks > 0)
+	rc = Build_Extents(instance, pfatFile);
+    if (rc == 0 && curBlock < pfatFile->allocBlocks)
+	extent = Find_Extent(pfatFile, curBlock);
+
+    while (rc == 0 && curBlock < endBlock && curBlock < pfatFile->allocBlocks) {
+	skip = curBlock - extent->fileBlock;
+	count = extent->numBlocks - skip;
+	if (count > endBlock - curBlock)
+	    count = endBlock - curBlock;
+
+	if (buf == 0) {
+	    Debug("Prefetching file blocks %lu-%lu (device block %lu)\n",
+		curBlock, curBlock + count - 1, extent->devBlock + skip);
+	    Buffer_Prefetch(dev, extent->devBlock + skip, count);
+	} else {
+	    len = count * SECTOR_SIZE - offset;
+	    if (len > numBytes)
+		len = numBytes;
+	    rc = Buffer_Read(dev, extent->devBlock + skip, offset, len, buf);
+	    buf += len;
+	    numBytes -= len;
+	    offset = 0;
+	}
+
+	curBlock += count;
+	++extent;
+    }
+
+    /* The rest is in the pages of the delayed blocks */
+    pos = (curBlock - pfatFile->allocBlocks) * SECTOR_SIZE + offset;
+    while (rc == 0 && buf != 0 && numBytes > 0) {
+	if (pfatFile->allocBlocks + pos / SECTOR_SIZE >= pfatFile->numBlocks ||
+		pfatFile->delayed[pos / PAGE_SIZE] == 0) {
+	    rc = EIO;
+	    break;
+	}
+	len = PAGE_SIZE - pos % PAGE_SIZE;
+	if (len > numBytes)
+	    len = numBytes;
+	memcpy(buf, pfatFile->delayed[pos / PAGE_SIZE] + pos % PAGE_SIZE, len);
+	buf += len;
+	numBytes -= len;
+	pos += len;
+    }
+
+    Mutex_Unlock(&pfatFile->lock);
+
+    return rc == 0 ? (int) total : rc;
+}
+
+/*
+ * Read function for PFAT files.
+ */
+static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes)
+{
+    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
+    ulong_t start = file->filePos;
+    ulong_t end = file->filePos + numBytes;
+    int rc;
+
+    /* Special case: can't handle reads longer than INT_MAX */
+    if (numBytes > INT_MAX || end < start)
+	return EINVALID;
+
+    /* The file may have been written through another File object */
+    file->endPos = pfatFile->entry->fileSize;
+
+    /* Read no further than the end of the file */
+    if (start >= file->endPos)
+	return 0;
+    if (end > file->endPos) {
+	end = file->endPos;
+	numBytes = end - start;
     }
 
     /*
-     * All cached data we need is up to date,
-     * so just copy it into the caller's buffer.
+     * Start reading all blocks which aren't in the buffer cache yet,
+     * then copy the data out as it arrives.
      */
-    memcpy(buf, pfatFile->fileDataCache + start, numBytes);
+    rc = Read_File_Blocks(file, start, numBytes, 0);
+    if (rc >= 0)
+	rc = Read_File_Blocks(file, start, numBytes, (char *) buf);
+    if (rc < 0)
+	return rc;
 
     Debug("Read satisfied!\n");
 
-    return numBytes;
+    file->filePos = start + rc;
+    return rc;
+}
+
+/*
+ * Readahead function for PFAT files.
+ */
+static int PFAT_Readahead(struct File *file, ulong_t pos, ulong_t numBytes)
+{
+    return Read_File_Blocks(file, pos, numBytes, 0);
 }
 
 /*
  * Write function for PFAT files.
+ * Blocks the file has on the device are overwritten in the buffer
+ * cache; data past them is kept in memory until blocks are allocated.
  */
 static int PFAT_Write(struct File *file, void *buf, ulong_t numBytes)
 {
-    /* Read only fs: writes not allowed */
-    return EACCESS;
+    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) file->mountPoint->fsData;
+    directoryEntry *entry = pfatFile->entry;
+    const char *src = (const char *) buf;
+    ulong_t pos = file->filePos, block, len, index;
+    struct PFAT_Extent *extent;
+    int rc = 0;
+
+    if (!(file->mode & O_WRITE))
+	return EACCESS;
+    if (numBytes > INT_MAX)
+	return EINVALID;
+
+    Mutex_Lock(&pfatFile->lock);
+
+    /* The file may have been truncated through another File object */
+    if (pos > (ulong_t) entry->fileSize)
+	rc = EINVALID;
+
+    while (rc == 0 && numBytes > 0) {
+	block = pos / SECTOR_SIZE;
+
+	if (block < pfatFile->allocBlocks) {
+	    /* Overwrite blocks the file has on the device */
+	    if (pfatFile->extents == 0 && (rc = Build_Extents(instance, pfatFile)) != 0)
+		break;
+	    extent = Find_Extent(pfatFile, block);
+	    len = (extent->fileBlock + extent->numBlocks) * SECTOR_SIZE - pos;
+	    if (len > numBytes)
+		len = numBytes;
+	    rc = Buffer_Write(file->mountPoint->dev, extent->devBlock + (block - extent->fileBlock),
+		pos % SECTOR_SIZE, len, src);
+	} else {
+	    /* Keep the data of new blocks in memory */
+	    index = pos - pfatFile->allocBlocks * SECTOR_SIZE;
+	    if (index / PAGE_SIZE >= MAX_DELAYED_PAGES) {
+		rc = Allocate_Delayed_Blocks(file->mountPoint, pfatFile);
+		continue;
+	    }
+	    if (pfatFile->delayed[index / PAGE_SIZE] == 0) {
+		char *page = Alloc_Page();
+		if (page == 0) {
+		    /* Make room by allocating the blocks we have */
+		    rc = pfatFile->numBlocks > pfatFile->allocBlocks ?
+			Allocate_Delayed_Blocks(file->mountPoint, pfatFile) : ENOMEM;
+		    continue;
+		}
+		memset(page, '\0', PAGE_SIZE);
+		pfatFile->delayed[index / PAGE_SIZE] = page;
+	    }
+	    len = PAGE_SIZE - index % PAGE_SIZE;
+	    if (len > numBytes)
+		len = numBytes;
+	    memcpy(pfatFile->delayed[index / PAGE_SIZE] + index % PAGE_SIZE, src, len);
+	}
+
+	if (rc == 0) {
+	    src += len;
+	    pos += len;
+	    numBytes -= len;
+	    if (pos > (ulong_t) entry->fileSize) {
+		entry->fileSize = pos;
+		pfatFile->numBlocks = Round_Up_To_Block(pos) / SECTOR_SIZE;
+	    }
+	}
+    }
+
+    if (pos != file->filePos) {
+	Touch_Entry(entry);
+	pfatFile->dirty = true;
+	rc = pos - file->filePos;
+	file->filePos = pos;
+    }
+    file->endPos = entry->fileSize;
+
+    Mutex_Unlock(&pfatFile->lock);
+
+    return rc;
 }
 
 /*
@@ -199,7 +778,11 @@ static int PFAT_Write(struct File *file, void *buf, ulong_t numBytes)
  */
 static int PFAT_Seek(struct File *file, ulong_t pos)
 {
-    if (pos >= file->endPos)
+    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
+
+    /* Files open for writing may also be positioned at their end */
+    file->endPos = pfatFile->entry->fileSize;
+    if (pos > file->endPos || (pos == file->endPos && !(file->mode & O_WRITE)))
 	return EINVALID;
      file->filePos = pos;
      return 0;
@@ -210,12 +793,26 @@ static int PFAT_Seek(struct File *file, ulong_t pos)
  */
 static int PFAT_Close(struct File *file)
 {
+    struct PFAT_File *pfatFile = (struct PFAT_File*) file->fsData;
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) file->mountPoint->fsData;
+    int rc = 0;
+
+    /* The file has probably been written completely: place its new blocks */
+    if (file->mode & O_WRITE) {
+	Mutex_Lock(&pfatFile->lock);
+	rc = Allocate_Delayed_Blocks(file->mountPoint, pfatFile);
+	Mutex_Unlock(&pfatFile->lock);
+    }
+
     /*
-     * The PFAT_File object caching the contents of the file
-     * will remain in the PFAT_Instance object, to speed up
-     * future accesses to this file.
+     * The PFAT_File object will remain in the PFAT_Instance
+     * object, to speed up future accesses to this file.
      */
-    return 0;
+    Mutex_Lock(&instance->lock);
+    --pfatFile->openCount;
+    Mutex_Unlock(&instance->lock);
+
+    return rc;
 }
 
 /*
@@ -228,13 +825,13 @@ static struct File_Ops s_pfatFileOps = {
     &PFAT_Seek,
     &PFAT_Close,
     0, /* Read_Entry */
+    &PFAT_Readahead,
 };
 
 static int PFAT_FStat_Dir(struct File *dir, struct VFS_File_Stat *stat)
 {
-    /* FIXME: for now, there is only one directory */
-    struct PFAT_Instance *instance = (struct PFAT_Instance*) dir->mountPoint->fsData;
-    Copy_Stat(stat, &instance->rootDirEntry);
+    struct PFAT_Dir *pfatDir = (struct PFAT_Dir*) dir->fsData;
+    Copy_Stat(stat, pfatDir->self);
     return 0;
 }
 
@@ -243,7 +840,12 @@ static int PFAT_FStat_Dir(struct File *dir, struct VFS_File_Stat *stat)
  */
 static int PFAT_Close_Dir(struct File *dir)
 {
-    /* This is a no-op. */
+    struct PFAT_Dir *pfatDir = (struct PFAT_Dir*) dir->fsData;
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) dir->mountPoint->fsData;
+
+    Mutex_Lock(&instance->lock);
+    --pfatDir->openCount;
+    Mutex_Unlock(&instance->lock);
     return 0;
 }
 
@@ -253,12 +855,22 @@ static int PFAT_Close_Dir(struct File *dir)
 static int PFAT_Read_Entry(struct File *dir, struct VFS_Dir_Entry *entry)
 {
     directoryEntry *pfatDirEntry;
+    struct PFAT_Dir *pfatDir = (struct PFAT_Dir*) dir->fsData;
     struct PFAT_Instance *instance = (struct PFAT_Instance*) dir->mountPoint->fsData;
+    int rc = 0;
 
-    if (dir->filePos >= dir->endPos)
-	return VFS_NO_MORE_DIR_ENTRIES; /* Reached the end of the directory. */
+    Mutex_Lock(&instance->lock);
 
-    pfatDirEntry = &instance->rootDir[dir->filePos++];
+    /* Skip free entries; the directory may have grown since it was opened */
+    dir->endPos = pfatDir->numEntries;
+    do {
+	if (dir->filePos >= dir->endPos) {
+	    rc = VFS_NO_MORE_DIR_ENTRIES; /* Reached the end of the directory. */
+	    goto done;
+	}
+	pfatDirEntry = DIR_ENTRY(pfatDir, dir->filePos);
+	++dir->filePos;
+    } while (pfatDirEntry->fileName[0] == '\0');
 
     /*
      * Note: we don't need to bounds check here, because
@@ -270,7 +882,9 @@ static int PFAT_Read_Entry(struct File *dir, struct VFS_Dir_Entry *entry)
 
     Copy_Stat(&entry->stats, pfatDirEntry);
 
-    return 0;
+done:
+    Mutex_Unlock(&instance->lock);
+    return rc;
 }
 
 /*
@@ -283,111 +897,473 @@ static struct File_Ops s_pfatDirOps = {
     0, /* Seek */
     &PFAT_Close_Dir,
     &PFAT_Read_Entry,
+    0, /* Readahead */
 };
 
 /*
- * Look up a directory entry in a PFAT filesystem.
+ * Hash the name in a directory entry.
+ */
+static uint_t Hash_Name(const char *name)
+{
+    uint_t hash = 0;
+    int i;
+
+    for (i = 0; i < MAX_NAME_LEN && name[i] != '\0'; ++i)
+	hash = hash * 31 + (uchar_t) name[i];
+    return hash;
+}
+
+static void Hash_Insert(struct PFAT_Dir *dir, int index)
+{
+    uint_t bucket = Hash_Name(DIR_ENTRY(dir, index)->fileName) & (dir->numBuckets - 1);
+
+    DIR_HASH_NEXT(dir, index) = dir->buckets[bucket];
+    dir->buckets[bucket] = index;
+}
+
+static void Hash_Remove(struct PFAT_Dir *dir, int index)
+{
+    int *link = &dir->buckets[Hash_Name(DIR_ENTRY(dir, index)->fileName) & (dir->numBuckets - 1)];
+
+    while (*link != index) {
+	KASSERT(*link >= 0);
+	link = &DIR_HASH_NEXT(dir, *link);
+    }
+    *link = DIR_HASH_NEXT(dir, index);
+}
+
+/*
+ * Build the hash table of a directory anew, with about
+ * one bucket for each entry.
+ */
+static int Rehash_Dir(struct PFAT_Dir *dir)
+{
+    int numBuckets = 16, *buckets, i;
+
+    while (numBuckets < dir->numEntries)
+	numBuckets *= 2;
+    if ((buckets = (int *) Malloc(numBuckets * sizeof(int))) == 0)
+	return ENOMEM;
+    for (i = 0; i < numBuckets; ++i)
+	buckets[i] = -1;
+
+    if (dir->buckets != 0)
+	Free(dir->buckets);
+    dir->buckets = buckets;
+    dir->numBuckets = numBuckets;
+
+    for (i = 0; i < dir->numEntries; ++i) {
+	if (DIR_ENTRY(dir, i)->fileName[0] != '\0')
+	    Hash_Insert(dir, i);
+    }
+    return 0;
+}
+
+/*
+ * Find the entry with the given name in a directory.
+ * Returns its index, or -1 if there is none.
+ */
+static int Find_Entry(struct PFAT_Dir *dir, const char *name)
+{
+    int i;
+
+    for (i = dir->buckets[Hash_Name(name) & (dir->numBuckets - 1)]; i >= 0; i = DIR_HASH_NEXT(dir, i)) {
+	if (strncmp(DIR_ENTRY(dir, i)->fileName, name, MAX_NAME_LEN) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+/*
+ * Free a directory loaded into memory.
  */
-static directoryEntry *PFAT_Lookup(struct PFAT_Instance *instance, const char *path)
+static void Free_Dir(struct PFAT_Dir *dir)
 {
-    directoryEntry *rootDir = instance->rootDir;
-    bootSector *fsinfo = &instance->fsinfo;
     int i;
 
+    for (i = 0; i < dir->numChunks; ++i) {
+	if (dir->chunks[i] != 0)
+	    Free(dir->chunks[i]);
+    }
+    if (dir->chunks != 0)
+	Free(dir->chunks);
+    if (dir->blocks != 0)
+	Free(dir->blocks);
+    if (dir->buckets != 0)
+	Free(dir->buckets);
+    Free(dir);
+}
+
+/*
+ * Load the directory with the given entry into memory.  The entries
+ * of the root directory are in consecutive blocks, those of other
+ * directories in the FAT chain of their entry.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Load_Dir(struct Mount_Point *mountPoint, struct PFAT_Dir *parent, int index,
+    directoryEntry *self, struct PFAT_Dir **pDir)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    struct PFAT_Dir *dir;
+    int block, count, i, rc = 0;
+
+    if ((dir = (struct PFAT_Dir*) Malloc(sizeof(*dir))) == 0)
+	return ENOMEM;
+    memset(dir, '\0', sizeof(*dir));
+    dir->self = self;
+    dir->parent = parent;
+    dir->selfIndex = index;
+    dir->numEntries = self->fileSize / sizeof(directoryEntry);
+    dir->numBlocks = Round_Up_To_Block(self->fileSize) / SECTOR_SIZE;
+    dir->numChunks = (dir->numEntries + DIR_CHUNK_ENTRIES - 1) / DIR_CHUNK_ENTRIES;
+
+    if (dir->numBlocks > 0 &&
+	(dir->blocks = (int *) Malloc(dir->numBlocks * sizeof(int))) == 0)
+	goto memfail;
+    if (dir->numChunks > 0) {
+	if ((dir->chunks = (struct PFAT_Dir_Chunk **) Malloc(dir->numChunks * sizeof(*dir->chunks))) == 0)
+	    goto memfail;
+	memset(dir->chunks, '\0', dir->numChunks * sizeof(*dir->chunks));
+    }
+    for (i = 0; i < dir->numChunks; ++i) {
+	if ((dir->chunks[i] = (struct PFAT_Dir_Chunk *) Malloc(sizeof(struct PFAT_Dir_Chunk))) == 0)
+	    goto memfail;
+	memset(dir->chunks[i], '\0', sizeof(struct PFAT_Dir_Chunk));
+    }
+
+    /* Find where the entries are */
+    block = parent == 0 ? instance->fsinfo.rootDirectoryOffset : self->firstBlock;
+    for (i = 0; i < dir->numBlocks; ++i) {
+	if (parent != 0 && (block < instance->dataStart || block >= instance->numFatBlocks)) {
+	    Print("PFAT: bad block %d in directory %s\n", block, self->fileName);
+	    rc = EINVALIDFS;
+	    goto fail;
+	}
+	dir->blocks[i] = block;
+	block = parent == 0 ? block + 1 : instance->fat[block];
+    }
+
+    /* Queue reads of all of them, then copy them chunk by chunk */
+    for (i = 0; i < dir->numBlocks; i += count) {
+	for (count = 1; i + count < dir->numBlocks &&
+		 dir->blocks[i + count] == dir->blocks[i] + count; ++count)
+	    ;
+	Buffer_Prefetch(mountPoint->dev, dir->blocks[i], count);
+    }
+    for (i = 0; i < dir->numChunks && rc == 0; ++i) {
+	count = dir->numEntries - i * DIR_CHUNK_ENTRIES;
+	if (count > DIR_CHUNK_ENTRIES)
+	    count = DIR_CHUNK_ENTRIES;
+	rc = Dir_IO(mountPoint, dir, i * DIR_CHUNK_ENTRIES * sizeof(directoryEntry),
+	    count * sizeof(directoryEntry), dir->chunks[i]->entry, false);
+    }
+    if (rc != 0 || (rc = Rehash_Dir(dir)) != 0)
+	goto fail;
+
+    Debug("Loaded directory %s: %d entries in %d blocks\n",
+	parent == 0 ? "/" : self->fileName, dir->numEntries, dir->numBlocks);
+    *pDir = dir;
+    return 0;
+
+memfail:
+    rc = ENOMEM;
+fail:
+    Free_Dir(dir);
+    return rc;
+}
+
+/*
+ * Get the subdirectory with the given entry of a directory,
+ * loading it if this is the first time it is looked into.
+ * The caller must hold the instance lock.
+ */
+static int Get_Subdir(struct Mount_Point *mountPoint, struct PFAT_Dir *dir, int index, struct PFAT_Dir **pSubdir)
+{
+    directoryEntry *entry = DIR_ENTRY(dir, index);
+    struct PFAT_Dir *subdir;
+    int rc;
+
+    if (!entry->directory)
+	return ENOTDIR;
+
+    if (DIR_SUBDIR(dir, index) == 0) {
+	if ((rc = Load_Dir(mountPoint, dir, index, entry, &subdir)) != 0)
+	    return rc;
+	DIR_SUBDIR(dir, index) = subdir;
+    }
+
+    *pSubdir = DIR_SUBDIR(dir, index);
+    return 0;
+}
+
+/*
+ * Find the directory holding what a path names, going through the
+ * directories on the way, and copy the last component of the path
+ * (empty for the root directory) to name, which has room for
+ * MAX_NAME_LEN characters.
+ * The caller must hold the instance lock.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Lookup_Parent(struct Mount_Point *mountPoint, const char *path, struct PFAT_Dir **pDir, char *name)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    struct PFAT_Dir *dir = instance->rootDir;
+    const char *end;
+    int index, rc;
+
     KASSERT(*path == '/');
+    name[0] = '\0';
+
+    for (;;) {
+	while (*path == '/')
+	    ++path;
+	if (*path == '\0')
+	    break;
+
+	/* There is more, so the previous component is a directory */
+	if (name[0] != '\0') {
+	    if ((index = Find_Entry(dir, name)) < 0)
+		return ENOTFOUND;
+	    if ((rc = Get_Subdir(mountPoint, dir, index, &dir)) != 0)
+		return rc;
+	}
+
+	end = strchr(path, '/');
+	if (end == 0)
+	    end = path + strlen(path);
+	if (end - path > MAX_NAME_LEN)
+	    return ENAMETOOLONG;
+	memcpy(name, path, end - path);
+	name[end - path] = '\0';
+	path = end;
+    }
+
+    *pDir = dir;
+    return 0;
+}
+
+/*
+ * Look up a directory entry in a PFAT filesystem.  If it is found,
+ * the directory holding it and its index there are stored in *pDir
+ * and *pIndex (null and -1 for the root directory).
+ * The caller must hold the instance lock.
+ */
+static directoryEntry *PFAT_Lookup(struct Mount_Point *mountPoint, const char *path,
+    struct PFAT_Dir **pDir, int *pIndex)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    char name[MAX_NAME_LEN + 1];
+    struct PFAT_Dir *dir;
+    int index;
+
+    if (Lookup_Parent(mountPoint, path, &dir, name) != 0)
+	return 0;
 
     /* Special case: root directory. */
-    if (strcmp(path, "/") == 0)
+    if (name[0] == '\0') {
+	*pDir = 0;
+	*pIndex = -1;
 	return &instance->rootDirEntry;
+    }
 
-    /* Skip leading '/' character. */
-    ++path;
+    if ((index = Find_Entry(dir, name)) < 0)
+	return 0;  /* Not found. */
 
-    /*
-     * FIXME: Eventually, we should try to implement hierarchical
-     * directory structure.  For now, only the root directory
-     * is supported.
-     */
-    for (i = 0; i < fsinfo->rootDirectoryCount; ++i) {
-    	directoryEntry *entry = &rootDir[i];
-	if (strcmp(entry->fileName, path) == 0) {
-	    /* Found it! */
-	    Debug("Found matching dir entry for %s\n", path);
-	    return entry;
-	}
+    Debug("Found matching dir entry for %s\n", path);
+    *pDir = dir;
+    *pIndex = index;
+    return DIR_ENTRY(dir, index);
+}
+
+/*
+ * Make room for more entries in a directory, by adding free entries
+ * up to the end of the next chunk.  The root directory cannot grow.
+ * The caller must hold the instance lock.
+ */
+static int Grow_Dir(struct Mount_Point *mountPoint, struct PFAT_Dir *dir)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    int numEntries = (dir->numEntries / DIR_CHUNK_ENTRIES + 1) * DIR_CHUNK_ENTRIES;
+    int numBlocks = Round_Up_To_Block(numEntries * sizeof(directoryEntry)) / SECTOR_SIZE;
+    struct PFAT_Dir_Chunk **chunks = 0, *chunk = 0;
+    int *blocks;
+    int lastBlock, start, count, i, j, err, rc = 0;
+
+    if (dir->parent == 0 || numBlocks - dir->numBlocks > instance->numFree)
+	return ENOSPACE;
+
+    /* Get the memory first, so that failing leaves the directory as it was */
+    blocks = (int *) Malloc(numBlocks * sizeof(int));
+    if (numEntries > dir->numChunks * DIR_CHUNK_ENTRIES) {
+	chunks = (struct PFAT_Dir_Chunk **) Malloc((dir->numChunks + 1) * sizeof(*chunks));
+	chunk = (struct PFAT_Dir_Chunk *) Malloc(sizeof(*chunk));
+	if (chunks == 0 || chunk == 0)
+	    goto memfail;
     }
+    if (blocks == 0)
+	goto memfail;
 
-    /* Not found. */
-    return 0;
+    if (chunk != 0) {
+	memset(chunk, '\0', sizeof(*chunk));
+	memcpy(chunks, dir->chunks, dir->numChunks * sizeof(*chunks));
+	chunks[dir->numChunks] = chunk;
+	if (dir->chunks != 0)
+	    Free(dir->chunks);
+	dir->chunks = chunks;
+	++dir->numChunks;
+    }
+
+    /* Add blocks to the end of the directory's chain */
+    memcpy(blocks, dir->blocks, dir->numBlocks * sizeof(int));
+    lastBlock = dir->numBlocks > 0 ? dir->blocks[dir->numBlocks - 1] : 0;
+    for (i = dir->numBlocks; i < numBlocks; i += count) {
+	if ((err = Allocate_Run(mountPoint, lastBlock, numBlocks - i, &start, &count)) != 0 && rc == 0)
+	    rc = err;
+	if (lastBlock == 0)
+	    dir->self->firstBlock = start;
+	for (j = 0; j < count; ++j)
+	    blocks[i + j] = start + j;
+	lastBlock = start + count - 1;
+    }
+    if (dir->blocks != 0)
+	Free(dir->blocks);
+    dir->blocks = blocks;
+    dir->numBlocks = numBlocks;
+
+    /* The new entries are free, that is zeroed, in memory already */
+    if ((err = Dir_IO(mountPoint, dir, dir->numEntries * sizeof(directoryEntry),
+	    (numEntries - dir->numEntries) * sizeof(directoryEntry),
+	    DIR_ENTRY(dir, dir->numEntries), true)) != 0 && rc == 0)
+	rc = err;
+    dir->numEntries = numEntries;
+
+    dir->self->fileSize = numEntries * sizeof(directoryEntry);
+    Touch_Entry(dir->self);
+    if ((err = Write_Dir_Entry(mountPoint, dir->parent, dir->selfIndex)) != 0 && rc == 0)
+	rc = err;
+
+    /* If the hash table can't grow, the old one still works */
+    if (dir->numEntries > 2 * dir->numBuckets)
+	Rehash_Dir(dir);
+
+    Debug("Directory %s grew to %d entries\n", dir->self->fileName, numEntries);
+    return rc;
+
+memfail:
+    if (blocks != 0)
+	Free(blocks);
+    if (chunks != 0)
+	Free(chunks);
+    if (chunk != 0)
+	Free(chunk);
+    return ENOMEM;
+}
+
+/*
+ * Create an empty entry with the given name in a directory,
+ * in a free entry, growing the directory if there is none.
+ * The caller must hold the instance lock.
+ */
+static int Create_Entry(struct Mount_Point *mountPoint, struct PFAT_Dir *dir, const char *name, int *pIndex)
+{
+    directoryEntry *entry;
+    int index, rc;
+
+    if (strlen(name) >= MAX_NAME_LEN)
+	return ENAMETOOLONG;
+
+    for (index = dir->freeHint; index < dir->numEntries; ++index) {
+	if (DIR_ENTRY(dir, index)->fileName[0] == '\0')
+	    break;
+    }
+    if (index == dir->numEntries && (rc = Grow_Dir(mountPoint, dir)) != 0)
+	return rc;
+    dir->freeHint = index + 1;
+
+    entry = DIR_ENTRY(dir, index);
+    memset(entry, '\0', sizeof(*entry));
+    strcpy(entry->fileName, name);
+    Touch_Entry(entry);
+    Hash_Insert(dir, index);
+
+    *pIndex = index;
+    return Write_Dir_Entry(mountPoint, dir, index);
+}
+
+/*
+ * Free an entry of a directory.
+ * The caller must hold the instance lock.
+ */
+static int Remove_Entry(struct Mount_Point *mountPoint, struct PFAT_Dir *dir, int index)
+{
+    Hash_Remove(dir, index);
+    memset(DIR_ENTRY(dir, index), '\0', sizeof(directoryEntry));
+    if (index < dir->freeHint)
+	dir->freeHint = index;
+    return Write_Dir_Entry(mountPoint, dir, index);
 }
 
 /*
  * Get a PFAT_File object representing the file whose directory entry
- * is given.
+ * is given, and count one more File object using it.
+ * The caller must hold the instance lock.
  */
-static struct PFAT_File *Get_PFAT_File(struct PFAT_Instance *instance, directoryEntry *entry)
+static struct PFAT_File *Get_PFAT_File(struct PFAT_Instance *instance, struct PFAT_Dir *dir, int index)
 {
+    directoryEntry *entry = DIR_ENTRY(dir, index);
     ulong_t numBlocks;
     struct PFAT_File *pfatFile = 0;
-    char *fileDataCache = 0;
-    struct Bit_Set *validBlockSet = 0;
 
     KASSERT(entry != 0);
     KASSERT(instance != 0);
 
-    Mutex_Lock(&instance->lock);
-
     /*
      * See if this file has already been opened.
      * If so, use the existing PFAT_File object.
      */
-    for (pfatFile = Get_Front_Of_PFAT_File_List(&instance->fileList);
-	 pfatFile != 0;
-	 pfatFile = Get_Next_In_PFAT_File_List(pfatFile)) {
-	if (pfatFile->entry == entry)
-	    break;
-    }
+    pfatFile = DIR_FILE(dir, index);
 
     if (pfatFile == 0) {
-	/* Determine size of data block cache for file. */
+	/* Determine number of blocks used by the file. */
 	numBlocks = Round_Up_To_Block(entry->fileSize) / SECTOR_SIZE;
 
-	/*
-	 * Allocate File object, PFAT_File object, file block data cache,
-	 * and valid cache block bitset
-	 */
-	if ((pfatFile = (struct PFAT_File *) Malloc(sizeof(*pfatFile))) == 0 ||
-	    (fileDataCache = Malloc(numBlocks * SECTOR_SIZE)) == 0 ||
-	    (validBlockSet = Create_Bit_Set(numBlocks)) == 0) {
-	    goto memfail;
-	}
+	/* Allocate PFAT_File object */
+	if ((pfatFile = (struct PFAT_File *) Malloc(sizeof(*pfatFile))) == 0)
+	    return 0;
 
 	/* Populate PFAT_File */
+	memset(pfatFile, '\0', sizeof(*pfatFile));
 	pfatFile->entry = entry;
+	pfatFile->dir = dir;
+	pfatFile->index = index;
 	pfatFile->numBlocks = numBlocks;
-	pfatFile->fileDataCache = fileDataCache;
-	pfatFile->validBlockSet = validBlockSet;
+	pfatFile->allocBlocks = numBlocks;
 	Mutex_Init(&pfatFile->lock);
 
-	/* Add to instance's list of PFAT_File objects. */
+	/* Add to instance's list of PFAT_File objects, and to the directory. */
 	Add_To_Back_Of_PFAT_File_List(&instance->fileList, pfatFile);
+	DIR_FILE(dir, index) = pfatFile;
 	KASSERT(pfatFile->nextPFAT_File_List == 0);
     }
 
-    /* Success! */
-    goto done;
+    ++pfatFile->openCount;
+    return pfatFile;
+}
 
-memfail:
-    if (pfatFile != 0)
-	Free(pfatFile);
-    if (fileDataCache != 0)
-	Free(fileDataCache);
-    if (validBlockSet != 0)
-	Free(validBlockSet);
+/*
+ * Create an empty file where a path says.
+ * The caller must hold the instance lock.
+ */
+static int Create_File(struct Mount_Point *mountPoint, const char *path, struct PFAT_Dir **pDir, int *pIndex)
+{
+    char name[MAX_NAME_LEN + 1];
+    int rc;
 
-done:
-    Mutex_Unlock(&instance->lock);
-    return pfatFile;
+    if ((rc = Lookup_Parent(mountPoint, path, pDir, name)) != 0)
+	return rc;
+    if (name[0] == '\0')
+	return EEXIST;  /* the root directory */
+    return Create_Entry(mountPoint, *pDir, name, pIndex);
 }
 
 /*
@@ -398,68 +1374,153 @@ static int PFAT_Open(struct Mount_Point *mountPoint, const char *path, int mode,
     int rc = 0;
     struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
     directoryEntry *entry;
+    struct PFAT_Dir *dir;
+    int index;
     struct PFAT_File *pfatFile = 0;
     struct File *file = 0;
 
-    /* Reject attempts to create or write */
-    if ((mode & (O_WRITE | O_CREATE)) != 0)
-	return EACCESS;
-
-    /* Look up the directory entry */
-    entry = PFAT_Lookup(instance, path);
-    if (entry == 0)
-	return ENOTFOUND;
+    Mutex_Lock(&instance->lock);
 
-    /* Make sure the entry is not a directory. */
-    if (entry->directory)
-	return EACCESS;
+    /* Look up the directory entry, or create it */
+    entry = PFAT_Lookup(mountPoint, path, &dir, &index);
+    if (entry == 0) {
+	if (mode & O_CREATE) {
+	    if ((rc = Create_File(mountPoint, path, &dir, &index)) == 0)
+		entry = DIR_ENTRY(dir, index);
+	} else
+	    rc = ENOTFOUND;
+    } else if ((mode & (O_CREATE | O_EXCL)) == (O_CREATE | O_EXCL))
+	rc = EEXIST;
+    else if (entry->directory)
+	rc = EACCESS;  /* Make sure the entry is not a directory. */
+    else if ((mode & (O_WRITE | O_TRUNC)) != 0 &&
+	    (entry->readOnly || entry == instance->pagefile))
+	rc = EACCESS;  /* The paging file belongs to the pager */
 
     /* Get PFAT_File object */
-    pfatFile = Get_PFAT_File(instance, entry);
-    if (pfatFile == 0)
-	goto done;
+    if (rc == 0 && (pfatFile = Get_PFAT_File(instance, dir, index)) == 0)
+	rc = ENOMEM;
+
+    Mutex_Unlock(&instance->lock);
+    if (rc != 0)
+	return rc;
+
+    if (mode & O_TRUNC) {
+	Mutex_Lock(&pfatFile->lock);
+	rc = Truncate_File(mountPoint, pfatFile);
+	Mutex_Unlock(&pfatFile->lock);
+    }
 
     /* Create the file object. */
-    file = Allocate_File(&s_pfatFileOps, 0, entry->fileSize, pfatFile, 0, 0);
-    if (file == 0) {
-	rc = ENOMEM;
-	goto done;
+    if (rc == 0) {
+	file = Allocate_File(&s_pfatFileOps, 0, entry->fileSize, pfatFile, 0, 0);
+	if (file == 0)
+	    rc = ENOMEM;
+    }
+    if (rc != 0) {
+	Mutex_Lock(&instance->lock);
+	--pfatFile->openCount;
+	Mutex_Unlock(&instance->lock);
+	return rc;
     }
 
     /* Success! */
     *pFile = file;
-
-done:
-    return rc;
+    return 0;
 }
 
 /*
  * Open_Directory function for PFAT filesystems.
+ * The directory's File object keeps the index of the next
+ * entry to read as its position.
  */
 static int PFAT_Open_Directory(struct Mount_Point *mountPoint, const char *path, struct File **pDir)
 {
-    /*
-     * FIXME: for now, we only support a single directory.
-     * This makes this function pretty simple.
-     * We just store the current cursor index in the File object.
-     */
     struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
-    struct File *dir;
+    struct PFAT_Dir *parent, *pfatDir = 0;
+    struct File *dir = 0;
+    int index, rc = 0;
+
+    Mutex_Lock(&instance->lock);
+
+    if (PFAT_Lookup(mountPoint, path, &parent, &index) == 0)
+	rc = ENOTFOUND;
+    else if (parent == 0)
+	pfatDir = instance->rootDir;
+    else
+	rc = Get_Subdir(mountPoint, parent, index, &pfatDir);
+
+    if (rc == 0) {
+	dir = Allocate_File(&s_pfatDirOps, 0, pfatDir->numEntries, pfatDir, 0, 0);
+	if (dir == 0)
+	    rc = ENOMEM;
+	else
+	    ++pfatDir->openCount;
+    }
+
+    Mutex_Unlock(&instance->lock);
+
+    if (rc == 0)
+	*pDir = dir;
+    return rc;
+}
 
-    if (strcmp(path, "/") != 0)
-	return ENOTFOUND;
+/*
+ * Create_Directory function for PFAT filesystems.
+ * A new directory has room for DIR_CHUNK_ENTRIES entries.
+ */
+static int PFAT_Create_Directory(struct Mount_Point *mountPoint, const char *path)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    int numBlocks = Round_Up_To_Block(DIR_CHUNK_ENTRIES * sizeof(directoryEntry)) / SECTOR_SIZE;
+    char name[MAX_NAME_LEN + 1];
+    struct PFAT_Dir *dir;
+    directoryEntry *entry;
+    char *zero;
+    int index, start, count, lastBlock = 0, i, err, rc;
 
-    dir = (struct File*) Malloc(sizeof(*dir));
-    if (dir == 0)
+    if ((zero = (char *) Malloc(numBlocks * SECTOR_SIZE)) == 0)
 	return ENOMEM;
+    memset(zero, '\0', numBlocks * SECTOR_SIZE);
 
-    dir->ops = &s_pfatDirOps;
-    dir->filePos = 0; /* next dir entry to be read */
-    dir->endPos = instance->fsinfo.rootDirectoryCount; /* number of directory entries */
-    dir->fsData = 0;
+    Mutex_Lock(&instance->lock);
 
-    *pDir = dir;
-    return 0;
+    if ((rc = Lookup_Parent(mountPoint, path, &dir, name)) != 0)
+	goto done;
+    if (name[0] == '\0' || Find_Entry(dir, name) >= 0) {
+	rc = EEXIST;
+	goto done;
+    }
+    if ((rc = Create_Entry(mountPoint, dir, name, &index)) != 0)
+	goto done;
+    if (numBlocks > instance->numFree) {
+	/* Making room for the entry may have taken the last blocks */
+	Remove_Entry(mountPoint, dir, index);
+	rc = ENOSPACE;
+	goto done;
+    }
+    entry = DIR_ENTRY(dir, index);
+
+    /* Give it blocks of free entries */
+    for (i = 0; i < numBlocks; i += count) {
+	if ((err = Allocate_Run(mountPoint, lastBlock, numBlocks - i, &start, &count)) != 0 && rc == 0)
+	    rc = err;
+	if (lastBlock == 0)
+	    entry->firstBlock = start;
+	if ((err = Buffer_Write(mountPoint->dev, start, 0, count * SECTOR_SIZE, zero)) != 0 && rc == 0)
+	    rc = err;
+	lastBlock = start + count - 1;
+    }
+
+    entry->directory = 1;
+    entry->fileSize = DIR_CHUNK_ENTRIES * sizeof(directoryEntry);
+    if ((err = Write_Dir_Entry(mountPoint, dir, index)) != 0 && rc == 0)
+	rc = err;
+
+done:
+    Mutex_Unlock(&instance->lock);
+    Free(zero);
+    return rc;
 }
 
 /*
@@ -469,19 +1530,23 @@ static int PFAT_Stat(struct Mount_Point *mountPoint, const char *path, struct VF
 {
     struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
     directoryEntry *entry;
+    struct PFAT_Dir *dir;
+    int index, rc = 0;
 
     KASSERT(path != 0);
     KASSERT(stat != 0);
 
     Debug("PFAT_Stat(%s)\n", path);
 
-    entry = PFAT_Lookup(instance, path);
+    Mutex_Lock(&instance->lock);
+    entry = PFAT_Lookup(mountPoint, path, &dir, &index);
     if (entry == 0)
-	return ENOTFOUND;
-
-    Copy_Stat(stat, entry);
+	rc = ENOTFOUND;
+    else
+	Copy_Stat(stat, entry);
+    Mutex_Unlock(&instance->lock);
 
-    return 0;
+    return rc;
 }
 
 /*
@@ -489,38 +1554,152 @@ static int PFAT_Stat(struct Mount_Point *mountPoint, const char *path, struct VF
  */
 static int PFAT_Sync(struct Mount_Point *mountPoint)
 {
-    /* Read only filesystem: this is a no-op. */
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    struct PFAT_File *pfatFile;
+    int err, rc = 0;
+
+    /*
+     * Place the delayed blocks of every file.  Counting each file as
+     * open while its lock is taken keeps it from being deleted, and
+     * its PFAT_File object from being freed with its directory.
+     */
+    Mutex_Lock(&instance->lock);
+    for (pfatFile = Get_Front_Of_PFAT_File_List(&instance->fileList);
+	 pfatFile != 0;
+	 pfatFile = Get_Next_In_PFAT_File_List(pfatFile)) {
+	++pfatFile->openCount;
+	Mutex_Unlock(&instance->lock);
+
+	Mutex_Lock(&pfatFile->lock);
+	err = Allocate_Delayed_Blocks(mountPoint, pfatFile);
+	Mutex_Unlock(&pfatFile->lock);
+	if (err != 0 && rc == 0)
+	    rc = err;
+
+	Mutex_Lock(&instance->lock);
+	--pfatFile->openCount;
+    }
+    Mutex_Unlock(&instance->lock);
+
+    /* Then write back everything */
+    err = Flush_Buffers(mountPoint->dev);
+    return rc != 0 ? rc : err;
+}
+
+/*
+ * Check that a directory can be deleted, that is it is empty and not
+ * being read, and free it and the PFAT_File objects of files which
+ * were in it.  The caller must hold the instance lock.
+ */
+static int Forget_Dir(struct Mount_Point *mountPoint, struct PFAT_Dir *parent, int index)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    struct PFAT_Dir *dir;
+    struct PFAT_File *pfatFile, *next;
+    int i, rc;
+
+    if ((rc = Get_Subdir(mountPoint, parent, index, &dir)) != 0)
+	return rc;
+    if (dir->openCount > 0)
+	return EBUSY;
+    for (i = 0; i < dir->numEntries; ++i) {
+	if (DIR_ENTRY(dir, i)->fileName[0] != '\0')
+	    return EBUSY;  /* Not empty */
+    }
+    for (pfatFile = Get_Front_Of_PFAT_File_List(&instance->fileList);
+	 pfatFile != 0;
+	 pfatFile = Get_Next_In_PFAT_File_List(pfatFile)) {
+	if (pfatFile->dir == dir && pfatFile->openCount > 0)
+	    return EBUSY;
+    }
+
+    for (pfatFile = Get_Front_Of_PFAT_File_List(&instance->fileList); pfatFile != 0; pfatFile = next) {
+	next = Get_Next_In_PFAT_File_List(pfatFile);
+	if (pfatFile->dir == dir) {
+	    Remove_From_PFAT_File_List(&instance->fileList, pfatFile);
+	    Free_Delayed_Pages(pfatFile);
+	    Drop_Extents(pfatFile);
+	    Free(pfatFile);
+	}
+    }
+
+    DIR_SUBDIR(parent, index) = 0;
+    Free_Dir(dir);
     return 0;
 }
 
+/*
+ * Delete function for PFAT filesystems.
+ * Files which are open cannot be deleted, nor directories
+ * which are open or not empty.
+ */
+static int PFAT_Delete(struct Mount_Point *mountPoint, const char *path)
+{
+    struct PFAT_Instance *instance = (struct PFAT_Instance*) mountPoint->fsData;
+    struct PFAT_File *pfatFile = 0;
+    struct PFAT_Dir *dir;
+    directoryEntry *entry;
+    int index, rc = 0, err;
+
+    Mutex_Lock(&instance->lock);
+
+    entry = PFAT_Lookup(mountPoint, path, &dir, &index);
+    if (entry == 0)
+	rc = ENOTFOUND;
+    else if (dir == 0 || entry->readOnly || entry == instance->pagefile)
+	rc = EACCESS;  /* The root directory, a read only file, or the paging file */
+    else if (entry->directory)
+	rc = Forget_Dir(mountPoint, dir, index);
+    else if ((pfatFile = DIR_FILE(dir, index)) != 0 && pfatFile->openCount > 0)
+	rc = EBUSY;
+
+    if (rc == 0) {
+	/*
+	 * The PFAT_File object stays, empty, for whichever file
+	 * gets this directory entry next.
+	 */
+	if (pfatFile != 0) {
+	    Free_Delayed_Pages(pfatFile);
+	    Drop_Extents(pfatFile);
+	    pfatFile->numBlocks = 0;
+	    pfatFile->allocBlocks = 0;
+	    pfatFile->dirty = false;
+	}
+	rc = Free_Chain(mountPoint, entry->firstBlock);
+	if ((err = Remove_Entry(mountPoint, dir, index)) != 0 && rc == 0)
+	    rc = err;
+    }
+
+    Mutex_Unlock(&instance->lock);
+    return rc;
+}
+
 /*
  * Mount_Point_Ops for PFAT filesystem.
  */
 struct Mount_Point_Ops s_pfatMountPointOps = {
     PFAT_Open,
-    0,				/* Create_Directory() */
+    PFAT_Create_Directory,
     PFAT_Open_Directory,
     PFAT_Stat,
     PFAT_Sync,
-    0                          /* Delete */
+    PFAT_Delete,
 };
 
 /*
  * If the given PFAT instance has a paging file,
- * register it as the paging device, unless a paging device
- * has already been registered.
+ * register it as a paging device.
  */
 static void PFAT_Register_Paging_File(struct Mount_Point *mountPoint, struct PFAT_Instance *instance)
 {
     directoryEntry *pagefileEntry;
+    struct PFAT_Dir *dir;
+    int index;
     struct Paging_Device *pagedev = 0;
     size_t nameLen;
     char *fileName = 0;
 
-    if (Get_Paging_Device() != 0)
-	return;  /* A paging device is already registered */
-
-    pagefileEntry = PFAT_Lookup(instance, PAGEFILE_FILENAME);
+    pagefileEntry = PFAT_Lookup(mountPoint, PAGEFILE_FILENAME, &dir, &index);
     if (pagefileEntry == 0)
 	return;  /* No paging file in this filesystem */
 
@@ -543,9 +1722,15 @@ static void PFAT_Register_Paging_File(struct Mount_Point *mountPoint, struct PFA
     pagedev->dev = mountPoint->dev;
     pagedev->startSector = pagefileEntry->firstBlock;
     pagedev->numSectors = pagefileEntry->fileSize / SECTOR_SIZE;
+    pagedev->priority = PAGEFILE_PRIORITY;
 
-    /* Register it */
+    /*
+     * Register it.  From now on the entry is checked by the
+     * functions which could change the file, whatever path
+     * is used to name it.
+     */
     Register_Paging_Device(pagedev);
+    instance->pagefile = pagefileEntry;
     return;
 
 memfail:
@@ -564,10 +1749,8 @@ static int PFAT_Mount(struct Mount_Point *mountPoint)
 {
     struct PFAT_Instance *instance = 0;
     bootSector *fsinfo;
-    void *bootSect = 0;
     int rootDirSize;
-    int rc;
-    int i;
+    int i, rc;
 
     /* Allocate instance. */
     instance = (struct PFAT_Instance*) Malloc(sizeof(*instance));
@@ -578,21 +1761,12 @@ static int PFAT_Mount(struct Mount_Point *mountPoint)
     Debug("Created instance object\n");
 
     /*
-     * Allocate buffer to read bootsector,
+     * Read the filesystem parameters from the boot sector,
      * which contains metainformation about the PFAT filesystem.
      */
-    bootSect = Malloc(SECTOR_SIZE);
-    if (bootSect == 0)
-	goto memfail;
-
-    /* Read boot sector */
-    if ((rc = Block_Read(mountPoint->dev, 0, bootSect)) < 0)
+    if ((rc = Buffer_Read(mountPoint->dev, 0, PFAT_BOOT_RECORD_OFFSET, sizeof(bootSector), fsinfo)) < 0)
 	goto fail;
-    Debug("Read boot sector\n");
-
-    /* Copy filesystem parameters from boot sector */
-    memcpy(&instance->fsinfo, ((char*)bootSect) + PFAT_BOOT_RECORD_OFFSET, sizeof(bootSector));
-    Debug("Copied boot record\n");
+    Debug("Read boot record\n");
 
     /* Does magic number match? */
     if (fsinfo->magic != PFAT_MAGIC) {
@@ -616,35 +1790,41 @@ static int PFAT_Mount(struct Mount_Point *mountPoint)
     if (instance->fat == 0)
 	goto memfail;
 
-    /* Read the FAT */
-    for (i = 0; i < fsinfo->fileAllocationLength; ++i) {
-	int blockNum = fsinfo->fileAllocationOffset + i;
-	char *p = ((char*)instance->fat) + (i * SECTOR_SIZE);
-	if ((rc = Block_Read(mountPoint->dev, blockNum, p)) < 0)
-	    goto fail;
-    }
-    Debug("Read FAT successfully!\n");
-
-    /* Allocate root directory */
     rootDirSize = Round_Up_To_Block(sizeof(directoryEntry) * fsinfo->rootDirectoryCount);
-    instance->rootDir = (directoryEntry*) Malloc(rootDirSize);
-
-    /* Read the root directory */
     Debug("Root directory size = %d\n", rootDirSize);
-    for (i = 0; i < rootDirSize; i += SECTOR_SIZE) {
-	int blockNum = fsinfo->rootDirectoryOffset + i;
-	if ((rc = Block_Read(mountPoint->dev, blockNum, instance->rootDir + (i*SECTOR_SIZE))) < 0)
-	    goto fail;
+
+    /* Read the FAT, queueing the read of the root directory too */
+    Buffer_Prefetch(mountPoint->dev, fsinfo->fileAllocationOffset, fsinfo->fileAllocationLength);
+    Buffer_Prefetch(mountPoint->dev, fsinfo->rootDirectoryOffset, rootDirSize / SECTOR_SIZE);
+    if ((rc = Buffer_Read(mountPoint->dev, fsinfo->fileAllocationOffset, 0,
+	    fsinfo->fileAllocationLength * SECTOR_SIZE, instance->fat)) < 0)
+	goto fail;
+    Debug("Read FAT successfully!\n");
+
+    /* Find the free blocks, past the boot sector, FAT and root directory */
+    instance->dataStart = fsinfo->rootDirectoryOffset + rootDirSize / SECTOR_SIZE;
+    instance->numFatBlocks = fsinfo->fileAllocationLength * SECTOR_SIZE / sizeof(int);
+    if (instance->numFatBlocks > Get_Num_Blocks(mountPoint->dev))
+	instance->numFatBlocks = Get_Num_Blocks(mountPoint->dev);
+    instance->nextFree = instance->dataStart;
+    for (i = instance->dataStart; i < instance->numFatBlocks; ++i) {
+	if (instance->fat[i] == FAT_ENTRY_FREE)
+	    ++instance->numFree;
     }
-    Debug("Read root directory successfully!\n");
+    Debug("%d free blocks\n", instance->numFree);
 
     /* Create the fake root directory entry. */
     memset(&instance->rootDirEntry, '\0', sizeof(directoryEntry));
-    instance->rootDirEntry.readOnly = 1;
     instance->rootDirEntry.directory = 1;
     instance->rootDirEntry.fileSize =
 	instance->fsinfo.rootDirectoryCount * sizeof(directoryEntry);
 
+    /* Load the root directory; other directories are loaded when first used */
+    mountPoint->fsData = instance;
+    if ((rc = Load_Dir(mountPoint, 0, -1, &instance->rootDirEntry, &instance->rootDir)) != 0)
+	goto fail;
+    Debug("Read root directory successfully!\n");
+
     /* Initialize instance lock and PFAT_File list. */
     Mutex_Init(&instance->lock);
     Clear_PFAT_File_List(&instance->fileList);
@@ -666,15 +1846,12 @@ memfail:
 invalidfs:
     rc = EINVALIDFS; goto fail;
 fail:
+    mountPoint->fsData = 0;
     if (instance != 0) {
 	if (instance->fat != 0)
 	    Free(instance->fat);
-	if (instance->rootDir != 0)
-	    Free(instance->rootDir);
 	Free(instance);
     }
-    if (bootSect != 0)
-	Free(bootSect);
     return rc;
 }
 
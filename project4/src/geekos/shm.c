@@ -0,0 +1,616 @@
+/*
+ * Shared memory segments and mapped files
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/list.h>
+#include <geekos/kthread.h>
+#include <geekos/string.h>
+#include <geekos/screen.h>
+#include <geekos/malloc.h>
+#include <geekos/synch.h>
+#include <geekos/mem.h>
+#include <geekos/paging.h>
+#include <geekos/user.h>
+#include <geekos/vfs.h>
+#include <geekos/fileio.h>
+#include <geekos/zswap.h>
+#include <geekos/vma.h>
+#include <geekos/shm.h>
+
+/*
+ * A named segment of memory which can be mapped into several
+ * user address spaces at once.  The segment owns its frames:
+ * for each page, a master entry records either the frame holding
+ * the page, or the slot in the paging file where it was evicted.
+ * The page table entries of attached processes only ever point
+ * at resident frames; when a frame is evicted they are marked
+ * KINFO_PAGE_SHARED, so the next access asks the segment again.
+ *
+ * A mapped file is a read-only segment backed by a file instead of
+ * the paging file: its pages are read from the file on first touch,
+ * and dropped rather than written out when memory runs low.
+ * Every process mapping the same path shares one segment.
+ *
+ * All segment data is protected by disabling interrupts.
+ */
+
+struct Shm_Segment;
+DEFINE_LIST(Shm_Segment_List, Shm_Segment);
+
+struct Shm_Attachment {
+    struct User_Context *userContext;
+    struct VMA *vma;			 /* Area of the address space it occupies */
+};
+
+struct Shm_Segment {
+    int id;
+    char *name;				 /* Segment name, or path of mapped file */
+    struct File *file;			 /* Backing file, or null */
+    struct Mutex fileLock;		 /* Serializes reads of the backing file */
+    ulong_t numPages;
+    pte_t *pages;			 /* Master entry for each page */
+    int numAttached;
+    struct Shm_Attachment attached[SHM_MAX_ATTACH];
+    DEFINE_LINK(Shm_Segment_List, Shm_Segment);
+};
+
+IMPLEMENT_LIST(Shm_Segment_List, Shm_Segment);
+
+static struct Shm_Segment_List s_shmList;
+static int s_nextShmId = 1;
+
+/* Processes waiting for a segment page to be brought in. */
+static struct Thread_Queue s_shmWaitQueue;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct Shm_Segment *Lookup_Segment_By_Id(int id)
+{
+    struct Shm_Segment *seg = Get_Front_Of_Shm_Segment_List(&s_shmList);
+    while (seg != 0 && seg->id != id)
+	seg = Get_Next_In_Shm_Segment_List(seg);
+    return seg;
+}
+
+/*
+ * Segment names and file paths live in separate name spaces.
+ */
+static struct Shm_Segment *Lookup_Segment_By_Name(const char *name, bool fileBacked)
+{
+    struct Shm_Segment *seg = Get_Front_Of_Shm_Segment_List(&s_shmList);
+    while (seg != 0 &&
+	   ((seg->file != 0) != fileBacked || strcmp(seg->name, name) != 0))
+	seg = Get_Next_In_Shm_Segment_List(seg);
+    return seg;
+}
+
+/*
+ * Find the attachment of a segment which occupies the given area.
+ */
+static struct Shm_Attachment *Find_Attachment(struct Shm_Segment *seg, struct VMA *vma)
+{
+    int i;
+
+    for (i = 0; i < seg->numAttached; ++i) {
+	if (seg->attached[i].vma == vma)
+	    return &seg->attached[i];
+    }
+    return 0;
+}
+
+/*
+ * Find a free range of user addresses in the shared memory area
+ * of given user context, large enough for numPages pages.
+ * Returns 0 if the area is full.
+ */
+static ulong_t Find_Free_Range(struct User_Context *userContext, ulong_t numPages)
+{
+    ulong_t areaEnd = userContext->stack->limit - USER_GUARD_SIZE;
+
+    return Find_VMA_Gap(userContext->vmaRoot, areaEnd - USER_SHM_AREA_SIZE, areaEnd,
+	numPages * PAGE_SIZE);
+}
+
+/*
+ * Map a resident segment page into a user page table entry.
+ * Pages of mapped files are mapped read-only.
+ */
+static void Map_Shared_Frame(struct Shm_Segment *seg, pte_t *entry, pte_t *master)
+{
+    struct Page *page = Get_Page(master->pageBaseAddr << 12);
+
+    KASSERT(master->present);
+    KASSERT(page->flags & PAGE_SHARED);
+
+    *((uint_t *)entry) = 0;
+    entry->present = 1;
+    entry->flags = (seg->file != 0) ? VM_READ | VM_USER : VM_WRITE | VM_READ | VM_USER;
+    entry->pageBaseAddr = master->pageBaseAddr;
+    ++page->refCount;
+}
+
+/*
+ * Remove the mapping of the first numPages pages of one segment
+ * from a user address space.
+ */
+static void Unmap_Attachment(struct Shm_Segment *seg, struct Shm_Attachment *att,
+    ulong_t numPages)
+{
+    ulong_t i;
+
+    for (i = 0; i < numPages; ++i) {
+	ulong_t vaddr = USER_VM_START + att->vma->start + i * PAGE_SIZE;
+	pte_t *entry = Get_User_Page_Entry(att->userContext->pageDir, vaddr, false);
+	if (entry == 0)
+	    continue;
+	if (entry->present) {
+	    struct Page *page = Get_Page(entry->pageBaseAddr << 12);
+	    KASSERT(page->refCount > 0);
+	    --page->refCount;
+	}
+	*((uint_t *)entry) = 0;
+    }
+}
+
+/*
+ * Free a segment once nobody has it attached.
+ */
+static void Destroy_Segment(struct Shm_Segment *seg)
+{
+    ulong_t i;
+
+    KASSERT(seg->numAttached == 0);
+
+    for (i = 0; i < seg->numPages; ++i) {
+	pte_t *master = &seg->pages[i];
+	if (master->present) {
+	    void *frame = (void *)(master->pageBaseAddr << 12);
+	    KASSERT(Get_Page((ulong_t)frame)->refCount == 0);
+	    Free_Page(frame);
+	} else if (master->kernelInfo == KINFO_PAGE_ON_DISK) {
+	    Free_Space_On_Paging_File(master->pageBaseAddr);
+	} else if (master->kernelInfo == KINFO_PAGE_COMPRESSED) {
+	    Zswap_Free(master->pageBaseAddr);
+	}
+    }
+
+    if (seg->file != 0)
+	Close(seg->file);
+
+    Remove_From_Shm_Segment_List(&s_shmList, seg);
+    Free(seg->pages);
+    Free(seg->name);
+    Free(seg);
+}
+
+static void Detach_Segment(struct Shm_Segment *seg, struct Shm_Attachment *att)
+{
+    int index = att - seg->attached;
+
+    Unmap_Attachment(seg, att, seg->numPages);
+    if (att->userContext == g_currentThread->userContext)
+	Flush_TLB();
+    Remove_VMA(&att->userContext->vmaRoot, att->vma);
+    Free(att->vma);
+
+    memmove(att, att + 1, (seg->numAttached - index - 1) * sizeof(*att));
+    --seg->numAttached;
+    if (seg->numAttached == 0)
+	Destroy_Segment(seg);
+}
+
+/*
+ * Read one page of a mapped file into a frame, zero-filling
+ * whatever lies past the end of the file.  Interrupts must be
+ * disabled; they are enabled while the file is read.
+ * Returns 0 if successful, or an error code.
+ */
+static int Read_File_Page(struct Shm_Segment *seg, ulong_t index, void *paddr)
+{
+    ulong_t offset = index * PAGE_SIZE;
+    ulong_t len = seg->file->endPos - offset;
+    int rc;
+
+    if (len > PAGE_SIZE)
+	len = PAGE_SIZE;
+    memset((char *) paddr + len, '\0', PAGE_SIZE - len);
+
+    Enable_Interrupts();
+    Mutex_Lock(&seg->fileLock);
+    rc = Seek(seg->file, offset);
+    if (rc == 0) {
+	rc = Read(seg->file, paddr, len);
+	rc = (rc == (int) len) ? 0 : (rc < 0 ? rc : EIO);
+    }
+    Mutex_Unlock(&seg->fileLock);
+    Disable_Interrupts();
+
+    return rc;
+}
+
+/*
+ * Allocate a segment of given size, with no frames yet.
+ * Returns null if out of memory.
+ */
+static struct Shm_Segment *Create_Segment(const char *name, ulong_t numPages,
+    struct File *file)
+{
+    struct Shm_Segment *seg;
+
+    seg = (struct Shm_Segment *) Malloc(sizeof(*seg));
+    if (seg == 0)
+	return 0;
+    seg->name = strdup(name);
+    seg->pages = (pte_t *) Malloc(numPages * sizeof(pte_t));
+    if (seg->name == 0 || seg->pages == 0) {
+	if (seg->name != 0)
+	    Free(seg->name);
+	if (seg->pages != 0)
+	    Free(seg->pages);
+	Free(seg);
+	return 0;
+    }
+
+    /* Pages are given frames on first access. */
+    memset(seg->pages, '\0', numPages * sizeof(pte_t));
+    seg->id = s_nextShmId++;
+    seg->file = file;
+    Mutex_Init(&seg->fileLock);
+    seg->numPages = numPages;
+    seg->numAttached = 0;
+    Add_To_Back_Of_Shm_Segment_List(&s_shmList, seg);
+    return seg;
+}
+
+/*
+ * Map a segment into a user address space.
+ * Resident pages are mapped immediately; the rest are faulted in.
+ * Interrupts must be disabled.
+ */
+static int Attach_Segment(struct Shm_Segment *seg, struct User_Context *userContext,
+    ulong_t *pUserAddr)
+{
+    struct Shm_Attachment *att;
+    struct VMA *vma;
+    ulong_t start, end, i;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (seg->numAttached == SHM_MAX_ATTACH)
+	return EBUSY;
+    start = Find_Free_Range(userContext, seg->numPages);
+    if (start == 0)
+	return ENOMEM;
+    end = start + seg->numPages * PAGE_SIZE;
+
+    vma = Create_VMA(start, end, end,
+	(seg->file != 0) ? VM_READ : VM_READ | VM_WRITE,
+	(seg->file != 0) ? VMA_FILE : VMA_SHARED);
+    if (vma == 0)
+	return ENOMEM;
+    vma->object = seg;
+    if (Insert_VMA(&userContext->vmaRoot, vma) != 0) {
+	Free(vma);
+	return ENOMEM;
+    }
+
+    att = &seg->attached[seg->numAttached++];
+    att->userContext = userContext;
+    att->vma = vma;
+
+    for (i = 0; i < seg->numPages; ++i) {
+	ulong_t vaddr = USER_VM_START + start + i * PAGE_SIZE;
+	pte_t *entry = Get_User_Page_Entry(userContext->pageDir, vaddr, true);
+	if (entry == 0) {
+	    /*
+	     * Undo only this attachment; destroying the segment,
+	     * if nobody else has it, is up to the caller.
+	     */
+	    Unmap_Attachment(seg, att, i);
+	    if (userContext == g_currentThread->userContext)
+		Flush_TLB();
+	    Remove_VMA(&userContext->vmaRoot, vma);
+	    Free(vma);
+	    --seg->numAttached;
+	    return ENOMEM;
+	}
+	if (seg->pages[i].present) {
+	    Map_Shared_Frame(seg, entry, &seg->pages[i]);
+	} else {
+	    *((uint_t *)entry) = 0;
+	    entry->kernelInfo = KINFO_PAGE_SHARED;
+	}
+    }
+
+    *pUserAddr = start;
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Create a shared memory segment with the given name and size,
+ * or find the existing one of that name.
+ * Returns the segment id (> 0), or an error code.
+ */
+int Shm_Create(const char *name, ulong_t size)
+{
+    struct Shm_Segment *seg;
+    ulong_t numPages;
+    bool iflag;
+    int rc;
+
+    if (size == 0 || size > SHM_MAX_SIZE || strlen(name) > SHM_MAX_NAME_LEN)
+	return EINVALID;
+    numPages = Round_Up_To_Page(size) / PAGE_SIZE;
+
+    iflag = Begin_Int_Atomic();
+
+    seg = Lookup_Segment_By_Name(name, false);
+    if (seg != 0) {
+	/* An existing segment may be opened with any size up to its own. */
+	rc = (numPages <= seg->numPages) ? seg->id : EINVALID;
+	goto done;
+    }
+
+    seg = Create_Segment(name, numPages, 0);
+    rc = (seg != 0) ? seg->id : ENOMEM;
+
+done:
+    End_Int_Atomic(iflag);
+    return rc;
+}
+
+/*
+ * Map a shared memory segment into a user address space.
+ * Resident pages are mapped immediately; the rest are faulted in.
+ * Returns 0 and stores the user address of the mapping
+ * if successful, or an error code.
+ */
+int Shm_Attach(struct User_Context *userContext, int id, ulong_t *pUserAddr)
+{
+    struct Shm_Segment *seg;
+    bool iflag;
+    int rc;
+
+    iflag = Begin_Int_Atomic();
+
+    /* Mapped files can only be attached through Shm_Map_File() */
+    seg = Lookup_Segment_By_Id(id);
+    if (seg == 0 || seg->file != 0)
+	rc = ENOTFOUND;
+    else
+	rc = Attach_Segment(seg, userContext, pUserAddr);
+
+    End_Int_Atomic(iflag);
+    return rc;
+}
+
+/*
+ * Map the file with given path read-only into a user address space,
+ * sharing the pages of any other process that has it mapped.
+ * The file is opened here and closed once its last mapping is
+ * removed with Shm_Detach().  Interrupts must be enabled.
+ * Returns 0 and stores the user address of the mapping
+ * if successful, or an error code.
+ */
+int Shm_Map_File(struct User_Context *userContext, const char *path, ulong_t *pUserAddr)
+{
+    struct Shm_Segment *seg;
+    struct File *file = 0;
+    int rc;
+
+    KASSERT(Interrupts_Enabled());
+
+    /*
+     * Opening the file may block, so the segment list has to be
+     * searched again afterwards: someone else may have mapped
+     * the file in the meantime.
+     */
+    Disable_Interrupts();
+    while ((seg = Lookup_Segment_By_Name(path, true)) == 0 && file == 0) {
+	Enable_Interrupts();
+	rc = Open(path, O_READ, &file);
+	if (rc != 0)
+	    return rc;
+	if (file->endPos == 0 || file->endPos > SHM_MAX_SIZE) {
+	    Close(file);
+	    return EINVALID;
+	}
+	Disable_Interrupts();
+    }
+
+    if (seg == 0) {
+	seg = Create_Segment(path, Round_Up_To_Page(file->endPos) / PAGE_SIZE, file);
+	if (seg == 0) {
+	    rc = ENOMEM;
+	    goto done;
+	}
+	file = 0;
+    }
+
+    rc = Attach_Segment(seg, userContext, pUserAddr);
+    if (rc != 0 && seg->numAttached == 0) {
+	file = 0;	/* closed along with the segment */
+	Destroy_Segment(seg);
+    }
+
+done:
+    Enable_Interrupts();
+    if (file != 0)
+	Close(file);
+    return rc;
+}
+
+/*
+ * Unmap the shared memory segment attached at given user address.
+ * The segment is destroyed when its last attachment goes away.
+ * Returns 0 if successful, or an error code.
+ */
+int Shm_Detach(struct User_Context *userContext, ulong_t userAddr)
+{
+    struct VMA *vma;
+    bool iflag;
+    int rc = 0;
+
+    iflag = Begin_Int_Atomic();
+
+    vma = Find_VMA(userContext->vmaRoot, userAddr);
+    if (vma == 0 || vma->start != userAddr ||
+	(vma->kind != VMA_SHARED && vma->kind != VMA_FILE)) {
+	rc = EINVALID;
+    } else {
+	struct Shm_Segment *seg = (struct Shm_Segment *) vma->object;
+	Detach_Segment(seg, Find_Attachment(seg, vma));
+    }
+
+    End_Int_Atomic(iflag);
+    return rc;
+}
+
+/*
+ * Detach every segment attached to given user context.
+ * Called when the address space is torn down.
+ */
+void Shm_Detach_All(struct User_Context *userContext)
+{
+    struct VMA *vma, *next;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+
+    for (vma = Next_VMA(userContext->vmaRoot, 0); vma != 0; vma = next) {
+	next = Next_VMA(userContext->vmaRoot, vma->start + 1);
+	if (vma->kind == VMA_SHARED || vma->kind == VMA_FILE) {
+	    struct Shm_Segment *seg = (struct Shm_Segment *) vma->object;
+	    Detach_Segment(seg, Find_Attachment(seg, vma));
+	}
+    }
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Handle a fault on a page of a shared memory or mapped file area,
+ * given the area and the user page table entry for the address.
+ * Brings the segment page into memory if needed (zero-filled or
+ * read from the mapped file on first touch, or read back from the
+ * compressed pool or the paging file) and maps it.
+ * While a page is being brought in its master entry is marked
+ * KINFO_PAGE_BUSY, and other processes faulting on it wait.
+ * Interrupts must be disabled.
+ * Returns 0 if successful, -1 if the fault could not be resolved.
+ */
+int Shm_Fault(struct VMA *vma, pte_t *entry, ulong_t address)
+{
+    struct Shm_Segment *seg = (struct Shm_Segment *) vma->object;
+    ulong_t vaddr = Round_Down_To_Page(address);
+    pte_t *master;
+
+    KASSERT(!Interrupts_Enabled());
+
+    master = &seg->pages[(vaddr - USER_VM_START - vma->start) / PAGE_SIZE];
+
+    while (master->kernelInfo == KINFO_PAGE_BUSY)
+	Wait(&s_shmWaitQueue);
+
+    if (!master->present) {
+	int kernelInfo = master->kernelInfo;
+	int pagefileIndex = master->pageBaseAddr;
+	struct Page *page;
+	void *paddr;
+
+	master->kernelInfo = KINFO_PAGE_BUSY;
+	if (seg->file == 0 && kernelInfo == 0)
+	    paddr = Alloc_Zeroed_Pageable_Page(master, vaddr, 0);
+	else
+	    paddr = Alloc_Pageable_Page(master, vaddr, 0);
+	if (paddr == 0) {
+	    master->kernelInfo = kernelInfo;
+	    Wake_Up(&s_shmWaitQueue);
+	    return -1;
+	}
+
+	/* Keep the frame from being stolen while it is being filled */
+	page = Get_Page((ulong_t)paddr);
+	page->flags &= ~PAGE_PAGEABLE;
+	page->flags |= PAGE_SHARED;
+	master->kernelInfo = KINFO_PAGE_BUSY;
+
+	if (seg->file != 0) {
+	    page->flags |= PAGE_FILE;
+	    if (Read_File_Page(seg, master - seg->pages, paddr) != 0) {
+		*((uint_t *)master) = 0;
+		Wake_Up(&s_shmWaitQueue);
+		Free_Page(paddr);
+		return -1;
+	    }
+	} else if (kernelInfo == KINFO_PAGE_COMPRESSED) {
+	    Zswap_Load(pagefileIndex, paddr);
+	    Zswap_Free(pagefileIndex);
+	} else if (kernelInfo == KINFO_PAGE_ON_DISK) {
+	    ++g_zswapStats[ZSWAP_STAT_MISSES];
+	    Enable_Interrupts();
+	    Read_From_Paging_File(paddr, vaddr, pagefileIndex);
+	    Disable_Interrupts();
+	    Free_Space_On_Paging_File(pagefileIndex);
+	}
+
+	*((uint_t *)master) = 0;
+	master->present = 1;
+	master->flags = VM_WRITE | VM_READ | VM_USER;
+	master->pageBaseAddr = (ulong_t)paddr >> 12;
+	page->flags |= PAGE_PAGEABLE;
+	Wake_Up(&s_shmWaitQueue);
+    }
+
+    if (!entry->present)
+	Map_Shared_Frame(seg, entry, master);
+    return 0;
+}
+
+/*
+ * Called when a shared frame has been written to the paging file
+ * and is about to be reused: remove it from every address space
+ * the segment is attached to.  Interrupts must be disabled.
+ */
+void Shm_Unmap_Page(struct Page *page)
+{
+    struct Shm_Segment *seg;
+    ulong_t index;
+    int i;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(page->flags & PAGE_SHARED);
+
+    for (seg = Get_Front_Of_Shm_Segment_List(&s_shmList); seg != 0;
+	 seg = Get_Next_In_Shm_Segment_List(seg)) {
+	if (page->entry >= seg->pages && page->entry < seg->pages + seg->numPages)
+	    break;
+    }
+    if (seg == 0)
+	return;
+    index = page->entry - seg->pages;
+
+    for (i = 0; i < seg->numAttached; ++i) {
+	struct Shm_Attachment *att = &seg->attached[i];
+	ulong_t vaddr = USER_VM_START + att->vma->start + index * PAGE_SIZE;
+	pte_t *entry = Get_User_Page_Entry(att->userContext->pageDir, vaddr, false);
+	if (entry != 0 && entry->present) {
+	    *((uint_t *)entry) = 0;
+	    entry->kernelInfo = KINFO_PAGE_SHARED;
+	    --page->refCount;
+	}
+    }
+    KASSERT(page->refCount == 0);
+}
@@ -20,6 +20,12 @@
 #include <geekos/user.h>
 #include <geekos/timer.h>
 #include <geekos/vfs.h>
+#include <geekos/shm.h>
+#include <geekos/zswap.h>
+#include <geekos/mem.h>
+#include <geekos/memstat.h>
+#include <geekos/swapdev.h>
+#include <geekos/blockdev.h>
 
 #define MAX_LEN 25
 #define MAX_REGISTERED_THREADS 20
@@ -309,6 +315,7 @@ static int Sys_PutCursor(struct Interrupt_State *state)
  *   state->ecx - length of executable name
  *   state->edx - user address of command string
  *   state->esi - length of command string
+ *   state->edi - most pages the process may keep resident, 0 for no limit
  * Returns: pid of process if successful, error code (< 0) otherwise
  */
 static int Sys_Spawn(struct Interrupt_State *state)
@@ -325,7 +332,7 @@ static int Sys_Spawn(struct Interrupt_State *state)
     Enable_Interrupts();
     /*Now that we have collected the program name and command string
      * from user space, we can try to actually spawn the process.*/
-    rc = Spawn(program, command, &process);
+    rc = Spawn(program, command, state->edi, &process);
     if (rc == 0)
     {
         KASSERT(process != 0);
@@ -464,6 +471,532 @@ static int Sys_DestroySemaphore(struct Interrupt_State *state)
     return r;
 }
 
+/*
+ * Create a shared memory segment, or open the existing one
+ * with the same name.
+ * Params:
+ *   state->ebx - user address of name of segment
+ *   state->ecx - length of segment name
+ *   state->edx - size of segment in bytes
+ * Returns: the segment id if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_ShmCreate(struct Interrupt_State *state)
+{
+    char *name = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, SHM_MAX_NAME_LEN,
+                               &name)) != 0)
+        return rc;
+    rc = Shm_Create(name, state->edx);
+    Free(name);
+    return rc;
+}
+
+/*
+ * Map a shared memory segment into the address space of the
+ * current process.
+ * Params:
+ *   state->ebx - the segment id
+ *
+ * Returns: user address of the segment if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_ShmAttach(struct Interrupt_State *state)
+{
+    ulong_t userAddr;
+    int rc;
+    rc = Shm_Attach(g_currentThread->userContext, state->ebx, &userAddr);
+    if (rc != 0)
+        return rc;
+    return (int)userAddr;
+}
+
+/*
+ * Unmap a shared memory segment from the address space of the
+ * current process.
+ * Params:
+ *   state->ebx - user address the segment is attached at
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_ShmDetach(struct Interrupt_State *state)
+{
+    return Shm_Detach(g_currentThread->userContext, state->ebx);
+}
+
+/*
+ * Map a file read-only into the address space of the current
+ * process.  The mapping is removed with Sys_ShmDetach.
+ * Params:
+ *   state->ebx - user address of path of file
+ *   state->ecx - length of path
+ *
+ * Returns: user address of the mapping if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_Mmap(struct Interrupt_State *state)
+{
+    char *path = 0;
+    ulong_t userAddr;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN,
+                               &path)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Shm_Map_File(g_currentThread->userContext, path, &userAddr);
+    Disable_Interrupts();
+    Free(path);
+    if (rc != 0)
+        return rc;
+    return (int)userAddr;
+}
+
+/*
+ * Grow or shrink the heap of the current process.
+ * Params:
+ *   state->ebx - number of bytes to add to the heap (may be negative)
+ *
+ * Returns: the previous end of the heap if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_Sbrk(struct Interrupt_State *state)
+{
+    ulong_t oldBreak;
+    int rc;
+    rc = Resize_User_Heap(g_currentThread->userContext, (int)state->ebx,
+                          &oldBreak);
+    if (rc != 0)
+        return rc;
+    return (int)oldBreak;
+}
+
+/*
+ * Get one of the statistics of the compressed swap pool.
+ * Params:
+ *   state->ebx - which statistic (ZSWAP_STAT_xxx)
+ *
+ * Returns: the value of the statistic if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_SwapStat(struct Interrupt_State *state)
+{
+    if (state->ebx >= ZSWAP_NUM_STATS)
+        return EINVALID;
+    return (int)g_zswapStats[state->ebx];
+}
+
+/*
+ * Get one of the statistics of physical memory.
+ * Params:
+ *   state->ebx - which statistic (MEM_STAT_xxx)
+ *
+ * Returns: the value of the statistic if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_MemStat(struct Interrupt_State *state)
+{
+    if (state->ebx >= MEM_NUM_STATS)
+        return EINVALID;
+    Update_Mem_Stats();
+    return (int)g_memStats[state->ebx];
+}
+
+/*
+ * Get the memory usage of a process.
+ * Params:
+ *   state->ebx - pid of the process, 0 for the calling process
+ *   state->ecx - which figure (MEM_USAGE_xxx)
+ *
+ * Returns: the number of pages if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_MemUsage(struct Interrupt_State *state)
+{
+    struct Kernel_Thread *kthread = g_currentThread;
+    struct User_Context *userContext;
+    if (state->ebx != 0)
+        kthread = Lookup_Thread(state->ebx);
+    // 已退出的进程不再报告内存使用
+    if (kthread == 0 || !kthread->alive || kthread->userContext == 0)
+        return ENOTFOUND;
+    userContext = kthread->userContext;
+    switch (state->ecx)
+    {
+    case MEM_USAGE_RSS:
+        return (int)userContext->rssPages;
+    case MEM_USAGE_RSS_PEAK:
+        return (int)userContext->rssPeak;
+    case MEM_USAGE_SWAP:
+        return (int)userContext->swapPages;
+    case MEM_USAGE_RSS_LIMIT:
+        return (int)userContext->rssLimit;
+    default:
+        return EINVALID;
+    }
+}
+
+/*
+ * Copy a user buffer into a kernel buffer and back again,
+ * to measure the cost of copying to and from user memory.
+ * Params:
+ *   state->ebx - address of the buffer in user memory
+ *   state->ecx - length of the buffer, at most USER_COPY_TEST_MAX
+ *
+ * Returns: the number of bytes copied each way if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_CopyTest(struct Interrupt_State *state)
+{
+    char *buf;
+    int rc = (int)state->ecx;
+    if (state->ecx == 0 || state->ecx > USER_COPY_TEST_MAX)
+        return EINVALID;
+    buf = (char *)Malloc(state->ecx);
+    if (buf == 0)
+        return ENOMEM;
+    if (!Copy_From_User(buf, state->ebx, state->ecx) ||
+        !Copy_To_User(state->ebx, buf, state->ecx))
+        rc = EINVALID;
+    Free(buf);
+    return rc;
+}
+
+/*
+ * Get one of the statistics of a swap device.
+ * Params:
+ *   state->ebx - number of the device, from 0 in order of
+ *     decreasing priority
+ *   state->ecx - which statistic (SWAP_DEV_xxx)
+ *
+ * Returns: the value of the statistic if successful,
+ *   error code (< 0) if unsuccessful (ENOTFOUND if there
+ *   is no such device)
+ */
+static int Sys_SwapDevStat(struct Interrupt_State *state)
+{
+    return Swap_Device_Stat((int)state->ebx, (int)state->ecx);
+}
+
+/*
+ * Choose the I/O scheduler of a block device.
+ * Params:
+ *   state->ebx - address of the device name in user memory
+ *   state->ecx - length of the device name
+ *   state->edx - the scheduler (IO_SCHED_xxx)
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_SetIOSched(struct Interrupt_State *state)
+{
+    char *name = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, BLOCKDEV_MAX_NAME_LEN - 1,
+                               &name)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Set_IO_Scheduler(name, (int)state->edx);
+    Disable_Interrupts();
+    Free(name);
+    return rc;
+}
+
+/*
+ * Get one of the statistics of a block device.
+ * Params:
+ *   state->ebx - address of the device name in user memory
+ *   state->ecx - length of the device name
+ *   state->edx - which statistic (BLOCKDEV_STAT_xxx)
+ *
+ * Returns: the value of the statistic if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_BlockDevStat(struct Interrupt_State *state)
+{
+    char *name = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, BLOCKDEV_MAX_NAME_LEN - 1,
+                               &name)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Block_Device_Stat(name, (int)state->edx);
+    Disable_Interrupts();
+    Free(name);
+    return rc;
+}
+
+/*
+ * Get one of the statistics of a mounted filesystem.
+ * Params:
+ *   state->ebx - address of the mount prefix in user memory
+ *   state->ecx - length of the mount prefix
+ *   state->edx - which statistic (MOUNT_STAT_xxx)
+ *
+ * Returns: the value of the statistic if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_MountStat(struct Interrupt_State *state)
+{
+    char *prefix = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN,
+                               &prefix)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Mount_Point_Stat(prefix, (int)state->edx);
+    Disable_Interrupts();
+    Free(prefix);
+    return rc;
+}
+
+/*
+ * Get the open file with the given descriptor in the current process.
+ * Returns: the File, or null if the descriptor is not in use
+ */
+static struct File *Get_User_File(int fd)
+{
+    if (fd < 0 || fd >= USER_MAX_FILES)
+        return 0;
+    return g_currentThread->userContext->files[fd];
+}
+
+/*
+ * Open a file.
+ * Params:
+ *   state->ebx - address of the path in user memory
+ *   state->ecx - length of the path
+ *   state->edx - mode flags (O_xxx)
+ *
+ * Returns: a file descriptor if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_Open(struct Interrupt_State *state)
+{
+    struct User_Context *userContext = g_currentThread->userContext;
+    struct File *file;
+    char *path = 0;
+    int fd, rc;
+
+    for (fd = 0; fd < USER_MAX_FILES; ++fd)
+    {
+        if (userContext->files[fd] == 0)
+            break;
+    }
+    if (fd == USER_MAX_FILES)
+        return EMFILE;
+
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN,
+                               &path)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Open(path, (int)state->edx, &file);
+    Disable_Interrupts();
+    Free(path);
+    if (rc != 0)
+        return rc;
+
+    /* The slot may have been taken while interrupts were enabled */
+    for (fd = 0; fd < USER_MAX_FILES; ++fd)
+    {
+        if (userContext->files[fd] == 0)
+        {
+            userContext->files[fd] = file;
+            return fd;
+        }
+    }
+    Enable_Interrupts();
+    Close(file);
+    Disable_Interrupts();
+    return EMFILE;
+}
+
+/*
+ * Close a file.
+ * Params:
+ *   state->ebx - file descriptor
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Close(struct Interrupt_State *state)
+{
+    struct File *file = Get_User_File((int)state->ebx);
+    int rc;
+    if (file == 0)
+        return EINVALID;
+    g_currentThread->userContext->files[state->ebx] = 0;
+    Enable_Interrupts();
+    rc = Close(file);
+    Disable_Interrupts();
+    return rc;
+}
+
+/*
+ * Read from the current position of a file.
+ * Params:
+ *   state->ebx - file descriptor
+ *   state->ecx - address of the buffer in user memory
+ *   state->edx - number of bytes to read
+ *
+ * Returns: the number of bytes read (0 at the end of the file)
+ *   if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Read(struct Interrupt_State *state)
+{
+    struct File *file = Get_User_File((int)state->ebx);
+    ulong_t done = 0, len;
+    char *buf;
+    int rc = 0;
+    if (file == 0)
+        return EINVALID;
+    if ((buf = Alloc_Page()) == 0)
+        return ENOMEM;
+
+    /* A page at a time, through a kernel buffer */
+    while (done < state->edx)
+    {
+        len = state->edx - done;
+        if (len > PAGE_SIZE)
+            len = PAGE_SIZE;
+        Enable_Interrupts();
+        rc = Read(file, buf, len);
+        Disable_Interrupts();
+        if (rc <= 0)
+            break;
+        if (!Copy_To_User(state->ecx + done, buf, rc))
+        {
+            rc = EINVALID;
+            break;
+        }
+        done += rc;
+        if ((ulong_t)rc < len)
+            break;
+    }
+
+    Free_Page(buf);
+    return done > 0 ? (int)done : rc;
+}
+
+/*
+ * Write to the current position of a file.
+ * Params:
+ *   state->ebx - file descriptor
+ *   state->ecx - address of the data in user memory
+ *   state->edx - number of bytes to write
+ *
+ * Returns: the number of bytes written if successful,
+ *   error code (< 0) if unsuccessful
+ */
+static int Sys_Write(struct Interrupt_State *state)
+{
+    struct File *file = Get_User_File((int)state->ebx);
+    ulong_t done = 0, len;
+    char *buf;
+    int rc = 0;
+    if (file == 0)
+        return EINVALID;
+    if ((buf = Alloc_Page()) == 0)
+        return ENOMEM;
+
+    while (done < state->edx)
+    {
+        len = state->edx - done;
+        if (len > PAGE_SIZE)
+            len = PAGE_SIZE;
+        if (!Copy_From_User(buf, state->ecx + done, len))
+        {
+            rc = EINVALID;
+            break;
+        }
+        Enable_Interrupts();
+        rc = Write(file, buf, len);
+        Disable_Interrupts();
+        if (rc <= 0)
+            break;
+        done += rc;
+        if ((ulong_t)rc < len)
+            break;
+    }
+
+    Free_Page(buf);
+    return done > 0 ? (int)done : rc;
+}
+
+/*
+ * Set the current position of a file.
+ * Params:
+ *   state->ebx - file descriptor
+ *   state->ecx - new position
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Seek(struct Interrupt_State *state)
+{
+    struct File *file = Get_User_File((int)state->ebx);
+    int rc;
+    if (file == 0)
+        return EINVALID;
+    Enable_Interrupts();
+    rc = Seek(file, state->ecx);
+    Disable_Interrupts();
+    return rc;
+}
+
+/*
+ * Delete a file.
+ * Params:
+ *   state->ebx - address of the path in user memory
+ *   state->ecx - length of the path
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Delete(struct Interrupt_State *state)
+{
+    char *path = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN,
+                               &path)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Delete(path);
+    Disable_Interrupts();
+    Free(path);
+    return rc;
+}
+
+/*
+ * Write back everything written to the mounted filesystems.
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Sync(struct Interrupt_State *state)
+{
+    int rc;
+    Enable_Interrupts();
+    rc = Sync();
+    Disable_Interrupts();
+    return rc;
+}
+
+/*
+ * Create a directory.
+ * Params:
+ *   state->ebx - address of the path in user memory
+ *   state->ecx - length of the path
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_CreateDir(struct Interrupt_State *state)
+{
+    char *path = 0;
+    int rc;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN,
+                               &path)) != 0)
+        return rc;
+    Enable_Interrupts();
+    rc = Create_Directory(path);
+    Disable_Interrupts();
+    Free(path);
+    return rc;
+}
 
 /*
  * Global table of system call handler functions.
@@ -486,6 +1019,29 @@ const Syscall g_syscallTable[] = {
     Sys_P,
     Sys_V,
     Sys_DestroySemaphore,
+    /* Shared memory system calls. */
+    Sys_ShmCreate,
+    Sys_ShmAttach,
+    Sys_ShmDetach,
+    Sys_Mmap,
+    Sys_Sbrk,
+    Sys_SwapStat,
+    Sys_MemStat,
+    Sys_MemUsage,
+    Sys_CopyTest,
+    Sys_SwapDevStat,
+    Sys_SetIOSched,
+    Sys_BlockDevStat,
+    Sys_MountStat,
+    /* File system calls. */
+    Sys_Open,
+    Sys_Close,
+    Sys_Read,
+    Sys_Write,
+    Sys_Seek,
+    Sys_Delete,
+    Sys_Sync,
+    Sys_CreateDir,
 };
 
 /*
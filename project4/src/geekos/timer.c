@@ -102,10 +102,19 @@ static void Timer_Interrupt_Handler(struct Interrupt_State *state)
     {
         if (pendingTimerEvents[i].ticks == 0)
         {
+            int id = pendingTimerEvents[i].id;
+
             if (timerDebug)
                 Print("timer: event %d expired (%d ticks)\n",
-                      pendingTimerEvents[i].id, pendingTimerEvents[i].origTicks);
-            (pendingTimerEvents[i].callBack)(pendingTimerEvents[i].id);
+                      id, pendingTimerEvents[i].origTicks);
+            (pendingTimerEvents[i].callBack)(id);
+
+            /*
+             * If the callback cancelled its timer, Cancel_Timer()
+             * moved the last event into this slot; look at it again.
+             */
+            if (i < timeEventCount && pendingTimerEvents[i].id != id)
+                i--;
         }
         else
         {
@@ -17,12 +17,18 @@
 #include <geekos/vfs.h>
 #include <geekos/tss.h>
 #include <geekos/user.h>
+#include <geekos/execcache.h>
 
 /*
  * This module contains common functions for implementation of user
  * mode processes.
  */
 
+/*
+ * User context whose address space is currently loaded.
+ */
+static struct User_Context *s_currentUserContext;
+
 /*
  * Associate the given user context with a kernel thread.
  * This makes the thread a user process.
@@ -61,11 +67,22 @@ void Detach_User_Context(struct Kernel_Thread* kthread)
 	Disable_Interrupts();
         --old->refCount;
 	refCount = old->refCount;
+	/* The memory may be reused for another context */
+	if (refCount == 0 && old == s_currentUserContext)
+	    s_currentUserContext = 0;
 	Enable_Interrupts();
 
 	/*Print("User context refcount == %d\n", refCount);*/
-        if (refCount == 0)
+        if (refCount == 0) {
+	    int fd;
+
+	    /* Close the files the process left open */
+	    for (fd = 0; fd < USER_MAX_FILES; ++fd) {
+		if (old->files[fd] != 0)
+		    Close(old->files[fd]);
+	    }
             Destroy_User_Context(old);
+	}
     }
 }
 
@@ -74,6 +91,7 @@ void Detach_User_Context(struct Kernel_Thread* kthread)
  * Params:
  *   program - the full path of the program executable file
  *   command - the command, including name of program and arguments
+ *   rssLimit - most pages the process may keep resident, 0 for no limit
  *   pThread - reference to Kernel_Thread pointer where a pointer to
  *     the newly created user mode thread (process) should be
  *     stored
@@ -83,26 +101,24 @@ void Detach_User_Context(struct Kernel_Thread* kthread)
  *   should return ENOTFOUND if the reason for failure is that
  *   the executable file doesn't exist.
  */
-int Spawn(const char *program, const char *command, struct Kernel_Thread **pThread)
+int Spawn(const char *program, const char *command, ulong_t rssLimit,
+          struct Kernel_Thread **pThread)
 {
     int rc;
-    char *exeFileData = 0;
-    ulong_t exeFileLength;
+    struct Exec_Image *image = 0;
     struct User_Context *userContext = 0;
     struct Kernel_Thread *process = 0;
-    struct Exe_Format exeFormat;
-    /*Load the executable file data, parse ELF headers,
-     * and load code and data segments into user memory.*/
-    if ((rc = Read_Fully(program, (void **)&exeFileData, &exeFileLength)) !=
-            0 ||
-        (rc = Parse_ELF_Executable(exeFileData, exeFileLength, &exeFormat)) != 0 ||
-        (rc = Load_User_Program(exeFileData, exeFileLength, &exeFormat, command,
-                                &userContext)) != 0)
+    /* Get the executable image, which is read from the file and
+     * parsed only if it is not cached already, and map it into
+     * a new address space. */
+    if ((rc = Get_Exec_Image(program, &image)) != 0 ||
+        (rc = Load_User_Program(image, command, &userContext)) != 0)
         goto fail;
-    /*User program has been loaded, so we can free the
-     * executable file data now. */
-    Free(exeFileData);
-    exeFileData = 0;
+    /* The new process maps the pages it needs from the image, so
+     * we can let go of the image now. */
+    Put_Exec_Image(image);
+    image = 0;
+    userContext->rssLimit = rssLimit;
     /* Start the process! */
     process = Start_User_Thread(userContext, false);
     if (process != 0)
@@ -112,11 +128,14 @@ int Spawn(const char *program, const char *command, struct Kernel_Thread **pThre
         *pThread = process;
     }
     else
+    {
         rc = ENOMEM;
+        goto fail;
+    }
     return rc;
 fail:
-    if (exeFileData != 0)
-        Free(exeFileData);
+    if (image != 0)
+        Put_Exec_Image(image);
     if (userContext != 0)
         Destroy_User_Context(userContext);
     return rc;
@@ -134,8 +153,6 @@ fail:
 void Switch_To_User_Context(struct Kernel_Thread *kthread, struct
                             Interrupt_State *state)
 {
-    static struct User_Context *s_currentUserContext; /* last user context
-   used */
     struct User_Context *userContext = kthread->userContext;
     KASSERT(!Interrupts_Enabled());
     if (userContext == 0)
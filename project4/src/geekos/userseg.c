@@ -20,6 +20,7 @@
 #include <geekos/kthread.h>
 #include <geekos/argblock.h>
 #include <geekos/user.h>
+#include <geekos/execcache.h>
 
 /* ----------------------------------------------------------------------
  * Variables
@@ -142,11 +143,8 @@ void Destroy_User_Context(struct User_Context *userContext)
  * Load a user executable into memory by creating a User_Context
  * data structure.
  * Params:
- * exeFileData - a buffer containing the executable to load
- * exeFileLength - number of bytes in exeFileData
- * exeFormat - parsed ELF segment information describing how to
- *   load the executable's text and data segments, and the
- *   code entry point address
+ * image - the executable, parsed and with its segments laid out
+ *   in page frames
  * command - string containing the complete command to be executed:
  *   this should be used to create the argument block for the
  *   process
@@ -156,10 +154,11 @@ void Destroy_User_Context(struct User_Context *userContext)
  * Returns:
  *   0 if successful, or an error code (< 0) if unsuccessful
  */
-int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
-                      struct Exe_Format *exeFormat, const char *command,
+int Load_User_Program(struct Exec_Image *image, const char *command,
                       struct User_Context **pUserContext)
 {
+    struct Exe_Format *exeFormat = &image->exeFormat;
+    ulong_t page;
     int i;
     ulong_t maxva = 0;
     unsigned numArgs;
@@ -185,13 +184,12 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
     userContext = Create_User_Context(size);
     if (userContext == 0)
         return -1;
-    /* Load segment data into memory */
-    for (i = 0; i < exeFormat->numSegments; ++i)
+    /* Copy the pages of the image holding segment data into memory */
+    for (page = 0; page < image->numPages; ++page)
     {
-        struct Exe_Segment *segment = &exeFormat->segmentList[i];
-        memcpy(userContext->memory + segment->startAddress,
-               exeFileData + segment->offsetInFile,
-               segment->lengthInFile);
+        if (image->frames[page] != 0)
+            memcpy(userContext->memory + image->startAddress + page * PAGE_SIZE,
+                   image->frames[page], PAGE_SIZE);
     }
     /* Format argument block */
     Format_Argument_Block(userContext->memory + argBlockAddr, numArgs,
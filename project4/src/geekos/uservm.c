@@ -7,6 +7,7 @@
  * redistribute, and modify it as specified in the file "COPYING".
  */
 
+#include <geekos/errno.h>
 #include <geekos/int.h>
 #include <geekos/mem.h>
 #include <geekos/paging.h>
@@ -17,6 +18,11 @@
 #include <geekos/range.h>
 #include <geekos/vfs.h>
 #include <geekos/user.h>
+#include <geekos/shm.h>
+#include <geekos/zswap.h>
+#include <geekos/vma.h>
+#include <geekos/ksm.h>
+#include <geekos/execcache.h>
 
 int userDebug = 0;
 extern pde_t *g_kernel_pde;
@@ -35,10 +41,8 @@ struct User_Context *Create_User_Context()
     {
         return NULL;
     }
-    user_context->ldtDescriptor = NULL;
     user_context->memory = NULL;
     user_context->size = 0;
-    user_context->ldtSelector = 0;
     user_context->csSelector = 0;
     user_context->dsSelector = 0;
     user_context->pageDir = NULL;
@@ -46,36 +50,119 @@ struct User_Context *Create_User_Context()
     user_context->argBlockAddr = 0;
     user_context->stackPointerAddr = 0;
     user_context->refCount = 0;
+    user_context->rssPages = 0;
+    user_context->rssPeak = 0;
+    user_context->swapPages = 0;
+    user_context->rssLimit = 0;
+    user_context->vmaRoot = NULL;
+    user_context->heap = NULL;
+    user_context->stack = NULL;
+    memset(user_context->files, 0, sizeof(user_context->files));
     return user_context;
 }
 
+/*
+ * Release whatever backs a user page table entry: its frame,
+ * its compressed copy, or its slot in the paging file.
+ */
+static void Free_User_Page_Entry(struct User_Context *userContext,
+                                 pte_t *entry)
+{
+    // 关中断，以免页在释放之前被换出或合并
+    bool iflag = Begin_Int_Atomic();
+    if (entry->present == 1)
+    {
+        void *paddr = (void *)((uint_t)entry->pageBaseAddr << 12);
+        struct Page *page = Get_Page((ulong_t)paddr);
+        // 合并的页可能还被其他进程使用
+        if (page->flags & PAGE_MERGED)
+            Ksm_Release_Page(page);
+        else // 驻留页由Free_Page从进程的驻留页数中扣除
+            Free_Page(paddr);
+    }
+    else if (entry->kernelInfo == KINFO_PAGE_ON_DISK)
+    {
+        Free_Space_On_Paging_File(entry->pageBaseAddr);
+        --userContext->swapPages;
+    }
+    else if (entry->kernelInfo == KINFO_PAGE_COMPRESSED)
+    {
+        Zswap_Free(entry->pageBaseAddr);
+        --userContext->swapPages;
+    }
+    *((uint_t *)entry) = 0;
+    End_Int_Atomic(iflag);
+}
+
 void Free_User_Pages(struct User_Context *userContext)
 {
     pde_t *pageDirectory = userContext->pageDir;
-    int i, j;
-    for (i = 512; i <= 1018; i++)
+    struct VMA *vma;
+    ulong_t addr;
+    int i;
+    // 先解除共享内存段的映射，共享的页由共享内存段负责释放
+    Shm_Detach_All(userContext);
+    // 只访问各虚拟内存区域内的页，不扫描整个页表
+    for (vma = Next_VMA(userContext->vmaRoot, 0); vma != NULL;
+         vma = Next_VMA(userContext->vmaRoot, vma->start + 1))
     {
-        pde_t *cur_pde = pageDirectory + i;
-        if (cur_pde->present == 1)
+        for (addr = Round_Down_To_Page(vma->start);
+             addr < Round_Up_To_Page(vma->end); addr += PAGE_SIZE)
         {
-            pte_t *pageTable = (pte_t *)(cur_pde->pageTableBaseAddr << 12);
-            for (j = 0; j < 1024; j++)
-            {
-                pte_t *cur_pte = pageTable + j;
-                if (cur_pte->present == 1)
-                {
-                    if (cur_pte->kernelInfo != KINFO_PAGE_ON_DISK)
-                        Free_Page((void *)((uint_t)cur_pte->pageBaseAddr << 12));
-                    else
-                        Free_Space_On_Paging_File(cur_pte->pageBaseAddr);
-                }
-            }
-            Free_Page(pageTable);
+            pte_t *entry = Get_User_Page_Entry(pageDirectory,
+                                               addr + USER_VM_START, false);
+            if (entry != NULL)
+                Free_User_Page_Entry(userContext, entry);
         }
     }
+    for (i = 512; i <= 1018; i++)
+    {
+        pde_t *cur_pde = pageDirectory + i;
+        // 4MB页没有页表，也不属于这个进程
+        if (cur_pde->present == 1 && !cur_pde->largePages)
+            Free_Page((void *)(cur_pde->pageTableBaseAddr << 12));
+    }
+    Destroy_VMA_Tree(&userContext->vmaRoot);
     Free_Page(pageDirectory);
 }
 
+/*
+ * Move the end (the "break") of the heap of a user context by
+ * given number of bytes.  New heap pages are zero-filled by the
+ * page fault handler when first touched; pages which no longer
+ * belong to a shrinking heap are freed at once.
+ * Returns 0 and stores the previous break if successful,
+ * or an error code.
+ */
+int Resize_User_Heap(struct User_Context *userContext, int increment,
+                     ulong_t *pOldBreak)
+{
+    struct VMA *heap = userContext->heap;
+    ulong_t oldEnd = heap->end;
+    ulong_t newEnd = oldEnd + increment;
+    ulong_t addr;
+    bool iflag;
+    if (increment >= 0 ? (newEnd < oldEnd || newEnd > heap->limit)
+                       : (newEnd > oldEnd || newEnd < heap->start))
+        return ENOMEM;
+    iflag = Begin_Int_Atomic();
+    heap->end = newEnd;
+    // 归还收缩后不再属于堆的页
+    for (addr = Round_Up_To_Page(newEnd); addr < Round_Up_To_Page(oldEnd);
+         addr += PAGE_SIZE)
+    {
+        pte_t *entry = Get_User_Page_Entry(userContext->pageDir,
+                                           addr + USER_VM_START, false);
+        if (entry != NULL)
+            Free_User_Page_Entry(userContext, entry);
+    }
+    if (newEnd < oldEnd && userContext == g_currentThread->userContext)
+        Flush_TLB();
+    End_Int_Atomic(iflag);
+    *pOldBreak = oldEnd;
+    return 0;
+}
+
 uint_t lin_to_phyaddr(pde_t *page_dir, uint_t lin_address)
 {
     uint_t pagedir_index = lin_address >> 22;
@@ -83,10 +170,18 @@ uint_t lin_to_phyaddr(pde_t *page_dir, uint_t lin_address)
     uint_t offset_address = lin_address & 0xfff;
     pde_t *pagedir_entry = page_dir + pagedir_index;
     pte_t *page_entry = 0;
-    if (pagedir_entry->present)
+    if (pagedir_entry->present && pagedir_entry->largePages)
+    { // 4MB页：页目录项中是页的物理地址
+        return ((pagedir_entry->pageTableBaseAddr << 12) & 0xffc00000) +
+               (lin_address & 0x3fffff);
+    }
+    else if (pagedir_entry->present)
     {
         page_entry = (pte_t *)((uint_t)pagedir_entry->pageTableBaseAddr << 12);
         page_entry += page_index;
+        // 换出的页的表项里不是物理地址
+        if (!page_entry->present)
+            return 0;
         return (page_entry->pageBaseAddr << 12) + offset_address;
     }
     else
@@ -162,6 +257,71 @@ bool Copy_User_Page(pde_t *page_dir, uint_t dest_user, char *src, uint_t byte_nu
     return true;
 }
 
+/*
+ * Map the pages of a cached executable image which hold file data.
+ * Every process running the program maps the same frames read-only;
+ * the page fault handler gives a process its own copy of a page of
+ * a writable segment when it writes to it.  Pages lying entirely in
+ * a segment's BSS are left unmapped; they are zero-filled on demand.
+ * Returns 0 if successful, -1 if out of memory.
+ */
+static int Map_Image_Pages(struct User_Context *userContext,
+                           struct Exec_Image *image)
+{
+    ulong_t i;
+    for (i = 0; i < image->numPages; i++)
+    {
+        ulong_t vaddr = USER_VM_START + image->startAddress + i * PAGE_SIZE;
+        pte_t *entry;
+        if (image->frames[i] == NULL)
+            continue;
+        entry = Get_User_Page_Entry(userContext->pageDir, vaddr, true);
+        if (entry == NULL)
+            return -1;
+        Ksm_Map_Frame(entry, image->frames[i]);
+    }
+    return 0;
+}
+
+/*
+ * Create the virtual memory areas for the segments of an executable,
+ * with the protection each segment asks for.  Segments sharing a page
+ * share an area, which is writable if either of them is.
+ * Returns 0 if successful, -1 if the segments overlap or out of memory.
+ */
+static int Insert_Image_VMAs(struct User_Context *userContext,
+                             struct Exe_Format *exeFormat)
+{
+    struct VMA *last = NULL;
+    int i;
+    for (i = 0; i < exeFormat->numSegments; i++)
+    {
+        struct Exe_Segment *segment = &exeFormat->segmentList[i];
+        ulong_t start = Round_Down_To_Page(segment->startAddress);
+        ulong_t end = Round_Up_To_Page(segment->startAddress +
+                                       segment->sizeInMemory);
+        int prot = VM_READ | (segment->protFlags & VM_WRITE);
+        if (segment->sizeInMemory == 0)
+            continue;
+        if (last != NULL && start < last->end && start >= last->start)
+        { // 与上一个段共用一页
+            if (end > last->end)
+                last->end = last->limit = end;
+            last->prot |= prot;
+            continue;
+        }
+        last = Create_VMA(start, end, end, prot, VMA_ANON);
+        if (last == NULL)
+            return -1;
+        if (Insert_VMA(&userContext->vmaRoot, last) != 0)
+        {
+            Free(last);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
@@ -173,12 +333,14 @@ bool Copy_User_Page(pde_t *page_dir, uint_t dest_user, char *src, uint_t byte_nu
 void Destroy_User_Context(struct User_Context *context)
 {
     KASSERT(context->refCount == 0);
-    /* Free the context's LDT descriptor */
-    Free_Segment_Descriptor(context->ldtDescriptor);
     bool iflag;
     iflag = Begin_Int_Atomic();
+    // 不能继续使用即将释放的页目录
+    if (Get_PDBR() == context->pageDir)
+        Set_PDBR(g_kernel_pde);
     //--destroy page table, page dir，free all pages
-    Free_User_Pages(context);
+    if (context->pageDir != NULL)
+        Free_User_Pages(context);
     Free(context);
     End_Int_Atomic(iflag);
 }
@@ -187,11 +349,8 @@ void Destroy_User_Context(struct User_Context *context)
  * Load a user executable into memory by creating a User_Context
  * data structure.
  * Params:
- * exeFileData - a buffer containing the executable to load
- * exeFileLength - number of bytes in exeFileData
- * exeFormat - parsed ELF segment information describing how to
- *   load the executable's text and data segments, and the
- *   code entry point address
+ * image - the executable, parsed and with its segments laid out
+ *   in frames which are mapped into the new address space
  * command - string containing the complete command to be executed:
  *   this should be used to create the argument block for the
  *   process
@@ -201,108 +360,105 @@ void Destroy_User_Context(struct User_Context *context)
  * Returns:
  *   0 if successful, or an error code (< 0) if unsuccessful
  */
-int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
-                      struct Exe_Format *exeFormat, const char *command,
+int Load_User_Program(struct Exec_Image *image, const char *command,
                       struct User_Context **pUserContext)
 {
+    struct Exe_Format *exeFormat = &image->exeFormat;
     struct User_Context *uContext;
+    char *block_buffer = NULL;
+    int rc = ENOMEM;
     uContext = Create_User_Context();
-    //----先处理pUserContext中涉及分段机制的选择子，描述符等结构-----
-    uContext->ldtDescriptor = Allocate_Segment_Descriptor();
-    if (uContext->ldtDescriptor == NULL)
-    {
-        Print("allocate segment descriptor fail/n");
-        return -1;
-    }
-    Init_LDT_Descriptor(uContext->ldtDescriptor, uContext->ldt,
-                        NUM_USER_LDT_ENTRIES);
-    uContext->ldtSelector = Selector(USER_PRIVILEGE, true,
-                                     Get_Descriptor_Index(uContext->ldtDescriptor));
-    // 注意，在GeekOS的分页机制下，用户地址空间默认从线性地址2G开始
-    Init_Code_Segment_Descriptor(&uContext->ldt[0], USER_VM_START,
-                                 USER_VM_LEN / PAGE_SIZE, USER_PRIVILEGE);
-    Init_Data_Segment_Descriptor(&uContext->ldt[1], USER_VM_START,
-                                 USER_VM_LEN / PAGE_SIZE, USER_PRIVILEGE);
-    uContext->csSelector = Selector(USER_PRIVILEGE, false, 0);
-    uContext->dsSelector = Selector(USER_PRIVILEGE, false, 1);
+    if (uContext == NULL)
+        return ENOMEM;
+    //----分页机制下所有进程的段都相同，使用GDT中共享的用户段----------
+    // 这样进程数不受GDT大小限制，切换地址空间时也不用重新加载LDT
+    uContext->csSelector = USER_CS;
+    uContext->dsSelector = USER_DS;
     //---------处理分页涉及的数据--------------------------------------
     pde_t *pageDirectory;
     pageDirectory = (pde_t *)Alloc_Page();
     if (pageDirectory == NULL)
-    {
-        return -1;
-    }
-    memset(pageDirectory, '\0', PAGE_SIZE);
+        goto fail;
     // 将内核页目录复制到用户态进程的页目录中
     memcpy(pageDirectory, g_kernel_pde, PAGE_SIZE);
     uContext->pageDir = pageDirectory;
-    int i, res;
-    uint_t startAddress = 0;
-    uint_t sizeInMemory = 0;
-    uint_t offsetInFile = 0;
-    uint_t lengthInFile = 0;
+    int i;
+    ulong_t dataEnd = 0;
+    struct VMA *heap, *stack;
     for (i = 0; i < exeFormat->numSegments; i++)
     {
-        startAddress = exeFormat->segmentList[i].startAddress;
-        sizeInMemory = exeFormat->segmentList[i].sizeInMemory;
-        offsetInFile = exeFormat->segmentList[i].offsetInFile;
-        lengthInFile = exeFormat->segmentList[i].lengthInFile;
-        if (startAddress + sizeInMemory < USER_VM_LEN)
+        struct Exe_Segment *segment = &exeFormat->segmentList[i];
+        ulong_t segEnd = segment->startAddress + segment->sizeInMemory;
+        if (!Check_Range_Under(segment->startAddress, segment->sizeInMemory,
+                               USER_VM_LEN - MAX_STACK_SIZE - USER_GUARD_SIZE -
+                                   USER_SHM_AREA_SIZE) ||
+            segment->lengthInFile > segment->sizeInMemory)
         {
-            res = Alloc_User_Page(pageDirectory, startAddress + USER_VM_START,
-                                  sizeInMemory);
-            if (res != 0)
-            {
-                return -1;
-            }
-            if ((sizeInMemory == 0) && (lengthInFile == 0))
-                continue;
-            res = Copy_User_Page(pageDirectory, startAddress + USER_VM_START,
-                                 exeFileData + offsetInFile, lengthInFile);
-            if (res != true)
-            {
-                return -1;
-            }
-        }
-        else
-        {
-            return -1;
+            rc = ENOEXEC;
+            goto fail;
         }
+        if (segEnd > dataEnd)
+            dataEnd = segEnd;
+    }
+    if (dataEnd == 0)
+    {
+        rc = ENOEXEC;
+        goto fail;
     }
-    //----------处理参数块与堆栈块---------------------------------
-    uint_t args_num, stack_addr, arg_addr;
+    //----------计算参数块的位置---------------------------------------
+    uint_t args_num, arg_addr;
     ulong_t arg_size;
     Get_Argument_Block_Size(command, &args_num, &arg_size);
     if (arg_size > PAGE_SIZE)
     {
-        return -1;
+        rc = EINVALID;
+        goto fail;
     }
-    // 分配参数块所需页
     arg_addr = Round_Down_To_Page(USER_VM_LEN - arg_size);
-    char *block_buffer = Malloc(arg_size);
-    KASSERT(block_buffer != NULL);
-    Format_Argument_Block(block_buffer, args_num, arg_addr, command);
-    res = Alloc_User_Page(pageDirectory, arg_addr + USER_VM_START, arg_size);
-    if (res != 0)
+    //----------建立虚拟内存区域-------------------------------------
+    // 先建立区域再映射页，出错时Destroy_User_Context能找到所有的页
+    // 堆栈从参数块开始向下生长，最低处留一个保护页
+    stack = Create_VMA(arg_addr, Round_Up_To_Page(arg_addr + arg_size),
+                       arg_addr - MAX_STACK_SIZE, VM_READ | VM_WRITE, VMA_STACK);
+    if (stack == NULL)
+        goto fail;
+    if (Insert_VMA(&uContext->vmaRoot, stack) != 0)
     {
-        return -1;
+        Free(stack);
+        goto fail;
     }
-    res = Copy_User_Page(pageDirectory, arg_addr + USER_VM_START,
-                         block_buffer, arg_size);
-    if (res != true)
+    uContext->stack = stack;
+    // 堆从数据段之后开始，最多生长到共享内存区
+    heap = Create_VMA(Round_Up_To_Page(dataEnd), Round_Up_To_Page(dataEnd),
+                      stack->limit - USER_GUARD_SIZE - USER_SHM_AREA_SIZE,
+                      VM_READ | VM_WRITE, VMA_ANON);
+    if (heap == NULL)
+        goto fail;
+    if (Insert_VMA(&uContext->vmaRoot, heap) != 0)
     {
-        return -1;
+        Free(heap);
+        goto fail;
     }
-    Free(block_buffer);
-    // 分配堆栈所需页
-    stack_addr = USER_VM_LEN - Round_Up_To_Page(arg_size) -
-                 DEFAULT_STACK_SIZE;
-    res = Alloc_User_Page(pageDirectory, stack_addr + USER_VM_START,
-                          DEFAULT_STACK_SIZE);
-    if (res != 0)
+    uContext->heap = heap;
+    // 程序映像：每个段一个区域，代码段只读
+    if (Insert_Image_VMAs(uContext, exeFormat) != 0)
     {
-        return -1;
+        rc = ENOEXEC;
+        goto fail;
     }
+    //----------映射程序映像，处理参数块--------------------------------
+    // 映像中的页由运行同一程序的进程共享，BSS部分缺页时再分配
+    if (Map_Image_Pages(uContext, image) != 0)
+        goto fail;
+    block_buffer = Malloc(arg_size);
+    if (block_buffer == NULL)
+        goto fail;
+    Format_Argument_Block(block_buffer, args_num, arg_addr, command);
+    if (Alloc_User_Page(uContext, arg_addr + USER_VM_START, arg_size) != 0 ||
+        Copy_User_Page(pageDirectory, arg_addr + USER_VM_START,
+                       block_buffer, arg_size) != true)
+        goto fail;
+    Free(block_buffer);
     // 最后处理UserContext的信息
     uContext->entryAddr = exeFormat->entryAddr;
     uContext->argBlockAddr = arg_addr;
@@ -310,67 +466,44 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
     uContext->stackPointerAddr = arg_addr;
     *pUserContext = uContext;
     return 0;
+
+fail:
+    if (block_buffer != NULL)
+        Free(block_buffer);
+    Destroy_User_Context(uContext);
+    return rc;
 }
 
 /*
  * Copy data from user buffer into kernel buffer.
+ * The copy goes through the current process's own mapping: pages
+ * which are not resident are brought in by the page fault handler,
+ * and an address outside the process's memory makes the copy stop.
  * Returns true if successful, false otherwise.
  */
 bool Copy_From_User(void *destInKernel, ulong_t srcInUser, ulong_t numBytes)
 {
-    void *kaddr = destInKernel;
-    ulong_t userVA = srcInUser + USER_VM_START;
-    ulong_t numCopied = 0;
-    struct User_Context *userContext = g_currentThread->userContext;
-    while (numCopied < numBytes)
-    {
-        struct Page *cur_page = Get_Page(lin_to_phyaddr(userContext->pageDir,
-                                                        userVA));
-        bool iflag = Begin_Int_Atomic();
-        cur_page->flags &= ~(PAGE_PAGEABLE);
-        End_Int_Atomic(iflag);
-        ulong_t toCopy = PAGE_SIZE;
-        if (!Is_Page_Multiple(userVA))
-            toCopy -= (userVA & (PAGE_SIZE - 1));
-        if (toCopy > numBytes)
-            toCopy = numBytes;
-        memcpy(kaddr, (void *)userVA, toCopy);
-        userVA = Round_Down_To_Page(userVA + PAGE_SIZE);
-        kaddr = (void *)((char *)kaddr + toCopy);
-        numCopied += toCopy;
-        iflag = Begin_Int_Atomic();
-        cur_page->flags |= PAGE_PAGEABLE;
-        End_Int_Atomic(iflag);
-    }
-    return true;
+    // 只允许访问用户地址空间，内核地址不会缺页，必须先检查
+    if (g_currentThread->userContext == NULL ||
+        !Check_Range_Under(srcInUser, numBytes, USER_VM_LEN))
+        return false;
+    return Copy_User_Bytes(destInKernel, (void *)(srcInUser + USER_VM_START),
+                           numBytes) == 0;
 }
 
 /*
  * Copy data from kernel buffer into user buffer.
+ * Writing to a merged page gives the process its own copy first,
+ * as a write from user mode would.
  * Returns true if successful, false otherwise.
  */
 bool Copy_To_User(ulong_t destInUser, void *srcInKernel, ulong_t numBytes)
 {
-    ulong_t userVA = destInUser + USER_VM_START;
-    ulong_t numCopied = 0;
-    struct User_Context *userContext = g_currentThread->userContext;
-    while (numCopied < numBytes)
-    {
-        struct Page *cur_page = Get_Page(lin_to_phyaddr(userContext->pageDir, userVA));
-        cur_page->flags &= ~(PAGE_PAGEABLE);
-        ulong_t pageVA = Round_Down_To_Page(userVA);
-        ulong_t toCopy = PAGE_SIZE;
-        if (!Is_Page_Multiple(userVA))
-            toCopy -= (userVA & (PAGE_SIZE - 1));
-        if (toCopy > numBytes)
-            toCopy = numBytes;
-        memcpy((void *)pageVA, srcInKernel, toCopy);
-        userVA = Round_Down_To_Page(userVA + PAGE_SIZE);
-        srcInKernel = (void *)((char *)srcInKernel + toCopy);
-        numCopied += toCopy;
-        cur_page->flags |= PAGE_PAGEABLE;
-    }
-    return true;
+    if (g_currentThread->userContext == NULL ||
+        !Check_Range_Under(destInUser, numBytes, USER_VM_LEN))
+        return false;
+    return Copy_User_Bytes((void *)(destInUser + USER_VM_START), srcInKernel,
+                           numBytes) == 0;
 }
 
 /*
@@ -378,12 +511,7 @@ bool Copy_To_User(ulong_t destInUser, void *srcInKernel, ulong_t numBytes)
  */
 void Switch_To_Address_Space(struct User_Context *userContext)
 {
-    ushort_t ldtSelector;
+    // 用户段在GDT中，所有进程共用，只需切换页目录
     Set_PDBR(userContext->pageDir);
-    ldtSelector = userContext->ldtSelector;
-    __asm__ __volatile__(
-        "lldt %0"
-        :
-        : "a"(ldtSelector));
 }
 
@@ -14,6 +14,7 @@
 #include <geekos/screen.h>
 #include <geekos/malloc.h>
 #include <geekos/synch.h>
+#include <geekos/bufcache.h>
 #include <geekos/vfs.h>
 
 /*
@@ -58,7 +59,7 @@ IMPLEMENT_LIST(Filesystem_List, Filesystem);
 static struct Filesystem_List s_filesystemList;
 
 /* Registered paging device. */
-static struct Paging_Device *s_pagingDevice;
+static struct Paging_Device *s_pagingDevices;
 
 #define MAX_PREFIX_LEN 16
 
@@ -221,6 +222,62 @@ static int Do_Open_Directory(struct Mount_Point *mountPoint, const char *path, i
     return mountPoint->ops->Open_Directory(mountPoint, path, pDir);
 }
 
+/*
+ * Readahead of a file read sequentially starts RA_MIN_WINDOW bytes
+ * past the first read, and is topped up whenever the reader gets
+ * within half a window of its end, with the window doubling each
+ * time up to RA_MAX_WINDOW.  A read anywhere else stops it.
+ */
+#define RA_MIN_WINDOW (16 * 1024)
+#define RA_MAX_WINDOW (128 * 1024)
+
+/*
+ * Called by Read() before reading len bytes at the current position
+ * of a file whose filesystem can read ahead.
+ */
+static void Read_Ahead(struct File *file, ulong_t len)
+{
+    struct Mount_Point *mountPoint = file->mountPoint;
+    ulong_t pos = file->filePos, end = pos + len;
+    ulong_t start;
+
+    ++mountPoint->stats[MOUNT_STAT_READS];
+
+    if (pos != file->raNextPos) {
+	/* Random access: stop reading ahead */
+	if (file->raWindow != 0)
+	    ++mountPoint->stats[MOUNT_STAT_RA_STOPPED];
+	file->raWindow = 0;
+	file->raEnd = 0;
+	file->raNextPos = end;
+	return;
+    }
+
+    ++mountPoint->stats[MOUNT_STAT_SEQ_READS];
+    if (end <= file->raEnd)
+	++mountPoint->stats[MOUNT_STAT_RA_HITS];
+    file->raNextPos = end;
+
+    /* Still far enough ahead of the reader, or nothing left to read? */
+    if ((file->raEnd > end && file->raEnd - end >= file->raWindow / 2) || end >= file->endPos)
+	return;
+
+    if (file->raWindow == 0)
+	file->raWindow = RA_MIN_WINDOW;
+    else if (file->raWindow < RA_MAX_WINDOW)
+	file->raWindow *= 2;
+
+    start = file->raEnd > end ? file->raEnd : end;
+    file->raEnd = end + file->raWindow;
+    if (file->raEnd > file->endPos)
+	file->raEnd = file->endPos;
+
+    Debug("Reading ahead %lu-%lu\n", start, file->raEnd);
+    mountPoint->stats[MOUNT_STAT_RA_BLOCKS] +=
+	(Round_Up_To_Block(file->raEnd) - start / SECTOR_SIZE * SECTOR_SIZE) / SECTOR_SIZE;
+    file->ops->Readahead(file, start, file->raEnd - start);
+}
+
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
@@ -402,9 +459,12 @@ int Close(struct File *file)
 
     KASSERT(file->ops->Close != 0); /* All filesystems must implement Close(). */
 
+    /*
+     * The file is closed even if that fails, for instance
+     * because its last data could not be written.
+     */
     rc = file->ops->Close(file);
-    if (rc == 0)
-	Free(file);
+    Free(file);
     return rc;
 }
 
@@ -438,7 +498,8 @@ int Stat(const char *path, struct VFS_File_Stat *stat)
 }
 
 /*
- * Sync all mounted filesystems.
+ * Sync all mounted filesystems, then write back the blocks
+ * still dirty in the buffer cache.
  * Returns: 0 if successful, error code (< 0) if not
  */
 int Sync(void)
@@ -457,9 +518,34 @@ int Sync(void)
     }
     Mutex_Unlock(&s_vfsLock);
 
+    if (rc == 0)
+	rc = Flush_Buffers(0);
+
     return rc;
 }
 
+/*
+ * Get one of the MOUNT_STAT_* statistics of the filesystem
+ * mounted at given prefix.
+ * Returns the (non-negative) value, or an error code.
+ */
+int Mount_Point_Stat(const char *prefix, int which)
+{
+    struct Mount_Point *mountPoint;
+
+    if (which < 0 || which >= MOUNT_NUM_STATS)
+	return EINVALID;
+
+    /* Skip leading slash character(s) */
+    while (*prefix == '/')
+	++prefix;
+
+    mountPoint = Lookup_Mount_Point(prefix);
+    if (mountPoint == 0)
+	return ENOTFOUND;
+    return mountPoint->stats[which];
+}
+
 /*
  * Allocate a new File object.
  * Params:
@@ -485,6 +571,9 @@ struct File *Allocate_File(struct File_Ops *ops, int filePos, int endPos, void *
 	file->fsData = fsData;
 	file->mode = mode;
 	file->mountPoint = mountPoint;
+	file->raNextPos = filePos;
+	file->raEnd = 0;
+	file->raWindow = 0;
     }
     return file;
 }
@@ -505,7 +594,8 @@ int FStat(struct File *file, struct VFS_File_Stat *stat)
 }
 
 /*
- * Read bytes from the current position in a file.
+ * Read bytes from the current position in a file,
+ * reading ahead if the file is read sequentially.
  * Params:
  *   file - the File object
  *   buf - kernel buffer where data read from file should be stored
@@ -517,8 +607,10 @@ int Read(struct File *file, void *buf, ulong_t len)
 {
     if (file->ops->Read == 0)
 	return EUNSUPPORTED;
-    else
-	return file->ops->Read(file, buf, len);
+
+    if (file->ops->Readahead != 0)
+	Read_Ahead(file, len);
+    return file->ops->Read(file, buf, len);
 }
 
 /*
@@ -689,22 +781,30 @@ int Read_Entry(struct File *file, struct VFS_Dir_Entry *entry)
 }
 
 /*
- * Register a paging device.
+ * Register a paging device.  Devices are kept in order of
+ * decreasing priority; devices of equal priority stay in
+ * the order they were registered.
  */
 void Register_Paging_Device(struct Paging_Device *pagingDevice)
 {
-    KASSERT(s_pagingDevice == 0);
+    struct Paging_Device **pos = &s_pagingDevices;
+
     KASSERT(pagingDevice != 0);
-    Print("Registering paging device: %s on %s\n", pagingDevice->fileName, pagingDevice->dev->name);
-    s_pagingDevice = pagingDevice;
+    Print("Registering paging device: %s on %s, priority %d\n", pagingDevice->fileName,
+	pagingDevice->dev->name, pagingDevice->priority);
+    while (*pos != 0 && (*pos)->priority >= pagingDevice->priority)
+	pos = &(*pos)->next;
+    pagingDevice->next = *pos;
+    *pos = pagingDevice;
 }
 
 /*
- * Get the paging device.
+ * Get the paging device with the highest priority; the others
+ * follow it through their next fields.
  * Returns null if no paging device has been registered.
  */
 struct Paging_Device *Get_Paging_Device(void)
 {
-    return s_pagingDevice;
+    return s_pagingDevices;
 }
 
@@ -0,0 +1,263 @@
+/*
+ * Virtual memory areas
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/malloc.h>
+#include <geekos/vma.h>
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * The range an area occupies, including the room it may grow into.
+ */
+#define Reserved_Start(v) ((v)->kind == VMA_STACK ? (v)->limit : (v)->start)
+#define Reserved_End(v)   ((v)->kind != VMA_STACK && (v)->limit > (v)->end ? (v)->limit : (v)->end)
+
+static int Height(struct VMA *node)
+{
+    return node != 0 ? node->height : 0;
+}
+
+static void Update_Height(struct VMA *node)
+{
+    int left = Height(node->left), right = Height(node->right);
+    node->height = 1 + (left > right ? left : right);
+}
+
+static struct VMA *Rotate_Right(struct VMA *node)
+{
+    struct VMA *left = node->left;
+
+    node->left = left->right;
+    left->right = node;
+    Update_Height(node);
+    Update_Height(left);
+    return left;
+}
+
+static struct VMA *Rotate_Left(struct VMA *node)
+{
+    struct VMA *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    Update_Height(node);
+    Update_Height(right);
+    return right;
+}
+
+/*
+ * Restore the AVL property at a node whose subtrees differ
+ * in height by at most two.  Returns the new subtree root.
+ */
+static struct VMA *Rebalance(struct VMA *node)
+{
+    int balance;
+
+    Update_Height(node);
+    balance = Height(node->left) - Height(node->right);
+    if (balance > 1) {
+	if (Height(node->left->left) < Height(node->left->right))
+	    node->left = Rotate_Left(node->left);
+	return Rotate_Right(node);
+    }
+    if (balance < -1) {
+	if (Height(node->right->right) < Height(node->right->left))
+	    node->right = Rotate_Right(node->right);
+	return Rotate_Left(node);
+    }
+    return node;
+}
+
+static struct VMA *Insert_Node(struct VMA *node, struct VMA *vma)
+{
+    if (node == 0)
+	return vma;
+    if (vma->start < node->start)
+	node->left = Insert_Node(node->left, vma);
+    else
+	node->right = Insert_Node(node->right, vma);
+    return Rebalance(node);
+}
+
+static struct VMA *Remove_Min(struct VMA *node, struct VMA **pMin)
+{
+    if (node->left == 0) {
+	*pMin = node;
+	return node->right;
+    }
+    node->left = Remove_Min(node->left, pMin);
+    return Rebalance(node);
+}
+
+static struct VMA *Remove_Node(struct VMA *node, struct VMA *vma)
+{
+    struct VMA *min;
+
+    KASSERT(node != 0);
+    if (vma->start < node->start) {
+	node->left = Remove_Node(node->left, vma);
+    } else if (vma->start > node->start) {
+	node->right = Remove_Node(node->right, vma);
+    } else {
+	KASSERT(node == vma);
+	if (node->right == 0)
+	    return node->left;
+	node->right = Remove_Min(node->right, &min);
+	min->left = node->left;
+	min->right = node->right;
+	node = min;
+    }
+    return Rebalance(node);
+}
+
+/*
+ * Find the area with the greatest start address <= addr.
+ */
+static struct VMA *Prev_VMA(struct VMA *root, ulong_t addr)
+{
+    struct VMA *best = 0;
+
+    while (root != 0) {
+	if (root->start <= addr) {
+	    best = root;
+	    root = root->right;
+	} else {
+	    root = root->left;
+	}
+    }
+    return best;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Allocate an area; it is not part of any tree yet.
+ * Returns null if out of memory.
+ */
+struct VMA *Create_VMA(ulong_t start, ulong_t end, ulong_t limit, int prot, int kind)
+{
+    struct VMA *vma = (struct VMA *) Malloc(sizeof(*vma));
+
+    if (vma != 0) {
+	vma->start = start;
+	vma->end = end;
+	vma->limit = limit;
+	vma->prot = prot;
+	vma->kind = kind;
+	vma->object = 0;
+	vma->left = vma->right = 0;
+	vma->height = 1;
+    }
+    return vma;
+}
+
+/*
+ * Add an area to a tree.
+ * Returns 0 if successful, or EEXIST if it overlaps another area
+ * (or the room another area may grow into).
+ */
+int Insert_VMA(struct VMA **root, struct VMA *vma)
+{
+    struct VMA *prev, *next;
+
+    if (Reserved_Start(vma) >= Reserved_End(vma))
+	return EINVALID;
+
+    prev = Prev_VMA(*root, vma->start);
+    next = Next_VMA(*root, vma->start);
+    if ((prev != 0 && Reserved_End(prev) > Reserved_Start(vma)) ||
+	(next != 0 && Reserved_Start(next) < Reserved_End(vma)))
+	return EEXIST;
+
+    vma->left = vma->right = 0;
+    vma->height = 1;
+    *root = Insert_Node(*root, vma);
+    return 0;
+}
+
+/*
+ * Take an area out of its tree.  The area itself is not freed.
+ */
+void Remove_VMA(struct VMA **root, struct VMA *vma)
+{
+    *root = Remove_Node(*root, vma);
+    vma->left = vma->right = 0;
+}
+
+/*
+ * Find the area containing given address.
+ * Returns null if the address is not in any area.
+ */
+struct VMA *Find_VMA(struct VMA *root, ulong_t addr)
+{
+    struct VMA *vma = Prev_VMA(root, addr);
+
+    return (vma != 0 && addr < vma->end) ? vma : 0;
+}
+
+/*
+ * Find the area with the lowest start address >= addr.
+ * Iterating with Next_VMA(root, vma->start + 1) visits
+ * the areas in address order.
+ */
+struct VMA *Next_VMA(struct VMA *root, ulong_t addr)
+{
+    struct VMA *best = 0;
+
+    while (root != 0) {
+	if (root->start >= addr) {
+	    best = root;
+	    root = root->left;
+	} else {
+	    root = root->right;
+	}
+    }
+    return best;
+}
+
+/*
+ * Find the lowest address in [low, high) where size bytes
+ * fit without overlapping any area.
+ * Returns 0 if there is no such gap.
+ */
+ulong_t Find_VMA_Gap(struct VMA *root, ulong_t low, ulong_t high, ulong_t size)
+{
+    ulong_t addr = low;
+    struct VMA *vma = Prev_VMA(root, addr);
+
+    if (vma != 0 && Reserved_End(vma) > addr)
+	addr = Reserved_End(vma);
+
+    for (vma = Next_VMA(root, addr); vma != 0; vma = Next_VMA(root, vma->start + 1)) {
+	if (addr + size <= Reserved_Start(vma) || addr + size > high)
+	    break;
+	if (Reserved_End(vma) > addr)
+	    addr = Reserved_End(vma);
+    }
+    return (addr >= low && addr + size <= high && addr + size > addr) ? addr : 0;
+}
+
+/*
+ * Free every area in a tree.
+ */
+void Destroy_VMA_Tree(struct VMA **root)
+{
+    struct VMA *node = *root;
+
+    if (node == 0)
+	return;
+    Destroy_VMA_Tree(&node->left);
+    Destroy_VMA_Tree(&node->right);
+    Free(node);
+    *root = 0;
+}
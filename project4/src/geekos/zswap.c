@@ -0,0 +1,207 @@
+/*
+ * Compressed swap pool
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/malloc.h>
+#include <geekos/bitset.h>
+#include <geekos/mem.h>
+#include <geekos/lz.h>
+#include <geekos/zswap.h>
+
+/*
+ * Evicted pages are compressed into a pool of frames set aside
+ * at boot, and only go to the paging file when they do not
+ * compress well or the pool is full.  A page table entry for a
+ * page in the pool is marked KINFO_PAGE_COMPRESSED, and its
+ * pageBaseAddr holds the index of the pool entry.
+ *
+ * Each pool frame is divided into units; a compressed page
+ * occupies a run of consecutive units within one frame.
+ *
+ * The pool is only accessed with interrupts disabled.
+ */
+
+#define UNIT_SIZE      64
+#define UNITS_PER_PAGE (PAGE_SIZE / UNIT_SIZE)
+
+/* Pages which compress worse than this go to the paging file. */
+#define MAX_STORED_SIZE (PAGE_SIZE * 3 / 4)
+
+/* Pool entries per frame: the pool is full at 16:1 compression. */
+#define ENTRIES_PER_FRAME 16
+
+#define NO_ENTRY 0xffff
+
+struct Zswap_Frame {
+    uchar_t *data;
+    void *usedUnits;			 /* Bit set of units in use */
+    int numFree;
+};
+
+struct Zswap_Entry {
+    ushort_t frame;
+    uchar_t unit;
+    uchar_t numUnits;
+    ushort_t length;			 /* Compressed length */
+    ushort_t nextFree;
+};
+
+ulong_t g_zswapStats[ZSWAP_NUM_STATS];
+
+static struct Zswap_Frame *s_frames;
+static int s_numFrames;
+static int s_nextFrame;			 /* Where to start looking for space */
+
+static struct Zswap_Entry *s_entries;
+static int s_numEntries;
+static int s_freeEntry = NO_ENTRY;
+
+/* Compression output, copied into the pool once its size is known. */
+static uchar_t s_buffer[MAX_STORED_SIZE];
+
+/*
+ * Find a run of numUnits free units in a frame.
+ * Returns the first unit of the run, or -1.
+ */
+static int Find_Free_Units(struct Zswap_Frame *frame, int numUnits)
+{
+    if (frame->numFree < numUnits)
+	return -1;
+    return Find_First_N_Free(frame->usedUnits, numUnits, UNITS_PER_PAGE);
+}
+
+static void Mark_Units(struct Zswap_Frame *frame, int unit, int numUnits, bool used)
+{
+    if (used)
+	Set_Bits(frame->usedUnits, unit, numUnits);
+    else
+	Clear_Bits(frame->usedUnits, unit, numUnits);
+    frame->numFree += used ? -numUnits : numUnits;
+}
+
+/*
+ * Set aside part of physical memory for the pool.
+ */
+void Init_Zswap(void)
+{
+    extern uint_t g_freePageCount;
+    int i;
+
+    s_numFrames = g_freePageCount / ZSWAP_POOL_FRACTION;
+    s_numEntries = s_numFrames * ENTRIES_PER_FRAME;
+    if (s_numEntries > NO_ENTRY) {
+	s_numEntries = NO_ENTRY;
+	s_numFrames = NO_ENTRY / ENTRIES_PER_FRAME;
+    }
+
+    s_frames = (struct Zswap_Frame *) Malloc(s_numFrames * sizeof(struct Zswap_Frame));
+    s_entries = (struct Zswap_Entry *) Malloc(s_numEntries * sizeof(struct Zswap_Entry));
+    KASSERT(s_frames != 0 && s_entries != 0);
+
+    for (i = 0; i < s_numFrames; ++i) {
+	s_frames[i].data = (uchar_t *) Alloc_Page();
+	s_frames[i].usedUnits = Create_Bit_Set(UNITS_PER_PAGE);
+	KASSERT(s_frames[i].data != 0 && s_frames[i].usedUnits != 0);
+	s_frames[i].numFree = UNITS_PER_PAGE;
+    }
+    for (i = s_numEntries - 1; i >= 0; --i) {
+	s_entries[i].nextFree = s_freeEntry;
+	s_freeEntry = i;
+    }
+
+    g_zswapStats[ZSWAP_STAT_POOL_BYTES] = s_numFrames * PAGE_SIZE;
+    Print("Compressed swap pool: %d pages\n", s_numFrames);
+}
+
+/*
+ * Compress a page into the pool.
+ * Returns the index of the pool entry, or -1 if the page does
+ * not compress well enough or there is no room for it.
+ */
+int Zswap_Store(void *paddr)
+{
+    struct Zswap_Entry *entry;
+    int length, numUnits, unit = -1, i, index;
+
+    KASSERT(!Interrupts_Enabled());
+
+    length = LZ_Compress(paddr, PAGE_SIZE, s_buffer, sizeof(s_buffer));
+    if (length < 0) {
+	++g_zswapStats[ZSWAP_STAT_REJECTS];
+	return -1;
+    }
+    numUnits = (length + UNIT_SIZE - 1) / UNIT_SIZE;
+
+    /* Next fit: continue from the frame the last page went to */
+    if (s_freeEntry != NO_ENTRY) {
+	for (i = 0; i < s_numFrames; ++i) {
+	    unit = Find_Free_Units(&s_frames[s_nextFrame], numUnits);
+	    if (unit >= 0)
+		break;
+	    s_nextFrame = (s_nextFrame + 1) % s_numFrames;
+	}
+    }
+    if (unit < 0) {
+	++g_zswapStats[ZSWAP_STAT_POOL_FULL];
+	return -1;
+    }
+
+    index = s_freeEntry;
+    entry = &s_entries[index];
+    s_freeEntry = entry->nextFree;
+
+    entry->frame = s_nextFrame;
+    entry->unit = unit;
+    entry->numUnits = numUnits;
+    entry->length = length;
+    Mark_Units(&s_frames[s_nextFrame], unit, numUnits, true);
+    memcpy(s_frames[s_nextFrame].data + unit * UNIT_SIZE, s_buffer, length);
+
+    ++g_zswapStats[ZSWAP_STAT_STORES];
+    ++g_zswapStats[ZSWAP_STAT_STORED_PAGES];
+    g_zswapStats[ZSWAP_STAT_STORED_BYTES] += length;
+    return index;
+}
+
+/*
+ * Decompress the page held in a pool entry into a frame.
+ * The entry stays allocated until Zswap_Free() is called.
+ */
+void Zswap_Load(int index, void *paddr)
+{
+    struct Zswap_Entry *entry = &s_entries[index];
+    int length;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(0 <= index && index < s_numEntries);
+
+    length = LZ_Decompress(s_frames[entry->frame].data + entry->unit * UNIT_SIZE,
+	entry->length, paddr, PAGE_SIZE);
+    KASSERT(length == PAGE_SIZE);
+    ++g_zswapStats[ZSWAP_STAT_HITS];
+}
+
+/*
+ * Release a pool entry.
+ */
+void Zswap_Free(int index)
+{
+    struct Zswap_Entry *entry = &s_entries[index];
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(0 <= index && index < s_numEntries);
+
+    Mark_Units(&s_frames[entry->frame], entry->unit, entry->numUnits, false);
+    --g_zswapStats[ZSWAP_STAT_STORED_PAGES];
+    g_zswapStats[ZSWAP_STAT_STORED_BYTES] -= entry->length;
+
+    entry->nextFree = s_freeEntry;
+    s_freeEntry = index;
+}
@@ -0,0 +1,25 @@
+/*
+ * File I/O
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <fileio.h>
+
+DEF_SYSCALL(Open,SYS_OPEN,int,(const char *path, int mode),
+    const char *arg0 = path; size_t arg1 = strlen(path); int arg2 = mode;,SYSCALL_REGS_3)
+DEF_SYSCALL(Close,SYS_CLOSE,int,(int fd),int arg0 = fd;,SYSCALL_REGS_1)
+DEF_SYSCALL(Read,SYS_READ,int,(int fd, void *buf, unsigned long len),
+    int arg0 = fd; void *arg1 = buf; unsigned long arg2 = len;,SYSCALL_REGS_3)
+DEF_SYSCALL(Write,SYS_WRITE,int,(int fd, const void *buf, unsigned long len),
+    int arg0 = fd; const void *arg1 = buf; unsigned long arg2 = len;,SYSCALL_REGS_3)
+DEF_SYSCALL(Seek,SYS_SEEK,int,(int fd, unsigned long pos),
+    int arg0 = fd; unsigned long arg1 = pos;,SYSCALL_REGS_2)
+DEF_SYSCALL(Delete,SYS_DELETE,int,(const char *path),
+    const char *arg0 = path; size_t arg1 = strlen(path);,SYSCALL_REGS_2)
+DEF_SYSCALL(Sync,SYS_SYNC,int,(void),,SYSCALL_REGS_0)
+DEF_SYSCALL(Create_Directory,SYS_CREATEDIR,int,(const char *path),
+    const char *arg0 = path; size_t arg1 = strlen(path);,SYSCALL_REGS_2)
@@ -0,0 +1,17 @@
+/*
+ * Block I/O schedulers and I/O statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <iosched.h>
+
+DEF_SYSCALL(Set_IO_Scheduler,SYS_SETIOSCHED,int,(const char *device, int scheduler),
+    const char *arg0 = device; size_t arg1 = strlen(device); int arg2 = scheduler;,SYSCALL_REGS_3)
+DEF_SYSCALL(Get_Block_Device_Stat,SYS_BLOCKDEVSTAT,int,(const char *device, int which),
+    const char *arg0 = device; size_t arg1 = strlen(device); int arg2 = which;,SYSCALL_REGS_3)
+DEF_SYSCALL(Get_Mount_Stat,SYS_MOUNTSTAT,int,(const char *prefix, int which),
+    const char *arg0 = prefix; size_t arg1 = strlen(prefix); int arg2 = which;,SYSCALL_REGS_3)
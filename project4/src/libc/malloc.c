@@ -0,0 +1,278 @@
+/*
+ * User heap allocator
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <stddef.h>
+#include <malloc.h>
+
+/*
+ * Move the end of the heap by given number of bytes.
+ * Returns the previous end of the heap, or an error code (< 0).
+ */
+DEF_SYSCALL(Sbrk,SYS_SBRK,void*,(int increment),int arg0 = increment;,SYSCALL_REGS_1)
+
+/*
+ * The heap is a contiguous run of chunks growing up from the
+ * start of the heap region, followed by the "top" chunk: the free
+ * space between the last chunk and the break.
+ *
+ * Each chunk starts with a header holding its size and two flag
+ * bits.  The size of the previous chunk is stored in front of the
+ * header, but only while the previous chunk is free; in use, that
+ * word belongs to the previous chunk's payload.
+ *
+ * Small chunks are kept on exact-size free lists when freed and are
+ * never merged, so allocating and freeing them is a list push/pop.
+ * Larger chunks are merged with free neighbours when freed and kept
+ * on free lists binned by powers of two.  When the top chunk grows
+ * past TRIM_THRESHOLD, the excess is handed back to the kernel.
+ */
+
+struct Chunk {
+    size_t prevSize;		 /* Size of previous chunk, if it is free */
+    size_t size;		 /* Size of this chunk, and flag bits */
+    struct Chunk *next;		 /* Free list links, only while free */
+    struct Chunk *prev;
+};
+
+#define CHUNK_INUSE     0x1	 /* chunk is allocated (or on a small list) */
+#define CHUNK_PREVINUSE 0x2	 /* previous chunk is not free */
+#define CHUNK_FLAGS     (CHUNK_INUSE | CHUNK_PREVINUSE)
+
+#define CHUNK_ALIGN     8
+#define CHUNK_OVERHEAD  sizeof(size_t)
+#define MIN_CHUNK_SIZE  sizeof(struct Chunk)
+#define MAX_SMALL_SIZE  256
+#define NUM_SMALL_BINS  (MAX_SMALL_SIZE / CHUNK_ALIGN + 1)
+#define NUM_LARGE_BINS  32
+
+#define HEAP_GROW_SIZE  (16 * 1024)
+#define TRIM_THRESHOLD  (64 * 1024)
+#define PAGE_SIZE       4096
+
+#define Chunk_Size(c)       ((c)->size & ~CHUNK_FLAGS)
+#define Chunk_At(c, offset) ((struct Chunk *) ((char *) (c) + (offset)))
+#define Chunk_To_Mem(c)     ((void *) &(c)->next)
+#define Mem_To_Chunk(p)     ((struct Chunk *) ((char *) (p) - 2 * sizeof(size_t)))
+
+static struct Chunk *s_smallBins[NUM_SMALL_BINS];
+static struct Chunk *s_largeBins[NUM_LARGE_BINS];
+static struct Chunk *s_top;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Bin for a large chunk: the position of the highest set bit.
+ */
+static int Large_Bin(size_t size)
+{
+    int bin;
+
+    __asm__ ("bsrl %1, %0" : "=r" (bin) : "r" (size));
+    return bin;
+}
+
+static void Link_Free_Chunk(struct Chunk *c)
+{
+    struct Chunk **head = &s_largeBins[Large_Bin(Chunk_Size(c))];
+
+    c->prev = 0;
+    c->next = *head;
+    if (*head != 0)
+	(*head)->prev = c;
+    *head = c;
+}
+
+static void Unlink_Free_Chunk(struct Chunk *c)
+{
+    if (c->prev != 0)
+	c->prev->next = c->next;
+    else
+	s_largeBins[Large_Bin(Chunk_Size(c))] = c->next;
+    if (c->next != 0)
+	c->next->prev = c->prev;
+}
+
+/*
+ * Make the top chunk at least given size by moving the break.
+ * Returns 0 if successful, -1 if the heap cannot grow.
+ */
+static int Grow_Top(size_t size)
+{
+    size_t topSize = (s_top != 0) ? Chunk_Size(s_top) : 0;
+    size_t grow = (size - topSize + HEAP_GROW_SIZE - 1) & ~(HEAP_GROW_SIZE - 1);
+    char *base = (char *) Sbrk(grow);
+
+    if ((int) base < 0)
+	return -1;
+
+    if (s_top != 0 && Chunk_At(s_top, topSize) == (struct Chunk *) base) {
+	s_top->size += grow;
+    } else {
+	/*
+	 * First call, or someone else moved the break: the old top
+	 * (if any) is given up as an allocated chunk, and the heap
+	 * continues at the new base.
+	 */
+	if (s_top != 0)
+	    s_top->size |= CHUNK_INUSE;
+	s_top = (struct Chunk *) base;
+	s_top->size = grow | CHUNK_PREVINUSE;
+    }
+    return 0;
+}
+
+/*
+ * Give the kernel back whole pages of a top chunk which has
+ * grown past the trim threshold.
+ */
+static void Trim_Top(void)
+{
+    size_t topSize = Chunk_Size(s_top);
+    size_t excess;
+
+    if (topSize <= TRIM_THRESHOLD)
+	return;
+    excess = (topSize - HEAP_GROW_SIZE) & ~(PAGE_SIZE - 1);
+    if ((int) Sbrk(-(int) excess) >= 0)
+	s_top->size -= excess;
+}
+
+/*
+ * Carve a chunk of given size from the top chunk.
+ */
+static struct Chunk *Split_Top(size_t size)
+{
+    struct Chunk *c;
+
+    while (s_top == 0 || Chunk_Size(s_top) < size + MIN_CHUNK_SIZE) {
+	if (Grow_Top(size + MIN_CHUNK_SIZE) != 0)
+	    return 0;
+    }
+
+    c = s_top;
+    s_top = Chunk_At(c, size);
+    s_top->size = (Chunk_Size(c) - size) | CHUNK_PREVINUSE;
+    c->size = size | CHUNK_INUSE | (c->size & CHUNK_PREVINUSE);
+    return c;
+}
+
+/*
+ * Find a free chunk of at least given size in the large bins,
+ * and split off what is not needed.
+ */
+static struct Chunk *Find_Free_Chunk(size_t size)
+{
+    int bin;
+
+    for (bin = Large_Bin(size); bin < NUM_LARGE_BINS; ++bin) {
+	struct Chunk *c;
+
+	for (c = s_largeBins[bin]; c != 0; c = c->next) {
+	    size_t chunkSize = Chunk_Size(c);
+
+	    if (chunkSize < size)
+		continue;
+
+	    Unlink_Free_Chunk(c);
+	    if (chunkSize - size >= MIN_CHUNK_SIZE) {
+		struct Chunk *rest = Chunk_At(c, size);
+
+		rest->size = (chunkSize - size) | CHUNK_PREVINUSE;
+		Chunk_At(rest, chunkSize - size)->prevSize = chunkSize - size;
+		Link_Free_Chunk(rest);
+		c->size = size | CHUNK_INUSE | CHUNK_PREVINUSE;
+	    } else {
+		c->size |= CHUNK_INUSE;
+		Chunk_At(c, chunkSize)->size |= CHUNK_PREVINUSE;
+	    }
+	    return c;
+	}
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+void *Malloc(size_t n)
+{
+    size_t size;
+    struct Chunk *c;
+
+    if (n > 0x7fffffff - MIN_CHUNK_SIZE)
+	return 0;
+    size = (n + CHUNK_OVERHEAD + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+    if (size < MIN_CHUNK_SIZE)
+	size = MIN_CHUNK_SIZE;
+
+    if (size <= MAX_SMALL_SIZE) {
+	struct Chunk **head = &s_smallBins[size / CHUNK_ALIGN];
+
+	if (*head != 0) {
+	    c = *head;
+	    *head = c->next;
+	    return Chunk_To_Mem(c);
+	}
+    }
+
+    c = Find_Free_Chunk(size);
+    if (c == 0)
+	c = Split_Top(size);
+    return (c != 0) ? Chunk_To_Mem(c) : 0;
+}
+
+void Free(void *ptr)
+{
+    struct Chunk *c, *next;
+    size_t size;
+
+    if (ptr == 0)
+	return;
+
+    c = Mem_To_Chunk(ptr);
+    size = Chunk_Size(c);
+
+    if (size <= MAX_SMALL_SIZE) {
+	struct Chunk **head = &s_smallBins[size / CHUNK_ALIGN];
+
+	c->next = *head;
+	*head = c;
+	return;
+    }
+
+    /* Merge with the previous chunk if it is free */
+    if (!(c->size & CHUNK_PREVINUSE)) {
+	struct Chunk *prev = Chunk_At(c, -(int) c->prevSize);
+
+	Unlink_Free_Chunk(prev);
+	size += c->prevSize;
+	c = prev;
+    }
+
+    /* Merge with the next chunk if it is free, or with the top */
+    next = Chunk_At(c, size);
+    if (next == s_top) {
+	c->size = (size + Chunk_Size(s_top)) | CHUNK_PREVINUSE;
+	s_top = c;
+	Trim_Top();
+	return;
+    }
+    if (!(next->size & CHUNK_INUSE)) {
+	Unlink_Free_Chunk(next);
+	size += Chunk_Size(next);
+	next = Chunk_At(c, size);
+    }
+
+    c->size = size | CHUNK_PREVINUSE;
+    next->prevSize = size;
+    next->size &= ~CHUNK_PREVINUSE;
+    Link_Free_Chunk(c);
+}
@@ -20,8 +20,12 @@ DEF_SYSCALL(Null,SYS_NULL,int,(void),,SYSCALL_REGS_0)
 DEF_SYSCALL(Exit,SYS_EXIT,int,(int exitCode), int arg0 = exitCode;, SYSCALL_REGS_1)
 DEF_SYSCALL(Spawn_Program,SYS_SPAWN,int,
     (const char *program, const char *command),
-    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command);,
-    SYSCALL_REGS_4)
+    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command); int arg4 = 0;,
+    SYSCALL_REGS_5)
+DEF_SYSCALL(Spawn_Limited,SYS_SPAWN,int,
+    (const char *program, const char *command, int maxResidentPages),
+    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command); int arg4 = maxResidentPages;,
+    SYSCALL_REGS_5)
 DEF_SYSCALL(Wait,SYS_WAIT,int,(int pid),int arg0 = pid;,SYSCALL_REGS_1)
 DEF_SYSCALL(Get_PID,SYS_GETPID,int,(void),,SYSCALL_REGS_0)
 
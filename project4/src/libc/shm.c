@@ -0,0 +1,20 @@
+/*
+ * Shared memory segments and mapped files
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <shm.h>
+
+DEF_SYSCALL(Create_Shared_Memory,SYS_SHMCREATE,int,(const char *name, size_t size),
+    const char *arg0 = name; size_t arg1 = strlen(name); size_t arg2 = size;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Attach_Shared_Memory,SYS_SHMATTACH,void*,(int shmId),int arg0 = shmId;,SYSCALL_REGS_1)
+DEF_SYSCALL(Detach_Shared_Memory,SYS_SHMDETACH,int,(void *addr),void *arg0 = addr;,SYSCALL_REGS_1)
+DEF_SYSCALL(Map_File,SYS_MMAP,void*,(const char *path),
+    const char *arg0 = path; size_t arg1 = strlen(path);,
+    SYSCALL_REGS_2)
+DEF_SYSCALL(Unmap_File,SYS_SHMDETACH,int,(void *addr),void *arg0 = addr;,SYSCALL_REGS_1)
@@ -0,0 +1,15 @@
+/*
+ * Compressed swap and memory statistics
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <swap.h>
+
+DEF_SYSCALL(Get_Swap_Stat,SYS_SWAPSTAT,int,(int which),int arg0 = which;,SYSCALL_REGS_1)
+DEF_SYSCALL(Get_Mem_Stat,SYS_MEMSTAT,int,(int which),int arg0 = which;,SYSCALL_REGS_1)
+DEF_SYSCALL(Get_Mem_Usage,SYS_MEMUSAGE,int,(int pid, int which),int arg0 = pid; int arg1 = which;,SYSCALL_REGS_2)
+DEF_SYSCALL(Get_Swap_Device_Stat,SYS_SWAPDEVSTAT,int,(int device, int which),int arg0 = device; int arg1 = which;,SYSCALL_REGS_2)
+DEF_SYSCALL(Copy_Test,SYS_COPYTEST,int,(void *buf, int len),int arg0 = (int) buf; int arg1 = len;,SYSCALL_REGS_2)
@@ -0,0 +1,236 @@
+/*
+ * Host-side benchmark of the kernel bit set
+ *
+ * Runs the allocation patterns of the paging file (single slots)
+ * and of the compressed swap pool (runs of slots) against the
+ * kernel bit set and the original byte-at-a-time version, checking
+ * that both give the same answers.
+ *
+ * usage: bitsetBench [max bits]
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Build the kernel implementation with host libc in place of the kernel's */
+#define GEEKOS_KASSERT_H
+#define GEEKOS_MALLOC_H
+#define GEEKOS_SCREEN_H
+#define STRING_H
+#define KASSERT(cond) assert(cond)
+#define Malloc malloc
+#define Free free
+#include "../geekos/bitset.c"
+
+/* ----------------------------------------------------------------------
+ * The original implementation
+ * ---------------------------------------------------------------------- */
+
+#define OLD_NUM_BYTES(totalBits) (((totalBits) + 7) / 8)
+
+static void *Old_Create_Bit_Set(uint_t totalBits)
+{
+    return calloc(OLD_NUM_BYTES(totalBits), 1);
+}
+
+static void Old_Set_Bit(void *bitSet, uint_t bitPos)
+{
+    ((uchar_t*)bitSet)[bitPos / 8] |= (1 << (bitPos % 8));
+}
+
+static void Old_Clear_Bit(void *bitSet, uint_t bitPos)
+{
+    ((uchar_t*)bitSet)[bitPos / 8] &= ~(1 << (bitPos % 8));
+}
+
+static bool Old_Is_Bit_Set(void *bitSet, uint_t bitPos)
+{
+    return (((uchar_t*)bitSet)[bitPos / 8] & (1 << (bitPos % 8))) != 0;
+}
+
+static int Old_Find_First_Free_Bit(void *bitSet, ulong_t totalBits)
+{
+    uint_t numBytes = OLD_NUM_BYTES(totalBits);
+    ulong_t offset;
+    uchar_t *bits = (uchar_t*) bitSet;
+
+    for (offset = 0; offset < numBytes; ++offset) {
+	if (bits[offset] != 0xff) {
+	    uint_t bit;
+	    for (bit = 0; bit < 8; ++bit) {
+		if ((bits[offset] & (1 << bit)) == 0)
+		    return (offset * 8) + bit < totalBits ? (int) ((offset * 8) + bit) : -1;
+	    }
+	}
+    }
+    return -1;
+}
+
+static int Old_Find_First_N_Free(void *bitSet, uint_t runLength, ulong_t totalBits)
+{
+    uint_t i, j;
+
+    for (i = 0; i + runLength <= totalBits; i++) {
+	if (!Old_Is_Bit_Set(bitSet, i)) {
+	    for (j = 1; j < runLength; j++) {
+		if (Old_Is_Bit_Set(bitSet, i + j))
+		    break;
+	    }
+	    if (j == runLength)
+		return i;
+	}
+    }
+    return -1;
+}
+
+/* ----------------------------------------------------------------------
+ * Benchmark
+ * ---------------------------------------------------------------------- */
+
+#define NUM_OPS 20000
+#define RUN_LENGTH 8
+
+static unsigned long s_seed;
+
+static uint_t Random(uint_t range)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return ((s_seed >> 8) & 0xffffff) * (unsigned long long) range >> 24;
+}
+
+static double Seconds(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+/*
+ * Fill a set to 90%, then repeatedly free a random slot and allocate
+ * the first free one.  This is what the paging file sees once it is
+ * busy: free slots are scattered and the search runs deep.
+ */
+static double Run_Single(uint_t totalBits, bool old)
+{
+    void *set = old ? Old_Create_Bit_Set(totalBits) : Create_Bit_Set(totalBits);
+    clock_t start;
+    uint_t i;
+
+    for (i = 0; i < totalBits / 10 * 9; ++i)
+	old ? Old_Set_Bit(set, i) : Set_Bit(set, i);
+
+    s_seed = 1;
+    start = clock();
+    for (i = 0; i < NUM_OPS; ++i) {
+	uint_t victim = Random(totalBits / 10 * 9);
+	int bit;
+
+	old ? Old_Clear_Bit(set, victim) : Clear_Bit(set, victim);
+	bit = old ? Old_Find_First_Free_Bit(set, totalBits) : Find_First_Free_Bit(set, totalBits);
+	assert(bit >= 0 && (uint_t) bit <= victim);
+	old ? Old_Set_Bit(set, bit) : Set_Bit(set, bit);
+    }
+    free(set);
+    return Seconds(start);
+}
+
+/*
+ * Fragment the bottom half of a set so that no run of RUN_LENGTH
+ * free bits fits there, then repeatedly allocate and free such a run.
+ */
+static double Run_Runs(uint_t totalBits, bool old)
+{
+    void *set = old ? Old_Create_Bit_Set(totalBits) : Create_Bit_Set(totalBits);
+    clock_t start;
+    uint_t i, j;
+
+    s_seed = 2;
+    for (i = 0; i + RUN_LENGTH <= totalBits; i += RUN_LENGTH) {
+	/* Leave at most RUN_LENGTH - 1 free bits in each run */
+	uint_t gap = Random(RUN_LENGTH);
+	for (j = gap; j < RUN_LENGTH; ++j)
+	    old ? Old_Set_Bit(set, i + j) : Set_Bit(set, i + j);
+    }
+    /* Only the top half has room for whole runs */
+    for (i = totalBits / 2; i + RUN_LENGTH <= totalBits; i += RUN_LENGTH * 4)
+	for (j = 0; j < RUN_LENGTH; ++j)
+	    old ? Old_Clear_Bit(set, i + j) : Clear_Bit(set, i + j);
+
+    start = clock();
+    for (i = 0; i < NUM_OPS / 10; ++i) {
+	int bit = old ? Old_Find_First_N_Free(set, RUN_LENGTH, totalBits)
+		      : Find_First_N_Free(set, RUN_LENGTH, totalBits);
+	assert(bit >= 0);
+	for (j = 0; j < RUN_LENGTH; ++j)
+	    old ? Old_Set_Bit(set, bit + j) : Set_Bit(set, bit + j);
+	for (j = 0; j < RUN_LENGTH; ++j)
+	    old ? Old_Clear_Bit(set, bit + j) : Clear_Bit(set, bit + j);
+    }
+    free(set);
+    return Seconds(start);
+}
+
+/*
+ * Check the new set against the old one on random contents.
+ */
+static void Check(uint_t totalBits)
+{
+    void *oldSet = Old_Create_Bit_Set(totalBits);
+    void *newSet = Create_Bit_Set(totalBits);
+    uint_t i;
+
+    s_seed = 3;
+    for (i = 0; i < 4 * NUM_OPS; ++i) {
+	uint_t bit = Random(totalBits);
+	uint_t count = Random(70) + 1;
+	uint_t run = Random(40) + 1;
+
+	if (bit + count > totalBits)
+	    count = totalBits - bit;
+	if (Random(3) != 0) {
+	    uint_t j;
+	    for (j = 0; j < count; ++j)
+		Old_Set_Bit(oldSet, bit + j);
+	    Set_Bits(newSet, bit, count);
+	} else {
+	    Old_Clear_Bit(oldSet, bit);
+	    Clear_Bit(newSet, bit);
+	}
+	assert(Old_Is_Bit_Set(oldSet, bit) == Is_Bit_Set(newSet, bit));
+	if (i % 64 == 0) {
+	    assert(Old_Find_First_Free_Bit(oldSet, totalBits) ==
+		   Find_First_Free_Bit(newSet, totalBits));
+	    assert(Old_Find_First_N_Free(oldSet, run, totalBits) ==
+		   Find_First_N_Free(newSet, run, totalBits));
+	}
+    }
+    free(oldSet);
+    free(newSet);
+}
+
+int main(int argc, char *argv[])
+{
+    uint_t maxBits = 1 << 20;
+    uint_t totalBits;
+
+    if (argc > 1)
+	maxBits = strtoul(argv[1], 0, 0);
+
+    Check(1000);
+    Check(4097);
+    Check(100003);
+    printf("bit set results agree with the original\n\n");
+
+    printf("%10s %12s %12s %12s %12s\n", "bits", "first old", "first new",
+	"run old", "run new");
+    for (totalBits = 1 << 12; totalBits <= maxBits; totalBits <<= 2) {
+	printf("%10u %11.3fs %11.3fs %11.3fs %11.3fs\n", totalBits,
+	    Run_Single(totalBits, true), Run_Single(totalBits, false),
+	    Run_Runs(totalBits, true), Run_Runs(totalBits, false));
+    }
+    return 0;
+}
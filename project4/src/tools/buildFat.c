@@ -2,6 +2,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdio.h>
@@ -10,6 +11,21 @@
 
 #define SECTOR_SIZE 512
 
+/* Free entries in each directory, for files created by the kernel */
+#define SPARE_DIR_ENTRIES 64
+
+/*
+ * Files named on the command line go into the root directory.
+ * A directory named there becomes a subdirectory, with the files
+ * and directories in it (except hidden ones), and so on.
+ */
+
+static int fd;
+static int *fat;
+static int blocks;
+static int firstFreeBlock;
+static char *imageFile;
+
 int roundToNextBlock(int x)
 {
     if (x % SECTOR_SIZE == 0) {
@@ -19,20 +35,137 @@ int roundToNextBlock(int x)
     }
 }
 
+/*
+ * Reserve the next free blocks, chained in the FAT, and return the
+ * first.  Even an empty file gets a block.
+ */
+int reserveBlocks(int numBlocks)
+{
+    int first = firstFreeBlock;
+    int j;
+
+    if (numBlocks == 0)
+	numBlocks = 1;
+    if (firstFreeBlock + numBlocks > blocks) {
+	printf("Error: %s is full\n", imageFile);
+	exit(-1);
+    }
+
+    for (j=0; j < numBlocks-1; j++) {
+	fat[firstFreeBlock] = firstFreeBlock + 1;
+	++firstFreeBlock;
+    }
+    fat[firstFreeBlock++] = FAT_ENTRY_EOF;
+
+    return first;
+}
+
+int skipHidden(const struct dirent *d)
+{
+    return d->d_name[0] != '.';
+}
+
+void addEntry(directoryEntry *entry, const char *filename);
+
+/*
+ * Write a directory, with its files and directories, into the image.
+ */
+void addDirectory(directoryEntry *entry, const char *dirname)
+{
+    struct dirent **names;
+    directoryEntry *directory;
+    char path[1024];
+    int count, dirCount, i;
+
+    count = scandir(dirname, &names, skipHidden, alphasort);
+    if (count < 0) {
+	perror(dirname);
+	exit(-1);
+    }
+
+    /* The entries come first, then what is in the directory */
+    dirCount = count + SPARE_DIR_ENTRIES;
+    directory = (directoryEntry*) calloc(dirCount, sizeof(directoryEntry));
+    entry->directory = 1;
+    entry->fileSize = sizeof(directoryEntry) * dirCount;
+    entry->firstBlock = reserveBlocks(roundToNextBlock(entry->fileSize)/SECTOR_SIZE);
+    printf("directory %s starts at block %d\n", dirname, entry->firstBlock);
+
+    for (i=0; i < count; i++) {
+	snprintf(path, sizeof(path), "%s/%s", dirname, names[i]->d_name);
+	addEntry(&directory[i], path);
+	free(names[i]);
+    }
+    free(names);
+
+    lseek(fd, entry->firstBlock * SECTOR_SIZE, SEEK_SET);
+    write(fd, directory, entry->fileSize);
+    free(directory);
+}
+
+/*
+ * Write a file or directory into the image, and fill in its entry.
+ */
+void addEntry(directoryEntry *entry, const char *filename)
+{
+    struct stat sbuf;
+    const char *basename;
+    int ret;
+    int j;
+    int numBlocks;
+    int fd2;
+
+    ret = stat(filename, &sbuf);
+    if (ret != 0) {
+	printf("Error stating %s\n", filename);
+	exit(-1);
+    }
+
+    /* Remove leading directory path components */
+    basename = filename;
+    if (strrchr(basename, '/') != 0)
+	basename = strrchr(basename, '/') + 1;
+
+    /* Set filename in directory entry */
+    strncpy(entry->fileName, basename, sizeof(entry->fileName));
+
+    if (S_ISDIR(sbuf.st_mode)) {
+	addDirectory(entry, filename);
+	return;
+    }
+
+    numBlocks = roundToNextBlock(sbuf.st_size)/SECTOR_SIZE;
+    entry->fileSize = sbuf.st_size;
+    entry->firstBlock = reserveBlocks(numBlocks);
+
+    printf("file %s starts at block %d\n", filename, entry->firstBlock);
+    lseek(fd, entry->firstBlock * SECTOR_SIZE, SEEK_SET);
+
+    /* copy the file to the disk */
+    fd2 = open(filename, O_RDONLY, 0);
+    assert(fd2 >= 0);
+    for (j=0; j < numBlocks; j++) {
+	int ret2;
+	char buffer[SECTOR_SIZE];
+
+	ret = read(fd2, buffer, SECTOR_SIZE);
+	assert(ret >= 0);
+	ret2 = write(fd, buffer, ret);
+	assert(ret2 == ret);
+    }
+    close(fd2);
+}
+
 int main(int argc, char *argv[])
 {
     int i;
-    int fd;
     int fd2;
     int ret;
     int curr;
-    int *fat;
-    int blocks;
     int diskSize;
     int fileCount;
-    char *imageFile;
+    int dirCount;
     struct stat sbuf;
-    int firstFreeBlock;
     bootSector bSector;
     directoryEntry *directory;
     int writeBoot = 0;
@@ -73,7 +206,8 @@ int main(int argc, char *argv[])
     bSector.fileAllocationLength = roundToNextBlock(blocks)/SECTOR_SIZE*4;
     fat = (int *) calloc(blocks, sizeof(int));
     bSector.rootDirectoryOffset = bSector.fileAllocationLength + 1;
-    bSector.rootDirectoryCount = fileCount;
+    dirCount = fileCount + SPARE_DIR_ENTRIES;
+    bSector.rootDirectoryCount = dirCount;
 
     fd = open(imageFile, O_WRONLY, 0);
     if (fd < 0) {
@@ -103,79 +237,31 @@ int main(int argc, char *argv[])
     }
 
     firstFreeBlock = bSector.rootDirectoryOffset + 
-        roundToNextBlock(sizeof(directoryEntry) * fileCount)/ SECTOR_SIZE;
+        roundToNextBlock(sizeof(directoryEntry) * dirCount)/ SECTOR_SIZE;
     printf("first data blocks is %d\n", firstFreeBlock);
 
-    directory = (directoryEntry*) malloc(sizeof(directoryEntry) * fileCount);
+    /* Entries left zeroed are free */
+    directory = (directoryEntry*) calloc(dirCount, sizeof(directoryEntry));
     for (i=0; i < fileCount; i++) {
-	int j;
-	int numBlocks;
-	const char *filename = argv[i+curr];
-
-	directory[i].firstBlock = firstFreeBlock;
-
-	ret = stat(filename, &sbuf);
-	if (ret != 0) {
-	    printf("Error stating %s\n", filename);
-	    exit(-1);
-	}
-	assert(ret == 0);
-	numBlocks = roundToNextBlock(sbuf.st_size)/SECTOR_SIZE;
-	directory[i].fileSize = sbuf.st_size;
+	addEntry(&directory[i], argv[i+curr]);
 
         if (writeBoot) {
+	   int numBlocks = roundToNextBlock(directory[i].fileSize)/SECTOR_SIZE;
+
 	   if (i== 0) {
 	       /* setup.bin */
-	       bSector.setupStart = firstFreeBlock;
+	       bSector.setupStart = directory[i].firstBlock;
 	       bSector.setupSize = numBlocks;
 	       printf("setup file starts at %d, %d sectors long\n",
 		   bSector.setupStart, bSector.setupSize);
 	   } else if (i==1) {
 	       /* kernel.exe */
-	       bSector.kernelStart = firstFreeBlock;
+	       bSector.kernelStart = directory[i].firstBlock;
 	       bSector.kernelSize = numBlocks;
 	       printf("kernel file starts at %d, %d sectors long\n",
 		   bSector.kernelStart, bSector.kernelSize);
 	   }
 	}
-	for (j=0; j < numBlocks-1; j++) {
-	    fat[firstFreeBlock] = firstFreeBlock + 1;
-	    ++firstFreeBlock;
-
-	    if (firstFreeBlock > (diskSize/SECTOR_SIZE)) {
-		printf("Error: %s is full\n", imageFile);
-		exit(-1);
-	    }
-	}
-	fat[firstFreeBlock++] = FAT_ENTRY_EOF;
-
-	lseek(fd, directory[i].firstBlock * SECTOR_SIZE, SEEK_SET);
-
-	/* copy the file to the disk */
-	fd2 = open(filename, O_RDONLY, 0);
-	assert(fd2);
-
-	/* Remove leading directory path components */
-	if (strrchr(filename, '/') != 0)
-	    filename = strrchr(filename, '/') + 1;
-
-	/* Set filename in directory entry */
-	strncpy(directory[i].fileName, filename, sizeof(directory[i].fileName));
-
-	printf("file %s starts at block %d\n", directory[i].fileName, directory[i].firstBlock);
-	lseek(fd, directory[i].firstBlock * SECTOR_SIZE, SEEK_SET);
-
-	/* copy the file to the disk */
-	for (j=0; j < numBlocks; j++) {
-	    int ret2;
-	    char buffer[SECTOR_SIZE];
-
-	    ret = read(fd2, buffer, SECTOR_SIZE);
-	    assert(ret >= 0);
-	    ret2 = write(fd, buffer, ret);
-	    assert(ret2 == ret);
-	}
-	close(fd2);
     }
 
     lseek(fd, SECTOR_SIZE, SEEK_SET);
@@ -183,7 +269,7 @@ int main(int argc, char *argv[])
 
     lseek(fd, bSector.rootDirectoryOffset * SECTOR_SIZE, SEEK_SET);
     printf("putting the directory at sector %d\n", bSector.rootDirectoryOffset);
-    write(fd, directory, sizeof(directoryEntry) * fileCount);
+    write(fd, directory, sizeof(directoryEntry) * dirCount);
 
     /* write out boot record */
     lseek(fd, PFAT_BOOT_RECORD_OFFSET, SEEK_SET);
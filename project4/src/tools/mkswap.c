@@ -0,0 +1,46 @@
+/*
+ * Host-side tool to make a disk image usable as a swap device
+ *
+ * Writes the swap header into the first sector of an existing
+ * image (made with scripts/zerofile), so the kernel will page to
+ * the image when it is attached as a block device.
+ *
+ * usage: mkswap <image> [priority]
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/swapdev.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR_SIZE 512
+
+int main(int argc, char *argv[])
+{
+    unsigned char sector[SECTOR_SIZE];
+    struct Swap_Header *header = (struct Swap_Header *) sector;
+    FILE *fp;
+
+    if (argc < 2 || argc > 3) {
+	fprintf(stderr, "usage: mkswap <image> [priority]\n");
+	return 1;
+    }
+
+    memset(sector, '\0', sizeof(sector));
+    memcpy(header->magic, SWAP_MAGIC, SWAP_MAGIC_LEN);
+    header->priority = argc > 2 ? atoi(argv[2]) : PAGEFILE_PRIORITY;
+
+    fp = fopen(argv[1], "r+b");
+    if (fp == NULL) {
+	perror(argv[1]);
+	return 1;
+    }
+    if (fwrite(sector, SECTOR_SIZE, 1, fp) != 1 || fclose(fp) != 0) {
+	perror(argv[1]);
+	return 1;
+    }
+    return 0;
+}
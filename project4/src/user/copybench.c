@@ -0,0 +1,77 @@
+/*
+ * A user mode program which has the kernel copy buffers of various
+ * sizes in from user memory and back out again, and reports how many
+ * bytes per tick each size achieves.  It also checks the contents
+ * survive the round trip, and that a bad address makes the copy fail
+ * instead of killing the process.
+ *
+ * usage: copybench [ticks per size]
+ */
+
+#include <conio.h>
+#include <sched.h>
+#include <malloc.h>
+#include <swap.h>
+#include <string.h>
+
+static int s_sizes[] = { 16, 256, 1024, 4096, 16384, USER_COPY_TEST_MAX };
+#define NUM_SIZES (sizeof(s_sizes) / sizeof(s_sizes[0]))
+
+int main(int argc, char **argv)
+{
+    int ticks = 20, i, j, rc;
+    unsigned char *buf;
+
+    if (argc > 1)
+	ticks = atoi(argv[1]);
+    if (ticks < 1) {
+	Print("usage: copybench [ticks per size]\n");
+	return 1;
+    }
+
+    /* Start in the middle of a page, so copies cross page boundaries */
+    buf = (unsigned char *) Malloc(USER_COPY_TEST_MAX + 4096);
+    if (buf == 0) {
+	Print("could not allocate buffer\n");
+	return 1;
+    }
+    buf += 4096 - ((int) buf & 4095) + 1000;
+    for (j = 0; j < USER_COPY_TEST_MAX; ++j)
+	buf[j] = (unsigned char) (j * 7);
+
+    for (i = 0; i < NUM_SIZES; ++i) {
+	int size = s_sizes[i], count = 0, start, end;
+
+	start = Get_Time_Of_Day();
+	end = start + ticks;
+	while (Get_Time_Of_Day() < end) {
+	    rc = Copy_Test(buf, size);
+	    if (rc != size) {
+		Print("copy of %d bytes failed: %d\n", size, rc);
+		return 1;
+	    }
+	    ++count;
+	}
+	Print("%6d bytes: %6d round trips in %d ticks, %8d bytes/tick each way\n",
+	    size, count, ticks, count * size / ticks);
+    }
+
+    for (j = 0; j < USER_COPY_TEST_MAX; ++j) {
+	if (buf[j] != (unsigned char) (j * 7)) {
+	    Print("byte %d changed by the copies\n", j);
+	    return 1;
+	}
+    }
+
+    /*
+     * The kernel must refuse an unmapped address in the middle of the
+     * address space (caught by the page fault handler) and one beyond
+     * its end (caught before copying)
+     */
+    rc = Copy_Test((void *) 0x40000000, 4096);
+    Print("copy from an unmapped address: %d (expected < 0)\n", rc);
+    rc = Copy_Test((void *) 0x7fff0000, 4096);
+    Print("copy from outside the process: %d (expected < 0)\n", rc);
+
+    return 0;
+}
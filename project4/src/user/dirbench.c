@@ -0,0 +1,84 @@
+/*
+ * A user mode program which measures looking up files in a large
+ * directory.  It makes a directory two levels down, creates many
+ * empty files in it, then opens them all in a scattered order, and
+ * reports the time each step took.  Then it deletes everything.
+ *
+ * usage: dirbench [files]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <fileio.h>
+#include <string.h>
+
+#define TOP "/c/dirbench"
+#define DIR "/c/dirbench/files"
+
+/*
+ * Name of the i'th file.
+ */
+static void File_Name(char *name, size_t len, int i)
+{
+    snprintf(name, len, "%s/f%d", DIR, i);
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 500;
+    int fd, i, j, stride, start, createTicks, openTicks, rc = 0;
+    char name[64];
+
+    if (count < 1) {
+	Print("usage: dirbench [files]\n");
+	return 1;
+    }
+
+    if (Create_Directory(TOP) != 0 || Create_Directory(DIR) != 0) {
+	Print("could not create %s\n", DIR);
+	return 1;
+    }
+
+    start = Get_Time_Of_Day();
+    for (i = 0; i < count; ++i) {
+	File_Name(name, sizeof(name), i);
+	if ((fd = Open(name, O_CREATE | O_EXCL | O_WRITE)) < 0) {
+	    Print("could not create %s: %d\n", name, fd);
+	    count = i;
+	    rc = 1;
+	    break;
+	}
+	Close(fd);
+    }
+    createTicks = Get_Time_Of_Day() - start;
+
+    /* A prime stride visits every file once, out of order */
+    stride = count % 7919 == 0 ? 1 : 7919;
+    start = Get_Time_Of_Day();
+    for (i = 0, j = 0; i < count && rc == 0; ++i, j = (j + stride) % count) {
+	File_Name(name, sizeof(name), j);
+	if ((fd = Open(name, O_READ)) < 0) {
+	    Print("could not open %s: %d\n", name, fd);
+	    rc = 1;
+	    break;
+	}
+	Close(fd);
+    }
+    openTicks = Get_Time_Of_Day() - start;
+
+    if (rc == 0)
+	Print("%d files: created in %d ticks, opened in %d ticks\n",
+	    count, createTicks, openTicks);
+
+    for (i = 0; i < count; ++i) {
+	File_Name(name, sizeof(name), i);
+	Delete(name);
+    }
+    if (Delete(DIR) != 0 || Delete(TOP) != 0) {
+	Print("could not delete %s\n", DIR);
+	rc = 1;
+    }
+
+    return rc;
+}
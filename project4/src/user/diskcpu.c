@@ -0,0 +1,91 @@
+/*
+ * A user mode program which measures how much of the CPU a compute
+ * bound process gets while another process streams pages to and
+ * from disk.  It counts iterations of a busy loop, first on an idle
+ * system and then while zswapbench pages random data, and reports
+ * the second count as a percentage of the first.
+ *
+ * The paging load is by default a little larger than free memory.
+ *
+ * usage: diskcpu [ticks] [kilobytes to page]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <swap.h>
+#include <string.h>
+
+#define PROGRAM "/c/zswapbench.exe"
+
+/*
+ * Default size of the paging load: more than the free memory, so
+ * that it has to page, but well short of free memory and swap
+ * together, so that it is not killed for running out of memory.
+ */
+static int Default_Load_KB(void)
+{
+    int freeKB = Get_Mem_Stat(MEM_STAT_FREE_PAGES) * 4, swapKB = 0, slots, i;
+
+    for (i = 0; (slots = Get_Swap_Device_Stat(i, SWAP_DEV_SLOTS)) >= 0; ++i)
+	swapKB += (slots - Get_Swap_Device_Stat(i, SWAP_DEV_USED)) * 4;
+
+    /* Leave a megabyte for page tables and the kernel heap */
+    return freeKB - 1024 + swapKB / 2;
+}
+
+/*
+ * Count iterations of a small computation for the given number of ticks.
+ */
+static int Compute(int ticks)
+{
+    volatile unsigned long x = 1;
+    int end, count = 0, i;
+
+    end = Get_Time_Of_Day() + ticks;
+    while (Get_Time_Of_Day() < end) {
+	for (i = 0; i < 1000; ++i)
+	    x = x * 1103515245 + 12345;
+	++count;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    int ticks = 200, kbytes = Default_Load_KB(), pid, idle, busy, rc;
+    char command[64];
+
+    if (argc > 1)
+	ticks = atoi(argv[1]);
+    if (argc > 2)
+	kbytes = atoi(argv[2]);
+    if (ticks < 1 || kbytes < 1) {
+	Print("usage: diskcpu [ticks] [kilobytes to page]\n");
+	return 1;
+    }
+
+    idle = Compute(ticks);
+    Print("idle: %d iterations in %d ticks\n", idle, ticks);
+
+    /* Random pages don't compress, so they must go to disk */
+    snprintf(command, sizeof(command), "%s random %d 2", PROGRAM, kbytes);
+    pid = Spawn_Program(PROGRAM, command);
+    if (pid < 0) {
+	Print("could not run %s: %d\n", PROGRAM, pid);
+	return 1;
+    }
+    busy = Compute(ticks);
+    Print("paging: %d iterations in %d ticks, %d%% of idle\n",
+	busy, ticks, idle > 0 ? busy * 100 / idle : 0);
+
+    /* The numbers above mean nothing if the load was cut short */
+    rc = Wait(pid);
+    if (rc != 0) {
+	Print("paging %d KB did not finish (exit code %d), ignore the paging result\n",
+	    kbytes, rc);
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * A user mode program which compares the I/O schedulers.  With each
+ * scheduler in turn it runs several copies of zswapbench at once,
+ * so their paging interleaves on the swap devices, and reports the
+ * time taken and how the requests were scheduled on each device.
+ * By default the processes together use a little more than the free
+ * memory; a run in which any of them fails is not reported.
+ *
+ * usage: iobench [processes] [kilobytes each]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <iosched.h>
+#include <swap.h>
+#include <string.h>
+
+#define PROGRAM "/c/zswapbench.exe"
+#define MAX_PROCS 8
+
+static const char *s_devices[] = { "ide0", "ide1" };
+#define NUM_DEVICES (sizeof(s_devices) / sizeof(s_devices[0]))
+
+static const char *s_schedulerNames[IO_NUM_SCHEDULERS] = { "fifo", "elevator" };
+
+/*
+ * Default size of the paging load: more than the free memory, so
+ * that it has to page, but well short of free memory and swap
+ * together, so that no process is killed for running out of memory.
+ */
+static int Default_Load_KB(void)
+{
+    int freeKB = Get_Mem_Stat(MEM_STAT_FREE_PAGES) * 4, swapKB = 0, slots, i;
+
+    for (i = 0; (slots = Get_Swap_Device_Stat(i, SWAP_DEV_SLOTS)) >= 0; ++i)
+	swapKB += (slots - Get_Swap_Device_Stat(i, SWAP_DEV_USED)) * 4;
+
+    /* Leave a megabyte for page tables and the kernel heap */
+    return freeKB - 1024 + swapKB / 2;
+}
+
+static int Run(int scheduler, int numProcs, int kbytes)
+{
+    int before[NUM_DEVICES][BLOCKDEV_NUM_STATS];
+    int pids[MAX_PROCS];
+    char command[64];
+    int i, j, start, rc, failed = 0;
+
+    for (i = 0; i < NUM_DEVICES; ++i) {
+	Set_IO_Scheduler(s_devices[i], scheduler);
+	for (j = 0; j < BLOCKDEV_NUM_STATS; ++j)
+	    before[i][j] = Get_Block_Device_Stat(s_devices[i], j);
+    }
+
+    start = Get_Time_Of_Day();
+    snprintf(command, sizeof(command), "%s random %d 2", PROGRAM, kbytes);
+    for (i = 0; i < numProcs; ++i) {
+	pids[i] = Spawn_Program(PROGRAM, command);
+	if (pids[i] < 0) {
+	    Print("could not run %s: %d\n", PROGRAM, pids[i]);
+	    failed = 1;
+	}
+    }
+    for (i = 0; i < numProcs; ++i) {
+	if (pids[i] >= 0 && (rc = Wait(pids[i])) != 0) {
+	    Print("process %d failed (exit code %d)\n", pids[i], rc);
+	    failed = 1;
+	}
+    }
+
+    /* The statistics only compare if every process did the same work */
+    if (failed) {
+	Print("%s: run discarded\n", s_schedulerNames[scheduler]);
+	return 1;
+    }
+
+    Print("%s: %d ticks\n", s_schedulerNames[scheduler], Get_Time_Of_Day() - start);
+    for (i = 0; i < NUM_DEVICES; ++i) {
+	int stat[BLOCKDEV_NUM_STATS];
+
+	if (before[i][0] < 0)
+	    continue;
+	for (j = 0; j < BLOCKDEV_NUM_STATS; ++j)
+	    stat[j] = Get_Block_Device_Stat(s_devices[i], j) - before[i][j];
+	if (stat[BLOCKDEV_STAT_REQUESTS] == 0)
+	    continue;
+	Print("  %s: %d requests in %d transfers (%d merged), %d blocks, seek %d blocks\n",
+	    s_devices[i], stat[BLOCKDEV_STAT_REQUESTS], stat[BLOCKDEV_STAT_TRANSFERS],
+	    stat[BLOCKDEV_STAT_MERGED], stat[BLOCKDEV_STAT_BLOCKS], stat[BLOCKDEV_STAT_SEEK]);
+	Print("  %s: average wait %d ticks, longest %d ticks so far, %d past deadline\n",
+	    s_devices[i], stat[BLOCKDEV_STAT_WAIT] / stat[BLOCKDEV_STAT_REQUESTS],
+	    Get_Block_Device_Stat(s_devices[i], BLOCKDEV_STAT_MAX_WAIT),
+	    stat[BLOCKDEV_STAT_EXPIRED]);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int numProcs = 4, kbytes = 0, rc = 0, i;
+
+    if (argc > 1)
+	numProcs = atoi(argv[1]);
+    if (argc > 2)
+	kbytes = atoi(argv[2]);
+    if (argc <= 2 && numProcs > 0)
+	kbytes = Default_Load_KB() / numProcs;
+    if (numProcs < 1 || numProcs > MAX_PROCS || kbytes < 1) {
+	Print("usage: iobench [processes (at most %d)] [kilobytes each]\n", MAX_PROCS);
+	return 1;
+    }
+    Print("%d processes paging %d KB each\n", numProcs, kbytes);
+
+    for (i = 0; i < IO_NUM_SCHEDULERS && rc == 0; ++i)
+	rc = Run(i, numProcs, kbytes);
+
+    /* Leave the devices with the default scheduler */
+    for (i = 0; i < NUM_DEVICES; ++i)
+	Set_IO_Scheduler(s_devices[i], IO_SCHED_ELEVATOR);
+
+    return rc;
+}
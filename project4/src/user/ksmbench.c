@@ -0,0 +1,134 @@
+/*
+ * A user mode program which runs several copies of itself, each
+ * filling a heap buffer with the same contents, and shows free
+ * memory going back up as the kernel merges their identical pages.
+ * Before exiting each copy writes to every page of its buffer, so
+ * the merged pages have to be copied again, and checks the data.
+ *
+ * usage: ksmbench [copies] [pages]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <malloc.h>
+#include <swap.h>
+#include <string.h>
+
+#define PAGE_SIZE 4096
+#define PROGRAM "/c/ksmbench.exe"
+
+/* How long the copies keep their buffers, and how often to report */
+#define HOLD_TICKS   400
+#define REPORT_TICKS 50
+
+static void Fill_Page(int *page, int pageNum)
+{
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(int); ++i)
+	page[i] = pageNum * 1024 + i;
+}
+
+static int Check_Page(int *page, int pageNum, int delta)
+{
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(int); ++i) {
+	if (page[i] != pageNum * 1024 + i + (i == 0 ? delta : 0))
+	    return 0;
+    }
+    return 1;
+}
+
+static void Delay(int ticks)
+{
+    int end = Get_Time_Of_Day() + ticks;
+
+    while (Get_Time_Of_Day() < end)
+	;
+}
+
+/*
+ * Body of each copy: fill a buffer, hold on to it for a while,
+ * then modify it.  Returns the number of pages with wrong contents.
+ */
+static int Child(int numPages)
+{
+    int *buf, i, errors = 0;
+
+    buf = (int *) Sbrk(numPages * PAGE_SIZE);
+    if ((int) buf < 0)
+	return numPages;
+    for (i = 0; i < numPages; ++i)
+	Fill_Page(buf + i * PAGE_SIZE / sizeof(int), i);
+
+    Delay(HOLD_TICKS);
+
+    for (i = 0; i < numPages; ++i) {
+	int *page = buf + i * PAGE_SIZE / sizeof(int);
+	if (!Check_Page(page, i, 0))
+	    ++errors;
+	page[0] += Get_PID();
+	if (!Check_Page(page, i, Get_PID()))
+	    ++errors;
+    }
+    return errors;
+}
+
+static void Print_Stats(int start)
+{
+    Print("%4d ticks: free pages %d, %d merged frames for %d pages, %d passes, %d copied\n",
+	Get_Time_Of_Day() - start, Get_Mem_Stat(MEM_STAT_FREE_PAGES),
+	Get_Mem_Stat(MEM_STAT_KSM_SHARED), Get_Mem_Stat(MEM_STAT_KSM_SHARING),
+	Get_Mem_Stat(MEM_STAT_KSM_SCANS), Get_Mem_Stat(MEM_STAT_KSM_COW));
+}
+
+int main(int argc, char **argv)
+{
+    int copies = 4, numPages = 64;
+    int pids[16], i, start, freeBefore, errors = 0;
+    char command[64];
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+	return Child(atoi(argv[2]));
+    if (argc > 1)
+	copies = atoi(argv[1]);
+    if (argc > 2)
+	numPages = atoi(argv[2]);
+    if (copies < 1 || copies > 16) {
+	Print("usage: ksmbench [copies (1-16)] [pages]\n");
+	return 1;
+    }
+
+    freeBefore = Get_Mem_Stat(MEM_STAT_FREE_PAGES);
+    start = Get_Time_Of_Day();
+    Print_Stats(start);
+
+    snprintf(command, sizeof(command), "%s -c %d", PROGRAM, numPages);
+    for (i = 0; i < copies; ++i) {
+	pids[i] = Spawn_Program(PROGRAM, command);
+	if (pids[i] < 0) {
+	    Print("could not run %s: %d\n", PROGRAM, pids[i]);
+	    copies = i;
+	    break;
+	}
+    }
+
+    while (Get_Time_Of_Day() - start < HOLD_TICKS) {
+	Delay(REPORT_TICKS);
+	Print_Stats(start);
+    }
+    Print("%d copies of %d pages: %d pages in use, %d without merging\n",
+	copies, numPages, freeBefore - Get_Mem_Stat(MEM_STAT_FREE_PAGES),
+	freeBefore - Get_Mem_Stat(MEM_STAT_FREE_PAGES) +
+	Get_Mem_Stat(MEM_STAT_KSM_SHARING) - Get_Mem_Stat(MEM_STAT_KSM_SHARED));
+
+    for (i = 0; i < copies; ++i)
+	errors += Wait(pids[i]);
+    Print_Stats(start);
+    if (errors != 0)
+	Print("%d pages had wrong contents\n", errors);
+
+    return 0;
+}
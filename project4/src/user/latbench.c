@@ -0,0 +1,131 @@
+/*
+ * A user mode program which measures how long a CPU-bound process
+ * goes without running, first on an idle system and then while
+ * another process pages heavily to disk.  It spins reading the
+ * cycle counter, and records the longest gap between two readings
+ * and how many gaps were longer than a timer tick.
+ *
+ * The paging load is by default a little larger than free memory.
+ *
+ * usage: latbench [ticks] [kilobytes to page]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <swap.h>
+#include <string.h>
+
+#define PROGRAM "/c/zswapbench.exe"
+
+/*
+ * Default size of the paging load: more than the free memory, so
+ * that it has to page, but well short of free memory and swap
+ * together, so that it is not killed for running out of memory.
+ */
+static int Default_Load_KB(void)
+{
+    int freeKB = Get_Mem_Stat(MEM_STAT_FREE_PAGES) * 4, swapKB = 0, slots, i;
+
+    for (i = 0; (slots = Get_Swap_Device_Stat(i, SWAP_DEV_SLOTS)) >= 0; ++i)
+	swapKB += (slots - Get_Swap_Device_Stat(i, SWAP_DEV_USED)) * 4;
+
+    /* Leave a megabyte for page tables and the kernel heap */
+    return freeKB - 1024 + swapKB / 2;
+}
+
+static __inline__ unsigned long long Read_TSC(void)
+{
+    unsigned long long tsc;
+    __asm__ __volatile__ ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/*
+ * Cycles in one timer tick; the shortest of a few ticks,
+ * since ticks missed with interrupts disabled make some longer.
+ */
+static unsigned long Cycles_Per_Tick(void)
+{
+    unsigned long best = 0, cycles;
+    unsigned long long start;
+    int i, tick;
+
+    for (i = 0; i < 5; ++i) {
+	tick = Get_Time_Of_Day();
+	while (Get_Time_Of_Day() == tick)
+	    ;
+	start = Read_TSC();
+	++tick;
+	while (Get_Time_Of_Day() == tick)
+	    ;
+	cycles = (unsigned long) (Read_TSC() - start);
+	if (best == 0 || cycles < best)
+	    best = cycles;
+    }
+    return best;
+}
+
+/*
+ * Spin for the given number of ticks and report the gaps.
+ */
+static void Measure(const char *what, int ticks, unsigned long cyclesPerTick)
+{
+    unsigned long long prev, now;
+    unsigned long gap, maxGap = 0;
+    int end = Get_Time_Of_Day() + ticks, slow = 0;
+
+    prev = Read_TSC();
+    while (Get_Time_Of_Day() < end) {
+	now = Read_TSC();
+	gap = (unsigned long) (now - prev);
+	prev = now;
+	if (gap > maxGap)
+	    maxGap = gap;
+	if (gap > cyclesPerTick)
+	    ++slow;
+    }
+
+    Print("%s: longest gap %lu cycles (%lu.%02lu ticks), %d gaps over a tick\n",
+	what, maxGap, maxGap / cyclesPerTick,
+	(maxGap % cyclesPerTick) * 100 / cyclesPerTick, slow);
+}
+
+int main(int argc, char **argv)
+{
+    int ticks = 200, kbytes = Default_Load_KB(), pid, rc;
+    unsigned long cyclesPerTick;
+    char command[64];
+
+    if (argc > 1)
+	ticks = atoi(argv[1]);
+    if (argc > 2)
+	kbytes = atoi(argv[2]);
+    if (ticks < 1 || kbytes < 1) {
+	Print("usage: latbench [ticks] [kilobytes to page]\n");
+	return 1;
+    }
+
+    cyclesPerTick = Cycles_Per_Tick();
+    Print("%lu cycles per tick\n", cyclesPerTick);
+    Measure("idle", ticks, cyclesPerTick);
+
+    /* Random pages don't compress, so they must be written to disk */
+    snprintf(command, sizeof(command), "%s random %d 2", PROGRAM, kbytes);
+    pid = Spawn_Program(PROGRAM, command);
+    if (pid < 0) {
+	Print("could not run %s: %d\n", PROGRAM, pid);
+	return 1;
+    }
+    Measure("paging", ticks, cyclesPerTick);
+
+    /* The numbers above mean nothing if the load was cut short */
+    rc = Wait(pid);
+    if (rc != 0) {
+	Print("paging %d KB did not finish (exit code %d), ignore the paging result\n",
+	    kbytes, rc);
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Run a program with a limit on the number of pages it may keep
+ * resident, and watch its memory usage until it exits.  Once at
+ * its limit, the program has to evict its own pages instead of
+ * everyone else's.
+ *
+ * usage: limit <pages> <program> [args...]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <swap.h>
+#include <string.h>
+
+#define POLL_TICKS 10
+
+int main(int argc, char **argv)
+{
+    char command[80];
+    int pid, exitCode, i, next;
+    int maxPages, rss, swap, maxRss = 0, maxSwap = 0, peak = 0;
+
+    if (argc < 3) {
+	Print("usage: limit <pages> <program> [args...]\n");
+	return 1;
+    }
+    maxPages = atoi(argv[1]);
+
+    command[0] = '\0';
+    for (i = 2; i < argc; ++i) {
+	if (strlen(command) + strlen(argv[i]) + 2 > sizeof(command)) {
+	    Print("command too long\n");
+	    return 1;
+	}
+	if (i > 2)
+	    strcat(command, " ");
+	strcat(command, argv[i]);
+    }
+
+    pid = Spawn_Limited(argv[2], command, maxPages);
+    if (pid < 0) {
+	Print("could not run %s: %d\n", argv[2], pid);
+	return 1;
+    }
+
+    /* Sample the usage of the child until it has exited */
+    for (;;) {
+	rss = Get_Mem_Usage(pid, MEM_USAGE_RSS);
+	swap = Get_Mem_Usage(pid, MEM_USAGE_SWAP);
+	if (rss < 0 || swap < 0)
+	    break;
+	peak = Get_Mem_Usage(pid, MEM_USAGE_RSS_PEAK);
+	if (rss > maxRss)
+	    maxRss = rss;
+	if (swap > maxSwap)
+	    maxSwap = swap;
+	next = Get_Time_Of_Day() + POLL_TICKS;
+	while (Get_Time_Of_Day() < next)
+	    ;
+    }
+
+    exitCode = Wait(pid);
+    Print("pid %d exited with %d: limit %d pages, peak resident %d, most swapped out %d\n",
+	pid, exitCode, maxPages, peak > maxRss ? peak : maxRss, maxSwap);
+    return 0;
+}
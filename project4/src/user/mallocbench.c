@@ -0,0 +1,90 @@
+/*
+ * A user mode program which exercises the heap allocator:
+ * a burst of small allocations and frees, then a random mix of
+ * large blocks whose contents are checked before they are freed.
+ * Prints the time taken by each phase and the size of the heap,
+ * which should shrink again once everything is freed.
+ *
+ * usage: mallocbench [rounds]
+ */
+
+#include <conio.h>
+#include <sched.h>
+#include <malloc.h>
+#include <string.h>
+
+#define NUM_SLOTS 256
+
+static char *s_slots[NUM_SLOTS];
+static int s_sizes[NUM_SLOTS];
+static unsigned long s_seed = 1;
+
+static unsigned long Random(void)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 16) & 0x7fff;
+}
+
+static int Release(int i)
+{
+    int ok = 1;
+
+    if (s_slots[i] != 0) {
+	ok = (s_slots[i][0] == (char) i &&
+	      s_slots[i][s_sizes[i] - 1] == (char) i);
+	Free(s_slots[i]);
+	s_slots[i] = 0;
+    }
+    return ok;
+}
+
+static int Run(int rounds, int minSize, int maxSize)
+{
+    int r, i, errors = 0;
+
+    for (r = 0; r < rounds; ++r) {
+	i = Random() % NUM_SLOTS;
+	if (!Release(i))
+	    ++errors;
+	s_sizes[i] = minSize + Random() % (maxSize - minSize + 1);
+	s_slots[i] = Malloc(s_sizes[i]);
+	if (s_slots[i] == 0) {
+	    Print("out of memory after %d allocations\n", r);
+	    break;
+	}
+	s_slots[i][0] = (char) i;
+	s_slots[i][s_sizes[i] - 1] = (char) i;
+    }
+    for (i = 0; i < NUM_SLOTS; ++i) {
+	if (!Release(i))
+	    ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = 20000;
+    int start, errors;
+
+    if (argc > 1)
+	rounds = atoi(argv[1]);
+
+    Print("heap break at start: %x\n", (unsigned) Sbrk(0));
+
+    start = Get_Time_Of_Day();
+    errors = Run(rounds, 1, 256);
+    Print("small blocks: %d allocations, %d ticks\n", rounds,
+	Get_Time_Of_Day() - start);
+
+    start = Get_Time_Of_Day();
+    errors += Run(rounds / 10, 1024, 64 * 1024);
+    Print("large blocks: %d allocations, %d ticks\n", rounds / 10,
+	Get_Time_Of_Day() - start);
+
+    Print("heap break at end: %x\n", (unsigned) Sbrk(0));
+    if (errors != 0)
+	Print("%d corrupted blocks\n", errors);
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * A user mode program which keeps hundreds of processes alive at
+ * once.  Each process spawns the next one and waits for it, so when
+ * the last one starts, all of them exist together.  The last one
+ * reports free memory; then the chain unwinds and each process adds
+ * one to the count it returns.  This is repeated a few times, to see
+ * that exiting processes give all their memory back.
+ *
+ * Each process keeps about five pages which cannot be paged out: its
+ * thread, kernel stack, page directory and two page tables, besides a
+ * few pageable ones.  The default of 500 processes needs about 16MB,
+ * which fits in the 32MB machine with room to spare.
+ *
+ * usage: manyproc [processes] [rounds]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <swap.h>
+#include <string.h>
+
+#define PROGRAM "/c/manyproc.exe"
+
+/*
+ * Start the rest of the chain below this process.
+ * Returns the number of processes in the chain, this one included.
+ */
+static int Chain(int remaining)
+{
+    char command[64];
+    int pid, count;
+
+    if (remaining <= 1) {
+	Print("all processes running, free pages %d\n",
+	    Get_Mem_Stat(MEM_STAT_FREE_PAGES));
+	return 1;
+    }
+
+    snprintf(command, sizeof(command), "%s -c %d", PROGRAM, remaining - 1);
+    pid = Spawn_Program(PROGRAM, command);
+    if (pid < 0) {
+	Print("could not start process %d: %d, free pages %d\n",
+	    Get_PID(), pid, Get_Mem_Stat(MEM_STAT_FREE_PAGES));
+	return 1;
+    }
+    count = Wait(pid);
+    return count < 0 ? 1 : count + 1;
+}
+
+int main(int argc, char **argv)
+{
+    int numProcs = 500, rounds = 3;
+    int i, start, count, freeBefore;
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+	return Chain(atoi(argv[2]));
+    if (argc > 1)
+	numProcs = atoi(argv[1]);
+    if (argc > 2)
+	rounds = atoi(argv[2]);
+    if (numProcs < 1 || rounds < 1) {
+	Print("usage: manyproc [processes] [rounds]\n");
+	return 1;
+    }
+
+    freeBefore = Get_Mem_Stat(MEM_STAT_FREE_PAGES);
+    for (i = 0; i < rounds; ++i) {
+	start = Get_Time_Of_Day();
+	count = Chain(numProcs);
+	Print("round %d: %d of %d processes at once, %d ticks, free pages %d (%d before)\n",
+	    i + 1, count, numProcs, Get_Time_Of_Day() - start,
+	    Get_Mem_Stat(MEM_STAT_FREE_PAGES), freeBefore);
+    }
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * A user mode program which measures sequential reading of a large
+ * file in small pieces.  It reads one part of the file by mapping it
+ * and touching it one page after another, so the kernel reads it a
+ * page at a time, and each of the other parts with Read() calls of a
+ * small buffer.  For each it reports the time taken, how the buffer
+ * cache fared, and how much the kernel read ahead.  Each way of
+ * reading gets a part of its own, so none of them finds the data in
+ * the cache already.
+ *
+ * usage: seqread [file] [kilobytes]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <shm.h>
+#include <fileio.h>
+#include <iosched.h>
+#include <swap.h>
+#include <string.h>
+
+/* Made by the build, see diskc.img in build/Makefile */
+#define FILE_NAME "/c/data/bigfile.dat"
+#define FILE_KBYTES 4096
+#define MOUNT "/c"
+
+#define PAGE_SIZE 4096
+
+/* Buffer sizes of the Read() calls, one part of the file each */
+static const int s_readSizes[] = { 64, 512 };
+#define NUM_READ_SIZES (sizeof(s_readSizes) / sizeof(s_readSizes[0]))
+
+static char s_buf[512];
+
+static int s_hits, s_misses, s_start;
+static int s_before[MOUNT_NUM_STATS];
+
+static void Start_Measure(void)
+{
+    int i;
+
+    s_hits = Get_Mem_Stat(MEM_STAT_BUF_HITS);
+    s_misses = Get_Mem_Stat(MEM_STAT_BUF_MISSES);
+    for (i = 0; i < MOUNT_NUM_STATS; ++i)
+	s_before[i] = Get_Mount_Stat(MOUNT, i);
+    s_start = Get_Time_Of_Day();
+}
+
+static void Report(const char *what, int kbytes)
+{
+    int ticks = Get_Time_Of_Day() - s_start;
+    int stats[MOUNT_NUM_STATS], i;
+
+    Print("%s: read %d KB in %d ticks (%d KB/s), %d cache hits, %d misses\n",
+	what, kbytes, ticks, ticks > 0 ? kbytes * 18 / ticks : 0,
+	Get_Mem_Stat(MEM_STAT_BUF_HITS) - s_hits,
+	Get_Mem_Stat(MEM_STAT_BUF_MISSES) - s_misses);
+
+    for (i = 0; i < MOUNT_NUM_STATS; ++i)
+	stats[i] = Get_Mount_Stat(MOUNT, i) - s_before[i];
+    Print("%s: %d reads, %d sequential, %d of them read ahead; %d blocks read ahead\n",
+	what, stats[MOUNT_STAT_READS], stats[MOUNT_STAT_SEQ_READS],
+	stats[MOUNT_STAT_RA_HITS], stats[MOUNT_STAT_RA_BLOCKS]);
+}
+
+/*
+ * Touch the pages of a mapped file from offset on.
+ */
+static int Read_Mapped(const char *path, int offset, int kbytes)
+{
+    volatile char *data;
+    int i;
+
+    data = Map_File(path);
+    if ((int) data < 0) {
+	Print("could not map %s: %d\n", path, (int) data);
+	return 1;
+    }
+
+    /* Each page touched for the first time is read by the kernel */
+    Start_Measure();
+    for (i = 0; i < kbytes * 1024; i += PAGE_SIZE)
+	(void) data[offset + i];
+    Report("mapped pages", kbytes);
+
+    Unmap_File((void *) data);
+    return 0;
+}
+
+/*
+ * Read a file from offset on with Read() calls of size bytes each.
+ */
+static int Read_Small(const char *path, int offset, int kbytes, int size)
+{
+    char what[32];
+    int fd, pos = 0, rc;
+
+    fd = Open(path, O_READ);
+    if (fd < 0) {
+	Print("could not open %s: %d\n", path, fd);
+	return 1;
+    }
+
+    Start_Measure();
+    if ((rc = Seek(fd, offset)) == 0) {
+	for (pos = 0; pos < kbytes * 1024; pos += rc) {
+	    if ((rc = Read(fd, s_buf, size)) <= 0)
+		break;
+	}
+    }
+    snprintf(what, sizeof(what), "%d byte reads", size);
+    Report(what, kbytes);
+
+    Close(fd);
+    if (rc <= 0) {
+	Print("read failed at %d: %d\n", offset + pos, rc);
+	return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : FILE_NAME;
+    int kbytes = argc > 2 ? atoi(argv[2]) : FILE_KBYTES;
+    int partKB, rc, i;
+
+    /* Whole pages for each part */
+    partKB = kbytes / (NUM_READ_SIZES + 1) / 4 * 4;
+    if (partKB < 4) {
+	Print("usage: seqread [file] [kilobytes]\n");
+	return 1;
+    }
+
+    rc = Read_Mapped(path, 0, partKB);
+    for (i = 0; i < NUM_READ_SIZES && rc == 0; ++i)
+	rc = Read_Small(path, (i + 1) * partKB * 1024, partKB, s_readSizes[i]);
+
+    return rc;
+}
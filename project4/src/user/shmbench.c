@@ -0,0 +1,156 @@
+/*
+ * A user mode program which measures the throughput of a
+ * producer/consumer channel between two processes, once through
+ * a shared memory segment used in place, and once through the same
+ * segment used as a copy-based channel (data is copied in by the
+ * producer and copied out by the consumer, the way a pipe would).
+ *
+ * usage: shmbench [copy|shared] <kilobytes>
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <sema.h>
+#include <shm.h>
+#include <string.h>
+
+#define CHUNK_SIZE 16384
+
+struct Channel {
+    int done;
+    unsigned long sum;
+    char data[CHUNK_SIZE];
+};
+
+static char s_buffer[CHUNK_SIZE];
+
+static void Fill(char *buf, int seq)
+{
+    int i;
+
+    for (i = 0; i < CHUNK_SIZE; ++i)
+        buf[i] = (char) (seq + i);
+}
+
+static unsigned long Checksum(const char *buf, unsigned long sum)
+{
+    int i;
+
+    for (i = 0; i < CHUNK_SIZE; ++i)
+        sum = sum * 31 + (unsigned char) buf[i];
+    return sum;
+}
+
+static struct Channel *Open_Channel(int *full, int *empty)
+{
+    int id;
+    struct Channel *chan;
+
+    id = Create_Shared_Memory("shmbench", sizeof(struct Channel));
+    if (id < 0) {
+        Print("could not create shared memory segment: %d\n", id);
+        Exit(1);
+    }
+    chan = Attach_Shared_Memory(id);
+    if ((int) chan < 0) {
+        Print("could not attach shared memory segment: %d\n", (int) chan);
+        Exit(1);
+    }
+    *full = Create_Semaphore("shmbench-full", 0);
+    *empty = Create_Semaphore("shmbench-empty", 1);
+    return chan;
+}
+
+static void Consume(int copy, int count)
+{
+    int full, empty, i;
+    unsigned long sum = 0;
+    struct Channel *chan = Open_Channel(&full, &empty);
+
+    for (i = 0; i < count; ++i) {
+        P(full);
+        if (copy) {
+            memcpy(s_buffer, chan->data, CHUNK_SIZE);
+            V(empty);
+            sum = Checksum(s_buffer, sum);
+        } else {
+            sum = Checksum(chan->data, sum);
+            V(empty);
+        }
+    }
+    chan->sum = sum;
+    chan->done = 1;
+    Detach_Shared_Memory(chan);
+}
+
+static struct Channel *Produce(int copy, int count, unsigned long *pSum)
+{
+    int full, empty, i;
+    unsigned long sum = 0;
+    struct Channel *chan = Open_Channel(&full, &empty);
+
+    chan->done = 0;
+    for (i = 0; i < count; ++i) {
+        if (copy) {
+            Fill(s_buffer, i);
+            sum = Checksum(s_buffer, sum);
+            P(empty);
+            memcpy(chan->data, s_buffer, CHUNK_SIZE);
+        } else {
+            P(empty);
+            Fill(chan->data, i);
+            sum = Checksum(chan->data, sum);
+        }
+        V(full);
+    }
+    *pSum = sum;
+    return chan;
+}
+
+int main(int argc, char **argv)
+{
+    int copy, kbytes, count, pid, start, elapsed;
+    unsigned long sum;
+    struct Channel *chan;
+    char command[80];
+
+    if (argc == 4 && !strcmp(argv[1], "consume")) {
+        Consume(!strcmp(argv[2], "copy"), atoi(argv[3]));
+        return 0;
+    }
+
+    if (argc != 3 || (strcmp(argv[1], "copy") && strcmp(argv[1], "shared"))) {
+        Print("usage: %s [copy|shared] <kilobytes>\n", argv[0]);
+        Exit(1);
+    }
+    copy = !strcmp(argv[1], "copy");
+    kbytes = atoi(argv[2]);
+    count = (kbytes * 1024 + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (count <= 0)
+        count = 1;
+
+    snprintf(command, sizeof(command), "/c/shmbench.exe consume %s %d",
+             argv[1], count);
+
+    start = Get_Time_Of_Day();
+    pid = Spawn_Program("/c/shmbench.exe", command);
+    if (pid < 0) {
+        Print("could not spawn consumer: %d\n", pid);
+        Exit(1);
+    }
+    chan = Produce(copy, count, &sum);
+    Wait(pid);
+    elapsed = Get_Time_Of_Day() - start;
+
+    /* The segment stays alive while we are still attached. */
+    if (!chan->done)
+        Print("consumer did not finish\n");
+    else if (chan->sum != sum)
+        Print("checksum mismatch: %lx != %lx\n", chan->sum, sum);
+    Detach_Shared_Memory(chan);
+
+    Print("%s: %d KB in %d chunks, %d ticks\n", argv[1],
+          count * (CHUNK_SIZE / 1024), count, elapsed);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * A user mode program which spawns copies of itself one after
+ * another, and shows how long each spawn takes once the kernel
+ * has the executable image cached.
+ *
+ * usage: spawnbench [count]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <swap.h>
+#include <string.h>
+
+#define PROGRAM "/c/spawnbench.exe"
+
+int main(int argc, char **argv)
+{
+    int count = 20, i, pid, start, first, errors = 0;
+    int hits, misses;
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+	return 0;
+    if (argc > 1)
+	count = atoi(argv[1]);
+    if (count < 1) {
+	Print("usage: spawnbench [count]\n");
+	return 1;
+    }
+
+    hits = Get_Mem_Stat(MEM_STAT_EXEC_HITS);
+    misses = Get_Mem_Stat(MEM_STAT_EXEC_MISSES);
+
+    start = Get_Time_Of_Day();
+    first = start;
+    for (i = 0; i < count; ++i) {
+	pid = Spawn_Program(PROGRAM, PROGRAM " -c");
+	if (pid < 0) {
+	    Print("could not run %s: %d\n", PROGRAM, pid);
+	    return 1;
+	}
+	if (Wait(pid) != 0)
+	    ++errors;
+	if (i == 0)
+	    first = Get_Time_Of_Day();
+    }
+
+    Print("%d spawns in %d ticks (first %d), %d cache hits, %d misses, %d cached pages\n",
+	count, Get_Time_Of_Day() - start, first - start,
+	Get_Mem_Stat(MEM_STAT_EXEC_HITS) - hits,
+	Get_Mem_Stat(MEM_STAT_EXEC_MISSES) - misses,
+	Get_Mem_Stat(MEM_STAT_EXEC_PAGES));
+    if (errors != 0)
+	Print("%d copies failed\n", errors);
+
+    return 0;
+}
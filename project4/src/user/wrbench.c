@@ -0,0 +1,126 @@
+/*
+ * A user mode program which measures writing a file in many small
+ * appends.  It creates the file, appends to it a few bytes at a time,
+ * closes it and syncs, and reports the time each step took and how
+ * many buffers the buffer cache wrote back.  Then it reads the file back
+ * to check it, and deletes it.
+ *
+ * usage: wrbench [kilobytes] [bytes per append]
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <fileio.h>
+#include <swap.h>
+#include <string.h>
+
+#define FILE_NAME "/c/wrbench.out"
+
+#define MAX_APPEND 4096
+
+static char s_buf[MAX_APPEND];
+
+/*
+ * The byte at a given position of the file.
+ */
+static char Pattern(int pos)
+{
+    return (char) (pos * 7 + pos / 4096);
+}
+
+/*
+ * Read the file back and check its contents.
+ */
+static int Verify(int size)
+{
+    int fd, pos = 0, rc, i;
+
+    fd = Open(FILE_NAME, O_READ);
+    if (fd < 0) {
+	Print("could not reopen %s: %d\n", FILE_NAME, fd);
+	return 1;
+    }
+    while ((rc = Read(fd, s_buf, MAX_APPEND)) > 0) {
+	for (i = 0; i < rc; ++i, ++pos) {
+	    if (s_buf[i] != Pattern(pos)) {
+		Print("wrong data at %d\n", pos);
+		Close(fd);
+		return 1;
+	    }
+	}
+    }
+    Close(fd);
+    if (rc < 0 || pos != size) {
+	Print("read back %d of %d bytes: %d\n", pos, size, rc);
+	return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int kbytes = argc > 1 ? atoi(argv[1]) : 1024;
+    int chunk = argc > 2 ? atoi(argv[2]) : 100;
+    int size, fd, pos, len, rc, i, start, writeTicks, closeTicks, syncTicks;
+    int writes;
+
+    if (kbytes < 1 || chunk < 1 || chunk > MAX_APPEND) {
+	Print("usage: wrbench [kilobytes] [bytes per append]\n");
+	return 1;
+    }
+    size = kbytes * 1024;
+
+    fd = Open(FILE_NAME, O_CREATE | O_WRITE | O_TRUNC);
+    if (fd < 0) {
+	Print("could not create %s: %d\n", FILE_NAME, fd);
+	return 1;
+    }
+
+    writes = Get_Mem_Stat(MEM_STAT_BUF_WRITES);
+    start = Get_Time_Of_Day();
+    for (pos = 0; pos < size; pos += len) {
+	len = size - pos < chunk ? size - pos : chunk;
+	for (i = 0; i < len; ++i)
+	    s_buf[i] = Pattern(pos + i);
+	if ((rc = Write(fd, s_buf, len)) != len) {
+	    Print("write at %d failed: %d\n", pos, rc);
+	    Close(fd);
+	    return 1;
+	}
+    }
+    writeTicks = Get_Time_Of_Day() - start;
+
+    /* Blocks are only allocated, and queued for writing, now */
+    start = Get_Time_Of_Day();
+    rc = Close(fd);
+    closeTicks = Get_Time_Of_Day() - start;
+    if (rc != 0) {
+	Print("close failed: %d\n", rc);
+	return 1;
+    }
+
+    start = Get_Time_Of_Day();
+    rc = Sync();
+    syncTicks = Get_Time_Of_Day() - start;
+    if (rc != 0) {
+	Print("sync failed: %d\n", rc);
+	return 1;
+    }
+
+    Print("%d appends of %d bytes: write %d, close %d, sync %d ticks (%d KB/s)\n",
+	(size + chunk - 1) / chunk, chunk, writeTicks, closeTicks, syncTicks,
+	writeTicks + closeTicks + syncTicks > 0 ?
+	    kbytes * 18 / (writeTicks + closeTicks + syncTicks) : 0);
+    Print("%d buffers written back\n",
+	Get_Mem_Stat(MEM_STAT_BUF_WRITES) - writes);
+
+    rc = Verify(size);
+    if (rc == 0)
+	Print("read back ok\n");
+
+    if (Delete(FILE_NAME) != 0)
+	Print("could not delete %s\n", FILE_NAME);
+
+    return rc;
+}
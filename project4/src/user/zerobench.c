@@ -0,0 +1,54 @@
+/*
+ * A user mode program which touches freshly allocated heap pages,
+ * each of which has to be given a zeroed frame by the page fault
+ * handler, and reports how many of those frames came from the pool
+ * of pages cleared ahead of time by the idle thread.
+ *
+ * usage: zerobench [pages]
+ */
+
+#include <conio.h>
+#include <sched.h>
+#include <malloc.h>
+#include <swap.h>
+#include <string.h>
+
+#define PAGE_SIZE 4096
+
+int main(int argc, char **argv)
+{
+    int numPages = 64;
+    int hits, misses, cycles, start, i;
+    char *buf;
+
+    if (argc > 1)
+	numPages = atoi(argv[1]);
+
+    Print("free pages %d, pre-zeroed %d\n",
+	Get_Mem_Stat(MEM_STAT_FREE_PAGES), Get_Mem_Stat(MEM_STAT_ZERO_PAGES));
+
+    buf = (char *) Sbrk(numPages * PAGE_SIZE);
+    if ((int) buf < 0) {
+	Print("heap too small for %d pages\n", numPages);
+	return 1;
+    }
+
+    hits = Get_Mem_Stat(MEM_STAT_ZERO_HITS);
+    misses = Get_Mem_Stat(MEM_STAT_ZERO_MISSES);
+    start = Get_Time_Of_Day();
+    for (i = 0; i < numPages; ++i) {
+	if (buf[i * PAGE_SIZE] != 0)
+	    Print("page %d not zeroed\n", i);
+	buf[i * PAGE_SIZE] = 1;
+    }
+    Print("%d pages touched in %d ticks\n", numPages, Get_Time_Of_Day() - start);
+
+    hits = Get_Mem_Stat(MEM_STAT_ZERO_HITS) - hits;
+    misses = Get_Mem_Stat(MEM_STAT_ZERO_MISSES) - misses;
+    cycles = Get_Mem_Stat(MEM_STAT_ZERO_CYCLES);
+    Print("zeroed frames: %d from the pool, %d cleared on demand\n", hits, misses);
+    Print("%d pages cleared while idle, %d cycles each: about %d cycles saved\n",
+	Get_Mem_Stat(MEM_STAT_IDLE_ZEROED), cycles, hits * cycles);
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * A user mode program which overcommits memory to exercise the
+ * compressed swap pool.  It fills a heap buffer larger than the
+ * memory available to user pages, then sweeps over it several
+ * times, checking the contents.  With "text" the pages compress
+ * well, with "random" they do not and must go to the swap devices,
+ * which share the pages between them if they have equal priority.
+ *
+ * usage: zswapbench [text|random] <kilobytes> [passes]
+ */
+
+#include <conio.h>
+#include <sched.h>
+#include <malloc.h>
+#include <swap.h>
+#include <string.h>
+
+#define PAGE_SIZE 4096
+
+static unsigned long s_seed = 1;
+
+static unsigned long Random(void)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return s_seed >> 16;
+}
+
+/*
+ * Fill a page with something resembling text, or with noise.
+ * The first word of each page holds its page number.
+ */
+static void Fill_Page(int *page, int pageNum, int random)
+{
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(int); ++i)
+	page[i] = random ? (int) Random() : (i % 16 == 0 ? pageNum + i : 0x20656874);
+    page[0] = pageNum;
+}
+
+static void Print_Stats(void)
+{
+    int stored = Get_Swap_Stat(ZSWAP_STAT_STORED_PAGES);
+    int bytes = Get_Swap_Stat(ZSWAP_STAT_STORED_BYTES);
+    int i;
+
+    Print("stores %d, rejects %d, pool full %d, hits %d, misses %d\n",
+	Get_Swap_Stat(ZSWAP_STAT_STORES), Get_Swap_Stat(ZSWAP_STAT_REJECTS),
+	Get_Swap_Stat(ZSWAP_STAT_POOL_FULL), Get_Swap_Stat(ZSWAP_STAT_HITS),
+	Get_Swap_Stat(ZSWAP_STAT_MISSES));
+    Print("pool: %d pages in %d of %d bytes", stored, bytes,
+	Get_Swap_Stat(ZSWAP_STAT_POOL_BYTES));
+    if (bytes > 0)
+	Print(", ratio %d.%02d", stored * PAGE_SIZE / bytes,
+	    (stored * PAGE_SIZE % bytes) * 100 / bytes);
+    Print("\n");
+
+    for (i = 0; Get_Swap_Device_Stat(i, SWAP_DEV_SLOTS) >= 0; ++i) {
+	Print("swap device %d: priority %d, %d of %d pages used, %d writes, %d reads\n",
+	    i, Get_Swap_Device_Stat(i, SWAP_DEV_PRIORITY), Get_Swap_Device_Stat(i, SWAP_DEV_USED),
+	    Get_Swap_Device_Stat(i, SWAP_DEV_SLOTS), Get_Swap_Device_Stat(i, SWAP_DEV_WRITES),
+	    Get_Swap_Device_Stat(i, SWAP_DEV_READS));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int random, kbytes, numPages, passes = 3;
+    int pass, i, start, errors = 0;
+    char *buf;
+
+    if (argc < 3 || (strcmp(argv[1], "text") && strcmp(argv[1], "random"))) {
+	Print("usage: %s [text|random] <kilobytes> [passes]\n", argv[0]);
+	return 1;
+    }
+    random = !strcmp(argv[1], "random");
+    kbytes = atoi(argv[2]);
+    if (argc > 3)
+	passes = atoi(argv[3]);
+    numPages = kbytes / 4;
+
+    buf = Malloc(numPages * PAGE_SIZE + PAGE_SIZE);
+    if (buf == 0) {
+	Print("could not allocate %d KB\n", kbytes);
+	return 1;
+    }
+    buf = (char *) (((unsigned) buf + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    start = Get_Time_Of_Day();
+    for (i = 0; i < numPages; ++i)
+	Fill_Page((int *) (buf + i * PAGE_SIZE), i, random);
+    Print("fill: %d pages, %d ticks\n", numPages, Get_Time_Of_Day() - start);
+
+    for (pass = 0; pass < passes; ++pass) {
+	start = Get_Time_Of_Day();
+	for (i = 0; i < numPages; ++i) {
+	    if (*(int *) (buf + i * PAGE_SIZE) != i)
+		++errors;
+	}
+	Print("pass %d: %d ticks\n", pass, Get_Time_Of_Day() - start);
+    }
+
+    if (errors != 0)
+	Print("%d pages corrupted\n", errors);
+    Print_Stats();
+    return 0;
+}